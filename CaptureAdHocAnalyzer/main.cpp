@@ -0,0 +1,389 @@
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "FramePoolSimulator.h"
+#include "FrameTimer.h"
+#include "FrameTrace.h"
+
+void PrintUsage()
+{
+    printf("CaptureAdHocAnalyzer - offline analysis of CaptureAdHocTest output\n");
+    printf("\n");
+    printf("Usage:\n");
+    printf("  CaptureAdHocAnalyzer trace <trace file> [--csv <output file>]\n");
+    printf("  CaptureAdHocAnalyzer simulate [options]\n");
+    printf("\n");
+    printf("Simulate options:\n");
+    printf("  --buffers <a,b,...>     Frame pool buffer counts to sweep (default: 1,2,3,4)\n");
+    printf("  --intervals <a,b,...>   MinUpdateInterval values to sweep, in ms (default: 0,1,16.7,33.3)\n");
+    printf("  --trace <trace file>    Take the render, refresh and delivery timings from a trace\n");
+    printf("  --render-fps <fps>      Renderer present rate (default: 60)\n");
+    printf("  --render-jitter <ms>    Present times vary by up to this either way (default: 0)\n");
+    printf("  --render-phase <ms>     How long before a refresh the renderer presents (default: 0)\n");
+    printf("  --refresh-hz <hz>       Display refresh rate (default: 60)\n");
+    printf("  --latency <ms>          Refresh to FrameArrived (default: 1)\n");
+    printf("  --service <ms>          TryGetNextFrame to closing the frame (default: 2)\n");
+    printf("  --service-jitter <ms>   Service time varies by up to this either way (default: 0)\n");
+    printf("  --policy <each|latest>  Process every frame, or only the newest waiting one (default: each)\n");
+    printf("  --seconds <seconds>     Simulated time per point (default: 10)\n");
+    printf("  --seed <n>              Random seed (default: 1)\n");
+    printf("  --csv <output file>     Save every point's results\n");
+}
+
+template <typename T>
+void PrintFrameTimeStatistics(char const* name, FrameTimer<T> const& timer)
+{
+    auto stats = timer.ComputeStatistics();
+    printf("%s: %u frames\n", name, timer.m_totalFrames);
+    printf("  mean %fms, stddev %fms, jitter %fms\n", stats.Mean.count(), stats.StandardDeviation.count(), stats.Jitter.count());
+    printf("  min %fms, p50 %fms, p90 %fms, p99 %fms, p99.9 %fms, max %fms\n",
+        stats.Min.count(), stats.P50.count(), stats.P90.count(), stats.P99.count(), stats.P999.count(), stats.Max.count());
+}
+
+void PrintLatency(char const* name, LatencyHistogram const& histogram)
+{
+    typedef std::chrono::duration<double, std::milli> Milliseconds;
+    if (histogram.Count() == 0)
+    {
+        return;
+    }
+    printf("%s: %llu samples\n", name, static_cast<unsigned long long>(histogram.Count()));
+    printf("  min %fms, p50 %fms, p90 %fms, p99 %fms, p99.9 %fms, max %fms\n",
+        Milliseconds(histogram.Min()).count(),
+        Milliseconds(histogram.Percentile(50.0)).count(),
+        Milliseconds(histogram.Percentile(90.0)).count(),
+        Milliseconds(histogram.Percentile(99.0)).count(),
+        Milliseconds(histogram.Percentile(99.9)).count(),
+        Milliseconds(histogram.Max()).count());
+}
+
+int AnalyzeTrace(std::string const& tracePath, std::string const& csvPath)
+{
+    auto records = ReadFrameTrace(tracePath);
+    printf("Trace: %s (%zu frames)\n", tracePath.c_str(), records.size());
+
+    FrameTimer<FrameTimeSpan> captureTimer;
+    FrameTimer<FrameTimeSpan> arrivalTimer;
+    FrameTimer<FrameTimeSpan> flipTimer;
+    LatencyHistogram captureToArrival;
+    LatencyHistogram flipToArrival;
+    uint64_t skippedSequences = 0;
+    int64_t lastFlipTime = 0;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        auto const& record = records[i];
+        captureTimer.RecordTimestamp(FrameTimeSpan(record.SystemRelativeTime));
+        arrivalTimer.RecordTimestamp(FrameTimeSpan(record.ArrivalTime));
+        // Both are QPC based on Windows
+        captureToArrival.Record(FrameTimeSpan(record.ArrivalTime - record.SystemRelativeTime));
+        if (record.RenderFlipTime != 0)
+        {
+            flipToArrival.Record(FrameTimeSpan(record.ArrivalTime - record.RenderFlipTime));
+            if (record.RenderFlipTime != lastFlipTime)
+            {
+                flipTimer.RecordTimestamp(FrameTimeSpan(record.RenderFlipTime));
+                lastFlipTime = record.RenderFlipTime;
+            }
+        }
+        if (i > 0 && record.Sequence != records[i - 1].Sequence + 1)
+        {
+            skippedSequences++;
+        }
+    }
+
+    PrintFrameTimeStatistics("Capture frame time", captureTimer);
+    PrintFrameTimeStatistics("Capture arrival time", arrivalTimer);
+    if (flipTimer.m_totalFrames > 0)
+    {
+        PrintFrameTimeStatistics("Observed flip time", flipTimer);
+    }
+    PrintLatency("Capture to arrival latency", captureToArrival);
+    PrintLatency("Flip to arrival latency", flipToArrival);
+    if (skippedSequences > 0)
+    {
+        printf("Sequence discontinuities: %llu\n", static_cast<unsigned long long>(skippedSequences));
+    }
+
+    if (!csvPath.empty())
+    {
+        std::ofstream csv(csvPath);
+        csv << "sequence,system_relative_time,arrival_time,render_flip_time\n";
+        for (auto&& record : records)
+        {
+            csv << record.Sequence << "," << record.SystemRelativeTime << "," << record.ArrivalTime << "," << record.RenderFlipTime << "\n";
+        }
+        printf("CSV saved: %s\n", csvPath.c_str());
+    }
+
+    return 0;
+}
+
+std::chrono::nanoseconds FromMilliseconds(double milliseconds)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double, std::milli>(milliseconds));
+}
+
+double ToMilliseconds(std::chrono::nanoseconds value)
+{
+    return std::chrono::duration<double, std::milli>(value).count();
+}
+
+// "1,2,3" to { 1, 2, 3 }. Throws invalid_argument if any part isn't a number.
+std::vector<double> ParseNumberList(std::string const& text)
+{
+    std::vector<double> values;
+    std::istringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, ','))
+    {
+        values.push_back(std::stod(part));
+    }
+    if (values.empty())
+    {
+        throw std::invalid_argument("Empty list");
+    }
+    return values;
+}
+
+// Rates divide a second, so zero, negative and non-finite values are rejected.
+// Throws invalid_argument if the value isn't a usable rate.
+double ParseRate(std::string const& text)
+{
+    auto value = std::stod(text);
+    if (!std::isfinite(value) || value <= 0.0)
+    {
+        throw std::invalid_argument("Rates must be positive");
+    }
+    return value;
+}
+
+void PrintSimulationRow(char const* label, FramePoolSimResult const& result)
+{
+    printf("%-14s %8.1f %8.1f%% %8.1f %8.1f %9.2f %9.2f %9.2f\n", label, result.ProcessedPerSecond(), result.MissedPercent(),
+        result.PoolFull / std::chrono::duration<double>(result.Duration).count(),
+        result.Throttled / std::chrono::duration<double>(result.Duration).count(),
+        ToMilliseconds(result.PresentToProcessed.Percentile(50.0)), ToMilliseconds(result.PresentToProcessed.Percentile(99.0)),
+        ToMilliseconds(result.WaitInPool.Percentile(99.0)));
+}
+
+struct SimulateOptions
+{
+    FramePoolSimOptions Simulation;
+    std::vector<uint32_t> BufferCounts = { 1, 2, 3, 4 };
+    std::vector<std::chrono::nanoseconds> MinUpdateIntervals = { FromMilliseconds(0.0), FromMilliseconds(1.0), FromMilliseconds(16.7), FromMilliseconds(33.3) };
+    std::string TracePath;
+    std::string CsvPath;
+};
+
+int Simulate(SimulateOptions options)
+{
+    if (!options.TracePath.empty())
+    {
+        auto records = ReadFrameTrace(options.TracePath);
+        auto calibration = CalibrateFramePool(records);
+        options.Simulation = calibration.Apply(options.Simulation);
+        printf("Calibrated from %s (%zu frames)\n", options.TracePath.c_str(), records.size());
+        printf("  refresh %fms, render phase %fms, %zu render intervals, %zu delivery latencies\n", ToMilliseconds(calibration.RefreshInterval),
+            ToMilliseconds(calibration.RenderPhase), calibration.RenderIntervals.size(), calibration.DeliveryLatencies.size());
+
+        // The rate tests run with 3 buffers and a 1ms MinUpdateInterval, so
+        // that's what the trace should look like
+        auto check = options.Simulation;
+        check.BufferCount = 3;
+        check.MinUpdateInterval = FromMilliseconds(1.0);
+        auto result = SimulateFramePool(check);
+        printf("  %-28s %10s %10s\n", "", "trace", "model");
+        printf("  %-28s %10.1f %10.1f\n", "Frames per second", calibration.ArrivalsPerSecond,
+            result.Captured / std::chrono::duration<double>(result.Duration).count());
+        if (calibration.FlipToArrival.Count() > 0)
+        {
+            printf("  %-28s %10.2f %10.2f\n", "Flip to arrival p50 (ms)", ToMilliseconds(calibration.FlipToArrival.Percentile(50.0)),
+                ToMilliseconds(result.PresentToArrival.Percentile(50.0)));
+            printf("  %-28s %10.2f %10.2f\n", "Flip to arrival p99 (ms)", ToMilliseconds(calibration.FlipToArrival.Percentile(99.0)),
+                ToMilliseconds(result.PresentToArrival.Percentile(99.0)));
+        }
+        printf("\n");
+    }
+
+    auto const& simulation = options.Simulation;
+    printf("Policy %s, %.1fs per point, service %fms\n", SimConsumerPolicyName(simulation.Policy),
+        std::chrono::duration<double>(simulation.Duration).count(), ToMilliseconds(simulation.ServiceTime.Mean));
+    printf("%-14s %8s %9s %8s %8s %9s %9s %9s\n", "buffers/min", "fps", "missed", "full/s", "thrtl/s", "p50 ms", "p99 ms", "wait p99");
+    auto points = SweepFramePool(simulation, options.BufferCounts, options.MinUpdateIntervals);
+    for (auto&& point : points)
+    {
+        char label[32];
+        snprintf(label, sizeof(label), "%u / %.1fms", point.BufferCount, ToMilliseconds(point.MinUpdateInterval));
+        PrintSimulationRow(label, point.Result);
+    }
+
+    if (!options.CsvPath.empty())
+    {
+        std::ofstream csv(options.CsvPath);
+        csv << "buffers,min_update_interval_ms,presents,captured,processed,discarded,superseded,pool_full,throttled,max_buffers_in_use,"
+            "processed_per_second,missed_percent,latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_max_ms,arrival_p50_ms,arrival_p99_ms,wait_p99_ms\n";
+        for (auto&& point : points)
+        {
+            auto const& result = point.Result;
+            csv << point.BufferCount << "," << ToMilliseconds(point.MinUpdateInterval) << "," << result.Presents << "," << result.Captured << ","
+                << result.Processed << "," << result.Discarded << "," << result.Superseded << "," << result.PoolFull << "," << result.Throttled << ","
+                << result.MaxBuffersInUse << "," << result.ProcessedPerSecond() << "," << result.MissedPercent() << ","
+                << ToMilliseconds(result.PresentToProcessed.Percentile(50.0)) << "," << ToMilliseconds(result.PresentToProcessed.Percentile(90.0)) << ","
+                << ToMilliseconds(result.PresentToProcessed.Percentile(99.0)) << "," << ToMilliseconds(result.PresentToProcessed.Max()) << ","
+                << ToMilliseconds(result.PresentToArrival.Percentile(50.0)) << "," << ToMilliseconds(result.PresentToArrival.Percentile(99.0)) << ","
+                << ToMilliseconds(result.WaitInPool.Percentile(99.0)) << "\n";
+        }
+        printf("CSV saved: %s\n", options.CsvPath.c_str());
+    }
+    return 0;
+}
+
+// Throws invalid_argument if an option or its value isn't valid
+SimulateOptions ParseSimulateOptions(std::vector<std::string> const& args)
+{
+    SimulateOptions options;
+    auto& simulation = options.Simulation;
+    auto serviceMean = ToMilliseconds(simulation.ServiceTime.Mean);
+    auto serviceJitter = 0.0;
+    auto renderFps = 60.0;
+    auto renderJitter = 0.0;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        auto const& name = args[i];
+        if (i + 1 >= args.size())
+        {
+            throw std::invalid_argument(name + " needs a value");
+        }
+        auto const& value = args[++i];
+        if (name == "--buffers")
+        {
+            options.BufferCounts.clear();
+            for (auto count : ParseNumberList(value))
+            {
+                options.BufferCounts.push_back(static_cast<uint32_t>(std::max(1.0, count)));
+            }
+        }
+        else if (name == "--intervals")
+        {
+            options.MinUpdateIntervals.clear();
+            for (auto interval : ParseNumberList(value))
+            {
+                options.MinUpdateIntervals.push_back(FromMilliseconds(interval));
+            }
+        }
+        else if (name == "--trace")
+        {
+            options.TracePath = value;
+        }
+        else if (name == "--render-fps")
+        {
+            renderFps = ParseRate(value);
+        }
+        else if (name == "--render-jitter")
+        {
+            renderJitter = std::stod(value);
+        }
+        else if (name == "--render-phase")
+        {
+            simulation.RenderPhase = FromMilliseconds(std::stod(value));
+        }
+        else if (name == "--refresh-hz")
+        {
+            simulation.RefreshInterval = FromMilliseconds(1000.0 / ParseRate(value));
+        }
+        else if (name == "--latency")
+        {
+            simulation.DeliveryLatency = SimTiming::Constant(FromMilliseconds(std::stod(value)));
+        }
+        else if (name == "--service")
+        {
+            serviceMean = std::stod(value);
+        }
+        else if (name == "--service-jitter")
+        {
+            serviceJitter = std::stod(value);
+        }
+        else if (name == "--policy" && (value == "each" || value == "latest"))
+        {
+            simulation.Policy = value == "each" ? SimConsumerPolicy::EachFrame : SimConsumerPolicy::LatestOnly;
+        }
+        else if (name == "--seconds")
+        {
+            simulation.Duration = FromMilliseconds(std::stod(value) * 1000.0);
+        }
+        else if (name == "--seed")
+        {
+            simulation.Seed = static_cast<uint32_t>(std::stoul(value));
+        }
+        else if (name == "--csv")
+        {
+            options.CsvPath = value;
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown option " + name);
+        }
+    }
+    simulation.RenderInterval = SimTiming::Constant(FromMilliseconds(1000.0 / renderFps), FromMilliseconds(renderJitter));
+    simulation.ServiceTime = SimTiming::Constant(FromMilliseconds(serviceMean), FromMilliseconds(serviceJitter));
+    return options;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (!args.empty() && args[0] == "simulate")
+    {
+        SimulateOptions options;
+        try
+        {
+            options = ParseSimulateOptions(args);
+        }
+        catch (std::exception const&)
+        {
+            PrintUsage();
+            return 1;
+        }
+        try
+        {
+            return Simulate(std::move(options));
+        }
+        catch (std::exception const& error)
+        {
+            printf("Failed to simulate! %s\n", error.what());
+            return 1;
+        }
+    }
+    if (args.size() < 2 || args[0] != "trace")
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::string csvPath;
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        if (args[i] == "--csv" && i + 1 < args.size())
+        {
+            csvPath = args[++i];
+        }
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    try
+    {
+        return AnalyzeTrace(args[1], csvPath);
+    }
+    catch (std::exception const& error)
+    {
+        printf("Failed to analyze trace! %s\n", error.what());
+        return 1;
+    }
+}
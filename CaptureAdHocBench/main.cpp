@@ -0,0 +1,4099 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "ArtifactWriter.h"
+#include "BufferPool.h"
+#include "CaptureStress.h"
+#include "completionSource.h"
+#include "DirtyTiles.h"
+#include "ExrEncoder.h"
+#include "FrameBarcode.h"
+#include "FrameHash.h"
+#include "FramePoolSimulator.h"
+#include "FrameSource.h"
+#include "FrameTimer.h"
+#include "FrameTrace.h"
+#include "GoldenStore.h"
+#include "HalfFloat.h"
+#include "HdrAnalysis.h"
+#include "ImageDiff.h"
+#include "ImageView.h"
+#include "JsonWriter.h"
+#include "MappedFile.h"
+#include "PixelKernels.h"
+#include "PngEncoder.h"
+#include "ReferenceRasterizer.h"
+#include "RegionVerifier.h"
+#include "SimdSupport.h"
+#include "SpscRing.h"
+#include "SuiteScheduler.h"
+#include "SuiteWorker.h"
+#include "TestReport.h"
+#include "ToneMap.h"
+#include "VideoRecorder.h"
+
+// Define CAPTURE_BENCH_WITH_ZLIB (and link zlib) to compare the PNG encoder
+// against zlib and check its output with zlib's inflate.
+#if defined(CAPTURE_BENCH_WITH_ZLIB)
+#include <zlib.h>
+#endif
+
+void PrintUsage()
+{
+    printf("CaptureAdHocBench - benchmarks for everything that happens to a frame after it arrives\n");
+    printf("\n");
+    printf("Usage:\n");
+    printf("  CaptureAdHocBench [options]\n");
+    printf("\n");
+    printf("Options:\n");
+    printf("  --json <output file>    Save the results as JSON, to compare between builds\n");
+    printf("  --label <text>          Stored in the JSON (e.g. the commit being measured)\n");
+    printf("  --groups <a,b,...>      Only run these groups: copy, readback, verify, diff, hash,\n");
+    printf("                          dirty, i420, kernels, kernels-exhaustive, hdr,\n");
+    printf("                          hdr-save, png, reference, golden,\n");
+    printf("                          artifact-writer, buffer-pool, pipeline, suite, results,\n");
+    printf("                          barcode, trace, record, histogram, frame-pool-sim,\n");
+    printf("                          spsc, completion, stress\n");
+    printf("  --sizes <a,b,...>       Corpus sizes: 720p, 1080p, 4k, 8k (default: all)\n");
+    printf("  --quick                 One timed run per benchmark\n");
+}
+
+struct SyntheticFrame
+{
+    std::vector<uint8_t> Bytes;
+    BgraImageView View;
+};
+
+// Rows are padded like a mapped staging texture's can be. Common widths
+// already fill whole 256 byte blocks, so there's always at least one extra
+// block, to catch anything that ignores RowPitch.
+SyntheticFrame CreateSolidFrame(uint32_t width, uint32_t height, BgraColor color)
+{
+    SyntheticFrame frame;
+    auto rowPitch = (((width * 4) + 255) & ~255u) + 256;
+    frame.Bytes.resize(static_cast<size_t>(rowPitch) * height);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto row = frame.Bytes.data() + (static_cast<size_t>(rowPitch) * y);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            std::memcpy(row + (x * 4), &color, 4);
+        }
+    }
+    frame.View = BgraImageView{ frame.Bytes.data(), width, height, rowPitch };
+    return frame;
+}
+
+// Something closer to a desktop than a solid color: flat panels, a gradient
+// and some high frequency "text".
+SyntheticFrame CreateDesktopLikeFrame(uint32_t width, uint32_t height)
+{
+    auto frame = CreateSolidFrame(width, height, BgraColor{ 240, 240, 240, 255 });
+    uint32_t seed = 12345;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto row = frame.Bytes.data() + (static_cast<size_t>(frame.View.RowPitch) * y);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            auto pixel = row + (x * 4);
+            if (y < height / 8)
+            {
+                pixel[0] = static_cast<uint8_t>((x * 255) / width);
+                pixel[1] = static_cast<uint8_t>((y * 255) / (height / 8));
+                pixel[2] = 128;
+            }
+            else if (x > width / 2 && ((y / 24) % 2) == 0 && (x % 400) < 300)
+            {
+                seed = (seed * 1664525u) + 1013904223u;
+                auto ink = (seed >> 24) < 90 ? static_cast<uint8_t>(seed >> 8) : static_cast<uint8_t>(255);
+                pixel[0] = ink;
+                pixel[1] = ink;
+                pixel[2] = ink;
+            }
+        }
+    }
+    return frame;
+}
+
+// What a game or video looks like to the encoder: smooth shading with a
+// little sensor-style noise on every pixel, so nothing repeats exactly.
+SyntheticFrame CreateVideoLikeFrame(uint32_t width, uint32_t height)
+{
+    auto frame = CreateSolidFrame(width, height, BgraColor{ 0, 0, 0, 255 });
+    uint32_t seed = 54321;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto row = frame.Bytes.data() + (static_cast<size_t>(frame.View.RowPitch) * y);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            seed = (seed * 1664525u) + 1013904223u;
+            auto noise = static_cast<int>((seed >> 24) & 7) - 4;
+            auto u = (x * 256) / width;
+            auto v = (y * 256) / height;
+            auto pixel = row + (x * 4);
+            pixel[0] = static_cast<uint8_t>(std::clamp(static_cast<int>((u + v) / 2) + noise, 0, 255));
+            pixel[1] = static_cast<uint8_t>(std::clamp(static_cast<int>(v) + noise, 0, 255));
+            pixel[2] = static_cast<uint8_t>(std::clamp(static_cast<int>(255 - u) + noise, 0, 255));
+        }
+    }
+    return frame;
+}
+
+struct FrameSize
+{
+    char const* Name;
+    uint32_t Width;
+    uint32_t Height;
+
+    uint64_t PixelBytes() const { return static_cast<uint64_t>(Width) * Height * 4; }
+};
+
+std::vector<FrameSize> const CorpusSizes =
+{
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "4k", 3840, 2160 },
+    { "8k", 7680, 4320 },
+};
+
+struct Timing
+{
+    // Milliseconds
+    double Median = 0.0;
+    double Min = 0.0;
+    uint32_t Iterations = 0;
+
+    static Timing Once(double milliseconds) { return Timing{ milliseconds, milliseconds, 1 }; }
+};
+
+// Runs the work once to warm up, then times it at least minIterations
+// times and keeps going until the time budget is used up.
+Timing Measure(std::function<void()> const& work, uint32_t minIterations, double budgetMilliseconds, uint32_t maxIterations = 50)
+{
+    std::vector<double> times;
+    work();
+    double total = 0.0;
+    while (times.size() < std::max(1u, minIterations) || (total < budgetMilliseconds && times.size() < maxIterations))
+    {
+        auto start = std::chrono::steady_clock::now();
+        work();
+        auto end = std::chrono::steady_clock::now();
+        times.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        total += times.back();
+    }
+    std::sort(times.begin(), times.end());
+    return Timing{ times[times.size() / 2], times.front(), static_cast<uint32_t>(times.size()) };
+}
+
+struct BenchResult
+{
+    std::string Group;
+    std::string Name;
+    // Corpus size, empty for benchmarks that don't use the corpus
+    std::string Size;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    Timing Time;
+    // Bytes processed per run, for throughput
+    uint64_t Bytes = 0;
+    // Anything else worth comparing (output size, fps, ...)
+    std::vector<std::pair<std::string, double>> Metrics;
+
+    std::string Id() const { return Group + "/" + Name + (Size.empty() ? "" : "/" + Size); }
+};
+
+struct BenchOptions
+{
+    // How to start this program again, for the suite workers
+    std::string ProgramPath;
+    std::string JsonPath;
+    std::string Label;
+    std::vector<std::string> Groups;
+    std::vector<FrameSize> Sizes = CorpusSizes;
+    uint32_t MinIterations = 3;
+    double BudgetMilliseconds = 250.0;
+};
+
+// Collects results as the benchmarks run and prints them as they come in
+class BenchRun
+{
+public:
+    BenchRun(BenchOptions const& options) : m_options(options) {}
+
+    BenchOptions const& Options() const { return m_options; }
+
+    bool Enabled(std::string const& group) const
+    {
+        return m_options.Groups.empty() || std::find(m_options.Groups.begin(), m_options.Groups.end(), group) != m_options.Groups.end();
+    }
+
+    Timing Measure(std::function<void()> const& work) const { return ::Measure(work, m_options.MinIterations, m_options.BudgetMilliseconds); }
+    // For work that's too slow to repeat much
+    Timing MeasureOnce(std::function<void()> const& work) const { return ::Measure(work, 1, 0.0); }
+
+    void BeginGroup(std::string const& group, FrameSize const& size, std::string const& note = {})
+    {
+        m_group = group;
+        m_size = size;
+        printf("%s %s (%ux%u)%s%s\n", group.c_str(), size.Name, size.Width, size.Height, note.empty() ? "" : " ", note.c_str());
+    }
+    void BeginGroup(std::string const& group, std::string const& description)
+    {
+        m_group = group;
+        m_size = FrameSize{ "", 0, 0 };
+        printf("%s %s\n", group.c_str(), description.c_str());
+    }
+
+    BenchResult& Report(std::string const& name, Timing const& time, uint64_t bytes = 0)
+    {
+        if (bytes > 0)
+        {
+            auto gigabytesPerSecond = (bytes / 1e9) / (time.Median / 1e3);
+            printf("  %-28s %10.3fms %8.2f GB/s\n", name.c_str(), time.Median, gigabytesPerSecond);
+        }
+        else
+        {
+            printf("  %-28s %10.3fms\n", name.c_str(), time.Median);
+        }
+        BenchResult result;
+        result.Group = m_group;
+        result.Name = name;
+        result.Size = m_size.Name;
+        result.Width = m_size.Width;
+        result.Height = m_size.Height;
+        result.Time = time;
+        result.Bytes = bytes;
+        m_results.push_back(std::move(result));
+        return m_results.back();
+    }
+
+    // Records whether the group's results were correct
+    bool Check(bool success)
+    {
+        if (!success)
+        {
+            printf("  Results did not match!\n");
+            auto name = m_group + (m_size.Width > 0 ? std::string("/") + m_size.Name : "");
+            m_failures.push_back(name);
+        }
+        return success;
+    }
+
+    bool Passed() const { return m_failures.empty(); }
+
+    // One object per result, keyed by a stable id so runs from different
+    // builds can be joined up.
+    void WriteJson(std::ostream& stream) const
+    {
+        JsonWriter json(stream);
+        json.BeginObject();
+        json.Field("label", m_options.Label);
+        json.Key("machine");
+        json.BeginObject();
+        json.Field("threads", BandPool::Shared().ThreadCount());
+        json.Field("simd", SimdLevelName(DetectSimdLevel()));
+#if defined(_WIN32)
+        json.Field("os", "windows");
+#else
+        json.Field("os", "posix");
+#endif
+#if defined(_MSC_VER)
+        json.Field("compiler", "msvc " + std::to_string(_MSC_VER));
+#elif defined(__clang__)
+        json.Field("compiler", "clang " __clang_version__);
+#elif defined(__GNUC__)
+        json.Field("compiler", "gcc " __VERSION__);
+#endif
+        json.EndObject();
+        json.Field("passed", Passed());
+        json.Key("failures");
+        json.BeginArray();
+        for (auto&& failure : m_failures)
+        {
+            json.String(failure);
+        }
+        json.EndArray();
+        json.Key("results");
+        json.BeginArray();
+        for (auto&& result : m_results)
+        {
+            json.BeginObject();
+            json.Field("id", result.Id());
+            json.Field("group", result.Group);
+            json.Field("name", result.Name);
+            if (!result.Size.empty())
+            {
+                json.Field("size", result.Size);
+                json.Field("width", result.Width);
+                json.Field("height", result.Height);
+            }
+            json.Field("iterations", result.Time.Iterations);
+            json.Field("median_ms", result.Time.Median);
+            json.Field("min_ms", result.Time.Min);
+            if (result.Bytes > 0)
+            {
+                json.Field("bytes", result.Bytes);
+                json.Field("gb_per_s", (result.Bytes / 1e9) / (result.Time.Median / 1e3));
+            }
+            if (!result.Metrics.empty())
+            {
+                json.Key("metrics");
+                json.BeginObject();
+                for (auto&& [name, value] : result.Metrics)
+                {
+                    json.Field(name, value);
+                }
+                json.EndObject();
+            }
+            json.EndObject();
+        }
+        json.EndArray();
+        json.EndObject();
+        stream << "\n";
+    }
+
+private:
+    BenchOptions m_options;
+    std::string m_group;
+    FrameSize m_size = { "", 0, 0 };
+    std::vector<BenchResult> m_results;
+    std::vector<std::string> m_failures;
+};
+
+// Getting the frame out of a padded, mapped texture into a tight buffer
+bool BenchmarkCopy(BenchRun& run, FrameSize const& size)
+{
+    auto frame = CreateDesktopLikeFrame(size.Width, size.Height);
+    run.BeginGroup("copy", size);
+
+    std::vector<uint8_t> destination(frame.Bytes.size());
+    auto time = run.Measure([&]() { std::memcpy(destination.data(), frame.Bytes.data(), frame.Bytes.size()); });
+    run.Report("memcpy (with padding)", time, frame.Bytes.size());
+
+    // The lease goes back to the pool first, so after the warm up this is just the copy
+    ImageArtifact artifact;
+    time = run.Measure([&]()
+    {
+        artifact.Pixels.Reset();
+        artifact = ImageArtifact::Copy("copy.png", frame.View);
+    });
+    run.Report("Row by row", time, size.PixelBytes());
+
+    auto success = artifact.RowPitch == size.Width * 4;
+    for (uint32_t y = 0; y < size.Height; y += 97)
+    {
+        success &= std::memcmp(artifact.View().Row(y), frame.View.Row(y), artifact.RowPitch) == 0;
+    }
+    return run.Check(success);
+}
+
+// Reading pixels one at a time the way MappedTexture::ReadBGRAPixel does,
+// versus walking the rows directly.
+bool BenchmarkReadback(BenchRun& run, FrameSize const& size)
+{
+    auto frame = CreateDesktopLikeFrame(size.Width, size.Height);
+    run.BeginGroup("readback", size);
+
+    uint64_t perPixelSum = 0;
+    auto time = run.Measure([&]()
+    {
+        perPixelSum = 0;
+        for (uint32_t y = 0; y < size.Height; y++)
+        {
+            for (uint32_t x = 0; x < size.Width; x++)
+            {
+                perPixelSum += frame.View.ReadPixel(x, y).Packed();
+            }
+        }
+    });
+    run.Report("Per-pixel reads", time, size.PixelBytes());
+
+    uint64_t bulkSum = 0;
+    time = run.Measure([&]()
+    {
+        bulkSum = 0;
+        for (uint32_t y = 0; y < size.Height; y++)
+        {
+            auto row = frame.View.Row(y);
+            for (uint32_t x = 0; x < size.Width; x++)
+            {
+                uint32_t pixel;
+                std::memcpy(&pixel, row + (x * 4), sizeof(pixel));
+                bulkSum += pixel;
+            }
+        }
+    });
+    run.Report("Bulk rows", time, size.PixelBytes());
+
+    return run.Check(perPixelSum == bulkSum);
+}
+
+bool BenchmarkVerifyRegion(BenchRun& run, FrameSize const& size)
+{
+    auto const red = BgraColor{ 0, 0, 255, 255 };
+    auto width = size.Width;
+    auto height = size.Height;
+    auto frame = CreateSolidFrame(width, height, red);
+    auto bounds = frame.View.Bounds();
+    run.BeginGroup("verify", size, std::string("best: ") + SimdLevelName(DetectSimdLevel()));
+
+    auto success = true;
+    std::vector<SimdLevel> levels = { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON };
+    for (auto level : levels)
+    {
+        if (ResolveSimdLevel(level) != level)
+        {
+            continue;
+        }
+        RegionVerifyResult result;
+        auto time = run.Measure([&]() { result = VerifyRegion(frame.View, bounds, red, {}, level); });
+        success &= result.Passed();
+        run.Report(SimdLevelName(level), time, size.PixelBytes());
+    }
+    {
+        RegionVerifyResult result;
+        auto time = run.Measure([&]() { result = VerifyRegionParallel(frame.View, bounds, red); });
+        success &= result.Passed();
+        run.Report("Parallel", time, size.PixelBytes());
+    }
+    {
+        // What the tests used to do for every pixel
+        uint64_t mismatches = 0;
+        auto time = run.Measure([&]()
+        {
+            mismatches = 0;
+            for (uint32_t y = 0; y < height; y++)
+            {
+                for (uint32_t x = 0; x < width; x++)
+                {
+                    mismatches += frame.View.ReadPixel(x, y) != red;
+                }
+            }
+        });
+        success &= mismatches == 0;
+        run.Report("Per-pixel reads", time, size.PixelBytes());
+    }
+
+    // Every implementation must agree on a frame with a few bad pixels
+    auto pitch = frame.View.RowPitch;
+    frame.Bytes[(static_cast<size_t>(pitch) * 7) + (13 * 4) + 1] = 10;
+    frame.Bytes[(static_cast<size_t>(pitch) * (height - 3)) + ((width - 2) * 4) + 3] = 0;
+    auto expected = VerifyRegion(frame.View, bounds, red, {}, SimdLevel::Scalar);
+    for (auto level : levels)
+    {
+        auto result = VerifyRegion(frame.View, bounds, red, {}, level);
+        success &= result.MismatchCount == expected.MismatchCount && result.FirstMismatchX == expected.FirstMismatchX &&
+            result.FirstMismatchY == expected.FirstMismatchY && result.MismatchBounds.Width == expected.MismatchBounds.Width &&
+            result.MismatchBounds.Height == expected.MismatchBounds.Height;
+    }
+    auto parallel = VerifyRegionParallel(frame.View, bounds, red);
+    success &= parallel.MismatchCount == 2 && parallel.FirstMismatchX == 13 && parallel.FirstMismatchY == 7 &&
+        parallel.MismatchBounds.Right() == width - 1 && parallel.MismatchBounds.Bottom() == height - 2;
+    return run.Check(success);
+}
+
+bool BenchmarkImageDiff(BenchRun& run, FrameSize const& size)
+{
+    auto const red = BgraColor{ 0, 0, 255, 255 };
+    auto width = size.Width;
+    auto height = size.Height;
+    auto expected = CreateSolidFrame(width, height, red);
+    auto actual = CreateSolidFrame(width, height, red);
+    auto bytes = size.PixelBytes() * 2;
+    run.BeginGroup("diff", size);
+
+    // Two separate blocks of noise, and one pixel that's off by less than the threshold
+    auto pitch = actual.View.RowPitch;
+    auto setPixel = [&](uint32_t x, uint32_t y, BgraColor color) { std::memcpy(actual.Bytes.data() + (static_cast<size_t>(pitch) * y) + (x * 4), &color, 4); };
+    for (uint32_t y = 100; y < 140; y++)
+    {
+        for (uint32_t x = 200; x < 300; x++)
+        {
+            setPixel(x, y, BgraColor{ 0, static_cast<uint8_t>(x + y), 255, 255 });
+        }
+    }
+    for (uint32_t i = 0; i < 50; i++)
+    {
+        setPixel(width - 10 - i, height - 10 - i, BgraColor{ 40, 0, 200, 255 });
+    }
+    setPixel(5, 5, BgraColor{ 3, 0, 255, 255 });
+
+    auto success = true;
+    ImageDiffOptions options;
+    options.Threshold = BgraColor{ 4, 4, 4, 4 };
+    std::vector<SimdLevel> levels = { SimdLevel::Scalar, SimdLevel::SSE2 };
+    std::vector<ImageDiffResult> results;
+    for (auto level : levels)
+    {
+        if (ResolveSimdLevel(level) != level)
+        {
+            continue;
+        }
+        options.Level = level;
+        ImageDiffResult result;
+        auto time = run.Measure([&]() { result = DiffImages(actual.View, expected.View, options); });
+        run.Report(SimdLevelName(level), time, bytes);
+        results.push_back(std::move(result));
+    }
+    options.Level = DetectSimdLevel();
+    options.GenerateMask = true;
+    {
+        ImageDiffResult result;
+        auto time = run.Measure([&]() { result = DiffImages(actual.View, expected.View, options); });
+        run.Report("With mask", time, bytes);
+        success &= result.Mask[(static_cast<size_t>(width) * 5) + 5] == 3 && result.Mask[(static_cast<size_t>(width) * 100) + 200] == 255;
+        results.push_back(std::move(result));
+    }
+    {
+        ImageDiffResult result;
+        auto time = run.Measure([&]() { result = DiffImageAgainstColor(actual.View, red, options); });
+        run.Report("Against color", time, bytes / 2);
+        results.push_back(std::move(result));
+    }
+
+    // The diagonal line is 8-connected, so it's a single area
+    for (auto&& result : results)
+    {
+        success &= result.DifferingPixels == 4000 + 50 && result.TotalRegionCount == 2 && result.Regions.size() == 2 &&
+            result.Regions[0].PixelCount == 4000 && result.Regions[0].Bounds.X == 200 && result.Regions[0].Bounds.Y == 100 &&
+            result.Regions[0].Bounds.Width == 100 && result.Regions[0].Bounds.Height == 40 &&
+            result.Regions[1].PixelCount == 50 && result.Regions[1].Bounds.Width == 50 && result.Regions[1].Bounds.Height == 50 &&
+            result.MaxError == BgraColor{ 40, 182, 55, 0 };
+    }
+
+    // An expected image from a predicate, which must agree with the same
+    // image written out as a frame. Only the diagonal line is left differing.
+    auto noise = [](uint32_t x, uint32_t y) { return x >= 200 && x < 300 && y >= 100 && y < 140; };
+    auto expectedPixel = [&](uint32_t x, uint32_t y) { return noise(x, y) ? BgraColor{ 0, static_cast<uint8_t>(x + y), 255, 255 } : red; };
+    auto pattern = CreateSolidFrame(width, height, red);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            if (noise(x, y))
+            {
+                auto color = expectedPixel(x, y);
+                std::memcpy(pattern.Bytes.data() + (static_cast<size_t>(pattern.View.RowPitch) * y) + (x * 4), &color, 4);
+            }
+        }
+    }
+    options.GenerateMask = false;
+    {
+        ImageDiffResult result;
+        auto time = run.Measure([&]() { result = DiffImageAgainst(actual.View, expectedPixel, options); });
+        run.Report("Against predicate", time, bytes / 2);
+        auto framed = DiffImages(actual.View, pattern.View, options);
+        success &= result.DifferingPixels == 50 && result.TotalRegionCount == 1 && result.MaxError == BgraColor{ 40, 0, 55, 0 };
+        success &= result.DifferingPixels == framed.DifferingPixels && result.TotalRegionCount == framed.TotalRegionCount &&
+            result.MaxError == framed.MaxError && result.Regions.size() == framed.Regions.size();
+        for (size_t i = 0; i < result.Regions.size() && i < framed.Regions.size(); i++)
+        {
+            auto const& region = result.Regions[i];
+            auto const& other = framed.Regions[i];
+            success &= region.PixelCount == other.PixelCount && region.Bounds.X == other.Bounds.X && region.Bounds.Y == other.Bounds.Y &&
+                region.Bounds.Width == other.Bounds.Width && region.Bounds.Height == other.Bounds.Height;
+        }
+    }
+    return run.Check(success);
+}
+
+// The fastest a single pass can read the frame, which is as fast as hashing can go
+uint64_t SumFrameWords(BgraImageView const& image)
+{
+    auto rowBytes = static_cast<size_t>(image.Width) * BgraImageView::BytesPerPixel;
+    uint64_t sums[4] = {};
+    for (uint32_t y = 0; y < image.Height; y++)
+    {
+        auto row = image.Row(y);
+        for (size_t x = 0; x + 32 <= rowBytes; x += 32)
+        {
+            for (size_t i = 0; i < 4; i++)
+            {
+                uint64_t word;
+                std::memcpy(&word, row + x + (i * 8), sizeof(word));
+                sums[i] += word;
+            }
+        }
+    }
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+bool BenchmarkHash(BenchRun& run, FrameSize const& size)
+{
+    auto frame = CreateDesktopLikeFrame(size.Width, size.Height);
+    run.BeginGroup("hash", size, std::string("best: ") + SimdLevelName(DetectSimdLevel()));
+
+    uint64_t sum = 0;
+    auto readTime = run.Measure([&]() { sum = SumFrameWords(frame.View); });
+    run.Report("Read baseline", readTime, size.PixelBytes());
+
+    uint64_t hash = 0;
+    auto time = run.Measure([&]() { hash = HashImage(frame.View, nullptr, SimdLevel::Scalar); });
+    run.Report("Scalar", time, size.PixelBytes());
+
+    std::vector<uint64_t> rowHashes;
+    time = run.Measure([&]() { HashImage(frame.View, &rowHashes, SimdLevel::Scalar); });
+    run.Report("Scalar with row hashes", time, size.PixelBytes());
+
+    // Every implementation has to give exactly the same hashes as the scalar one
+    auto success = sum != 0;
+    auto bestTime = time;
+    std::vector<SimdLevel> levels = { SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON };
+    for (auto level : levels)
+    {
+        if (ResolveSimdLevel(level) != level)
+        {
+            continue;
+        }
+        uint64_t levelHash = 0;
+        time = run.Measure([&]() { levelHash = HashImage(frame.View, nullptr, level); });
+        run.Report(SimdLevelName(level), time, size.PixelBytes());
+        std::vector<uint64_t> levelRowHashes;
+        success &= levelHash == hash && HashImage(frame.View, &levelRowHashes, level) == hash && levelRowHashes == rowHashes;
+        bestTime = time.Min < bestTime.Min ? time : bestTime;
+    }
+    {
+        uint64_t parallelHash = 0;
+        std::vector<uint64_t> parallelRowHashes;
+        time = run.Measure([&]() { parallelHash = HashImageParallel(frame.View, &parallelRowHashes); });
+        run.Report("Parallel with row hashes", time, size.PixelBytes());
+        success &= parallelHash == hash && parallelRowHashes == rowHashes;
+        bestTime = time.Min < bestTime.Min ? time : bestTime;
+    }
+
+    // Row lengths that aren't a whole number of stripes go through the tail
+    // handling, which the vector paths share with the scalar one.
+    for (auto width : { 1u, 15u, 16u, 17u, 33u })
+    {
+        auto view = frame.View.SubView(PixelRect{ 3, 5, width, 40 });
+        auto expected = HashImage(view, nullptr, SimdLevel::Scalar);
+        for (auto level : levels)
+        {
+            success &= HashImage(view, nullptr, level) == expected;
+        }
+    }
+
+    // Hashing runs on the delivery path, so from 4k up it has to stay close
+    // to just reading the frame. On one core AVX2 measures 82-96% of the read
+    // baseline (about 85% typically), so it doesn't quite match it; the check
+    // only catches a kernel that has fallen well behind. Smaller frames fit
+    // in the cache and aren't limited by memory at all.
+    if (size.PixelBytes() >= 3840ull * 2160 * 4)
+    {
+        auto ratio = readTime.Min / bestTime.Min;
+        printf("  Best hash runs at %.0f%% of read bandwidth\n", ratio * 100.0);
+        success &= ratio >= 0.75;
+    }
+
+    // Padding doesn't count, and the row hashes are the same ones the frame hash is built from
+    auto tight = ImageArtifact::Copy("hash.png", frame.View);
+    std::vector<uint64_t> tightRowHashes;
+    success &= HashImage(tight.View(), &tightRowHashes) == hash && tightRowHashes == rowHashes;
+    frame.Bytes[frame.View.RowPitch - 1] ^= 0xff;
+    success &= HashImage(frame.View) == hash;
+
+    // Any change to a pixel, or moving content around within a row, has to show up.
+    // This row is in the gradient, so no two blocks of it are the same.
+    auto y = size.Height / 16;
+    auto row = frame.Bytes.data() + (static_cast<size_t>(frame.View.RowPitch) * y);
+    row[(size.Width - 1) * 4] ^= 1;
+    success &= HashImage(frame.View) != hash;
+    row[(size.Width - 1) * 4] ^= 1;
+    std::swap_ranges(row + (size.Width / 2) * 4, row + ((size.Width / 2) + 16) * 4, row + ((size.Width / 2) + 16) * 4);
+    success &= HashImage(frame.View) != hash;
+
+    // Two unique frames, then the first one comes back three times in a row
+    FrameChangeCounter counter;
+    for (auto frameHash : { 1ull, 2ull, 1ull, 1ull, 1ull, 3ull })
+    {
+        counter.Add(frameHash);
+    }
+    success &= counter.Frames() == 6 && counter.UniqueFrames() == 4 && counter.LongestIdenticalRun() == 3;
+    return run.Check(success);
+}
+
+bool BenchmarkDirtyTiles(BenchRun& run, FrameSize const& size)
+{
+    auto width = size.Width;
+    auto height = size.Height;
+    auto before = CreateDesktopLikeFrame(width, height);
+    auto after = CreateDesktopLikeFrame(width, height);
+    run.BeginGroup("dirty", size, std::string("best: ") + SimdLevelName(DetectSimdLevel()));
+
+    // A block of new content that straddles tile edges, and the very last pixel
+    auto pitch = after.View.RowPitch;
+    for (uint32_t y = 100; y < 140; y++)
+    {
+        for (uint32_t x = 200; x < 300; x++)
+        {
+            after.Bytes[(static_cast<size_t>(pitch) * y) + (x * 4) + 1] ^= 0x40;
+        }
+    }
+    after.Bytes[(static_cast<size_t>(pitch) * (height - 1)) + ((width - 1) * 4) + 3] = 0;
+
+    auto success = true;
+    auto checkChanged = [&](DirtyTileResult const& result, uint32_t tileSize)
+    {
+        auto lastX = (width - 1) / tileSize;
+        auto lastY = (height - 1) / tileSize;
+        auto blockRect = PixelRect{ (200 / tileSize) * tileSize, (100 / tileSize) * tileSize, 0, 0 };
+        blockRect.Width = (((299 / tileSize) + 1) * tileSize) - blockRect.X;
+        blockRect.Height = (((139 / tileSize) + 1) * tileSize) - blockRect.Y;
+        auto blockTiles = (blockRect.Width / tileSize) * (blockRect.Height / tileSize);
+        auto cornerRect = PixelRect{ lastX * tileSize, lastY * tileSize, width - (lastX * tileSize), height - (lastY * tileSize) };
+        auto dirtyPixels = (static_cast<uint64_t>(blockRect.Width) * blockRect.Height) + (static_cast<uint64_t>(cornerRect.Width) * cornerRect.Height);
+        return result.TileSize == tileSize && result.DirtyTileCount == blockTiles + 1 && result.IsDirty(200 / tileSize, 100 / tileSize) &&
+            result.IsDirty(lastX, lastY) && !result.IsDirty(0, 0) &&
+            std::abs(result.ChangedAreaPercent - ((100.0 * dirtyPixels) / (static_cast<uint64_t>(width) * height))) < 1e-9 &&
+            result.DirtyRects.size() == 2 &&
+            result.DirtyRects[0].X == blockRect.X && result.DirtyRects[0].Y == blockRect.Y &&
+            result.DirtyRects[0].Width == blockRect.Width && result.DirtyRects[0].Height == blockRect.Height &&
+            result.DirtyRects[1].X == cornerRect.X && result.DirtyRects[1].Y == cornerRect.Y &&
+            result.DirtyRects[1].Width == cornerRect.Width && result.DirtyRects[1].Height == cornerRect.Height;
+    };
+
+    std::vector<SimdLevel> levels = { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON };
+    for (auto level : levels)
+    {
+        if (ResolveSimdLevel(level) != level)
+        {
+            continue;
+        }
+        // Nothing changed is the worst case: every row of every tile gets compared
+        DirtyTileDetector detector;
+        auto& first = detector.Compare(before.View, level);
+        success &= !first.Compared && first.DirtyTileCount == first.TilesX * first.TilesY && first.ChangedAreaPercent == 100.0 && first.DirtyRects.size() == 1;
+        auto time = run.Measure([&]() { detector.Compare(before.View, level); });
+        run.Report(std::string(SimdLevelName(level)) + " unchanged", time, size.PixelBytes() * 2);
+        auto& unchanged = detector.Compare(before.View, level);
+        success &= unchanged.Compared && unchanged.DirtyTileCount == 0 && unchanged.ChangedAreaPercent == 0.0 && unchanged.DirtyRects.empty();
+
+        // Going back and forth between the two frames changes the same tiles each time
+        success &= checkChanged(detector.Compare(after.View, level), DirtyTileDetector::DefaultTileSize);
+        auto bitmap = detector.Compare(before.View, level).Bitmap.data();
+        auto rects = detector.Compare(after.View, level).DirtyRects.data();
+        auto flip = false;
+        time = run.Measure([&]()
+        {
+            detector.Compare(flip ? after.View : before.View, level);
+            flip = !flip;
+        });
+        run.Report(std::string(SimdLevelName(level)) + " changed", time, size.PixelBytes() * 2);
+        auto& changed = detector.Compare(flip ? after.View : before.View, level);
+        success &= checkChanged(changed, DirtyTileDetector::DefaultTileSize);
+        // Nothing was reallocated once the detector had seen a frame of this size
+        success &= changed.Bitmap.data() == bitmap && changed.DirtyRects.data() == rects;
+    }
+
+    DirtyTileDetector largeTiles(64);
+    largeTiles.Compare(before.View);
+    success &= checkChanged(largeTiles.Compare(after.View), 64);
+    // A size change has nothing to compare to, like the first frame
+    success &= !largeTiles.Compare(before.View.SubView(PixelRect{ 0, 0, width / 2, height / 2 })).Compared;
+
+    // Clean tiles are compared as one span, so a single changed pixel
+    // anywhere in a row, tile and block edges included, has to be pinned on
+    // exactly its own tile. 7 pixel tiles don't line up with the blocks.
+    auto narrow = CreateSolidFrame(150, 2, BgraColor{ 10, 20, 30, 255 });
+    for (auto level : levels)
+    {
+        if (ResolveSimdLevel(level) != level)
+        {
+            continue;
+        }
+        DirtyTileDetector detector(7);
+        detector.Compare(narrow.View, level);
+        for (uint32_t x = 0; x < narrow.View.Width; x++)
+        {
+            narrow.Bytes[narrow.View.RowPitch + (x * 4)] ^= 1;
+            auto& result = detector.Compare(narrow.View, level);
+            success &= result.DirtyTileCount == 1 && result.IsDirty(x / 7, 0);
+        }
+    }
+    return run.Check(success);
+}
+
+bool BenchmarkI420(BenchRun& run, FrameSize const& size)
+{
+    auto width = size.Width;
+    auto height = size.Height;
+    auto frame = CreateVideoLikeFrame(width, height);
+    run.BeginGroup("i420", size, std::string("best: ") + SimdLevelName(DetectSimdLevel()));
+
+    auto convert = [](BgraImageView const& image, SimdLevel level)
+    {
+        std::vector<uint8_t> i420(I420Size(image.Width, image.Height));
+        ConvertBgraToI420(image, I420PlanesFor(i420.data(), image.Width, image.Height), level);
+        return i420;
+    };
+    auto expected = convert(frame.View, SimdLevel::Scalar);
+    std::vector<uint8_t> i420(expected.size());
+    auto planes = I420PlanesFor(i420.data(), width, height);
+    auto success = true;
+    for (auto level : { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON })
+    {
+        if (ResolveSimdLevel(level) != level)
+        {
+            continue;
+        }
+        auto time = run.Measure([&]() { ConvertBgraToI420(frame.View, planes, level); });
+        run.Report(SimdLevelName(level), time, size.PixelBytes());
+        success &= i420 == expected;
+        // Odd sizes and offsets go through the edge handling
+        for (auto rect : { PixelRect{ 1, 1, 37, 19 }, PixelRect{ 5, 2, 1, 1 }, PixelRect{ 0, 3, 16, 2 }, PixelRect{ 3, 0, 33, 5 } })
+        {
+            auto view = frame.View.SubView(rect);
+            success &= convert(view, level) == convert(view, SimdLevel::Scalar);
+        }
+    }
+    auto time = run.Measure([&]() { ConvertBgraToI420Parallel(frame.View, planes); });
+    run.Report("Parallel", time, size.PixelBytes());
+    success &= i420 == expected;
+
+    // The fixed point weights are within one step of BT.709 limited range
+    for (auto color : { BgraColor{ 255, 255, 255, 255 }, BgraColor{ 0, 0, 0, 255 }, BgraColor{ 0, 0, 255, 255 },
+        BgraColor{ 0, 255, 0, 255 }, BgraColor{ 255, 0, 0, 255 }, BgraColor{ 30, 160, 220, 255 } })
+    {
+        auto solid = CreateSolidFrame(20, 6, color);
+        auto result = convert(solid.View, DetectSimdLevel());
+        auto solidPlanes = I420PlanesFor(result.data(), 20, 6);
+        auto b = color.B / 255.0;
+        auto g = color.G / 255.0;
+        auto r = color.R / 255.0;
+        auto y = 16.0 + (219.0 * ((0.2126 * r) + (0.7152 * g) + (0.0722 * b)));
+        auto u = 128.0 + (224.0 * ((-0.1146 * r) - (0.3854 * g) + (0.5 * b)));
+        auto v = 128.0 + (224.0 * ((0.5 * r) - (0.4542 * g) - (0.0458 * b)));
+        success &= std::abs(solidPlanes.Y[0] - y) <= 1.0 && std::abs(solidPlanes.U[0] - u) <= 1.0 && std::abs(solidPlanes.V[0] - v) <= 1.0;
+        success &= solidPlanes.Y[119] == solidPlanes.Y[0] && solidPlanes.U[29] == solidPlanes.U[0] && solidPlanes.V[29] == solidPlanes.V[0];
+    }
+    return run.Check(success);
+}
+
+// Every byte random, alpha included
+SyntheticFrame CreateNoiseFrame(uint32_t width, uint32_t height, uint32_t seed)
+{
+    auto frame = CreateSolidFrame(width, height, BgraColor{ 0, 0, 0, 0 });
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto row = frame.Bytes.data() + (static_cast<size_t>(frame.View.RowPitch) * y);
+        for (uint32_t x = 0; x < width * 4; x++)
+        {
+            seed = (seed * 1664525u) + 1013904223u;
+            row[x] = static_cast<uint8_t>(seed >> 24);
+        }
+    }
+    return frame;
+}
+
+struct PixelKernel
+{
+    char const* Name;
+    // Output bytes per pixel
+    uint32_t OutputBytes;
+    void (*Convert)(BgraImageView const&, uint8_t*, uint32_t, SimdLevel);
+};
+
+PixelKernel const SwizzleKernel{ "swizzle", 4, SwapRedBlue };
+PixelKernel const PremultiplyKernel{ "premultiply", 4, PremultiplyAlpha };
+PixelKernel const UnpremultiplyKernel{ "unpremultiply", 4, UnpremultiplyAlpha };
+PixelKernel const GrayKernel{ "gray", 1, ConvertBgraToGray };
+PixelKernel const AllPixelKernels[] = { SwizzleKernel, PremultiplyKernel, UnpremultiplyKernel, GrayKernel };
+
+std::vector<uint8_t> ConvertWith(PixelKernel const& kernel, BgraImageView const& image, SimdLevel level)
+{
+    std::vector<uint8_t> result(static_cast<size_t>(image.Width) * image.Height * kernel.OutputBytes);
+    kernel.Convert(image, result.data(), image.Width * kernel.OutputBytes, level);
+    return result;
+}
+
+std::vector<uint8_t> ConvertToNV12(BgraImageView const& image, SimdLevel level)
+{
+    std::vector<uint8_t> nv12(I420Size(image.Width, image.Height));
+    ConvertBgraToNV12(image, NV12PlanesFor(nv12.data(), image.Width, image.Height), level);
+    return nv12;
+}
+
+std::vector<SimdLevel> SupportedSimdLevels()
+{
+    std::vector<SimdLevel> levels;
+    for (auto level : { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2, SimdLevel::NEON })
+    {
+        if (ResolveSimdLevel(level) == level)
+        {
+            levels.push_back(level);
+        }
+    }
+    return levels;
+}
+
+bool BenchmarkPixelKernels(BenchRun& run, FrameSize const& size)
+{
+    auto width = size.Width;
+    auto height = size.Height;
+    run.BeginGroup("kernels", size, std::string("best: ") + SimdLevelName(DetectSimdLevel()));
+    auto frame = CreateVideoLikeFrame(width, height);
+    // Translucent pixels, so the alpha kernels have something to do
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto row = frame.Bytes.data() + (static_cast<size_t>(frame.View.RowPitch) * y);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            row[(x * 4) + 3] = static_cast<uint8_t>((x * 7) + (y * 3));
+        }
+    }
+
+    auto success = true;
+    for (auto&& kernel : AllPixelKernels)
+    {
+        auto expected = ConvertWith(kernel, frame.View, SimdLevel::Scalar);
+        std::vector<uint8_t> output(expected.size());
+        for (auto level : SupportedSimdLevels())
+        {
+            auto time = run.Measure([&]() { kernel.Convert(frame.View, output.data(), width * kernel.OutputBytes, level); });
+            run.Report(std::string(kernel.Name) + " " + SimdLevelName(level), time, size.PixelBytes());
+            success &= output == expected;
+        }
+    }
+
+    std::vector<uint8_t> nv12(I420Size(width, height));
+    auto expected = ConvertToNV12(frame.View, SimdLevel::Scalar);
+    for (auto level : SupportedSimdLevels())
+    {
+        auto time = run.Measure([&]() { ConvertBgraToNV12(frame.View, NV12PlanesFor(nv12.data(), width, height), level); });
+        run.Report(std::string("nv12 ") + SimdLevelName(level), time, size.PixelBytes());
+        success &= nv12 == expected;
+    }
+    auto time = run.Measure([&]() { ConvertBgraToNV12Parallel(frame.View, NV12PlanesFor(nv12.data(), width, height)); });
+    run.Report("nv12 Parallel", time, size.PixelBytes());
+    success &= nv12 == expected;
+    return run.Check(success);
+}
+
+// Checks every kernel at every level against the scalar reference on every
+// input it can be given (or, for the YUV kernels, every edge case), and the
+// scalar references against the exact results they're meant to round.
+bool TestPixelKernelsExhaustively(BenchRun& run)
+{
+    run.BeginGroup("kernels-exhaustive", "all inputs, every level against scalar");
+    auto levels = SupportedSimdLevels();
+    auto success = true;
+    auto check = [&](char const* name, bool passed)
+    {
+        if (!passed)
+        {
+            printf("  %s failed\n", name);
+        }
+        success &= passed;
+    };
+
+    // Every BGR color once, with alpha varying as well
+    auto colors = CreateSolidFrame(4096, 4096, BgraColor{ 0, 0, 0, 0 });
+    for (uint32_t y = 0; y < 4096; y++)
+    {
+        auto row = colors.Bytes.data() + (static_cast<size_t>(colors.View.RowPitch) * y);
+        for (uint32_t x = 0; x < 4096; x++)
+        {
+            auto color = (y * 4096) + x;
+            uint8_t pixel[4] = { static_cast<uint8_t>(color), static_cast<uint8_t>(color >> 8), static_cast<uint8_t>(color >> 16), static_cast<uint8_t>(x ^ y) };
+            std::memcpy(row + (x * 4), pixel, 4);
+        }
+    }
+    auto start = std::chrono::steady_clock::now();
+    for (auto&& kernel : { SwizzleKernel, GrayKernel })
+    {
+        auto expected = ConvertWith(kernel, colors.View, SimdLevel::Scalar);
+        for (auto level : levels)
+        {
+            check(kernel.Name, ConvertWith(kernel, colors.View, level) == expected);
+        }
+    }
+    auto swapped = ConvertWith(SwizzleKernel, colors.View, SimdLevel::Scalar);
+    auto grays = ConvertWith(GrayKernel, colors.View, SimdLevel::Scalar);
+    auto swapCorrect = true;
+    auto grayCorrect = true;
+    for (uint32_t color = 0; color < (1u << 24); color++)
+    {
+        auto pixel = colors.View.Row(color / 4096) + ((color % 4096) * 4);
+        auto out = swapped.data() + (static_cast<size_t>(color) * 4);
+        swapCorrect &= out[0] == pixel[2] && out[1] == pixel[1] && out[2] == pixel[0] && out[3] == pixel[3];
+        // Rounding to 8 bits is half a step, and rounding the weights to 8
+        // bits can add just over half a step more
+        auto luma = (0.0722 * pixel[0]) + (0.7152 * pixel[1]) + (0.2126 * pixel[2]);
+        grayCorrect &= std::abs(grays[color] - luma) <= 1.05;
+    }
+    check("swizzle reference", swapCorrect);
+    check("gray reference", grayCorrect);
+
+    // Every (channel, alpha) pair: x is the channel value and y is alpha, with
+    // the channels in a different order in each of B, G and R
+    auto pairs = CreateSolidFrame(256, 256, BgraColor{ 0, 0, 0, 0 });
+    for (uint32_t a = 0; a < 256; a++)
+    {
+        auto row = pairs.Bytes.data() + (static_cast<size_t>(pairs.View.RowPitch) * a);
+        for (uint32_t c = 0; c < 256; c++)
+        {
+            uint8_t pixel[4] = { static_cast<uint8_t>(c), static_cast<uint8_t>(255 - c), static_cast<uint8_t>(c ^ 0x5a), static_cast<uint8_t>(a) };
+            std::memcpy(row + (c * 4), pixel, 4);
+        }
+    }
+    for (auto&& kernel : { PremultiplyKernel, UnpremultiplyKernel })
+    {
+        auto expected = ConvertWith(kernel, pairs.View, SimdLevel::Scalar);
+        for (auto level : levels)
+        {
+            check(kernel.Name, ConvertWith(kernel, pairs.View, level) == expected);
+        }
+    }
+    auto premultiplied = ConvertWith(PremultiplyKernel, pairs.View, SimdLevel::Scalar);
+    auto straight = ConvertWith(UnpremultiplyKernel, pairs.View, SimdLevel::Scalar);
+    auto premultiplyCorrect = true;
+    auto unpremultiplyCorrect = true;
+    for (uint32_t a = 0; a < 256; a++)
+    {
+        for (uint32_t c = 0; c < 256; c++)
+        {
+            auto pixel = pairs.View.Row(a) + (c * 4);
+            auto offset = ((static_cast<size_t>(a) * 256) + c) * 4;
+            for (uint32_t channel = 0; channel < 3; channel++)
+            {
+                auto value = pixel[channel];
+                // Rounded to nearest, and a tie can't happen when dividing by 255
+                premultiplyCorrect &= premultiplied[offset + channel] == ((value * a * 2) + 255) / 510;
+                auto ideal = a == 0 ? 0.0 : std::min((value * 255.0) / a, 255.0);
+                unpremultiplyCorrect &= std::abs(straight[offset + channel] - ideal) <= 0.5;
+            }
+            premultiplyCorrect &= premultiplied[offset + 3] == a;
+            unpremultiplyCorrect &= straight[offset + 3] == a;
+        }
+    }
+    check("premultiply reference", premultiplyCorrect);
+    check("unpremultiply reference", unpremultiplyCorrect);
+
+    // Every width up to a few vectors wide, at odd offsets and in place, so
+    // every tail length is covered
+    auto noise = CreateNoiseFrame(80, 8, 777);
+    for (uint32_t width = 1; width <= 67; width++)
+    {
+        for (uint32_t left : { 0u, 1u, 3u })
+        {
+            auto view = noise.View.SubView(PixelRect{ left, 1, width, 3 });
+            for (auto&& kernel : AllPixelKernels)
+            {
+                auto expected = ConvertWith(kernel, view, SimdLevel::Scalar);
+                for (auto level : levels)
+                {
+                    check(kernel.Name, ConvertWith(kernel, view, level) == expected);
+                    if (kernel.OutputBytes == 4)
+                    {
+                        auto copy = noise.Bytes;
+                        auto data = copy.data() + noise.View.RowPitch + (left * 4);
+                        auto inPlace = BgraImageView{ data, width, 3, noise.View.RowPitch };
+                        kernel.Convert(inPlace, data, inPlace.RowPitch, level);
+                        auto same = true;
+                        for (uint32_t y = 0; y < 3; y++)
+                        {
+                            same &= std::memcmp(inPlace.Row(y), expected.data() + (static_cast<size_t>(width) * 4 * y), static_cast<size_t>(width) * 4) == 0;
+                        }
+                        check(kernel.Name, same);
+                    }
+                }
+            }
+        }
+    }
+
+    // Every width and height up to a few row pairs, on random pixels. NV12
+    // has to be I420 with the chroma interleaved.
+    auto yuvNoise = CreateNoiseFrame(72, 12, 4242);
+    for (uint32_t width = 1; width <= 67; width++)
+    {
+        for (uint32_t height = 1; height <= 7; height++)
+        {
+            auto view = yuvNoise.View.SubView(PixelRect{ 72 - width, 12 - height, width, height });
+            std::vector<uint8_t> i420(I420Size(width, height));
+            ConvertBgraToI420(view, I420PlanesFor(i420.data(), width, height), SimdLevel::Scalar);
+            auto expected = ConvertToNV12(view, SimdLevel::Scalar);
+            auto planes = I420PlanesFor(i420.data(), width, height);
+            auto chromaCount = static_cast<size_t>(ChromaSize(width)) * ChromaSize(height);
+            auto lumaCount = static_cast<size_t>(width) * height;
+            auto interleaved = std::memcmp(i420.data(), expected.data(), lumaCount) == 0;
+            for (size_t i = 0; i < chromaCount; i++)
+            {
+                interleaved &= expected[lumaCount + (i * 2)] == planes.U[i] && expected[lumaCount + (i * 2) + 1] == planes.V[i];
+            }
+            check("nv12 layout", interleaved);
+            for (auto level : levels)
+            {
+                check("nv12", ConvertToNV12(view, level) == expected);
+                std::vector<uint8_t> levelI420(i420.size());
+                ConvertBgraToI420(view, I420PlanesFor(levelI420.data(), width, height), level);
+                check("i420", levelI420 == i420);
+            }
+        }
+    }
+    run.Report("Everything", Timing::Once(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()));
+    return run.Check(success);
+}
+
+struct SyntheticHalfFrame
+{
+    std::vector<uint16_t> Halves;
+    HalfImageView View;
+    // How many pixels HdrBoostedColor (within the default tolerance) was written
+    uint64_t BoostedPixels = 0;
+};
+
+ScRgbColor const HdrBoostedColor{ 3.0f, 3.0f, 0.0f };
+
+// Re-rolled while it lands near HdrBoostedColor, so that every match counted
+// by the analysis is one of the pixels written as the boosted color
+ScRgbColor RandomHdrSpeckle(uint32_t& seed)
+{
+    auto margin = HdrAnalysisOptions{}.Tolerance * 2.0f;
+    while (true)
+    {
+        ScRgbColor color{ ((seed >> 8) & 0xff) / 10.0f, ((seed >> 16) & 0xff) / 40.0f, (seed & 0xff) / 1000.0f };
+        if (std::abs(color.R - HdrBoostedColor.R) > margin ||
+            std::abs(color.G - HdrBoostedColor.G) > margin ||
+            std::abs(color.B - HdrBoostedColor.B) > margin)
+        {
+            return color;
+        }
+        seed = (seed * 1664525u) + 1013904223u;
+    }
+}
+
+// Mostly the HDR test's boosted yellow, with an SDR gradient down the left
+// and random HDR speckles, in rows padded like a mapped texture's
+SyntheticHalfFrame CreateHdrFrame(uint32_t width, uint32_t height, uint32_t seed)
+{
+    SyntheticHalfFrame frame;
+    auto rowPitch = (width + 8) * HalfImageView::BytesPerPixel;
+    frame.Halves.resize((static_cast<size_t>(rowPitch) / sizeof(uint16_t)) * height);
+    auto gradientWidth = std::max(width / 8, 1u);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto row = frame.Halves.data() + ((static_cast<size_t>(rowPitch) / sizeof(uint16_t)) * y);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            seed = (seed * 1664525u) + 1013904223u;
+            auto color = HdrBoostedColor;
+            if (x < gradientWidth)
+            {
+                auto value = static_cast<float>(x) / gradientWidth;
+                color = ScRgbColor{ value, value, value };
+            }
+            else if ((seed >> 24) < 16)
+            {
+                color = RandomHdrSpeckle(seed);
+            }
+            else
+            {
+                frame.BoostedPixels++;
+            }
+            auto pixel = row + (static_cast<size_t>(x) * HalfImageView::ChannelsPerPixel);
+            pixel[0] = FloatToHalf(color.R);
+            pixel[1] = FloatToHalf(color.G);
+            pixel[2] = FloatToHalf(color.B);
+            pixel[3] = FloatToHalf(1.0f);
+        }
+    }
+    frame.View = HalfImageView{ reinterpret_cast<uint8_t const*>(frame.Halves.data()), width, height, rowPitch };
+    return frame;
+}
+
+bool SameHdrStats(HdrFrameStats const& stats, HdrFrameStats const& expected)
+{
+    // Only the sums can differ between levels, in the last few bits
+    auto close = [](double value, double expected) { return std::abs(value - expected) <= std::abs(expected) * 1e-4; };
+    return stats.PixelCount == expected.PixelCount &&
+        stats.Max.R == expected.Max.R && stats.Max.G == expected.Max.G && stats.Max.B == expected.Max.B &&
+        stats.MaxLuminance == expected.MaxLuminance &&
+        close(stats.Mean.R, expected.Mean.R) && close(stats.Mean.G, expected.Mean.G) && close(stats.Mean.B, expected.Mean.B) &&
+        close(stats.MeanLuminance, expected.MeanLuminance) &&
+        stats.MatchingPixels == expected.MatchingPixels &&
+        stats.Histogram.Counts == expected.Histogram.Counts;
+}
+
+bool BenchmarkHdrAnalysis(BenchRun& run, FrameSize const& size)
+{
+    auto width = size.Width;
+    auto height = size.Height;
+    run.BeginGroup("hdr", size, std::string("best: ") + SimdLevelName(DetectSimdLevel()) + (CpuSupportsF16C() ? " with F16C" : ""));
+    auto frame = CreateHdrFrame(width, height, 2024);
+    auto halfBytes = static_cast<uint64_t>(width) * height * HalfImageView::BytesPerPixel;
+    auto success = true;
+
+    // Every half, at every level
+    std::vector<uint16_t> allHalves(1 << 16);
+    for (uint32_t i = 0; i < allHalves.size(); i++)
+    {
+        allHalves[i] = static_cast<uint16_t>(i);
+    }
+    std::vector<float> expectedFloats(allHalves.size());
+    ConvertHalfToFloat(allHalves.data(), expectedFloats.data(), allHalves.size(), SimdLevel::Scalar);
+    std::vector<float> floats(allHalves.size());
+    for (auto level : SupportedSimdLevels())
+    {
+        ConvertHalfToFloat(allHalves.data(), floats.data(), allHalves.size(), level);
+        success &= std::memcmp(floats.data(), expectedFloats.data(), floats.size() * sizeof(float)) == 0;
+    }
+
+    // The conversion by itself, a frame at a time
+    auto frameHalves = static_cast<size_t>(frame.View.RowPitch / sizeof(uint16_t)) * height;
+    floats.resize(frameHalves);
+    for (auto level : SupportedSimdLevels())
+    {
+        auto time = run.Measure([&]() { ConvertHalfToFloat(frame.Halves.data(), floats.data(), frameHalves, level); });
+        run.Report(std::string("to float ") + SimdLevelName(level), time, halfBytes);
+    }
+
+    HdrAnalysisOptions options;
+    options.Expected = HdrBoostedColor;
+    auto expected = AnalyzeHdrFrame(frame.View, options, SimdLevel::Scalar);
+    success &= expected.MatchingPixels == frame.BoostedPixels;
+    success &= expected.Max.R == 25.5f && expected.MaxLuminance > 3.0f;
+    for (auto level : SupportedSimdLevels())
+    {
+        HdrFrameStats stats;
+        auto time = run.Measure([&]() { stats = AnalyzeHdrFrame(frame.View, options, level); });
+        run.Report(std::string("analyze ") + SimdLevelName(level), time, halfBytes);
+        success &= SameHdrStats(stats, expected);
+        // Odd sizes and offsets go through the edge handling
+        for (auto rect : { PixelRect{ 1, 1, 37, 19 }, PixelRect{ 5, 2, 1, 1 }, PixelRect{ 0, 3, 3, 2 } })
+        {
+            auto view = frame.View.SubView(rect);
+            success &= SameHdrStats(AnalyzeHdrFrame(view, options, level), AnalyzeHdrFrame(view, options, SimdLevel::Scalar));
+        }
+    }
+    HdrFrameStats stats;
+    auto time = run.Measure([&]() { stats = AnalyzeHdrFrameParallel(frame.View, options); });
+    run.Report("analyze Parallel", time, halfBytes).Metrics.emplace_back("matching_percent", stats.MatchingPercent);
+    success &= SameHdrStats(stats, expected);
+    return run.Check(success);
+}
+
+// Reads the planes back out of an EXR from EncodeExr and compares them to the
+// frame it was made from
+bool ExrMatchesFrame(std::vector<uint8_t> const& exr, HalfImageView const& image)
+{
+    auto header = exr::Header(image.Width, image.Height);
+    if (exr.size() < header.size() || std::memcmp(exr.data(), header.data(), header.size()) != 0)
+    {
+        return false;
+    }
+    auto planeSize = static_cast<size_t>(image.Width) * sizeof(uint16_t);
+    for (uint32_t y = 0; y < image.Height; y++)
+    {
+        uint64_t offset = 0;
+        std::memcpy(&offset, exr.data() + header.size() + (static_cast<size_t>(y) * sizeof(offset)), sizeof(offset));
+        int32_t chunkY = 0;
+        int32_t dataSize = 0;
+        if (offset + 8 + (planeSize * 4) > exr.size())
+        {
+            return false;
+        }
+        std::memcpy(&chunkY, exr.data() + offset, sizeof(chunkY));
+        std::memcpy(&dataSize, exr.data() + offset + 4, sizeof(dataSize));
+        if (chunkY != static_cast<int32_t>(y) || static_cast<size_t>(dataSize) != planeSize * 4)
+        {
+            return false;
+        }
+        auto row = image.Row(y);
+        for (uint32_t x = 0; x < image.Width; x++)
+        {
+            // Planes are A, B, G, R
+            for (uint32_t plane = 0; plane < 4; plane++)
+            {
+                uint16_t half = 0;
+                std::memcpy(&half, exr.data() + offset + 8 + (planeSize * plane) + (x * sizeof(uint16_t)), sizeof(half));
+                if (half != row[(x * 4) + (3 - plane)])
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return exr.size() == header.size() + (static_cast<size_t>(image.Height) * (sizeof(uint64_t) + 8 + (planeSize * 4)));
+}
+
+bool BenchmarkHdrSave(BenchRun& run, FrameSize const& size)
+{
+    auto width = size.Width;
+    auto height = size.Height;
+    run.BeginGroup("hdr-save", size, std::string("best: ") + SimdLevelName(DetectSimdLevel()));
+    auto frame = CreateHdrFrame(width, height, 99);
+    auto halfBytes = static_cast<uint64_t>(width) * height * HalfImageView::BytesPerPixel;
+    auto success = true;
+
+    // Into a buffer that's already been written to, like the artifact
+    // writer's pooled one. A fresh 66MB vector costs more to fault in and
+    // zero than packing it does.
+    ExrOptions serial;
+    serial.Parallel = false;
+    std::vector<uint8_t> exrBuffer(ExrEncodedSize(width, height));
+    for (auto level : SupportedSimdLevels())
+    {
+        auto time = run.Measure([&]() { EncodeExr(frame.View, exrBuffer.data(), serial, level); });
+        run.Report(std::string("exr ") + SimdLevelName(level), time, halfBytes);
+        success &= ExrMatchesFrame(exrBuffer, frame.View);
+        // Every tail length
+        for (uint32_t edgeWidth = 1; edgeWidth <= 17; edgeWidth++)
+        {
+            auto view = frame.View.SubView(PixelRect{ 3, 1, edgeWidth, 2 });
+            success &= ExrMatchesFrame(EncodeExr(view, serial, level), view);
+        }
+    }
+    auto time = run.Measure([&]() { EncodeExr(frame.View, exrBuffer.data()); });
+    run.Report("exr Parallel", time, halfBytes).Metrics.emplace_back("size_mb", exrBuffer.size() / 1e6);
+    success &= ExrMatchesFrame(exrBuffer, frame.View);
+    std::vector<uint8_t> exr;
+    time = run.Measure([&]() { exr = EncodeExr(frame.View); });
+    run.Report("exr Parallel new vector", time, halfBytes);
+    success &= exr == exrBuffer;
+
+    auto previewPitch = width * BgraImageView::BytesPerPixel;
+    std::vector<uint8_t> preview(static_cast<size_t>(previewPitch) * height);
+    std::vector<uint8_t> parallelPreview(preview.size());
+    for (auto op : { ToneMapOperator::Reinhard, ToneMapOperator::Pq })
+    {
+        ToneMapOptions options;
+        options.Operator = op;
+        std::optional<ToneMapTable> table;
+        time = run.MeasureOnce([&]() { table.emplace(options); });
+        run.Report(std::string(ToneMapOperatorName(op)) + " table", time);
+        time = run.Measure([&]() { ToneMapToBgra(frame.View, preview.data(), previewPitch, *table); });
+        run.Report(ToneMapOperatorName(op), time, halfBytes);
+        time = run.Measure([&]() { ToneMapToBgraParallel(frame.View, parallelPreview.data(), previewPitch, *table); });
+        run.Report(std::string(ToneMapOperatorName(op)) + " Parallel", time, halfBytes);
+        success &= parallelPreview == preview;
+
+        // Black stays black, the white point and above are white, and the
+        // curve never goes down
+        success &= (*table)[FloatToHalf(0.0f)] == 0 && (*table)[FloatToHalf(-1.0f)] == 0 && (*table)[0x7e00] == 0;
+        success &= (*table)[FloatToHalf(options.WhitePoint)] == 255 && (*table)[0x7c00] == 255;
+        for (uint16_t half = 1; half < 0x7c00; half++)
+        {
+            success &= (*table)[half] >= (*table)[half - 1];
+        }
+        // The boosted yellow is brighter than SDR white, and in the preview
+        success &= (*table)[FloatToHalf(3.0f)] > (*table)[FloatToHalf(1.0f)];
+        auto pixel = preview.data() + (static_cast<size_t>(width - 1) * 4);
+        success &= pixel[0] == 0 && pixel[1] == (*table)[FloatToHalf(3.0f)] && pixel[2] == pixel[1] && pixel[3] == 255;
+    }
+
+    // A failure dump through the artifact writer, from queueing a copy of the
+    // frame to both files being written
+    auto directory = std::filesystem::temp_directory_path() / "CaptureAdHocBench";
+    std::filesystem::create_directories(directory);
+    {
+        ArtifactWriter writer(1, 2, QueueFullPolicy::Block);
+        time = run.Measure([&]()
+        {
+            auto artifact = ImageArtifact::Copy(directory / "dump.exr", frame.View);
+            artifact.PreviewPath = directory / "dump.png";
+            writer.Enqueue(std::move(artifact));
+            writer.Flush();
+        });
+        run.Report("Failure dump", time, halfBytes);
+        // The PNG preview is most of that, unless there are cores to spread it over
+        time = run.Measure([&]()
+        {
+            writer.Enqueue(ImageArtifact::Copy(directory / "dump.exr", frame.View));
+            writer.Flush();
+        });
+        run.Report("Failure dump without preview", time, halfBytes);
+        auto stats = writer.Stats();
+        success &= stats.Failed == 0 && stats.Written == stats.Queued;
+        std::vector<uint8_t> written(std::filesystem::file_size(directory / "dump.exr"));
+        std::ifstream file(directory / "dump.exr", std::ios::binary);
+        file.read(reinterpret_cast<char*>(written.data()), static_cast<std::streamsize>(written.size()));
+        success &= written == exr && std::filesystem::file_size(directory / "dump.png") > 0;
+    }
+    std::filesystem::remove_all(directory);
+    return run.Check(success);
+}
+
+// Coverage of an ellipse counted on a grid of samples, which is a different
+// anti-aliasing than the reference rasterizer's
+float SupersampledEllipseCoverage(ReferenceEllipse const& ellipse, uint32_t x, uint32_t y)
+{
+    constexpr int Samples = 8;
+    int inside = 0;
+    for (int sy = 0; sy < Samples; sy++)
+    {
+        for (int sx = 0; sx < Samples; sx++)
+        {
+            auto dx = (x + ((sx + 0.5) / Samples) - ellipse.CenterX) / ellipse.RadiusX;
+            auto dy = (y + ((sy + 0.5) / Samples) - ellipse.CenterY) / ellipse.RadiusY;
+            inside += ((dx * dx) + (dy * dy)) <= 1.0 ? 1 : 0;
+        }
+    }
+    return static_cast<float>(inside) / (Samples * Samples);
+}
+
+bool BenchmarkReferenceRasterizer(BenchRun& run, FrameSize const& size)
+{
+    auto width = size.Width;
+    auto height = size.Height;
+    run.BeginGroup("reference", size, std::string("best: ") + SimdLevelName(DetectSimdLevel()));
+    auto success = true;
+
+    // The transparency test's scene, scaled up to the whole frame, over a
+    // translucent rect that isn't on pixel boundaries
+    auto transparentBlack = BgraColor{ 0, 0, 0, 0 };
+    auto red = BgraColor{ 0, 0, 255, 255 };
+    auto translucentBlue = BgraColor{ 128, 0, 0, 128 };
+    auto ellipse = ReferenceEllipse{ width / 2.0f, height / 2.0f, width / 2.0f, height / 2.0f };
+    auto rect = ReferenceRect{ width / 8.0f + 0.25f, height / 8.0f + 0.5f, width / 3.0f, height / 3.0f };
+    std::optional<ReferenceRasterizer> reference;
+    auto time = run.Measure([&]()
+    {
+        reference.emplace(width, height, transparentBlack);
+        reference->FillRect(rect, translucentBlue);
+        reference->FillEllipse(ellipse, red);
+    });
+    run.Report("Allocate and generate", time, size.PixelBytes());
+    time = run.Measure([&]()
+    {
+        reference->Clear(transparentBlack);
+        reference->FillRect(rect, translucentBlue);
+        reference->FillEllipse(ellipse, red);
+    });
+    run.Report("Generate", time, size.PixelBytes()).Metrics.emplace_back("fringe_pixels", static_cast<double>(reference->FringePixels()));
+
+    // Every pixel of the ellipse by itself against the rule it's drawn with
+    ReferenceRasterizer ellipseOnly(width, height, transparentBlack);
+    ellipseOnly.FillEllipse(ellipse, red);
+    auto band = static_cast<double>(ellipseOnly.EdgeBand());
+    auto rasterCorrect = true;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+        {
+            auto distance = referenceraster::EllipseSignedDistance((x + 0.5) - ellipse.CenterX, (y + 0.5) - ellipse.CenterY, ellipse.RadiusX, ellipse.RadiusY);
+            auto expected = distance <= -band ? red : transparentBlack;
+            auto low = expected;
+            auto high = expected;
+            if (distance > -band && distance < band)
+            {
+                referenceraster::Blender blender(red, referenceraster::CoverageFromDistance(distance));
+                expected = BgraColor{ blender.Blend(0, 0), blender.Blend(0, 1), blender.Blend(0, 2), blender.Blend(0, 3) };
+                high = red;
+            }
+            auto offset = static_cast<size_t>(x) * 4;
+            rasterCorrect &= std::memcmp(ellipseOnly.View().Row(y) + offset, &expected, 4) == 0;
+            rasterCorrect &= std::memcmp(ellipseOnly.LowView().Row(y) + offset, &low, 4) == 0;
+            rasterCorrect &= std::memcmp(ellipseOnly.HighView().Row(y) + offset, &high, 4) == 0;
+        }
+    }
+    success &= rasterCorrect;
+
+    // The expected image and both bounds pass, at every level
+    auto expected = reference->View();
+    for (auto level : SupportedSimdLevels())
+    {
+        RegionVerifyResult result;
+        time = run.Measure([&]() { result = CompareToReference(expected, *reference, {}, level); });
+        run.Report(std::string("Compare ") + SimdLevelName(level), time, size.PixelBytes());
+        success &= result.Passed() && result.PixelCount == static_cast<uint64_t>(width) * height;
+        success &= CompareToReference(reference->LowView(), *reference, {}, level).Passed();
+        success &= CompareToReference(reference->HighView(), *reference, {}, level).Passed();
+    }
+    RegionVerifyResult result;
+    time = run.Measure([&]() { result = CompareToReferenceParallel(expected, *reference); });
+    run.Report("Compare Parallel", time, size.PixelBytes());
+    success &= result.Passed();
+
+    // A capture with different anti-aliasing passes, and one bad interior
+    // pixel (and one in the last column, in the tail) is all that fails
+    auto captured = CreateSolidFrame(width + 3, height, transparentBlack);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto row = captured.Bytes.data() + (static_cast<size_t>(captured.View.RowPitch) * y);
+        std::memcpy(row, expected.Row(y), static_cast<size_t>(width) * 4);
+    }
+    ReferenceRasterizer supersampled(width, height, transparentBlack);
+    supersampled.FillEllipse(ellipse, red);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto row = captured.Bytes.data() + (static_cast<size_t>(captured.View.RowPitch) * y);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            auto offset = static_cast<size_t>(x) * 4;
+            if (std::memcmp(supersampled.LowView().Row(y) + offset, supersampled.HighView().Row(y) + offset, 4) != 0 &&
+                std::memcmp(reference->LowView().Row(y) + offset, supersampled.LowView().Row(y) + offset, 4) == 0)
+            {
+                referenceraster::Blender blender(red, SupersampledEllipseCoverage(ellipse, x, y));
+                for (int c = 0; c < 4; c++)
+                {
+                    row[offset + c] = blender.Blend(0, c);
+                }
+            }
+        }
+    }
+    for (auto level : SupportedSimdLevels())
+    {
+        success &= CompareToReference(captured.View, *reference, {}, level).Passed();
+    }
+    auto badX = width / 2;
+    auto badY = height / 2;
+    captured.Bytes[(static_cast<size_t>(captured.View.RowPitch) * badY) + (badX * 4) + 1] = 1;
+    captured.Bytes[(static_cast<size_t>(captured.View.RowPitch) * (height - 1)) + ((width - 1) * 4) + 3] = 200;
+    for (auto level : SupportedSimdLevels())
+    {
+        result = CompareToReference(captured.View, *reference, {}, level);
+        success &= result.MismatchCount == 2 && result.FirstMismatchX == badX && result.FirstMismatchY == badY;
+        success &= result.MismatchBounds.X == badX && result.MismatchBounds.Right() == width && result.MismatchBounds.Bottom() == height;
+        // Within tolerance, the green one passes
+        success &= CompareToReference(captured.View, *reference, BgraColor{ 0, 1, 0, 0 }, level).MismatchCount == 1;
+    }
+    result = CompareToReferenceParallel(captured.View, *reference, {});
+    success &= result.MismatchCount == 2 && result.FirstMismatchX == badX && result.FirstMismatchY == badY;
+    return run.Check(success);
+}
+
+// A capture against its golden: passing should cost little more than hashing
+// the frame, and only the tiles that actually changed get decoded.
+bool BenchmarkGolden(BenchRun& run, FrameSize const& size)
+{
+    auto width = size.Width;
+    auto height = size.Height;
+    run.BeginGroup("golden", size, std::string("best: ") + SimdLevelName(DetectSimdLevel()));
+    auto directory = std::filesystem::temp_directory_path() / "CaptureAdHocBench";
+    auto success = true;
+
+    auto frame = CreateDesktopLikeFrame(width, height);
+    std::vector<uint8_t> encoded;
+    auto time = run.Measure([&]() { encoded = EncodeGolden(frame.View, 96); });
+    run.Report("Encode", time, size.PixelBytes()).Metrics.emplace_back("compressed_percent", (100.0 * encoded.size()) / size.PixelBytes());
+
+    auto store = GoldenStore(directory);
+    auto key = GoldenKey{ "bench", width, height, 96 };
+    store.Bless(key, frame.View);
+    std::optional<GoldenImage> golden;
+    time = run.Measure([&]() { golden = store.Load(key); });
+    run.Report("Load", time);
+    success &= golden.has_value() && golden->FileSize() == encoded.size();
+    if (!golden)
+    {
+        return run.Check(false);
+    }
+
+    // The golden decodes back to the frame, and so do incompressible tiles,
+    // which are stored raw
+    std::vector<uint8_t> decoded;
+    time = run.Measure([&]() { decoded = golden->Decode(); });
+    run.Report("Decode all", time, size.PixelBytes());
+    success &= DiffImages(frame.View, BgraImageView{ decoded.data(), width, height, width * 4 }).WithinThreshold();
+    auto noise = CreateNoiseFrame(width, height, 7);
+    auto noiseEncoded = EncodeGolden(noise.View, 96);
+    auto noiseGolden = GoldenImage(noiseEncoded.data(), noiseEncoded.size());
+    auto noiseDecoded = noiseGolden.Decode();
+    success &= DiffImages(noise.View, BgraImageView{ noiseDecoded.data(), width, height, width * 4 }).WithinThreshold();
+    success &= noiseEncoded.size() < size.PixelBytes() + (size.PixelBytes() / 16);
+
+    // What comparing costs without the tile hashes
+    ImageDiffResult fullDiff;
+    time = run.Measure([&]() { fullDiff = DiffImages(frame.View, BgraImageView{ golden->Decode().data(), width, height, width * 4 }); });
+    run.Report("Decode and diff", time, size.PixelBytes());
+
+    for (auto level : SupportedSimdLevels())
+    {
+        GoldenCompareResult result;
+        time = run.Measure([&]() { result = CompareToGolden(frame.View, *golden, { {}, false }, level); });
+        run.Report(std::string("Pass ") + SimdLevelName(level), time, size.PixelBytes());
+        success &= result.Passed() && result.ChangedTiles == 0 && result.TileCount == golden->TileCount();
+    }
+    GoldenCompareResult result;
+    time = run.Measure([&]() { result = CompareToGolden(frame.View, *golden); });
+    run.Report("Pass Parallel", time, size.PixelBytes());
+    success &= result.Passed() && result.ChangedTiles == 0;
+
+    // Three changed tiles: one only within the tolerance, and two with a
+    // pixel over it, one of them in the cut short bottom right tile
+    auto changed = CreateDesktopLikeFrame(width, height);
+    auto touch = [&](uint32_t x, uint32_t y, uint8_t delta)
+    {
+        auto pixel = changed.Bytes.data() + (static_cast<size_t>(changed.View.RowPitch) * y) + (static_cast<size_t>(x) * 4);
+        pixel[1] = static_cast<uint8_t>(pixel[1] ^ delta);
+    };
+    touch(5, 5, 1);
+    touch(width / 2, height / 2, 0x40);
+    touch(width - 1, height - 1, 0x40);
+    auto tolerance = BgraColor{ 1, 1, 1, 1 };
+    time = run.Measure([&]() { result = CompareToGolden(changed.View, *golden, { tolerance }); });
+    auto& report = run.Report("Changed Parallel", time, size.PixelBytes());
+    report.Metrics.emplace_back("changed_tiles", static_cast<double>(result.ChangedTiles));
+    report.Metrics.emplace_back("failed_tiles", static_cast<double>(result.FailedTiles.size()));
+    success &= !result.Passed() && result.ChangedTiles == 3 && result.FailedTiles.size() == 2 && result.DifferingPixels == 2;
+    success &= result.MaxError.G == 0x40 && result.MaxError.B == 0;
+    success &= !result.FailedTiles.empty() && result.FailedTiles.back().Right() == width && result.FailedTiles.back().Bottom() == height;
+    success &= CompareToGolden(changed.View, *golden, { { 0x40, 0x40, 0x40, 0x40 } }).Passed();
+
+    // A frame of the wrong size, and files that aren't whole goldens, fail
+    auto smaller = frame.View.SubView(PixelRect{ 0, 0, width - 1, height });
+    success &= !CompareToGolden(smaller, *golden).SizeMatches;
+    auto rejects = [](std::vector<uint8_t> const& bytes)
+    {
+        try
+        {
+            GoldenImage(bytes.data(), bytes.size()).Decode();
+            return false;
+        }
+        catch (std::runtime_error const&)
+        {
+            return true;
+        }
+    };
+    success &= rejects(std::vector<uint8_t>(encoded.begin(), encoded.begin() + (encoded.size() / 2)));
+    auto badMagic = encoded;
+    badMagic[0] = 'X';
+    success &= rejects(badMagic);
+    auto badTile = encoded;
+    auto firstTile = sizeof(golden::FileHeader) + (static_cast<size_t>(golden->TileCount()) * sizeof(golden::TileEntry));
+    badTile[firstTile] = 0x7f;
+    success &= rejects(badTile);
+
+    golden.reset();
+    std::filesystem::remove_all(directory);
+    return run.Check(success);
+}
+
+// A small inflater and PNG reader, just enough to check that what the
+// encoder writes decodes back to the pixels it was given without zlib.
+// Throws runtime_error on anything it doesn't understand or that's corrupt.
+class BenchInflater
+{
+public:
+    BenchInflater(uint8_t const* data, size_t size) : m_data(data), m_size(size) {}
+
+    std::vector<uint8_t> InflateZlib()
+    {
+        if (m_size < 6 || (m_data[0] & 0x0F) != 8 || ((m_data[0] << 8) | m_data[1]) % 31 != 0)
+        {
+            throw std::runtime_error("Bad zlib header");
+        }
+        m_position = 2;
+        std::vector<uint8_t> out;
+        auto final = false;
+        while (!final)
+        {
+            final = Bits(1) != 0;
+            auto type = Bits(2);
+            if (type == 0)
+            {
+                m_bitCount = 0;
+                m_bits = 0;
+                if (m_position + 4 > m_size)
+                {
+                    throw std::runtime_error("Truncated stored block");
+                }
+                auto length = m_data[m_position] | (m_data[m_position + 1] << 8);
+                auto complement = m_data[m_position + 2] | (m_data[m_position + 3] << 8);
+                m_position += 4;
+                if ((length ^ 0xFFFF) != complement || m_position + length > m_size)
+                {
+                    throw std::runtime_error("Bad stored block");
+                }
+                out.insert(out.end(), m_data + m_position, m_data + m_position + length);
+                m_position += length;
+            }
+            else if (type == 1)
+            {
+                std::vector<uint8_t> lengths(288 + 32);
+                std::fill(lengths.begin(), lengths.begin() + 144, 8);
+                std::fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+                std::fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+                std::fill(lengths.begin() + 280, lengths.begin() + 288, 8);
+                std::fill(lengths.begin() + 288, lengths.end(), 5);
+                InflateBlock(Huffman(lengths.data(), 288), Huffman(lengths.data() + 288, 32), out);
+            }
+            else if (type == 2)
+            {
+                auto literalCount = Bits(5) + 257;
+                auto distanceCount = Bits(5) + 1;
+                auto codeLengthCount = Bits(4) + 4;
+                static uint8_t const order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+                uint8_t codeLengthLengths[19] = {};
+                for (uint32_t i = 0; i < codeLengthCount; i++)
+                {
+                    codeLengthLengths[order[i]] = static_cast<uint8_t>(Bits(3));
+                }
+                Huffman codeLengths(codeLengthLengths, 19);
+                std::vector<uint8_t> lengths;
+                while (lengths.size() < literalCount + distanceCount)
+                {
+                    auto symbol = Decode(codeLengths);
+                    if (symbol < 16)
+                    {
+                        lengths.push_back(static_cast<uint8_t>(symbol));
+                    }
+                    else if (symbol == 16)
+                    {
+                        if (lengths.empty())
+                        {
+                            throw std::runtime_error("Repeat with nothing to repeat");
+                        }
+                        lengths.insert(lengths.end(), 3 + Bits(2), lengths.back());
+                    }
+                    else
+                    {
+                        lengths.insert(lengths.end(), symbol == 17 ? 3 + Bits(3) : 11 + Bits(7), 0);
+                    }
+                }
+                if (lengths.size() != literalCount + distanceCount)
+                {
+                    throw std::runtime_error("Code lengths overrun");
+                }
+                InflateBlock(Huffman(lengths.data(), literalCount), Huffman(lengths.data() + literalCount, distanceCount), out);
+            }
+            else
+            {
+                throw std::runtime_error("Bad block type");
+            }
+        }
+
+        m_bitCount = 0;
+        if (m_position + 4 > m_size)
+        {
+            throw std::runtime_error("Missing Adler-32");
+        }
+        auto adler = (static_cast<uint32_t>(m_data[m_position]) << 24) | (m_data[m_position + 1] << 16) | (m_data[m_position + 2] << 8) | m_data[m_position + 3];
+        if (adler != png::Adler32(out.data(), out.size()))
+        {
+            throw std::runtime_error("Adler-32 mismatch");
+        }
+        return out;
+    }
+
+private:
+    // Canonical codes, decoded a bit at a time
+    struct Huffman
+    {
+        Huffman(uint8_t const* lengths, uint32_t count)
+        {
+            for (uint32_t symbol = 0; symbol < count; symbol++)
+            {
+                Counts[lengths[symbol]]++;
+            }
+            Counts[0] = 0;
+            uint32_t offsets[16] = {};
+            for (uint32_t length = 1; length < 16; length++)
+            {
+                offsets[length] = offsets[length - 1] + Counts[length - 1];
+            }
+            Symbols.resize(count);
+            for (uint32_t symbol = 0; symbol < count; symbol++)
+            {
+                if (lengths[symbol] != 0)
+                {
+                    Symbols[offsets[lengths[symbol]]++] = static_cast<uint16_t>(symbol);
+                }
+            }
+        }
+
+        uint16_t Counts[16] = {};
+        std::vector<uint16_t> Symbols;
+    };
+
+    uint32_t Bits(uint32_t count)
+    {
+        while (m_bitCount < count)
+        {
+            if (m_position >= m_size)
+            {
+                throw std::runtime_error("Truncated stream");
+            }
+            m_bits |= static_cast<uint32_t>(m_data[m_position++]) << m_bitCount;
+            m_bitCount += 8;
+        }
+        auto value = m_bits & ((1u << count) - 1);
+        m_bits >>= count;
+        m_bitCount -= count;
+        return value;
+    }
+
+    uint32_t Decode(Huffman const& huffman)
+    {
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (uint32_t length = 1; length < 16; length++)
+        {
+            code |= static_cast<int>(Bits(1));
+            auto count = huffman.Counts[length];
+            if (code - count < first)
+            {
+                return huffman.Symbols[index + (code - first)];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        throw std::runtime_error("Bad Huffman code");
+    }
+
+    void InflateBlock(Huffman const& literals, Huffman const& distances, std::vector<uint8_t>& out)
+    {
+        static uint16_t const lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static uint8_t const lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static uint16_t const distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        static uint8_t const distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+        while (true)
+        {
+            auto symbol = Decode(literals);
+            if (symbol < 256)
+            {
+                out.push_back(static_cast<uint8_t>(symbol));
+                continue;
+            }
+            if (symbol == 256)
+            {
+                return;
+            }
+            symbol -= 257;
+            if (symbol >= 29)
+            {
+                throw std::runtime_error("Bad length symbol");
+            }
+            auto length = lengthBase[symbol] + Bits(lengthExtra[symbol]);
+            auto distanceSymbol = Decode(distances);
+            if (distanceSymbol >= 30)
+            {
+                throw std::runtime_error("Bad distance symbol");
+            }
+            auto distance = distanceBase[distanceSymbol] + Bits(distanceExtra[distanceSymbol]);
+            if (distance > out.size())
+            {
+                throw std::runtime_error("Distance before the start");
+            }
+            auto from = out.size() - distance;
+            for (uint32_t i = 0; i < length; i++)
+            {
+                out.push_back(out[from + i]);
+            }
+        }
+    }
+
+private:
+    uint8_t const* m_data;
+    size_t m_size;
+    size_t m_position = 0;
+    uint32_t m_bits = 0;
+    uint32_t m_bitCount = 0;
+};
+
+struct DecodedPng
+{
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t BytesPerPixel = 0;
+    // Tightly packed RGBA or gray samples
+    std::vector<uint8_t> Samples;
+};
+
+// 8-bit RGBA and gray only, which is all the encoder writes
+DecodedPng DecodeBenchPng(std::vector<uint8_t> const& png)
+{
+    if (png.size() < 8 || std::memcmp(png.data(), "\x89PNG\r\n\x1a\n", 8) != 0)
+    {
+        throw std::runtime_error("Not a PNG");
+    }
+    auto readBigEndian = [&png](size_t offset)
+    {
+        return (static_cast<uint32_t>(png[offset]) << 24) | (png[offset + 1] << 16) | (png[offset + 2] << 8) | png[offset + 3];
+    };
+    DecodedPng decoded;
+    std::vector<uint8_t> stream;
+    size_t offset = 8;
+    auto ended = false;
+    while (!ended)
+    {
+        if (offset + 12 > png.size())
+        {
+            throw std::runtime_error("Truncated chunk");
+        }
+        auto length = readBigEndian(offset);
+        if (offset + 12 + length > png.size())
+        {
+            throw std::runtime_error("Truncated chunk");
+        }
+        auto type = png.data() + offset + 4;
+        auto data = type + 4;
+        if (png::Crc32(type, length + 4) != readBigEndian(offset + 8 + length))
+        {
+            throw std::runtime_error("Chunk CRC mismatch");
+        }
+        if (std::memcmp(type, "IHDR", 4) == 0)
+        {
+            decoded.Width = readBigEndian(offset + 8);
+            decoded.Height = readBigEndian(offset + 12);
+            if (data[8] != 8 || (data[9] != 6 && data[9] != 0) || data[10] != 0 || data[11] != 0 || data[12] != 0)
+            {
+                throw std::runtime_error("Unsupported PNG format");
+            }
+            decoded.BytesPerPixel = data[9] == 6 ? 4 : 1;
+        }
+        else if (std::memcmp(type, "IDAT", 4) == 0)
+        {
+            stream.insert(stream.end(), data, data + length);
+        }
+        ended = std::memcmp(type, "IEND", 4) == 0;
+        offset += 12 + length;
+    }
+
+    auto filtered = BenchInflater(stream.data(), stream.size()).InflateZlib();
+    auto rowSize = static_cast<size_t>(decoded.Width) * decoded.BytesPerPixel;
+    if (decoded.BytesPerPixel == 0 || filtered.size() != (rowSize + 1) * decoded.Height)
+    {
+        throw std::runtime_error("Wrong amount of image data");
+    }
+    decoded.Samples.resize(rowSize * decoded.Height);
+    std::vector<uint8_t> zero(rowSize);
+    auto bpp = decoded.BytesPerPixel;
+    for (uint32_t y = 0; y < decoded.Height; y++)
+    {
+        auto in = filtered.data() + ((rowSize + 1) * y);
+        auto row = decoded.Samples.data() + (rowSize * y);
+        auto prior = y > 0 ? row - rowSize : zero.data();
+        for (size_t i = 0; i < rowSize; i++)
+        {
+            int left = i >= bpp ? row[i - bpp] : 0;
+            int up = prior[i];
+            int upLeft = i >= bpp ? prior[i - bpp] : 0;
+            int predictor = 0;
+            switch (in[0])
+            {
+            case 0: predictor = 0; break;
+            case 1: predictor = left; break;
+            case 2: predictor = up; break;
+            case 3: predictor = (left + up) / 2; break;
+            case 4:
+            {
+                auto estimate = left + up - upLeft;
+                auto distanceLeft = std::abs(estimate - left);
+                auto distanceUp = std::abs(estimate - up);
+                auto distanceUpLeft = std::abs(estimate - upLeft);
+                predictor = distanceLeft <= distanceUp && distanceLeft <= distanceUpLeft ? left : distanceUp <= distanceUpLeft ? up : upLeft;
+                break;
+            }
+            default:
+                throw std::runtime_error("Bad filter type");
+            }
+            row[i] = static_cast<uint8_t>(in[i + 1] + predictor);
+        }
+    }
+    return decoded;
+}
+
+// Whether png decodes to image, swizzled to RGBA and unpremultiplied if asked
+bool PngMatchesImage(std::vector<uint8_t> const& png, BgraImageView const& image, bool premultiplied = false)
+{
+    DecodedPng decoded;
+    try
+    {
+        decoded = DecodeBenchPng(png);
+    }
+    catch (std::runtime_error const& error)
+    {
+        printf("  PNG didn't decode: %s\n", error.what());
+        return false;
+    }
+    if (decoded.Width != image.Width || decoded.Height != image.Height || decoded.BytesPerPixel != 4)
+    {
+        return false;
+    }
+    std::vector<uint8_t> expected(static_cast<size_t>(image.Width) * 4);
+    for (uint32_t y = 0; y < image.Height; y++)
+    {
+        auto row = image.Row(y);
+        if (premultiplied)
+        {
+            pixelkernels::UnpremultiplyRowScalar(row, expected.data(), 0, image.Width);
+            row = expected.data();
+        }
+        pixelkernels::SwapRedBlueRowScalar(row, expected.data(), 0, image.Width);
+        if (std::memcmp(decoded.Samples.data() + (expected.size() * y), expected.data(), expected.size()) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BenchmarkPngEncode(BenchRun& run, FrameSize const& size)
+{
+    auto width = size.Width;
+    auto height = size.Height;
+    auto bytes = size.PixelBytes();
+    run.BeginGroup("png", size, std::to_string(BandPool::Shared().ThreadCount()) + " threads");
+
+    auto success = true;
+    std::vector<uint8_t> png;
+    {
+        auto video = CreateVideoLikeFrame(width, height);
+        auto time = run.Measure([&]() { png = EncodePng(video.View); });
+        run.Report("Video-like", time, bytes).Metrics.emplace_back("size_mb", png.size() / 1e6);
+        printf("  %-28s %10.2fMB\n", "Size", png.size() / 1e6);
+        success &= PngMatchesImage(png, video.View);
+    }
+
+    auto frame = CreateDesktopLikeFrame(width, height);
+    auto time = run.Measure([&]() { png = EncodePng(frame.View); });
+    run.Report("Desktop-like", time, bytes).Metrics.emplace_back("size_mb", png.size() / 1e6);
+    printf("  %-28s %10.2fMB\n", "Size", png.size() / 1e6);
+    success &= PngMatchesImage(png, frame.View);
+
+    // What the artifact writer uses for previews
+    {
+        PngOptions fast;
+        fast.Fast = true;
+        std::vector<uint8_t> fastPng;
+        time = run.Measure([&]() { fastPng = EncodePng(frame.View, fast); });
+        run.Report("Desktop-like, fast", time, bytes).Metrics.emplace_back("size_mb", fastPng.size() / 1e6);
+        printf("  %-28s %10.2fMB\n", "Size", fastPng.size() / 1e6);
+        success &= PngMatchesImage(fastPng, frame.View);
+    }
+
+    // Captured frames have premultiplied alpha, which PNG doesn't. Odd sizes
+    // and small chunks, both ways, on and off the band pool.
+    {
+        auto premultiplied = CreateSolidFrame(37, 29, BgraColor{});
+        std::mt19937 random(5);
+        for (uint32_t y = 0; y < premultiplied.View.Height; y++)
+        {
+            auto row = premultiplied.Bytes.data() + (static_cast<size_t>(premultiplied.View.RowPitch) * y);
+            for (uint32_t x = 0; x < premultiplied.View.Width; x++)
+            {
+                auto alpha = static_cast<uint8_t>(x == 0 ? 0 : random() % 256);
+                for (uint32_t c = 0; c < 3; c++)
+                {
+                    row[(x * 4) + c] = static_cast<uint8_t>(alpha == 0 ? 0 : random() % (alpha + 1u));
+                }
+                row[(x * 4) + 3] = alpha;
+            }
+        }
+        for (auto fast : { false, true })
+        {
+            PngOptions options;
+            options.Fast = fast;
+            options.RowsPerChunk = 4;
+            options.Parallel = fast;
+            success &= PngMatchesImage(EncodePng(premultiplied.View, options), premultiplied.View);
+            options.Premultiplied = true;
+            success &= PngMatchesImage(EncodePng(premultiplied.View, options), premultiplied.View, true);
+        }
+        std::vector<uint8_t> gray(31 * 7);
+        for (size_t i = 0; i < gray.size(); i++)
+        {
+            gray[i] = static_cast<uint8_t>(random());
+        }
+        auto decoded = DecodeBenchPng(EncodeGrayPng(gray.data(), 31, 7, 31));
+        success &= decoded.BytesPerPixel == 1 && decoded.Samples == gray;
+    }
+
+#if defined(CAPTURE_BENCH_WITH_ZLIB)
+    // Filter once, then time zlib on a single thread
+    auto rowSize = static_cast<size_t>(width) * 4;
+    std::vector<uint8_t> filtered((rowSize + 1) * height);
+    std::vector<uint8_t> previous(rowSize);
+    std::vector<uint8_t> current(rowSize);
+    std::vector<uint8_t> scratch;
+    auto filterTime = run.MeasureOnce([&]()
+    {
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = frame.View.Row(y);
+            for (uint32_t x = 0; x < width; x++)
+            {
+                current[(x * 4) + 0] = row[(x * 4) + 2];
+                current[(x * 4) + 1] = row[(x * 4) + 1];
+                current[(x * 4) + 2] = row[(x * 4) + 0];
+                current[(x * 4) + 3] = row[(x * 4) + 3];
+            }
+            png::FilterRow(current.data(), y > 0 ? previous.data() : nullptr, rowSize, 4, filtered.data() + ((rowSize + 1) * y), scratch);
+            std::swap(previous, current);
+        }
+    });
+    for (auto level : { 1, 6 })
+    {
+        std::vector<uint8_t> compressed(compressBound(static_cast<uLong>(filtered.size())));
+        uLongf compressedSize = 0;
+        auto zlibTime = run.MeasureOnce([&]()
+        {
+            compressedSize = static_cast<uLongf>(compressed.size());
+            compress2(compressed.data(), &compressedSize, filtered.data(), static_cast<uLong>(filtered.size()), level);
+        });
+        auto total = Timing::Once(filterTime.Median + zlibTime.Median);
+        run.Report("Desktop-like, zlib level " + std::to_string(level), total, bytes).Metrics.emplace_back("size_mb", compressedSize / 1e6);
+        printf("  %-28s %10.2fMB\n", "Size", compressedSize / 1e6);
+    }
+
+    // Our stream has to inflate back to exactly the filtered rows
+    std::vector<uint8_t> stream;
+    size_t offset = 8;
+    while (offset + 12 <= png.size())
+    {
+        auto length = (static_cast<uint32_t>(png[offset]) << 24) | (png[offset + 1] << 16) | (png[offset + 2] << 8) | png[offset + 3];
+        auto data = png.data() + offset + 8;
+        success &= png::Crc32(png.data() + offset + 4, length + 4) ==
+            ((static_cast<uint32_t>(data[length]) << 24) | (data[length + 1] << 16) | (data[length + 2] << 8) | data[length + 3]);
+        if (std::memcmp(png.data() + offset + 4, "IDAT", 4) == 0)
+        {
+            stream.insert(stream.end(), data, data + length);
+        }
+        offset += 12 + length;
+    }
+    std::vector<uint8_t> inflated(filtered.size());
+    auto inflatedSize = static_cast<uLongf>(inflated.size());
+    success &= uncompress(inflated.data(), &inflatedSize, stream.data(), static_cast<uLong>(stream.size())) == Z_OK;
+    success &= inflatedSize == filtered.size() && inflated == filtered;
+#endif
+    return run.Check(success);
+}
+
+// How long the caller is held up saving a burst of failure frames, inline
+// versus through the artifact writer.
+bool BenchmarkArtifactWriter(BenchRun& run, uint32_t width, uint32_t height, uint32_t frameCount)
+{
+    auto frame = CreateDesktopLikeFrame(width, height);
+    auto directory = std::filesystem::temp_directory_path() / "CaptureAdHocBench";
+    std::filesystem::create_directories(directory);
+    run.BeginGroup("artifact-writer", std::to_string(frameCount) + " frames of " + std::to_string(width) + "x" + std::to_string(height));
+
+    auto inlineTime = run.MeasureOnce([&]()
+    {
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            WritePngFile(directory / ("inline_" + std::to_string(i) + ".png"), frame.View);
+        }
+    });
+    run.Report("Inline", inlineTime);
+
+    auto success = true;
+    for (auto policy : { QueueFullPolicy::Block, QueueFullPolicy::DropNewest, QueueFullPolicy::DropOldest })
+    {
+        ArtifactWriter writer(2, 4, policy);
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            writer.Enqueue(ImageArtifact::Copy(directory / ("queued_" + std::to_string(i) + ".png"), frame.View));
+        }
+        auto enqueueTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        writer.Close();
+        auto stats = writer.Stats();
+        auto name = std::string(policy == QueueFullPolicy::Block ? "Queued (block)" : policy == QueueFullPolicy::DropNewest ? "Queued (drop newest)" : "Queued (drop oldest)");
+        auto encodeP50 = std::chrono::duration<double, std::milli>(stats.EncodeLatency.Percentile(50.0)).count();
+        auto& result = run.Report(name, Timing::Once(enqueueTime));
+        result.Metrics.emplace_back("written", static_cast<double>(stats.Written));
+        result.Metrics.emplace_back("dropped", static_cast<double>(stats.Dropped));
+        result.Metrics.emplace_back("encode_p50_ms", encodeP50);
+        printf("  %-28s %llu written, %llu dropped, depth %zu, encode p50 %.3fms\n", "", static_cast<unsigned long long>(stats.Written),
+            static_cast<unsigned long long>(stats.Dropped), stats.MaxQueueDepth, encodeP50);
+        success &= stats.Failed == 0 && stats.Written + stats.Dropped == frameCount && stats.MaxQueueDepth <= 4;
+        success &= policy != QueueFullPolicy::Block || stats.Written == frameCount;
+        success &= (stats.Dropped == 0) == stats.LastDropped.empty();
+        // The newest artifact always makes it in, in place of an older one
+        success &= policy != QueueFullPolicy::DropOldest || stats.LastDropped != directory / ("queued_" + std::to_string(frameCount - 1) + ".png");
+    }
+    std::filesystem::remove_all(directory);
+    return run.Check(success);
+}
+
+// Writes a long trace at a 60Hz cadence and reads it back, then reads one
+// that was never closed, the way a crashed run leaves it.
+bool BenchmarkFrameTrace(BenchRun& run, uint32_t frameCount)
+{
+    auto directory = std::filesystem::temp_directory_path() / "CaptureAdHocBench";
+    std::filesystem::create_directories(directory);
+    run.BeginGroup("trace", std::to_string(frameCount) + " frames at 60Hz");
+    auto success = true;
+
+    // A jittery capture of a renderer that now and then skips a frame
+    std::vector<FrameTraceRecord> records;
+    std::mt19937_64 random(1);
+    std::uniform_int_distribution<int64_t> jitter(-5000, 5000);
+    uint64_t sequence = 0;
+    int64_t flip = 10'000'000;
+    for (uint32_t i = 0; i < frameCount; i++)
+    {
+        sequence += random() % 100 == 0 ? 2 : 1;
+        flip += 166667;
+        auto captured = flip + 20000 + jitter(random);
+        records.push_back(FrameTraceRecord{ sequence, captured, captured + 10000 + jitter(random), flip });
+    }
+
+    auto path = directory / "trace.bin";
+    uint64_t bytes = 0;
+    auto time = run.MeasureOnce([&]()
+    {
+        FrameTraceWriter writer(path);
+        for (auto&& record : records)
+        {
+            writer.Write(record);
+        }
+        writer.Close();
+        bytes = writer.SizeInBytes();
+    });
+    run.Report("Write", time, bytes);
+    printf("  %-28s %10.1f bytes per frame\n", "", static_cast<double>(bytes) / frameCount);
+    std::vector<FrameTraceRecord> readBack;
+    time = run.MeasureOnce([&]() { readBack = ReadFrameTrace(path); });
+    run.Report("Read", time, bytes);
+    auto same = [](std::vector<FrameTraceRecord> const& left, std::vector<FrameTraceRecord> const& right, size_t count)
+    {
+        if (left.size() != count || right.size() < count)
+        {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            if (left[i].Sequence != right[i].Sequence || left[i].SystemRelativeTime != right[i].SystemRelativeTime ||
+                left[i].ArrivalTime != right[i].ArrivalTime || left[i].RenderFlipTime != right[i].RenderFlipTime)
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+    success &= std::filesystem::file_size(path) == bytes && same(readBack, records, records.size());
+
+    // Still open, the file is padded out to the grow size with zeros, which
+    // would decode as millions of frames if the header didn't say where to stop
+    {
+        auto crashedPath = directory / "crashed.bin";
+        FrameTraceWriter writer(crashedPath);
+        for (size_t i = 0; i < 100; i++)
+        {
+            writer.Write(records[i]);
+        }
+        success &= std::filesystem::file_size(crashedPath) >= MappedAppendFile::DefaultGrowSize;
+        success &= same(ReadFrameTrace(crashedPath), records, 100);
+    }
+
+    std::filesystem::remove_all(directory);
+    return run.Check(success);
+}
+
+// Records frames paced like a 60Hz capture, checking that the writer keeps
+// up without dropping any and that the file reads back as what was submitted.
+bool BenchmarkVideoRecorder(BenchRun& run, uint32_t frameCount)
+{
+    auto directory = std::filesystem::temp_directory_path() / "CaptureAdHocBench";
+    std::filesystem::create_directories(directory);
+    auto path = directory / "record.y4m";
+    auto threads = BandPool::Shared().ThreadCount();
+    run.BeginGroup("record", std::to_string(frameCount) + " frames at 60Hz, " + std::to_string(threads) + " threads");
+    auto toMilliseconds = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::milli>(value).count(); };
+
+    auto success = true;
+    for (auto&& size : { FrameSize{ "1080p", 1920, 1080 }, FrameSize{ "4k", 3840, 2160 } })
+    {
+        std::vector<SyntheticFrame> frames;
+        frames.push_back(CreateVideoLikeFrame(size.Width, size.Height));
+        frames.push_back(CreateDesktopLikeFrame(size.Width, size.Height));
+        VideoRecorder recorder(path, size.Width, size.Height);
+        auto interval = std::chrono::microseconds(16667);
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < frameCount; i++)
+        {
+            std::this_thread::sleep_until(start + (interval * i));
+            recorder.Submit(frames[i % frames.size()].View);
+        }
+        recorder.Close();
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        auto stats = recorder.Stats();
+        auto& result = run.Report(std::string("Paced ") + size.Name, Timing::Once(elapsed), static_cast<uint64_t>(stats.Written) * size.PixelBytes());
+        result.Metrics.emplace_back("dropped", static_cast<double>(stats.Dropped));
+        result.Metrics.emplace_back("convert_p99_ms", toMilliseconds(stats.ConvertLatency.Percentile(99.0)));
+        result.Metrics.emplace_back("write_p99_ms", toMilliseconds(stats.WriteLatency.Percentile(99.0)));
+        printf("  %-28s %llu written, %llu dropped, depth %zu, convert p99 %.3fms, write p99 %.3fms\n", "",
+            static_cast<unsigned long long>(stats.Written), static_cast<unsigned long long>(stats.Dropped), stats.MaxQueueDepth,
+            toMilliseconds(stats.ConvertLatency.Percentile(99.0)), toMilliseconds(stats.WriteLatency.Percentile(99.0)));
+        success &= stats.Failed == 0 && stats.Written + stats.Dropped == frameCount &&
+            std::filesystem::file_size(path) == stats.BytesWritten;
+        // 4k60 is about 750MB/s of I420. The conversion and the writer each
+        // need a core of their own to keep that up.
+        if (size.Width < 3840 || threads >= 4)
+        {
+            success &= stats.Dropped == 0;
+        }
+    }
+
+    // A frame that doesn't match the recording size is cropped and padded
+    {
+        auto frame = CreateVideoLikeFrame(40, 100);
+        VideoRecorder recorder(path, 64, 48);
+        recorder.Submit(frame.View);
+        recorder.Close();
+        std::vector<uint8_t> submitted;
+        {
+            MappedReadOnlyFile file(path);
+            std::string header = "YUV4MPEG2 W64 H48 F60:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\nFRAME\n";
+            success &= file.Size() == header.size() + I420Size(64, 48) && std::memcmp(file.Data(), header.data(), header.size()) == 0;
+            if (success)
+            {
+                std::vector<uint8_t> expected(I420Size(40, 48));
+                ConvertBgraToI420(frame.View.SubView(PixelRect{ 0, 0, 40, 48 }), I420PlanesFor(expected.data(), 40, 48));
+                auto recorded = file.Data() + header.size();
+                success &= std::memcmp(recorded, expected.data(), 40) == 0 && recorded[40] == 16 && recorded[63] == 16 &&
+                    recorded[(64 * 47) + 39] == expected[(40 * 47) + 39];
+                auto recordedU = recorded + (64 * 48);
+                success &= recordedU[0] == expected[40 * 48] && recordedU[20] == 128;
+            }
+            submitted.assign(file.Data(), file.Data() + file.Size());
+        }
+
+        // Read and converted on the writer thread instead, the file must be the same
+        VideoRecorder deferred(path, 64, 48);
+        auto read = false;
+        deferred.SubmitDeferred([&frame, &read](auto const& callback)
+        {
+            read = true;
+            callback(frame.View);
+        });
+        deferred.CountDropped();
+        deferred.Close();
+        auto stats = deferred.Stats();
+        success &= read && stats.Submitted == 2 && stats.Written == 1 && stats.Dropped == 1 && stats.ConvertLatency.Count() == 1;
+        MappedReadOnlyFile deferredFile(path);
+        success &= deferredFile.Size() == submitted.size() && std::memcmp(deferredFile.Data(), submitted.data(), submitted.size()) == 0;
+    }
+    std::filesystem::remove_all(directory);
+    return run.Check(success);
+}
+
+// The frame time histogram: bucket boundaries, percentiles against known
+// distributions, and merging, then how fast it records.
+bool TestLatencyHistogram(BenchRun& run)
+{
+    typedef LatencyHistogram H;
+    run.BeginGroup("histogram", std::to_string(H::BucketCount) + " buckets, " + std::to_string(H::SubBucketCount) + " per power of two");
+    auto success = true;
+
+    // Below SubBucketCount every value has its own bucket, then each power
+    // of two is split SubBucketCount ways
+    for (uint64_t value = 0; value < H::SubBucketCount; value++)
+    {
+        success &= H::BucketIndex(value) == value && H::BucketLowerBound(static_cast<uint32_t>(value)) == value && H::BucketUpperBound(static_cast<uint32_t>(value)) == value;
+    }
+    success &= H::BucketIndex(H::SubBucketCount) == H::SubBucketCount && H::BucketIndex((H::SubBucketCount * 2) - 1) == (H::SubBucketCount * 2) - 1;
+    success &= H::BucketIndex(H::SubBucketCount * 2) == H::BucketIndex((H::SubBucketCount * 2) + 1);
+    success &= H::BucketIndex((H::SubBucketCount * 2) + 2) == H::BucketIndex(H::SubBucketCount * 2) + 1;
+    for (uint32_t bit = H::SubBucketBits; bit < 64; bit++)
+    {
+        auto power = uint64_t(1) << bit;
+        success &= H::BucketIndex(power) == H::BucketIndex(power - 1) + 1 && H::BucketLowerBound(H::BucketIndex(power)) == power;
+    }
+    success &= H::BucketIndex(std::numeric_limits<uint64_t>::max()) == H::BucketCount - 1;
+    // Every bucket holds its own bounds and picks up where the last one stopped
+    for (uint32_t index = 0; index < H::BucketCount; index++)
+    {
+        auto lower = H::BucketLowerBound(index);
+        auto upper = H::BucketUpperBound(index);
+        success &= lower <= upper && H::BucketIndex(lower) == index && H::BucketIndex(upper) == index;
+        success &= index == 0 || lower == H::BucketUpperBound(index - 1) + 1;
+        success &= upper - lower <= lower / H::SubBucketCount;
+    }
+    success &= H::BucketUpperBound(H::BucketCount - 1) == std::numeric_limits<uint64_t>::max();
+
+    // Nothing recorded reports zeros, and negative durations count as zero
+    H histogram;
+    success &= histogram.Count() == 0 && histogram.Percentile(50.0).count() == 0 && histogram.Min().count() == 0 && histogram.Max().count() == 0;
+    histogram.Record(std::chrono::nanoseconds(-5));
+    success &= histogram.Count() == 1 && histogram.Percentile(100.0).count() == 0 && histogram.Max().count() == 0;
+    histogram.Reset();
+
+    // 1 to 100ns once each. Everything up to 63ns is exact, and above that
+    // the middle of the bucket is reported (99 is in [98, 99]) but never
+    // past the largest value.
+    for (int64_t value = 1; value <= 100; value++)
+    {
+        histogram.Record(std::chrono::nanoseconds(value));
+    }
+    success &= histogram.Count() == 100 && histogram.Min().count() == 1 && histogram.Max().count() == 100;
+    success &= histogram.Percentile(0.0).count() == 1 && histogram.Percentile(1.0).count() == 1;
+    success &= histogram.Percentile(50.0).count() == 50 && histogram.Percentile(50.5).count() == 51 && histogram.Percentile(62.5).count() == 63;
+    success &= histogram.Percentile(99.0).count() == 98 && histogram.Percentile(100.0).count() == 100 && histogram.Percentile(150.0).count() == 100;
+
+    // 1us to 10ms in 1us steps, the range frame times land in. Every
+    // percentile is within a bucket's width of the exact answer.
+    histogram.Reset();
+    H even;
+    H odd;
+    for (int64_t value = 1; value <= 10000; value++)
+    {
+        auto duration = std::chrono::microseconds(value);
+        histogram.Record(duration);
+        (value % 2 == 0 ? even : odd).Record(duration);
+    }
+    for (auto percentile : { 10.0, 50.0, 90.0, 99.0, 99.9 })
+    {
+        auto exact = std::ceil(percentile * 100.0) * 1000.0;
+        auto reported = static_cast<double>(histogram.Percentile(percentile).count());
+        success &= std::abs(reported - exact) <= exact / H::SubBucketCount;
+    }
+
+    // Merging the halves gives back exactly the whole
+    H merged;
+    merged.Merge(even);
+    merged.Merge(odd);
+    merged.Merge(H());
+    success &= merged.Count() == histogram.Count() && merged.Min() == histogram.Min() && merged.Max() == histogram.Max();
+    for (auto percentile : { 0.0, 25.0, 50.0, 75.0, 90.0, 99.0, 99.9, 100.0 })
+    {
+        success &= merged.Percentile(percentile) == histogram.Percentile(percentile);
+    }
+
+    // FrameTimer feeds the same histogram. A steady 60Hz has no spread.
+    FrameTimer<FrameTimeSpan> timer;
+    for (int64_t frame = 0; frame < 600; frame++)
+    {
+        timer.RecordTimestamp(FrameTimeSpan(frame * 166667));
+    }
+    auto stats = timer.ComputeStatistics();
+    success &= stats.Intervals == 599 && std::abs(stats.P50.count() - 16.6667) < 16.6667 / H::SubBucketCount && stats.Min == stats.Max;
+    success &= stats.StandardDeviation.count() < 1e-9 && stats.Jitter.count() < 1e-9;
+
+    std::vector<std::chrono::nanoseconds> samples;
+    std::mt19937_64 random(1);
+    std::lognormal_distribution<double> distribution(15.0, 0.5);
+    for (uint32_t i = 0; i < 1000000; i++)
+    {
+        samples.push_back(std::chrono::nanoseconds(static_cast<int64_t>(distribution(random))));
+    }
+    auto time = run.Measure([&]()
+    {
+        histogram.Reset();
+        for (auto sample : samples)
+        {
+            histogram.Record(sample);
+        }
+    });
+    run.Report("Record 1M samples", time, samples.size() * sizeof(int64_t));
+    std::chrono::nanoseconds p99{};
+    time = run.Measure([&]() { p99 = histogram.Percentile(99.0); });
+    run.Report("Percentile", time, sizeof(histogram));
+    success &= p99 > histogram.Percentile(50.0);
+
+    return run.Check(success);
+}
+
+// The frame pool model against cases with answers that can be worked out by
+// hand, then how fast it simulates.
+bool BenchmarkFramePoolSimulator(BenchRun& run)
+{
+    run.BeginGroup("frame-pool-sim", "60Hz display, 10s per simulation");
+    auto success = true;
+    auto near = [](double value, double expected, double tolerance) { return std::abs(value - expected) <= tolerance; };
+    auto toMilliseconds = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::milli>(value).count(); };
+
+    // A consumer that keeps up sees every present, 1ms delivery plus 2ms of
+    // service after it
+    FramePoolSimOptions options;
+    auto result = SimulateFramePool(options);
+    success &= near(result.ProcessedPerSecond(), 60.0, 0.2) && result.Superseded == 0 && result.PoolFull == 0 && result.Throttled == 0;
+    success &= near(toMilliseconds(result.PresentToProcessed.Percentile(50.0)), 3.0, 0.1) && result.MaxBuffersInUse == 1;
+
+    // A 25ms consumer with one buffer: the next capture waits for the
+    // refresh after the buffer comes back, so every other refresh
+    auto slow = options;
+    slow.BufferCount = 1;
+    slow.ServiceTime = SimTiming::Constant(std::chrono::milliseconds(25));
+    result = SimulateFramePool(slow);
+    success &= near(result.ProcessedPerSecond(), 30.0, 0.2) && result.PoolFull > 0 && near(result.MissedPercent(), 50.0, 0.5);
+    // More buffers keep it busy, at the cost of frames queueing up
+    slow.BufferCount = 3;
+    auto buffered = SimulateFramePool(slow);
+    success &= near(buffered.ProcessedPerSecond(), 40.0, 0.2) && buffered.MaxBuffersInUse == 3;
+    success &= buffered.PresentToProcessed.Percentile(99.0) > result.PresentToProcessed.Percentile(99.0);
+    // Only processing the newest frame cuts that latency back down
+    slow.Policy = SimConsumerPolicy::LatestOnly;
+    auto latest = SimulateFramePool(slow);
+    success &= latest.Discarded > 0 && latest.PresentToProcessed.Percentile(99.0) < buffered.PresentToProcessed.Percentile(99.0);
+
+    // MinUpdateInterval holds captures to the refresh after it's passed
+    auto throttled = options;
+    throttled.MinUpdateInterval = std::chrono::milliseconds(40);
+    result = SimulateFramePool(throttled);
+    success &= near(result.ProcessedPerSecond(), 20.0, 0.2) && result.Throttled > 0;
+
+    // A 120Hz renderer on a 60Hz display loses every other present
+    auto fast = options;
+    fast.RenderInterval = SimTiming::Constant(std::chrono::nanoseconds(8'333'333));
+    result = SimulateFramePool(fast);
+    success &= near(result.ProcessedPerSecond(), 60.0, 0.2) && near(static_cast<double>(result.Superseded) / result.Presents, 0.5, 0.01);
+
+    // Same options, same result, and a sweep point is the same as running it alone
+    auto jittered = options;
+    jittered.RenderInterval = SimTiming::Constant(std::chrono::nanoseconds(16'666'667), std::chrono::milliseconds(4));
+    jittered.ServiceTime = SimTiming::Constant(std::chrono::milliseconds(12), std::chrono::milliseconds(10));
+    auto first = SimulateFramePool(jittered);
+    auto second = SimulateFramePool(jittered);
+    success &= first.Processed == second.Processed && first.PresentToProcessed.Max() == second.PresentToProcessed.Max();
+    auto points = SweepFramePool(jittered, { 1, 2 }, { std::chrono::milliseconds(1) });
+    success &= points.size() == 2 && points[0].BufferCount == 1 && points[1].BufferCount == 2;
+    jittered.BufferCount = 2;
+    success &= points[1].Result.Processed == SimulateFramePool(jittered).Processed;
+
+    // A trace from a 60Hz display that misses every fifth refresh, with
+    // 2ms delivery and presents 5ms before each refresh
+    std::vector<FrameTraceRecord> records;
+    for (uint64_t refresh = 0; refresh < 600; refresh++)
+    {
+        if (refresh % 5 == 4)
+        {
+            continue;
+        }
+        auto systemRelativeTime = 100'000'000 + static_cast<int64_t>((refresh * 1'000'000) / 6);
+        records.push_back(FrameTraceRecord{ records.size(), systemRelativeTime, systemRelativeTime + 20'000, systemRelativeTime - 50'000 });
+    }
+    auto calibration = CalibrateFramePool(records);
+    success &= near(toMilliseconds(calibration.RefreshInterval), 16.6667, 0.001);
+    success &= near(calibration.ArrivalsPerSecond, 48.0, 0.1) && calibration.DeliveryLatencies.size() == records.size();
+    success &= near(toMilliseconds(calibration.FlipToArrival.Percentile(50.0)), 7.0, 0.25);
+    success &= near(toMilliseconds(calibration.RenderPhase), 5.0, 0.01);
+    auto calibrated = SimulateFramePool(calibration.Apply(options));
+    success &= near(toMilliseconds(calibrated.PresentToArrival.Percentile(50.0)), 7.0, 0.25);
+    // The recorded intervals are drawn at random, so the rate only roughly matches
+    success &= near(calibrated.Captured / std::chrono::duration<double>(calibrated.Duration).count(), calibration.ArrivalsPerSecond, calibration.ArrivalsPerSecond * 0.05);
+
+    // Speed, on the case with the most going on
+    auto stress = jittered;
+    stress.BufferCount = 3;
+    stress.Duration = std::chrono::seconds(60);
+    auto time = run.Measure([&]() { result = SimulateFramePool(stress); });
+    auto& report = run.Report("Simulate 60s", time);
+    report.Metrics.emplace_back("simulated_x_realtime", 60000.0 / time.Median);
+    std::vector<uint32_t> bufferCounts = { 1, 2, 3, 4, 6, 8 };
+    std::vector<std::chrono::nanoseconds> intervals = { std::chrono::milliseconds(0), std::chrono::milliseconds(1), std::chrono::milliseconds(8), std::chrono::milliseconds(16), std::chrono::milliseconds(33) };
+    time = run.Measure([&]() { points = SweepFramePool(options, bufferCounts, intervals); });
+    run.Report("Sweep 30 points", time);
+    success &= points.size() == bufferCounts.size() * intervals.size();
+    return run.Check(success);
+}
+
+// Stands in for a coroutine when driving an awaiter (SpscRing's,
+// completion_source) by hand, since this builds without coroutine support.
+// Resuming it finishes the co_await on whichever thread resumed it, like a
+// real one. Result is what await_resume returned.
+template <typename R>
+struct FakeCoroutine
+{
+    struct Handle
+    {
+        void* Address = nullptr;
+
+        void* address() const { return Address; }
+        static Handle from_address(void* address) { return Handle{ address }; }
+        void resume() const { static_cast<FakeCoroutine*>(Address)->Resume(); }
+    };
+
+    template <typename Awaiter>
+    void Await(Awaiter& awaiter)
+    {
+        Finish = [&awaiter, this]()
+        {
+            try
+            {
+                Result = awaiter.await_resume();
+            }
+            catch (std::exception const&)
+            {
+                Threw = true;
+            }
+        };
+        if (awaiter.await_ready() || !awaiter.await_suspend(Handle{ this }))
+        {
+            Resume();
+        }
+    }
+    void Resume()
+    {
+        ResumedAt = std::chrono::steady_clock::now();
+        ResumedOn = std::this_thread::get_id();
+        Finish();
+        std::lock_guard lock(Lock);
+        Done = true;
+        Condition.notify_one();
+    }
+    void Wait()
+    {
+        std::unique_lock lock(Lock);
+        Condition.wait(lock, [this]() { return Done; });
+    }
+
+    std::function<void()> Finish;
+    R Result{};
+    bool Threw = false;
+    std::chrono::steady_clock::time_point ResumedAt;
+    std::thread::id ResumedOn;
+    std::mutex Lock;
+    std::condition_variable Condition;
+    bool Done = false;
+};
+
+// The SPSC frame ring: what each policy keeps, then a producer pushing as
+// fast as it can at a thread consumer and a (hand driven) coroutine
+// consumer, checking nothing is lost, duplicated or reordered. Build with
+// -fsanitize=thread to check the ordering as well.
+bool BenchmarkSpscRing(BenchRun& run, uint64_t itemCount)
+{
+    run.BeginGroup("spsc", std::to_string(itemCount) + " items per run");
+    auto success = true;
+    using PopCoroutine = FakeCoroutine<std::optional<SequencedItem<uint64_t>>>;
+
+    // Move only, with no default constructor, like a frame handle
+    struct Handle
+    {
+        explicit Handle(uint64_t value) : Value(std::make_unique<uint64_t>(value)) {}
+        std::unique_ptr<uint64_t> Value;
+    };
+    auto keeps = [](QueueFullPolicy policy, std::vector<uint64_t> const& expected, QueuePushResult fullResult, uint64_t accepted)
+    {
+        SpscRing<Handle> ring(4, policy);
+        auto correct = true;
+        for (uint64_t i = 0; i < 10; i++)
+        {
+            correct &= ring.Push(Handle(i)) == (i < 4 ? QueuePushResult::Queued : fullResult);
+        }
+        correct &= ring.Size() == 4 && ring.Pushed() == accepted && ring.Overflows() == 6;
+        for (auto value : expected)
+        {
+            auto item = ring.TryPop();
+            correct &= item.has_value() && *item->Value.Value == value && item->Sequence == value;
+        }
+        ring.Close();
+        correct &= !ring.TryPop() && ring.Push(Handle(10)) == QueuePushResult::Closed;
+        return correct;
+    };
+    success &= keeps(QueueFullPolicy::DropOldest, { 6, 7, 8, 9 }, QueuePushResult::QueuedDroppedOldest, 10);
+    success &= keeps(QueueFullPolicy::DropNewest, { 0, 1, 2, 3 }, QueuePushResult::Dropped, 4);
+
+    // Every item arrives, in order, and a blocked producer counts overflows
+    auto blocking = [&](uint64_t count)
+    {
+        SpscRing<uint64_t> ring(64, QueueFullPolicy::Block);
+        std::thread producer([&]()
+        {
+            for (uint64_t i = 0; i < count; i++)
+            {
+                ring.Push(uint64_t(i));
+            }
+        });
+        uint64_t next = 0;
+        while (next < count)
+        {
+            auto item = ring.Pop(std::chrono::steady_clock::duration::max());
+            success &= item.has_value() && item->Sequence == next && item->Value == next;
+            next++;
+        }
+        producer.join();
+        success &= ring.Empty() && ring.Overflows() <= count;
+    };
+    auto ringTime = run.MeasureOnce([&]() { blocking(itemCount); });
+    auto mutexTime = run.MeasureOnce([&]()
+    {
+        BoundedQueue<uint64_t> queue(64, QueueFullPolicy::Block);
+        std::thread producer([&]()
+        {
+            for (uint64_t i = 0; i < itemCount; i++)
+            {
+                queue.Push(uint64_t(i));
+            }
+            queue.Close();
+        });
+        while (queue.Pop())
+        {
+        }
+        producer.join();
+    });
+    auto perItem = [&](Timing const& time) { return (time.Median * 1e6) / itemCount; };
+    run.Report("Block, thread consumer", ringTime).Metrics.emplace_back("ns_per_item", perItem(ringTime));
+    run.Report("BoundedQueue, same", mutexTime).Metrics.emplace_back("ns_per_item", perItem(mutexTime));
+
+    // A slow consumer sees the newest items, never one twice or out of order,
+    // and what it missed is accounted for
+    auto overwriteTime = run.MeasureOnce([&]()
+    {
+        SpscRing<uint64_t> ring(4, QueueFullPolicy::DropOldest);
+        std::atomic<uint64_t> dropped = 0;
+        std::thread producer([&]()
+        {
+            for (uint64_t i = 0; i < itemCount; i++)
+            {
+                if (ring.Push(uint64_t(i)) == QueuePushResult::QueuedDroppedOldest)
+                {
+                    dropped++;
+                }
+            }
+            ring.Close();
+        });
+        uint64_t received = 0;
+        int64_t last = -1;
+        while (auto item = ring.Pop(std::chrono::steady_clock::duration::max()))
+        {
+            success &= static_cast<int64_t>(item->Sequence) > last && item->Value == item->Sequence;
+            last = static_cast<int64_t>(item->Sequence);
+            received++;
+            if ((received % 64) == 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+        producer.join();
+        success &= received + dropped == itemCount && last == static_cast<int64_t>(itemCount) - 1;
+    });
+    run.Report("DropOldest, slow consumer", overwriteTime).Metrics.emplace_back("ns_per_item", perItem(overwriteTime));
+
+    // The awaiter: an item that's already there, a timeout, and a push that
+    // wakes it on the producer's thread
+    {
+        SpscRing<uint64_t> ring(2, QueueFullPolicy::DropOldest);
+        ring.Push(uint64_t(5));
+        PopCoroutine ready;
+        auto awaiter = ring.PopAsync(std::chrono::seconds(5));
+        ready.Await(awaiter);
+        success &= ready.Done && ready.Result && ready.Result->Value == 5;
+
+        PopCoroutine timesOut;
+        auto start = std::chrono::steady_clock::now();
+        auto timeout = ring.PopAsync(std::chrono::milliseconds(20));
+        timesOut.Await(timeout);
+        timesOut.Wait();
+        auto waited = std::chrono::steady_clock::now() - start;
+        success &= !timesOut.Result && waited >= std::chrono::milliseconds(20) && waited < std::chrono::seconds(5);
+
+        PopCoroutine woken;
+        auto wake = ring.PopAsync(std::chrono::seconds(5));
+        woken.Await(wake);
+        std::thread producer([&]()
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            ring.Push(uint64_t(6));
+        });
+        auto producerId = producer.get_id();
+        woken.Wait();
+        producer.join();
+        success &= woken.Result && woken.Result->Value == 6 && woken.Result->Sequence == 1 && woken.ResumedOn == producerId;
+    }
+
+    // Waiting for a match: skipping what's already there, giving up with the
+    // last miss, and a producer that gets there a frame at a time (which is
+    // what the transition tests wait on instead of a fixed sleep)
+    {
+        using MatchCoroutine = FakeCoroutine<RingMatch<uint64_t>>;
+        SpscRing<uint64_t> ring(16, QueueFullPolicy::Block);
+        for (uint64_t i = 0; i < 10; i++)
+        {
+            ring.Push(uint64_t(i));
+        }
+        MatchCoroutine ready;
+        auto awaiter = ring.PopMatchingAsync([](uint64_t value) { return value == 7; }, std::chrono::seconds(5));
+        ready.Await(awaiter);
+        success &= ready.Done && ready.Result.Item && ready.Result.Item->Value == 7 && ready.Result.Skipped == 7 &&
+            ready.Result.LastMiss && ready.Result.LastMiss->Value == 6 && ring.Size() == 2;
+
+        MatchCoroutine timesOut;
+        auto timeout = ring.PopMatchingAsync([](uint64_t value) { return value > 100; }, std::chrono::milliseconds(20));
+        timesOut.Await(timeout);
+        timesOut.Wait();
+        success &= !timesOut.Result.Item && timesOut.Result.Skipped == 2 && timesOut.Result.LastMiss && timesOut.Result.LastMiss->Value == 9 &&
+            timesOut.Result.Elapsed >= std::chrono::milliseconds(20) && timesOut.Result.Elapsed < std::chrono::seconds(5);
+
+        SpscRing<uint64_t> frames(1, QueueFullPolicy::DropOldest);
+        const uint64_t frameCount = 20;
+        MatchCoroutine transition;
+        auto match = frames.PopMatchingAsync([](uint64_t value) { return value == frameCount - 1; }, std::chrono::seconds(5));
+        transition.Await(match);
+        std::thread producer([&]()
+        {
+            for (uint64_t i = 0; i < frameCount; i++)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                frames.Push(uint64_t(i));
+            }
+        });
+        auto producerId = producer.get_id();
+        transition.Wait();
+        producer.join();
+        success &= transition.Result.Item && transition.Result.Item->Sequence == frameCount - 1 && transition.Result.Skipped < frameCount &&
+            transition.ResumedOn == producerId && transition.Result.Elapsed < std::chrono::seconds(5);
+        auto elapsedMs = std::chrono::duration<double, std::milli>(transition.Result.Elapsed).count();
+        run.Report("Match, producer thread", Timing::Once(elapsedMs)).Metrics.emplace_back("skipped", static_cast<double>(transition.Result.Skipped));
+    }
+
+    // Then a coroutine consumer against a producer going flat out, with
+    // timeouts short enough to race the pushes
+    auto awaitTime = run.MeasureOnce([&]()
+    {
+        SpscRing<uint64_t> ring(16, QueueFullPolicy::Block);
+        auto count = itemCount / 16;
+        std::thread producer([&]()
+        {
+            for (uint64_t i = 0; i < count; i++)
+            {
+                ring.Push(uint64_t(i));
+                if ((i % 1024) == 0)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                }
+            }
+        });
+        uint64_t next = 0;
+        uint64_t timeouts = 0;
+        while (next < count)
+        {
+            PopCoroutine consumer;
+            auto awaiter = ring.PopAsync(std::chrono::microseconds(20));
+            consumer.Await(awaiter);
+            consumer.Wait();
+            if (!consumer.Result)
+            {
+                timeouts++;
+                continue;
+            }
+            success &= consumer.Result->Sequence == next && consumer.Result->Value == next;
+            next++;
+        }
+        producer.join();
+        success &= ring.Empty();
+        printf("  %-28s %10llu timeouts\n", "", static_cast<unsigned long long>(timeouts));
+    });
+    run.Report("Block, awaiting consumer", awaitTime).Metrics.emplace_back("ns_per_item", (awaitTime.Median * 1e6) / (itemCount / 16));
+    return run.Check(success);
+}
+
+// The completion_source that completionSource.h used to have, for
+// comparison: a Win32 event and a threadpool wait per source, here a heap
+// allocated event and a thread that waits on it and then resumes the
+// coroutine.
+class EventWaitThread
+{
+public:
+    struct Event
+    {
+        void Set()
+        {
+            std::lock_guard lock(Lock);
+            Signaled = true;
+            Condition.notify_all();
+        }
+        bool IsSet()
+        {
+            std::lock_guard lock(Lock);
+            return Signaled;
+        }
+        void Wait()
+        {
+            std::unique_lock lock(Lock);
+            Condition.wait(lock, [this]() { return Signaled; });
+        }
+
+        std::mutex Lock;
+        std::condition_variable Condition;
+        bool Signaled = false;
+    };
+
+    EventWaitThread() : m_waits(64, QueueFullPolicy::Block), m_thread([this]() { ThreadLoop(); }) {}
+    ~EventWaitThread()
+    {
+        m_waits.Close();
+        m_thread.join();
+    }
+
+    void Submit(std::shared_ptr<Event> const& event, std::function<void()> callback)
+    {
+        m_waits.Push(Wait{ event, std::move(callback) });
+    }
+
+private:
+    struct Wait
+    {
+        std::shared_ptr<Event> Signal;
+        std::function<void()> Callback;
+    };
+
+    void ThreadLoop()
+    {
+        while (auto wait = m_waits.Pop())
+        {
+            wait->Signal->Wait();
+            wait->Callback();
+        }
+    }
+
+    BoundedQueue<Wait> m_waits;
+    std::thread m_thread;
+};
+
+template <typename T>
+class EventCompletionSource
+{
+public:
+    EventCompletionSource(EventWaitThread& waits) : m_event(std::make_shared<EventWaitThread::Event>()), m_waits(waits) {}
+
+    void set(T value)
+    {
+        m_value.emplace(std::move(value));
+        m_event->Set();
+    }
+    bool await_ready() const { return m_event->IsSet(); }
+    template <typename Handle>
+    bool await_suspend(Handle handle)
+    {
+        m_waits.Submit(m_event, [address = handle.address()]() { Handle::from_address(address).resume(); });
+        return true;
+    }
+    T await_resume() { return std::move(*m_value); }
+
+private:
+    std::shared_ptr<EventWaitThread::Event> m_event;
+    EventWaitThread& m_waits;
+    std::optional<T> m_value;
+};
+
+// completion_source: what each way of completing it does, a setter racing
+// timeouts, then how long it takes from set to the coroutine running again
+// against the event based version it replaced.
+bool BenchmarkCompletionSource(BenchRun& run, uint32_t iterations)
+{
+    run.BeginGroup("completion", std::to_string(iterations) + " completions per run");
+    auto success = true;
+
+    // Move only, with no default constructor, like a frame
+    struct Payload
+    {
+        explicit Payload(uint64_t value) : Value(std::make_unique<uint64_t>(value)) {}
+        std::unique_ptr<uint64_t> Value;
+    };
+
+    // Already set: no suspending, and only the first completion counts
+    {
+        completion_source<std::unique_ptr<uint64_t>> source;
+        success &= source.set(std::make_unique<uint64_t>(1)) && !source.set(std::make_unique<uint64_t>(2)) && !source.cancel();
+        FakeCoroutine<std::unique_ptr<uint64_t>> coroutine;
+        coroutine.Await(source);
+        success &= coroutine.Done && coroutine.Result && *coroutine.Result == 1;
+    }
+    // Set on another thread resumes the coroutine right there
+    {
+        completion_source<Payload> source;
+        FakeCoroutine<std::optional<Payload>> coroutine;
+        auto awaiter = source.wait_for(std::chrono::seconds(5));
+        coroutine.Await(awaiter);
+        success &= !coroutine.Done;
+        std::thread setter([&]() { source.set(Payload(7)); });
+        auto setterId = setter.get_id();
+        setter.join();
+        success &= coroutine.Done && coroutine.Result && *coroutine.Result->Value == 7 && coroutine.ResumedOn == setterId;
+    }
+    // Cancelling throws from co_await, and gives nothing from wait_for
+    {
+        completion_source<std::unique_ptr<uint64_t>> source;
+        FakeCoroutine<std::unique_ptr<uint64_t>> coroutine;
+        coroutine.Await(source);
+        success &= source.cancel() && coroutine.Done && coroutine.Threw && !source.set(std::make_unique<uint64_t>(1));
+        completion_source<Payload> waited;
+        FakeCoroutine<std::optional<Payload>> timed;
+        auto awaiter = waited.wait_for(std::chrono::seconds(5));
+        timed.Await(awaiter);
+        success &= waited.cancel() && timed.Done && !timed.Result && !timed.Threw;
+    }
+    // Timing out
+    {
+        completion_source<Payload> source;
+        FakeCoroutine<std::optional<Payload>> coroutine;
+        auto start = std::chrono::steady_clock::now();
+        auto awaiter = source.wait_for(std::chrono::milliseconds(20));
+        coroutine.Await(awaiter);
+        coroutine.Wait();
+        auto waited = std::chrono::steady_clock::now() - start;
+        success &= !coroutine.Result && waited >= std::chrono::milliseconds(20) && !source.set(Payload(1));
+    }
+
+    // A setter racing timeouts short enough to hit every interleaving: each
+    // source resolves once, with the value exactly when set says it won
+    {
+        auto count = iterations;
+        std::vector<std::unique_ptr<completion_source<uint64_t>>> sources;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            sources.push_back(std::make_unique<completion_source<uint64_t>>());
+        }
+        std::vector<uint8_t> setWon(count, 0);
+        std::atomic<uint32_t> awaited = 0;
+        std::thread setter([&]()
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                // Mostly right behind the awaiting side
+                while (awaited.load() < i && (i % 7) != 0)
+                {
+                    std::this_thread::yield();
+                }
+                setWon[i] = sources[i]->set(uint64_t(i)) ? 1 : 0;
+            }
+        });
+        uint32_t timeouts = 0;
+        for (uint32_t i = 0; i < count; i++)
+        {
+            FakeCoroutine<std::optional<uint64_t>> coroutine;
+            auto awaiter = sources[i]->wait_for(std::chrono::microseconds(i % 50));
+            coroutine.Await(awaiter);
+            awaited = i + 1;
+            coroutine.Wait();
+            if (coroutine.Result)
+            {
+                success &= *coroutine.Result == i;
+            }
+            else
+            {
+                timeouts++;
+            }
+        }
+        setter.join();
+        for (uint32_t i = 0; i < count; i++)
+        {
+            // Awaited before the setter got to it, or after
+            success &= sources[i]->await_ready();
+        }
+        uint32_t wins = 0;
+        for (auto won : setWon)
+        {
+            wins += won;
+        }
+        success &= wins + timeouts == count;
+        printf("  %-28s %10u of %u timed out first\n", "Set racing timeouts", timeouts, count);
+    }
+
+    // Set to resume: completion_source resumes inline on the setting thread,
+    // the event version hops to its wait thread
+    auto measure = [&](std::string const& name, auto&& completeOnce)
+    {
+        LatencyHistogram latency;
+        auto time = run.MeasureOnce([&]()
+        {
+            latency.Reset();
+            for (uint32_t i = 0; i < iterations; i++)
+            {
+                latency.Record(completeOnce(i));
+            }
+        });
+        auto toMicroseconds = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::micro>(value).count(); };
+        auto& report = run.Report(name, time);
+        report.Metrics.emplace_back("p50_us", toMicroseconds(latency.Percentile(50.0)));
+        report.Metrics.emplace_back("p99_us", toMicroseconds(latency.Percentile(99.0)));
+        printf("  %-28s %10.2fus p50 %8.2fus p99\n", "", toMicroseconds(latency.Percentile(50.0)), toMicroseconds(latency.Percentile(99.0)));
+    };
+    auto thisThread = std::this_thread::get_id();
+    measure("completion_source", [&](uint32_t i)
+    {
+        completion_source<uint64_t> source;
+        FakeCoroutine<uint64_t> coroutine;
+        coroutine.Await(source);
+        auto start = std::chrono::steady_clock::now();
+        source.set(uint64_t(i));
+        coroutine.Wait();
+        success &= coroutine.Result == i && coroutine.ResumedOn == thisThread;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(coroutine.ResumedAt - start);
+    });
+    EventWaitThread waits;
+    measure("Event and wait thread", [&](uint32_t i)
+    {
+        EventCompletionSource<uint64_t> source(waits);
+        FakeCoroutine<uint64_t> coroutine;
+        coroutine.Await(source);
+        auto start = std::chrono::steady_clock::now();
+        source.set(uint64_t(i));
+        coroutine.Wait();
+        success &= coroutine.Result == i;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(coroutine.ResumedAt - start);
+    });
+    return run.Check(success);
+}
+
+// Threads lease and return frame sized buffers concurrently, checking that
+// nobody else scribbles on a buffer while it's leased and that a steady
+// state loop stops going to the OS for memory.
+bool StressBufferPool(BenchRun& run, bool useHugePages)
+{
+    BufferPoolOptions options;
+    options.UseHugePages = useHugePages;
+    BufferPool pool(options);
+    run.BeginGroup("buffer-pool", std::string("stress (huge pages ") + (useHugePages ? "requested)" : "off)"));
+
+    auto success = true;
+    for (size_t size = 1; size < (size_t(1) << 34); size = (size * 3) / 2 + 1)
+    {
+        auto index = BufferPool::ClassIndex(size);
+        success &= BufferPool::ClassSize(index) >= size && (index == 0 || BufferPool::ClassSize(index - 1) < size);
+        success &= BufferPool::ClassSize(index) <= std::max<size_t>(BufferPool::MinClassSize, size + (size / 4) + 1);
+    }
+
+    std::vector<size_t> const sizes = { 1280 * 720 * 4, 1920 * 1080 * 4, 2560 * 1440 * 4, 3840 * 2160 * 4, 64 * 64 * 4 };
+    uint32_t const threadCount = 4;
+    uint32_t const iterations = 2000;
+    std::atomic<bool> corrupted = false;
+    auto worker = [&](uint32_t threadIndex)
+    {
+        uint32_t seed = threadIndex + 1;
+        for (uint32_t i = 0; i < iterations; i++)
+        {
+            seed = (seed * 1664525u) + 1013904223u;
+            auto lease = pool.Lease(sizes[(seed >> 16) % sizes.size()]);
+            if ((reinterpret_cast<uintptr_t>(lease.Data()) % BufferPool::Alignment) != 0 || lease.Capacity() < lease.Size())
+            {
+                corrupted = true;
+            }
+            // Tag the start, middle and end of the buffer, then check them
+            auto tag = static_cast<uint8_t>((threadIndex * 31) + i);
+            size_t const offsets[] = { 0, lease.Size() / 2, lease.Size() - 1 };
+            for (auto offset : offsets)
+            {
+                lease.Data()[offset] = tag;
+            }
+            std::this_thread::yield();
+            for (auto offset : offsets)
+            {
+                if (lease.Data()[offset] != tag)
+                {
+                    corrupted = true;
+                }
+            }
+        }
+    };
+
+    auto runThreads = [&]()
+    {
+        std::vector<std::thread> threads;
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            threads.emplace_back(worker, i);
+        }
+        for (auto&& thread : threads)
+        {
+            thread.join();
+        }
+    };
+
+    // Every thread could hold the same size at once
+    auto coldStart = std::chrono::steady_clock::now();
+    {
+        std::vector<BufferLease> leases;
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            for (auto size : sizes)
+            {
+                leases.push_back(pool.Lease(size));
+            }
+        }
+    }
+    auto coldTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - coldStart).count();
+    auto warm = pool.Stats();
+    auto steadyTime = run.MeasureOnce(runThreads);
+    auto steady = pool.Stats();
+    success &= !corrupted && steady.BytesLeased == 0 && steady.SystemAllocations == warm.SystemAllocations;
+
+    auto name = std::string(useHugePages ? " (huge pages)" : "");
+    auto perLease = [&](double milliseconds, uint64_t leases) { return (milliseconds * 1e6) / leases; };
+    run.Report("Cold" + name, Timing::Once(coldTime)).Metrics.emplace_back("ns_per_lease", perLease(coldTime, warm.Leases));
+    printf("  %-28s %10.1fns/lease  %llu allocations\n", "", perLease(coldTime, warm.Leases), static_cast<unsigned long long>(warm.SystemAllocations));
+    auto steadyLeases = static_cast<uint64_t>(threadCount) * iterations;
+    auto& result = run.Report("Steady state" + name, steadyTime);
+    result.Metrics.emplace_back("ns_per_lease", perLease(steadyTime.Median, steadyLeases));
+    result.Metrics.emplace_back("peak_mb", steady.PeakBytes / 1e6);
+    printf("  %-28s %10.1fns/lease  %llu allocations\n", "", perLease(steadyTime.Median, steadyLeases), static_cast<unsigned long long>(steady.SystemAllocations - warm.SystemAllocations));
+    printf("  %-28s %10.2fMB peak, %llu huge page blocks\n", "Memory", steady.PeakBytes / 1e6, static_cast<unsigned long long>(steady.HugePageAllocations));
+    return run.Check(success);
+}
+
+// Runs the post-FrameArrived pipeline (timing, sequence tracking and region
+// verification) against a synthetic source as fast as it will go.
+bool BenchmarkSyntheticPipeline(BenchRun& run, uint32_t width, uint32_t height, uint64_t frameCount)
+{
+    auto const red = BgraColor{ 0, 0, 255, 255 };
+    auto const green = BgraColor{ 0, 255, 0, 255 };
+    SyntheticFrameSourceOptions options;
+    options.Width = width;
+    options.Height = height;
+    options.FramesPerSecond = 60.0;
+    options.TimestampJitter = std::chrono::microseconds(500);
+    options.DropProbability = 0.01;
+    options.DuplicateProbability = 0.02;
+    options.RealTime = false;
+    options.FrameLimit = frameCount;
+    options.Script.push_back({ 0, SolidColorPainter(red), false });
+    options.Script.push_back({ frameCount / 3, SolidColorPainter(green), false });
+    options.Script.push_back({ (frameCount * 2) / 3, MovingBarPainter(green, red, 64), true });
+    run.BeginGroup("pipeline", std::to_string(frameCount) + " frames of " + std::to_string(width) + "x" + std::to_string(height));
+
+    SyntheticFrameSource source(options);
+    FrameTimer<FrameTimeSpan> timer;
+    uint64_t frames = 0;
+    uint64_t missing = 0;
+    uint64_t verifyFailures = 0;
+    uint64_t lastSequence = 0;
+    auto center = PixelRect{ width / 4, height / 4, width / 2, height / 2 };
+    source.FrameArrived([&](IFrameSource& sender)
+    {
+        while (auto frame = sender.TryGetNextFrame())
+        {
+            timer.RecordTimestamp(frame->SystemRelativeTime());
+            if (frames > 0)
+            {
+                missing += frame->Sequence() - lastSequence - 1;
+            }
+            lastSequence = frame->Sequence();
+            frames++;
+
+            // Solid content is either color, the moving bar is neither
+            auto surface = frame->Surface();
+            if (frame->Sequence() < (frameCount * 2) / 3)
+            {
+                auto result = VerifyRegion(surface, center, red);
+                if (!result.Passed())
+                {
+                    verifyFailures += !VerifyRegion(surface, center, green).Passed();
+                }
+            }
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    source.StartCapture();
+    source.WaitForCompletion();
+    auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    auto stats = source.Stats();
+    auto timing = timer.ComputeStatistics();
+
+    auto fps = frames / (elapsed / 1e3);
+    run.Report("Synthetic source", Timing::Once(elapsed), static_cast<uint64_t>(frames) * width * height * 4).Metrics.emplace_back("fps", fps);
+    printf("  %-28s %10.0f fps\n", "Throughput", fps);
+    printf("  %-28s %llu delivered, %llu dropped, %llu duplicated, %llu repaints\n", "Source",
+        static_cast<unsigned long long>(stats.Delivered), static_cast<unsigned long long>(stats.Dropped),
+        static_cast<unsigned long long>(stats.Duplicated), static_cast<unsigned long long>(stats.Repaints));
+    printf("  %-28s mean %.3fms, jitter %.3fms, p99 %.3fms\n", "Frame time", timing.Mean.count(), timing.Jitter.count(), timing.P99.count());
+
+    // Drops after the last delivered frame don't leave a gap
+    auto trailingDrops = stats.Produced - 1 - lastSequence;
+    auto success = stats.Produced == frameCount && frames == stats.Delivered && stats.PoolFull == 0 &&
+        stats.Delivered + stats.Dropped == stats.Produced && missing + trailingDrops == stats.Dropped && verifyFailures == 0;
+    return run.Check(success);
+}
+
+// Stand-ins for real tests, run by the suite runner's workers (this program
+// started with --suite-worker).
+bool RunStandInTest(std::vector<std::string> const& arguments)
+{
+    auto command = arguments.empty() ? std::string() : arguments[0];
+    if (command == "sleep" && arguments.size() == 2)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(std::stoi(arguments[1])));
+        return true;
+    }
+    if (command == "echo")
+    {
+        for (size_t i = 1; i < arguments.size(); i++)
+        {
+            printf("%s\n", arguments[i].c_str());
+        }
+        // No newline, the result has to end up on its own line anyway
+        printf("done");
+        return true;
+    }
+    if (command == "crash")
+    {
+        std::abort();
+    }
+    if (command == "hang")
+    {
+        while (true)
+        {
+            std::this_thread::sleep_for(std::chrono::hours(1));
+        }
+    }
+    return false;
+}
+
+int RunStandInWorker()
+{
+    auto writeLine = [](std::string const& line)
+    {
+        printf("%s\n", line.c_str());
+        fflush(stdout);
+    };
+    return RunSuiteWorkerLoop(std::cin, writeLine, RunStandInTest);
+}
+
+// Runs stand-in tests through the scheduler and real worker processes,
+// checking verdicts, captured output and that tests sharing a resource
+// never overlapped. Also measures what a test costs on top of its own work.
+bool BenchmarkSuiteRunner(BenchRun& run)
+{
+    auto const workerCount = 4u;
+    std::vector<std::string> const workerCommandLine = { run.Options().ProgramPath, "--suite-worker" };
+    run.BeginGroup("suite", std::to_string(workerCount) + " stand-in workers");
+
+    auto test = [](std::string const& commandLine, SuiteResource resources = SuiteResource::None)
+    {
+        SuiteTest test;
+        test.Name = commandLine;
+        test.Arguments = SplitCommandLine(commandLine);
+        test.Resources = resources;
+        test.Timeout = std::chrono::seconds(10);
+        return test;
+    };
+    std::vector<SuiteTest> tests =
+    {
+        test("echo \"hello world\" again"),
+        test("sleep 200"),
+        test("sleep 150", SuiteResource::Cursor),
+        test("sleep 150", SuiteResource::Cursor),
+        test("sleep 200"),
+        test("sleep 100", SuiteResource::Exclusive),
+        test("sleep 150", SuiteResource::Cursor | SuiteResource::FullscreenOutput),
+        test("sleep 150", SuiteResource::FullscreenOutput),
+        test("fail"),
+        test("crash"),
+        test("hang"),
+        test("sleep 200"),
+        test("sleep 100", SuiteResource::MonitorPower | SuiteResource::Exclusive),
+        test("sleep 200"),
+    };
+    tests[10].Timeout = std::chrono::milliseconds(300);
+
+    SuiteWorkerRunner runner(workerCommandLine, workerCount);
+    SuiteScheduler scheduler(workerCount, [&](uint32_t worker, SuiteTest const& test) { return runner(worker, test); });
+    // Only once, so the process count means something
+    auto report = scheduler.Run(tests);
+    auto time = Timing::Once(report.WallTime);
+    double serialTime = 0.0;
+    for (auto&& result : report.Results)
+    {
+        serialTime += result.WallTime;
+    }
+    auto& mixed = run.Report("Mixed suite", time);
+    mixed.Metrics.emplace_back("serial_ms", serialTime);
+    mixed.Metrics.emplace_back("processes", static_cast<double>(runner.ProcessesStarted()));
+    printf("  %-28s %10.3fms if run one at a time, %llu worker processes\n", "", serialTime, static_cast<unsigned long long>(runner.ProcessesStarted()));
+
+    auto success = report.Results.size() == tests.size() && report.Count(SuiteVerdict::Passed) == tests.size() - 3;
+    // Suite files hold Windows paths, split like CommandLineToArgvW would
+    success &= SplitCommandLine(R"(--json C:\out\a.json)") == std::vector<std::string>{ "--json", R"(C:\out\a.json)" };
+    success &= SplitCommandLine(R"("C:\My Files\" next")") == std::vector<std::string>{ R"(C:\My Files" next)" };
+    success &= SplitCommandLine(R"("C:\My Files\\" next)") == std::vector<std::string>{ R"(C:\My Files\)", "next" };
+    success &= SplitCommandLine(R"(a\\\"b "say ""hi""" \\server\share)") == std::vector<std::string>{ R"(a\"b)", R"(say "hi")", R"(\\server\share)" };
+    success &= report.Results[0].Output == "hello world\nagain\ndone\n";
+    success &= report.Results[8].Verdict == SuiteVerdict::Failed && report.Results[9].Verdict == SuiteVerdict::Crashed &&
+        report.Results[10].Verdict == SuiteVerdict::TimedOut;
+    for (size_t i = 0; i < tests.size(); i++)
+    {
+        for (size_t j = i + 1; j < tests.size(); j++)
+        {
+            auto& first = report.Results[i];
+            auto& second = report.Results[j];
+            auto overlap = first.StartTime < second.StartTime + second.WallTime && second.StartTime < first.StartTime + first.WallTime;
+            success &= !(overlap && SuiteResourcesConflict(tests[i].Resources, tests[j].Resources));
+        }
+    }
+    // Most of the suite can overlap, so it should take well under the serial time
+    success &= report.WallTime < serialTime * 0.75;
+    // A worker is only replaced after a crash or a timeout
+    success &= runner.ProcessesStarted() <= workerCount + 2;
+
+    // What the protocol costs per test, versus starting a new process for each one
+    std::vector<SuiteTest> noOps(200, test("sleep 0"));
+    SuiteWorkerRunner singleRunner(workerCommandLine, 1);
+    SuiteScheduler singleScheduler(1, [&](uint32_t worker, SuiteTest const& test) { return singleRunner(worker, test); });
+    time = run.Measure([&]() { report = singleScheduler.Run(noOps); });
+    run.Report("Persistent worker", time).Metrics.emplace_back("ms_per_test", time.Median / noOps.size());
+    printf("  %-28s %10.3fms per test\n", "", time.Median / noOps.size());
+    success &= report.Passed();
+
+    uint32_t const freshCount = 20;
+    time = run.Measure([&]()
+    {
+        for (uint32_t i = 0; i < freshCount; i++)
+        {
+            SuiteWorkerRunner freshRunner(workerCommandLine, 1);
+            success &= freshRunner(0, noOps[0]).Verdict == SuiteVerdict::Passed;
+        }
+    });
+    run.Report("New process per test", time).Metrics.emplace_back("ms_per_test", time.Median / freshCount);
+    printf("  %-28s %10.3fms per test\n", "", time.Median / freshCount);
+    return run.Check(success);
+}
+
+// What a scaled capture (a window on a monitor with a different DPI, a
+// capture resized for an encoder) does to the rendered pixels
+SyntheticFrame ResampleBilinear(BgraImageView const& image, uint32_t width, uint32_t height)
+{
+    auto frame = CreateSolidFrame(width, height, BgraColor{ 0, 0, 0, 255 });
+    auto scaleX = static_cast<double>(image.Width) / width;
+    auto scaleY = static_cast<double>(image.Height) / height;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        auto sourceY = std::clamp(((y + 0.5) * scaleY) - 0.5, 0.0, image.Height - 1.0);
+        auto y0 = static_cast<uint32_t>(sourceY);
+        auto y1 = std::min(y0 + 1, image.Height - 1);
+        auto fy = sourceY - y0;
+        auto row = frame.Bytes.data() + (static_cast<size_t>(frame.View.RowPitch) * y);
+        for (uint32_t x = 0; x < width; x++)
+        {
+            auto sourceX = std::clamp(((x + 0.5) * scaleX) - 0.5, 0.0, image.Width - 1.0);
+            auto x0 = static_cast<uint32_t>(sourceX);
+            auto x1 = std::min(x0 + 1, image.Width - 1);
+            auto fx = sourceX - x0;
+            for (uint32_t channel = 0; channel < 3; channel++)
+            {
+                auto sample = [&](uint32_t sx, uint32_t sy) { return static_cast<double>(image.Row(sy)[(sx * 4) + channel]); };
+                auto top = (sample(x0, y0) * (1.0 - fx)) + (sample(x1, y0) * fx);
+                auto bottom = (sample(x0, y1) * (1.0 - fx)) + (sample(x1, y1) * fx);
+                row[(x * 4) + channel] = static_cast<uint8_t>(std::lround((top * (1.0 - fy)) + (bottom * fy)));
+            }
+        }
+    }
+    return frame;
+}
+
+// A trip through a video encoder's color conversion: limited range BT.601
+// 4:2:0 in, decoded as BT.709, plus a little noise.
+void AddColorConversionNoise(SyntheticFrame& frame, uint32_t seed)
+{
+    auto& view = frame.View;
+    for (uint32_t blockY = 0; blockY < view.Height; blockY += 2)
+    {
+        for (uint32_t blockX = 0; blockX < view.Width; blockX += 2)
+        {
+            uint8_t* pixels[4] = {};
+            uint32_t count = 0;
+            double cb = 0.0;
+            double cr = 0.0;
+            for (uint32_t y = blockY; y < std::min(blockY + 2, view.Height); y++)
+            {
+                for (uint32_t x = blockX; x < std::min(blockX + 2, view.Width); x++)
+                {
+                    auto pixel = frame.Bytes.data() + (static_cast<size_t>(view.RowPitch) * y) + (x * 4);
+                    cb += 128.0 + (-37.797 * pixel[2] - 74.203 * pixel[1] + 112.0 * pixel[0]) / 255.0;
+                    cr += 128.0 + (112.0 * pixel[2] - 93.786 * pixel[1] - 18.214 * pixel[0]) / 255.0;
+                    pixels[count++] = pixel;
+                }
+            }
+            cb = std::round(cb / count) - 128.0;
+            cr = std::round(cr / count) - 128.0;
+            for (uint32_t i = 0; i < count; i++)
+            {
+                auto pixel = pixels[i];
+                auto luma = std::round(16.0 + (65.481 * pixel[2] + 128.553 * pixel[1] + 24.966 * pixel[0]) / 255.0) - 16.0;
+                seed = (seed * 1664525u) + 1013904223u;
+                auto noise = static_cast<double>(static_cast<int>((seed >> 24) % 9) - 4);
+                auto channel = [&](double value) { return static_cast<uint8_t>(std::clamp(std::lround(value + noise), 0l, 255l)); };
+                pixel[2] = channel(1.164 * luma + 1.793 * cr);
+                pixel[1] = channel(1.164 * luma - 0.213 * cb - 0.533 * cr);
+                pixel[0] = channel(1.164 * luma + 2.112 * cb);
+            }
+        }
+    }
+}
+
+// Stamps frame numbers into busy frames, puts them through scaling and
+// color conversion, and reads them back. Also checks the drop and duplicate
+// accounting against a known delivery pattern.
+bool BenchmarkFrameBarcode(BenchRun& run, uint32_t width, uint32_t height)
+{
+    run.BeginGroup("barcode", std::to_string(width) + "x" + std::to_string(height) + " frames");
+    FrameBarcodeLayout layout;
+    auto frame = CreateVideoLikeFrame(width, height);
+    uint32_t frameNumber = 0;
+    auto time = run.Measure([&]() { layout.Stamp(frame.Bytes.data(), width, height, frame.View.RowPitch, frameNumber++); });
+    run.Report("Stamp", time);
+    std::optional<uint32_t> decoded;
+    time = run.Measure([&]() { decoded = DecodeFrameBarcode(frame.View); });
+    run.Report("Decode", time);
+    auto success = decoded == frameNumber - 1;
+
+    // Every scale the decoder promises to handle, with frame numbers that
+    // exercise every bit
+    uint32_t decodedCount = 0;
+    uint32_t attempts = 0;
+    for (auto scale : { 0.5, 0.625, 0.75, 1.0, 1.25, 1.5, 2.0, 2.5 })
+    {
+        for (auto number : { 0u, 1u, 0x5555aaaau, 0xaaaa5555u, 0xfffffffeu, 123456789u })
+        {
+            layout.Stamp(frame.Bytes.data(), width, height, frame.View.RowPitch, number);
+            auto scaled = ResampleBilinear(frame.View, static_cast<uint32_t>(width * scale), static_cast<uint32_t>(height * scale));
+            AddColorConversionNoise(scaled, number);
+            auto result = DecodeFrameBarcode(scaled.View);
+            attempts++;
+            if (result == number)
+            {
+                decodedCount++;
+            }
+            else
+            {
+                printf("  Failed to read %u at %.3fx\n", number, scale);
+            }
+        }
+    }
+    // Cells don't have to stay square
+    layout.Stamp(frame.Bytes.data(), width, height, frame.View.RowPitch, 42);
+    auto stretched = ResampleBilinear(frame.View, width * 2, height);
+    success &= DecodeFrameBarcode(stretched.View) == 42u;
+    success &= decodedCount == attempts;
+    printf("  %-28s %u of %u scaled and converted frames read back\n", "", decodedCount, attempts);
+
+    // No code, or a damaged one, reads as nothing rather than as the wrong frame
+    auto blank = CreateVideoLikeFrame(width, height);
+    success &= !DecodeFrameBarcode(blank.View);
+    auto flipped = 0u;
+    for (uint32_t column = 1; column < framebarcode::Columns; column++)
+    {
+        layout.Stamp(frame.Bytes.data(), width, height, frame.View.RowPitch, 0x5555aaaau);
+        // Light up the cell that should be dark in both data rows
+        for (uint32_t row = 1; row < 3; row++)
+        {
+            for (uint32_t y = row * layout.CellSize; y < (row + 1) * layout.CellSize; y++)
+            {
+                auto pixels = frame.Bytes.data() + (static_cast<size_t>(frame.View.RowPitch) * y) + (column * layout.CellSize * 4);
+                std::memset(pixels, 0xff, layout.CellSize * 4);
+            }
+        }
+        flipped += DecodeFrameBarcode(frame.View) ? 0 : 1;
+        // Swap the two rows instead, i.e. a clean bit flip the CRC has to catch
+        layout.Stamp(frame.Bytes.data(), width, height, frame.View.RowPitch, 0x5555aaaau);
+        auto bit = framebarcode::CodewordBit(framebarcode::Codeword(0x5555aaaau), column);
+        for (uint32_t y = layout.CellSize; y < 3 * layout.CellSize; y++)
+        {
+            auto lit = (y < 2 * layout.CellSize) != bit;
+            auto pixels = frame.Bytes.data() + (static_cast<size_t>(frame.View.RowPitch) * y) + (column * layout.CellSize * 4);
+            std::memset(pixels, lit ? 0xff : 0x00, layout.CellSize * 4);
+        }
+        flipped += DecodeFrameBarcode(frame.View) ? 0 : 1;
+    }
+    success &= flipped == (framebarcode::Columns - 1) * 2;
+
+    // Render 1000 frames, capture all but every 10th, capture every 50th twice
+    FrameSequenceTracker tracker(64);
+    uint64_t latencyTotal = 0;
+    uint64_t latencyCount = 0;
+    for (uint32_t number = 0; number < 1000; number++)
+    {
+        tracker.Rendered(number, number * 10);
+        if ((number % 10) == 9)
+        {
+            continue;
+        }
+        auto delivery = tracker.Captured(number, (number * 10) + 25);
+        latencyTotal += delivery.Latency.value_or(0);
+        latencyCount += delivery.Latency ? 1 : 0;
+        if ((number % 50) == 0)
+        {
+            success &= tracker.Captured(number, (number * 10) + 30).Duplicate;
+        }
+    }
+    tracker.Captured(std::nullopt, 0);
+    auto stats = tracker.GetStats();
+    success &= stats.Rendered == 1000 && stats.Dropped == 99 && stats.Duplicates == 20 && stats.Unreadable == 1 && stats.OutOfOrder == 0;
+    success &= latencyCount == 900 && latencyTotal == 900 * 25;
+    return run.Check(success);
+}
+
+// Throws bytes away, counting them
+class CountingStreamBuffer : public std::streambuf
+{
+public:
+    uint64_t Count() const { return m_count; }
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        m_count++;
+        return traits_type::not_eof(c);
+    }
+    std::streamsize xsputn(char const*, std::streamsize count) override
+    {
+        m_count += count;
+        return count;
+    }
+
+private:
+    uint64_t m_count = 0;
+};
+
+// Just enough of a JSON parser to tell whether a document is well formed
+class JsonSyntaxChecker
+{
+public:
+    static bool IsValid(std::string_view text)
+    {
+        JsonSyntaxChecker checker(text);
+        auto valid = checker.Value();
+        checker.SkipSpace();
+        return valid && checker.m_position == text.size();
+    }
+
+private:
+    JsonSyntaxChecker(std::string_view text) : m_text(text) {}
+
+    void SkipSpace()
+    {
+        while (m_position < m_text.size() && std::strchr(" \t\r\n", m_text[m_position]) != nullptr)
+        {
+            m_position++;
+        }
+    }
+    bool Take(char c)
+    {
+        SkipSpace();
+        if (m_position < m_text.size() && m_text[m_position] == c)
+        {
+            m_position++;
+            return true;
+        }
+        return false;
+    }
+    bool Literal(std::string_view literal)
+    {
+        if (m_text.substr(m_position, literal.size()) != literal)
+        {
+            return false;
+        }
+        m_position += literal.size();
+        return true;
+    }
+    bool String()
+    {
+        if (!Take('"'))
+        {
+            return false;
+        }
+        while (m_position < m_text.size())
+        {
+            auto c = m_text[m_position++];
+            if (c == '"')
+            {
+                return true;
+            }
+            if (static_cast<uint8_t>(c) < 0x20)
+            {
+                return false;
+            }
+            if (c == '\\')
+            {
+                if (m_position >= m_text.size() || std::strchr("\"\\/bfnrtu", m_text[m_position]) == nullptr)
+                {
+                    return false;
+                }
+                m_position += m_text[m_position] == 'u' ? 5 : 1;
+            }
+        }
+        return false;
+    }
+    bool Number()
+    {
+        auto start = m_position;
+        while (m_position < m_text.size() && std::strchr("+-0123456789.eE", m_text[m_position]) != nullptr)
+        {
+            m_position++;
+        }
+        return m_position > start;
+    }
+    bool Value()
+    {
+        SkipSpace();
+        if (m_position >= m_text.size())
+        {
+            return false;
+        }
+        switch (m_text[m_position])
+        {
+        case '{':
+            m_position++;
+            if (Take('}'))
+            {
+                return true;
+            }
+            do
+            {
+                if (!String() || !Take(':') || !Value())
+                {
+                    return false;
+                }
+            } while (Take(','));
+            return Take('}');
+        case '[':
+            m_position++;
+            if (Take(']'))
+            {
+                return true;
+            }
+            do
+            {
+                if (!Value())
+                {
+                    return false;
+                }
+            } while (Take(','));
+            return Take(']');
+        case '"':
+            return String();
+        case 't':
+            return Literal("true");
+        case 'f':
+            return Literal("false");
+        case 'n':
+            return Literal("null");
+        default:
+            return Number();
+        }
+    }
+
+private:
+    std::string_view m_text;
+    size_t m_position = 0;
+};
+
+// Runs a fake rate test through a TestReport, with a capture thread
+// streaming per-frame records while the test thread records the rest.
+TestResult RunReportedStandIn(std::shared_ptr<TestResultWriter> writer, uint64_t frameCount)
+{
+    auto report = std::make_shared<TestReport>("window-rate", std::vector<std::string>{ "--window", "Stand \"in\"\n" }, writer);
+    FrameTimer<std::chrono::steady_clock::time_point> timer;
+    {
+        auto capturePhase = report->Phase("capture");
+        std::thread capture([&]()
+        {
+            for (uint64_t i = 0; i < frameCount; i++)
+            {
+                auto now = std::chrono::steady_clock::now();
+                timer.RecordTimestamp(now);
+                report->Frame({ i, static_cast<int64_t>(i * 166667), ToTraceTicks(now), 0 });
+            }
+        });
+        capture.join();
+    }
+    report->Count("capture_frames", timer.m_totalFrames);
+    report->Statistics("capture", timer.ComputeStatistics());
+    report->Message("stand-in");
+    return report->Finish(true);
+}
+
+// Streams long runs of per-frame results through the result writer, and
+// checks that what comes out of a short run parses.
+bool BenchmarkResultWriter(BenchRun& run, uint64_t frameCount)
+{
+    run.BeginGroup("results", std::to_string(frameCount) + " frame records");
+    auto success = true;
+    for (auto format : { ResultFormat::Json, ResultFormat::JsonLines })
+    {
+        TestResult result;
+        uint64_t bytes = 0;
+        auto time = run.MeasureOnce([&]()
+        {
+            CountingStreamBuffer buffer;
+            std::ostream stream(&buffer);
+            result = RunReportedStandIn(std::make_shared<TestResultWriter>(stream, format), frameCount);
+            bytes = buffer.Count();
+        });
+        auto& report = run.Report(format == ResultFormat::Json ? "JSON" : "JSON Lines", time, bytes);
+        report.Metrics.emplace_back("frames_per_s", frameCount / (time.Median / 1e3));
+        printf("  %-28s %10.1f bytes per frame\n", "", static_cast<double>(bytes) / frameCount);
+        success &= result.FrameCount == frameCount && result.Passed();
+    }
+
+    // A short run has to come out as valid JSON, line by line for JSON Lines
+    uint64_t const shortCount = 5;
+    std::ostringstream json;
+    auto result = RunReportedStandIn(std::make_shared<TestResultWriter>(json, ResultFormat::Json), shortCount);
+    success &= JsonSyntaxChecker::IsValid(json.str()) && json.str().find("\"frame_count\":5,") != std::string::npos;
+    std::ostringstream jsonLines;
+    RunReportedStandIn(std::make_shared<TestResultWriter>(jsonLines, ResultFormat::JsonLines), shortCount);
+    std::istringstream lines(jsonLines.str());
+    std::string line;
+    std::string lastLine;
+    uint64_t lineCount = 0;
+    while (std::getline(lines, line))
+    {
+        success &= JsonSyntaxChecker::IsValid(line);
+        lineCount++;
+        lastLine = line;
+    }
+    success &= lineCount == shortCount + 2 && lastLine.find("\"type\":\"result\"") == 1;
+    // Nothing per frame is kept once it's written
+    success &= result.Statistics.size() == 1 && result.Statistics[0].second.Intervals == shortCount - 1 && result.Phases.size() == 1;
+
+    // --json and --jsonl work anywhere on the command line
+    std::vector<std::string> arguments = { "window-rate", "--jsonl", "out.jsonl", "--window", "x" };
+    auto output = TakeResultOutputOption(arguments);
+    success &= output && output->Format == ResultFormat::JsonLines && output->Path == "out.jsonl" && arguments.size() == 3;
+    for (auto&& invalid : { std::vector<std::string>{ "alpha", "--json" }, std::vector<std::string>{ "alpha", "--json", "a", "--jsonl", "b" } })
+    {
+        try
+        {
+            auto copy = invalid;
+            TakeResultOutputOption(copy);
+            success = false;
+        }
+        catch (std::runtime_error const&)
+        {
+        }
+    }
+    return run.Check(success);
+}
+
+std::vector<std::string> SplitList(std::string const& list)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        auto end = std::min(list.find(',', start), list.size());
+        if (end > start)
+        {
+            items.push_back(list.substr(start, end - start));
+        }
+        start = end + 1;
+    }
+    return items;
+}
+
+
+// Many capture sessions at once, on synthetic sources standing in for
+// free threaded frame pools: 1, 2, 4 ... maxSessions 60fps sources, each
+// session's handler hashing its frames on a work-stealing pool. How
+// delivery rate, latency and CPU cost hold up as sessions are added.
+bool BenchmarkCaptureStress(BenchRun& run, uint32_t maxSessions)
+{
+    auto const width = 640u;
+    auto const height = 360u;
+    auto window = run.Options().BudgetMilliseconds > 0.0 ? std::chrono::milliseconds(1000) : std::chrono::milliseconds(300);
+    run.BeginGroup("stress", "1 to " + std::to_string(maxSessions) + " sessions of 60fps " + std::to_string(width) + "x" + std::to_string(height) + ", " +
+        std::to_string(window.count()) + "ms each");
+    auto success = true;
+
+    WorkStealingPool pool(std::max(2u, std::thread::hardware_concurrency()));
+    auto start = [&](StressSession& session) -> std::function<void()>
+    {
+        SyntheticFrameSourceOptions options;
+        options.Width = width;
+        options.Height = height;
+        options.FramesPerSecond = 60.0;
+        options.Seed = session.Index() + 1;
+        options.Script.push_back({ 0, SolidColorPainter(BgraColor{ static_cast<uint8_t>(session.Index() * 4), 128, 255, 255 }), false });
+        // The handler keeps the source alive for a run that's still queued
+        // when the session stops
+        auto source = std::make_shared<SyntheticFrameSource>(options);
+        session.SetHandler([source](StressSession& session)
+        {
+            while (auto frame = source->TryGetNextFrame())
+            {
+                auto now = std::chrono::duration_cast<FrameTimeSpan>(std::chrono::steady_clock::now().time_since_epoch());
+                HashImage(frame->Surface());
+                session.RecordFrame(now - frame->SystemRelativeTime(), frame->Sequence());
+            }
+        });
+        source->FrameArrived([&session](IFrameSource&) { session.Signal(); });
+        source->StartCapture();
+        return [source]() { source->Close(); };
+    };
+    auto name = [](uint32_t index) { return "synthetic " + std::to_string(index); };
+
+    std::vector<StressLevelResult> levels;
+    for (auto sessions : StressSessionCounts(maxSessions))
+    {
+        auto level = RunStressLevel(sessions, window, pool, start, name);
+        auto toMilliseconds = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::milli>(value).count(); };
+        auto& result = run.Report(std::to_string(sessions) + " sessions", Timing::Once(std::chrono::duration<double, std::milli>(level.Window).count()));
+        result.Metrics.emplace_back("fps", level.AggregateFramesPerSecond);
+        result.Metrics.emplace_back("min_session_fps", level.MinSessionFramesPerSecond);
+        result.Metrics.emplace_back("p50_ms", toMilliseconds(level.Latency.Percentile(50.0)));
+        result.Metrics.emplace_back("p99_ms", toMilliseconds(level.Latency.Percentile(99.0)));
+        result.Metrics.emplace_back("cpu_percent", level.CpuCores() * 100.0);
+        result.Metrics.emplace_back("us_per_frame", level.CpuMicrosecondsPerFrame());
+        // Sessions starving once the machine is saturated is what this is
+        // here to show, so only one session on its own has to keep up
+        success &= level.PerSession.size() == sessions && level.Frames > 0 && level.Delivered >= level.Frames;
+        // Latency covers exactly the frames the rates do
+        for (auto&& session : level.PerSession)
+        {
+            success &= session.Latency.Count() == session.Frames;
+        }
+        if (sessions == 1)
+        {
+            success &= level.AggregateFramesPerSecond > 50.0 && level.AggregateFramesPerSecond < 70.0;
+        }
+        levels.push_back(std::move(level));
+    }
+    printf("\n");
+    PrintStressReport(levels);
+    return run.Check(success);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> args(argv + 1, argv + argc);
+    if (args.size() == 1 && args[0] == "--suite-worker")
+    {
+        return RunStandInWorker();
+    }
+
+    BenchOptions options;
+    options.ProgramPath = argv[0];
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        if (args[i] == "--json" && i + 1 < args.size())
+        {
+            options.JsonPath = args[++i];
+        }
+        else if (args[i] == "--label" && i + 1 < args.size())
+        {
+            options.Label = args[++i];
+        }
+        else if (args[i] == "--groups" && i + 1 < args.size())
+        {
+            options.Groups = SplitList(args[++i]);
+        }
+        else if (args[i] == "--sizes" && i + 1 < args.size())
+        {
+            options.Sizes.clear();
+            for (auto&& name : SplitList(args[++i]))
+            {
+                auto size = std::find_if(CorpusSizes.begin(), CorpusSizes.end(), [&](FrameSize const& size) { return name == size.Name; });
+                if (size == CorpusSizes.end())
+                {
+                    PrintUsage();
+                    return 1;
+                }
+                options.Sizes.push_back(*size);
+            }
+        }
+        else if (args[i] == "--quick")
+        {
+            options.MinIterations = 1;
+            options.BudgetMilliseconds = 0.0;
+        }
+        else
+        {
+            PrintUsage();
+            return 1;
+        }
+    }
+
+    BenchRun run(options);
+    auto corpusBenchmarks = std::vector<std::pair<std::string, std::function<bool(BenchRun&, FrameSize const&)>>>
+    {
+        { "copy", BenchmarkCopy },
+        { "readback", BenchmarkReadback },
+        { "verify", BenchmarkVerifyRegion },
+        { "diff", BenchmarkImageDiff },
+        { "hash", BenchmarkHash },
+        { "dirty", BenchmarkDirtyTiles },
+        { "i420", BenchmarkI420 },
+        { "kernels", BenchmarkPixelKernels },
+        { "hdr", BenchmarkHdrAnalysis },
+        { "hdr-save", BenchmarkHdrSave },
+        { "png", BenchmarkPngEncode },
+        { "reference", BenchmarkReferenceRasterizer },
+        { "golden", BenchmarkGolden },
+    };
+    for (auto&& size : options.Sizes)
+    {
+        for (auto&& [group, benchmark] : corpusBenchmarks)
+        {
+            if (run.Enabled(group))
+            {
+                benchmark(run, size);
+            }
+        }
+    }
+    if (run.Enabled("kernels-exhaustive"))
+    {
+        TestPixelKernelsExhaustively(run);
+    }
+    if (run.Enabled("artifact-writer"))
+    {
+        BenchmarkArtifactWriter(run, 1920, 1080, 16);
+    }
+    if (run.Enabled("buffer-pool"))
+    {
+        StressBufferPool(run, false);
+        StressBufferPool(run, true);
+    }
+    if (run.Enabled("pipeline"))
+    {
+        BenchmarkSyntheticPipeline(run, 1280, 720, 6000);
+    }
+    if (run.Enabled("suite"))
+    {
+        BenchmarkSuiteRunner(run);
+    }
+    if (run.Enabled("results"))
+    {
+        BenchmarkResultWriter(run, 1000000);
+    }
+    if (run.Enabled("barcode"))
+    {
+        BenchmarkFrameBarcode(run, 1280, 720);
+    }
+    if (run.Enabled("trace"))
+    {
+        BenchmarkFrameTrace(run, 1000000);
+    }
+    if (run.Enabled("record"))
+    {
+        BenchmarkVideoRecorder(run, 120);
+    }
+    if (run.Enabled("histogram"))
+    {
+        TestLatencyHistogram(run);
+    }
+    if (run.Enabled("frame-pool-sim"))
+    {
+        BenchmarkFramePoolSimulator(run);
+    }
+    if (run.Enabled("spsc"))
+    {
+        BenchmarkSpscRing(run, 1000000);
+    }
+    if (run.Enabled("completion"))
+    {
+        BenchmarkCompletionSource(run, 20000);
+    }
+    if (run.Enabled("stress"))
+    {
+        BenchmarkCaptureStress(run, 64);
+    }
+
+    if (!options.JsonPath.empty())
+    {
+        std::ofstream json(options.JsonPath, std::ios::binary);
+        run.WriteJson(json);
+        if (!json)
+        {
+            printf("Failed to write %s\n", options.JsonPath.c_str());
+            return 1;
+        }
+        printf("JSON results saved: %s\n", options.JsonPath.c_str());
+    }
+    printf("Benchmark result: %s\n", run.Passed() ? "PASSED" : "FAILED");
+    return run.Passed() ? 0 : 1;
+}
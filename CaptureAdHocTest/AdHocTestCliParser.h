@@ -16,10 +16,17 @@ public:
             throw std::runtime_error("Strictly one fullscreen mode required!");
         }
 
-        return testparams::TestParams(testparams::FullscreenRate
+        auto result = testparams::FullscreenRate
         {
             setFullscreenState ? testparams::FullscreenMode::SetFullscreenState : testparams::FullscreenMode::FullscreenWindow
-        });
+        };
+
+        if (matches.IsPresent(L"--trace"))
+        {
+            result.TracePath = matches.ValueOf(L"--trace");
+        }
+
+        return testparams::TestParams(result);
     }
 
     static testparams::TestParams ValidateFullscreenTransition(robmikh::common::wcli::Matches& matches)
@@ -54,6 +61,28 @@ public:
             result.Duration = std::chrono::seconds(std::stoi(durationString));
         }
 
+        if (matches.IsPresent(L"--trace"))
+        {
+            result.TracePath = matches.ValueOf(L"--trace");
+        }
+
+        result.HashFrames = matches.IsPresent(L"--hash");
+
+        if (matches.IsPresent(L"--tiles"))
+        {
+            auto tileSize = std::stoi(matches.ValueOf(L"--tiles"));
+            if (tileSize < 8 || tileSize > 512)
+            {
+                throw std::runtime_error("Tile size must be between 8 and 512!");
+            }
+            result.DirtyTileSize = static_cast<uint32_t>(tileSize);
+        }
+
+        if (matches.IsPresent(L"--record"))
+        {
+            result.RecordPath = matches.ValueOf(L"--record");
+        }
+
         return testparams::TestParams(result);
     }
 
@@ -69,6 +98,22 @@ public:
         return testparams::TestParams(testparams::CursorDisable{ monitor, window });
     }
 
+    static testparams::TestParams ValidateHDRContent(robmikh::common::wcli::Matches& matches)
+    {
+        auto adHocMode = matches.IsPresent(L"--adhoc");
+        auto automatedMode = matches.IsPresent(L"--automated");
+        if (adHocMode && automatedMode)
+        {
+            throw std::runtime_error("Strictly one test mode required!");
+        }
+
+        // Ad hoc is the default, since that's all this test used to do
+        return testparams::TestParams(testparams::HDRContent
+        {
+            automatedMode ? testparams::HDRContentTestMode::Automated : testparams::HDRContentTestMode::AdHoc
+        });
+    }
+
     static testparams::TestParams ValidateDisplayAffinity(robmikh::common::wcli::Matches& matches)
     {
         auto none = matches.IsPresent(L"--none");
@@ -122,6 +167,69 @@ public:
             });
     }
 
+    static testparams::TestParams ValidateSuite(robmikh::common::wcli::Matches& matches)
+    {
+        auto result = testparams::Suite();
+        result.SuitePath = matches.ValueOf(L"--file");
+
+        if (matches.IsPresent(L"--workers"))
+        {
+            auto workers = std::stoi(matches.ValueOf(L"--workers"));
+            if (workers < 1)
+            {
+                throw std::runtime_error("At least one worker required!");
+            }
+            result.Workers = static_cast<uint32_t>(workers);
+        }
+
+        if (matches.IsPresent(L"--timeout"))
+        {
+            auto timeoutString = matches.ValueOf(L"--timeout");
+            result.Timeout = std::chrono::seconds(std::stoi(timeoutString));
+        }
+
+        return testparams::TestParams(result);
+    }
+
+    static testparams::TestParams ValidateCaptureStress(robmikh::common::wcli::Matches& matches)
+    {
+        auto result = testparams::CaptureStress();
+        auto windows = matches.IsPresent(L"--windows");
+        auto monitors = matches.IsPresent(L"--monitors");
+        if (windows != monitors)
+        {
+            result.Source = windows ? testparams::CaptureStressSource::Windows : testparams::CaptureStressSource::Monitors;
+        }
+
+        if (matches.IsPresent(L"--sessions"))
+        {
+            auto sessions = std::stoi(matches.ValueOf(L"--sessions"));
+            if (sessions < 1 || sessions > 256)
+            {
+                throw std::runtime_error("Sessions must be between 1 and 256!");
+            }
+            result.MaxSessions = static_cast<uint32_t>(sessions);
+        }
+
+        if (matches.IsPresent(L"--duration"))
+        {
+            auto durationString = matches.ValueOf(L"--duration");
+            result.Duration = std::chrono::seconds(std::stoi(durationString));
+        }
+
+        if (matches.IsPresent(L"--workers"))
+        {
+            auto workers = std::stoi(matches.ValueOf(L"--workers"));
+            if (workers < 1)
+            {
+                throw std::runtime_error("At least one worker required!");
+            }
+            result.Workers = static_cast<uint32_t>(workers);
+        }
+
+        return testparams::TestParams(result);
+    }
+
 private:
     AdHocTestCliValidator() {}
 };
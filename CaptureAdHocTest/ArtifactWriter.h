@@ -0,0 +1,273 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BoundedQueue.h"
+#include "BufferPool.h"
+#include "ExrEncoder.h"
+#include "FrameTimer.h"
+#include "HalfFloat.h"
+#include "ImageView.h"
+#include "PngEncoder.h"
+#include "ToneMap.h"
+
+enum class ArtifactPixelFormat
+{
+    // Written as a PNG
+    Bgra8,
+    // R16G16B16A16Float, written as an EXR
+    HalfFloat,
+};
+
+// An image that owns its pixels, waiting to be saved
+struct ImageArtifact
+{
+    std::filesystem::path Path;
+    BufferLease Pixels;
+    ArtifactPixelFormat Format = ArtifactPixelFormat::Bgra8;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t RowPitch = 0;
+    // Whether the pixels have premultiplied alpha, which captured surfaces do
+    bool Premultiplied = false;
+    // For HalfFloat images, where to also write a tone mapped 8-bit PNG
+    std::filesystem::path PreviewPath;
+    ToneMapOptions PreviewToneMap;
+
+    BgraImageView View() const { return BgraImageView{ Pixels.Data(), Width, Height, RowPitch }; }
+    HalfImageView HalfView() const { return HalfImageView{ Pixels.Data(), Width, Height, RowPitch }; }
+
+    // Copies the image, without its row padding, into a pooled buffer
+    static ImageArtifact Copy(std::filesystem::path const& path, BgraImageView const& image, BufferPool& pool = BufferPool::Shared())
+    {
+        return CopyRows(path, ArtifactPixelFormat::Bgra8, image.Data, image.Width, image.Height, image.RowPitch, BgraImageView::BytesPerPixel, pool);
+    }
+
+    static ImageArtifact Copy(std::filesystem::path const& path, HalfImageView const& image, BufferPool& pool = BufferPool::Shared())
+    {
+        return CopyRows(path, ArtifactPixelFormat::HalfFloat, image.Data, image.Width, image.Height, image.RowPitch, HalfImageView::BytesPerPixel, pool);
+    }
+
+private:
+    static ImageArtifact CopyRows(std::filesystem::path const& path, ArtifactPixelFormat format, uint8_t const* data, uint32_t width, uint32_t height, uint32_t rowPitch, uint32_t bytesPerPixel, BufferPool& pool)
+    {
+        ImageArtifact artifact;
+        artifact.Path = path;
+        artifact.Format = format;
+        artifact.Width = width;
+        artifact.Height = height;
+        artifact.RowPitch = width * bytesPerPixel;
+        artifact.Pixels = pool.Lease(static_cast<size_t>(artifact.RowPitch) * height);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            std::memcpy(artifact.Pixels.Data() + (static_cast<size_t>(artifact.RowPitch) * y), data + (static_cast<size_t>(rowPitch) * y), artifact.RowPitch);
+        }
+        return artifact;
+    }
+};
+
+struct ArtifactWriterStats
+{
+    uint64_t Queued = 0;
+    uint64_t Written = 0;
+    uint64_t Dropped = 0;
+    uint64_t Failed = 0;
+    uint64_t BytesWritten = 0;
+    // The most recent artifact that was thrown away, either the one being
+    // queued or (with DropOldest) the older one it replaced
+    std::filesystem::path LastDropped;
+    size_t MaxQueueDepth = 0;
+    // Time from Enqueue until a worker picked the artifact up
+    LatencyHistogram QueueLatency;
+    // Time to encode and write the file
+    LatencyHistogram EncodeLatency;
+    std::string LastError;
+};
+
+// Encodes and writes images as PNGs (or EXRs) on background threads, so saving a
+// failure doesn't hold up the test that found it. When the queue is full
+// Enqueue either waits or drops, depending on the policy.
+class ArtifactWriter
+{
+public:
+    static ArtifactWriter& Shared()
+    {
+        // Queued artifacts hold leases, so the pool has to be destroyed last
+        BufferPool::Shared();
+        static ArtifactWriter writer(2, 4, QueueFullPolicy::Block);
+        return writer;
+    }
+
+    ArtifactWriter(uint32_t workerCount, size_t capacity, QueueFullPolicy policy) : m_queue(capacity, policy)
+    {
+        for (uint32_t i = 0; i < std::max(1u, workerCount); i++)
+        {
+            m_workers.emplace_back([this]() { WorkerLoop(); });
+        }
+    }
+    ~ArtifactWriter()
+    {
+        Close();
+    }
+
+    ArtifactWriter(ArtifactWriter const&) = delete;
+    ArtifactWriter& operator=(ArtifactWriter const&) = delete;
+
+    // Returns false if this artifact was dropped. With DropOldest it's queued
+    // in place of an older one, which is counted as the dropped artifact.
+    bool Enqueue(ImageArtifact&& artifact)
+    {
+        {
+            std::lock_guard lock(m_lock);
+            m_stats.Queued++;
+            m_outstanding++;
+        }
+        Pending pending{ std::move(artifact), std::chrono::steady_clock::now() };
+        std::optional<Pending> evicted;
+        auto result = m_queue.Push(std::move(pending), &evicted);
+        auto queued = result == QueuePushResult::Queued || result == QueuePushResult::QueuedDroppedOldest;
+        if (!queued || evicted)
+        {
+            // Either way one artifact won't be written: this one, or the evicted one
+            std::lock_guard lock(m_lock);
+            m_stats.Dropped++;
+            m_stats.LastDropped = queued ? evicted->Artifact.Path : pending.Artifact.Path;
+            m_outstanding--;
+        }
+        m_idle.notify_all();
+        return queued;
+    }
+
+    // Waits for everything queued so far to be written
+    void Flush()
+    {
+        std::unique_lock lock(m_lock);
+        m_idle.wait(lock, [this]() { return m_outstanding == 0; });
+    }
+
+    // Flushes and stops the workers. Later artifacts are dropped.
+    void Close()
+    {
+        Flush();
+        m_queue.Close();
+        for (auto&& worker : m_workers)
+        {
+            if (worker.joinable())
+            {
+                worker.join();
+            }
+        }
+    }
+
+    ArtifactWriterStats Stats() const
+    {
+        std::lock_guard lock(m_lock);
+        auto stats = m_stats;
+        stats.MaxQueueDepth = m_queue.MaxDepth();
+        return stats;
+    }
+
+private:
+    struct Pending
+    {
+        ImageArtifact Artifact;
+        std::chrono::steady_clock::time_point QueuedAt;
+    };
+
+    void WorkerLoop()
+    {
+        // The workers already run in parallel, so 8-bit artifacts stay off the
+        // band pool where they'd hold up the tests' own verification. FP16
+        // dumps are rare and a 4k one is 66MB of halves, so those use it.
+        PngOptions options;
+        options.Parallel = false;
+        // A preview is only there to be looked at, the EXR has the pixels
+        PngOptions previewOptions;
+        previewOptions.Fast = true;
+        std::optional<ToneMapTable> toneMapTable;
+        while (auto pending = m_queue.Pop())
+        {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t bytes = 0;
+            std::string error;
+            try
+            {
+                auto& artifact = pending->Artifact;
+                if (artifact.Format == ArtifactPixelFormat::HalfFloat)
+                {
+                    // Leased, so a repeat dump doesn't fault in a fresh buffer
+                    auto exrSize = ExrEncodedSize(artifact.Width, artifact.Height);
+                    auto exr = BufferPool::Shared().Lease(exrSize);
+                    EncodeExr(artifact.HalfView(), exr.Data());
+                    WriteFileBytes(artifact.Path, exr.Data(), exrSize);
+                    bytes = exrSize;
+                    if (!artifact.PreviewPath.empty())
+                    {
+                        // Failures in one test tend to use the same curve
+                        auto const& toneMap = artifact.PreviewToneMap;
+                        if (!toneMapTable || toneMapTable->Options().Operator != toneMap.Operator || toneMapTable->Options().WhitePoint != toneMap.WhitePoint)
+                        {
+                            toneMapTable.emplace(toneMap);
+                        }
+                        auto preview = ImageArtifact();
+                        preview.Width = artifact.Width;
+                        preview.Height = artifact.Height;
+                        preview.RowPitch = artifact.Width * BgraImageView::BytesPerPixel;
+                        preview.Pixels = BufferPool::Shared().Lease(static_cast<size_t>(preview.RowPitch) * preview.Height);
+                        ToneMapToBgraParallel(artifact.HalfView(), preview.Pixels.Data(), preview.RowPitch, *toneMapTable);
+                        auto png = EncodePng(preview.View(), previewOptions);
+                        WriteFileBytes(artifact.PreviewPath, png);
+                        bytes += png.size();
+                    }
+                }
+                else
+                {
+                    options.Premultiplied = artifact.Premultiplied;
+                    auto png = EncodePng(artifact.View(), options);
+                    WriteFileBytes(artifact.Path, png);
+                    bytes = png.size();
+                }
+            }
+            catch (std::exception const& exception)
+            {
+                error = exception.what();
+            }
+            auto end = std::chrono::steady_clock::now();
+
+            {
+                std::lock_guard lock(m_lock);
+                m_stats.QueueLatency.Record(start - pending->QueuedAt);
+                m_stats.EncodeLatency.Record(end - start);
+                if (error.empty())
+                {
+                    m_stats.Written++;
+                    m_stats.BytesWritten += bytes;
+                }
+                else
+                {
+                    m_stats.Failed++;
+                    m_stats.LastError = error;
+                }
+                m_outstanding--;
+            }
+            m_idle.notify_all();
+        }
+    }
+
+private:
+    BoundedQueue<Pending> m_queue;
+    std::vector<std::thread> m_workers;
+    mutable std::mutex m_lock;
+    std::condition_variable m_idle;
+    ArtifactWriterStats m_stats;
+    uint64_t m_outstanding = 0;
+};
@@ -0,0 +1,132 @@
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+// What Push does when the queue is already full
+enum class QueueFullPolicy
+{
+    // Wait until a consumer makes room
+    Block,
+    // Throw away the item being pushed
+    DropNewest,
+    // Throw away the oldest queued item to make room
+    DropOldest,
+};
+
+enum class QueuePushResult
+{
+    Queued,
+    // Queued, but the oldest item was thrown away to make room
+    QueuedDroppedOldest,
+    Dropped,
+    Closed,
+};
+
+// A multi-producer, multi-consumer queue with a fixed capacity.
+template <typename T>
+class BoundedQueue
+{
+public:
+    BoundedQueue(size_t capacity, QueueFullPolicy policy) : m_capacity(std::max<size_t>(1, capacity)), m_policy(policy) {}
+
+    BoundedQueue(BoundedQueue const&) = delete;
+    BoundedQueue& operator=(BoundedQueue const&) = delete;
+
+    // The item is only moved from if it was queued. With DropOldest, the item
+    // thrown away to make room is moved into evicted, when that's given.
+    QueuePushResult Push(T&& item, std::optional<T>* evicted = nullptr)
+    {
+        auto result = QueuePushResult::Queued;
+        {
+            std::unique_lock lock(m_lock);
+            if (m_policy == QueueFullPolicy::Block)
+            {
+                m_notFull.wait(lock, [this]() { return m_closed || m_items.size() < m_capacity; });
+            }
+            if (m_closed)
+            {
+                return QueuePushResult::Closed;
+            }
+            if (m_items.size() >= m_capacity)
+            {
+                if (m_policy == QueueFullPolicy::DropNewest)
+                {
+                    m_dropped++;
+                    return QueuePushResult::Dropped;
+                }
+                if (evicted != nullptr)
+                {
+                    evicted->emplace(std::move(m_items.front()));
+                }
+                m_items.pop_front();
+                m_dropped++;
+                result = QueuePushResult::QueuedDroppedOldest;
+            }
+            m_items.push_back(std::move(item));
+            m_maxDepth = std::max(m_maxDepth, m_items.size());
+        }
+        m_notEmpty.notify_one();
+        return result;
+    }
+
+    // Waits for an item. Returns nothing once the queue is closed and empty.
+    std::optional<T> Pop()
+    {
+        std::optional<T> item;
+        {
+            std::unique_lock lock(m_lock);
+            m_notEmpty.wait(lock, [this]() { return m_closed || !m_items.empty(); });
+            if (m_items.empty())
+            {
+                return std::nullopt;
+            }
+            item.emplace(std::move(m_items.front()));
+            m_items.pop_front();
+        }
+        m_notFull.notify_one();
+        return item;
+    }
+
+    // Wakes everyone up. Items already queued can still be popped.
+    void Close()
+    {
+        {
+            std::lock_guard lock(m_lock);
+            m_closed = true;
+        }
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+    size_t Size() const
+    {
+        std::lock_guard lock(m_lock);
+        return m_items.size();
+    }
+    size_t MaxDepth() const
+    {
+        std::lock_guard lock(m_lock);
+        return m_maxDepth;
+    }
+    uint64_t Dropped() const
+    {
+        std::lock_guard lock(m_lock);
+        return m_dropped;
+    }
+    size_t Capacity() const { return m_capacity; }
+
+private:
+    mutable std::mutex m_lock;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<T> m_items;
+    size_t m_capacity;
+    QueueFullPolicy m_policy;
+    size_t m_maxDepth = 0;
+    uint64_t m_dropped = 0;
+    bool m_closed = false;
+};
@@ -0,0 +1,348 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+struct BufferPoolOptions
+{
+    // Try to back buffers of at least HugePageSize with huge (large) pages.
+    // Falls back to normal pages when the OS won't give us any.
+    bool UseHugePages = false;
+    // Returned buffers beyond this are freed instead of kept
+    size_t MaxCachedBytes = 512ull * 1024 * 1024;
+};
+
+struct BufferPoolStats
+{
+    uint64_t Leases = 0;
+    // Leases that had to go to the OS for memory
+    uint64_t SystemAllocations = 0;
+    uint64_t HugePageAllocations = 0;
+    uint64_t BytesLeased = 0;
+    uint64_t BytesCached = 0;
+    uint64_t PeakBytes = 0;
+};
+
+class BufferPool;
+
+// A buffer borrowed from a BufferPool, returned when the lease is destroyed.
+// The pool has to outlive its leases.
+class BufferLease
+{
+public:
+    BufferLease() = default;
+    BufferLease(BufferLease&& other) noexcept { *this = std::move(other); }
+    BufferLease& operator=(BufferLease&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            m_pool = std::exchange(other.m_pool, nullptr);
+            m_data = std::exchange(other.m_data, nullptr);
+            m_size = std::exchange(other.m_size, 0);
+            m_capacity = std::exchange(other.m_capacity, 0);
+            m_classIndex = other.m_classIndex;
+            m_mapped = other.m_mapped;
+        }
+        return *this;
+    }
+    ~BufferLease() { Reset(); }
+
+    BufferLease(BufferLease const&) = delete;
+    BufferLease& operator=(BufferLease const&) = delete;
+
+    uint8_t* Data() const { return m_data; }
+    // What was asked for
+    size_t Size() const { return m_size; }
+    // What the buffer can actually hold
+    size_t Capacity() const { return m_capacity; }
+    explicit operator bool() const { return m_data != nullptr; }
+
+    inline void Reset();
+
+private:
+    friend class BufferPool;
+
+    BufferPool* m_pool = nullptr;
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    size_t m_capacity = 0;
+    uint32_t m_classIndex = 0;
+    bool m_mapped = false;
+};
+
+// Recycles large, 64 byte aligned buffers (frame readbacks, artifacts) so a
+// steady stream of same sized frames doesn't go back to the heap. Requests
+// are rounded up to a size class: four classes per power of two, so at most
+// 25% is wasted. Each class has its own lock.
+class BufferPool
+{
+public:
+    static constexpr size_t Alignment = 64;
+    static constexpr size_t MinClassSize = 4096;
+    static constexpr size_t HugePageSize = 2 * 1024 * 1024;
+    static constexpr uint32_t ClassCount = 1 + (4 * (48 - 12));
+
+    static BufferPool& Shared()
+    {
+        static BufferPool pool;
+        return pool;
+    }
+
+    BufferPool(BufferPoolOptions const& options = {}) : m_options(options) {}
+    ~BufferPool()
+    {
+        Trim();
+    }
+
+    BufferPool(BufferPool const&) = delete;
+    BufferPool& operator=(BufferPool const&) = delete;
+
+    static uint32_t ClassIndex(size_t size)
+    {
+        if (size <= MinClassSize)
+        {
+            return 0;
+        }
+        // 2^bits < size <= 2^(bits + 1)
+        uint32_t bits = 12;
+        while ((size_t(1) << (bits + 1)) < size)
+        {
+            bits++;
+        }
+        auto step = size_t(1) << (bits - 2);
+        auto quarter = ((size - (size_t(1) << bits)) + step - 1) / step;
+        return 1 + ((bits - 12) * 4) + static_cast<uint32_t>(quarter - 1);
+    }
+
+    static size_t ClassSize(uint32_t index)
+    {
+        if (index == 0)
+        {
+            return MinClassSize;
+        }
+        auto bits = 12 + ((index - 1) / 4);
+        auto quarter = ((index - 1) % 4) + 1;
+        return (size_t(1) << bits) + (quarter * (size_t(1) << (bits - 2)));
+    }
+
+    BufferLease Lease(size_t size)
+    {
+        auto index = ClassIndex(std::max<size_t>(size, 1));
+        if (index >= ClassCount)
+        {
+            throw std::bad_alloc();
+        }
+
+        Block block;
+        auto& sizeClass = m_classes[index];
+        {
+            std::lock_guard lock(sizeClass.Lock);
+            if (!sizeClass.Free.empty())
+            {
+                block = sizeClass.Free.back();
+                sizeClass.Free.pop_back();
+            }
+        }
+        if (block.Data != nullptr)
+        {
+            m_bytesCached -= block.Capacity;
+        }
+        else
+        {
+            block = Allocate(ClassSize(index));
+        }
+
+        m_leases++;
+        auto leased = (m_bytesLeased += block.Capacity);
+        UpdatePeak(leased + m_bytesCached.load());
+
+        BufferLease lease;
+        lease.m_pool = this;
+        lease.m_data = block.Data;
+        lease.m_size = size;
+        lease.m_capacity = block.Capacity;
+        lease.m_classIndex = index;
+        lease.m_mapped = block.Mapped;
+        return lease;
+    }
+
+    // Frees every cached buffer
+    void Trim()
+    {
+        for (auto&& sizeClass : m_classes)
+        {
+            std::vector<Block> blocks;
+            {
+                std::lock_guard lock(sizeClass.Lock);
+                blocks.swap(sizeClass.Free);
+            }
+            for (auto&& block : blocks)
+            {
+                m_bytesCached -= block.Capacity;
+                Free(block);
+            }
+        }
+    }
+
+    BufferPoolStats Stats() const
+    {
+        BufferPoolStats stats;
+        stats.Leases = m_leases.load();
+        stats.SystemAllocations = m_systemAllocations.load();
+        stats.HugePageAllocations = m_hugePageAllocations.load();
+        stats.BytesLeased = m_bytesLeased.load();
+        stats.BytesCached = m_bytesCached.load();
+        stats.PeakBytes = m_peakBytes.load();
+        return stats;
+    }
+
+private:
+    friend class BufferLease;
+
+    struct Block
+    {
+        uint8_t* Data = nullptr;
+        size_t Capacity = 0;
+        bool Mapped = false;
+    };
+
+    struct SizeClass
+    {
+        std::mutex Lock;
+        std::vector<Block> Free;
+    };
+
+    void Return(BufferLease& lease)
+    {
+        Block block{ lease.m_data, lease.m_capacity, lease.m_mapped };
+        m_bytesLeased -= block.Capacity;
+        if (m_bytesCached.load() + block.Capacity > m_options.MaxCachedBytes)
+        {
+            Free(block);
+            return;
+        }
+        m_bytesCached += block.Capacity;
+        auto& sizeClass = m_classes[lease.m_classIndex];
+        std::lock_guard lock(sizeClass.Lock);
+        sizeClass.Free.push_back(block);
+    }
+
+    void UpdatePeak(uint64_t bytes)
+    {
+        auto peak = m_peakBytes.load();
+        while (bytes > peak && !m_peakBytes.compare_exchange_weak(peak, bytes))
+        {
+        }
+    }
+
+    Block Allocate(size_t capacity)
+    {
+        m_systemAllocations++;
+        if (m_options.UseHugePages && capacity >= HugePageSize)
+        {
+            auto block = AllocateHugePages(capacity);
+            if (block.Data != nullptr)
+            {
+                m_hugePageAllocations++;
+                return block;
+            }
+        }
+#if defined(_WIN32)
+        auto data = static_cast<uint8_t*>(_aligned_malloc(capacity, Alignment));
+#else
+        auto data = static_cast<uint8_t*>(std::aligned_alloc(Alignment, capacity));
+#endif
+        if (data == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+        return Block{ data, capacity, false };
+    }
+
+    // The mapping is rounded up to whole huge pages, so the block's capacity
+    // may end up larger than its class size.
+    static Block AllocateHugePages(size_t capacity)
+    {
+#if defined(_WIN32)
+        // Needs SeLockMemoryPrivilege, which most accounts don't have
+        auto largePage = GetLargePageMinimum();
+        if (largePage == 0)
+        {
+            return {};
+        }
+        capacity = ((capacity + largePage - 1) / largePage) * largePage;
+        auto data = VirtualAlloc(nullptr, capacity, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        return Block{ static_cast<uint8_t*>(data), capacity, data != nullptr };
+#else
+        capacity = ((capacity + HugePageSize - 1) / HugePageSize) * HugePageSize;
+        auto data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (data == MAP_FAILED)
+        {
+            // No reserved huge pages, ask for transparent ones instead
+            data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (data == MAP_FAILED)
+            {
+                return {};
+            }
+            madvise(data, capacity, MADV_HUGEPAGE);
+        }
+        return Block{ static_cast<uint8_t*>(data), capacity, true };
+#endif
+    }
+
+    static void Free(Block const& block)
+    {
+        if (block.Mapped)
+        {
+#if defined(_WIN32)
+            VirtualFree(block.Data, 0, MEM_RELEASE);
+#else
+            munmap(block.Data, block.Capacity);
+#endif
+            return;
+        }
+#if defined(_WIN32)
+        _aligned_free(block.Data);
+#else
+        std::free(block.Data);
+#endif
+    }
+
+private:
+    BufferPoolOptions m_options;
+    std::array<SizeClass, ClassCount> m_classes;
+    std::atomic<uint64_t> m_leases = 0;
+    std::atomic<uint64_t> m_systemAllocations = 0;
+    std::atomic<uint64_t> m_hugePageAllocations = 0;
+    std::atomic<uint64_t> m_bytesLeased = 0;
+    std::atomic<uint64_t> m_bytesCached = 0;
+    std::atomic<uint64_t> m_peakBytes = 0;
+};
+
+inline void BufferLease::Reset()
+{
+    if (m_pool != nullptr)
+    {
+        m_pool->Return(*this);
+    }
+    m_pool = nullptr;
+    m_data = nullptr;
+    m_size = 0;
+    m_capacity = 0;
+}
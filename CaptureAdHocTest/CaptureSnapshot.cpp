@@ -20,7 +20,7 @@ namespace util
 }
 
 IAsyncOperation<IDirect3DSurface>
-CaptureSnapshot::TakeAsync(IDirect3DDevice const& device, GraphicsCaptureItem const& item, bool asStagingTexture, bool cursorEnabled)
+CaptureSnapshot::TakeAsync(IDirect3DDevice const& device, GraphicsCaptureItem const& item, bool asStagingTexture, bool cursorEnabled, DirectXPixelFormat pixelFormat)
 {
     auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
     com_ptr<ID3D11DeviceContext> d3dContext;
@@ -32,7 +32,7 @@ CaptureSnapshot::TakeAsync(IDirect3DDevice const& device, GraphicsCaptureItem co
     // DispatcherQueue requirement.
     auto framePool = Direct3D11CaptureFramePool::CreateFreeThreaded(
         device,
-        DirectXPixelFormat::B8G8R8A8UIntNormalized,
+        pixelFormat,
         1,
         item.Size());
     auto session = framePool.CreateCaptureSession(item);
@@ -57,7 +57,8 @@ CaptureSnapshot::TakeAsync(IDirect3DDevice const& device, GraphicsCaptureItem co
         session.Close();
         framePool.Close();
 
-        // Complete the operation
+        // Complete the operation. This resumes TakeAsync right here on the
+        // frame pool's thread, so it has to come last.
         completion.set(result);
     });
 
@@ -8,7 +8,8 @@ public:
             winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
             winrt::Windows::Graphics::Capture::GraphicsCaptureItem const& item,
             bool asStagingTexture = false,
-            bool cursorEnabled = true);
+            bool cursorEnabled = true,
+            winrt::Windows::Graphics::DirectX::DirectXPixelFormat pixelFormat = winrt::Windows::Graphics::DirectX::DirectXPixelFormat::B8G8R8A8UIntNormalized);
 
 private:
     CaptureSnapshot() = delete;
@@ -0,0 +1,308 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "FrameTimer.h"
+#include "WorkStealingPool.h"
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// CPU time used by the whole process so far, every thread included
+inline std::chrono::nanoseconds ProcessCpuTime()
+{
+#if defined(_WIN32)
+    FILETIME creation = {};
+    FILETIME exit = {};
+    FILETIME kernel = {};
+    FILETIME user = {};
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    {
+        return std::chrono::nanoseconds(0);
+    }
+    auto ticks = [](FILETIME const& time) { return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime; };
+    return std::chrono::nanoseconds((ticks(kernel) + ticks(user)) * 100);
+#else
+    rusage usage = {};
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return std::chrono::nanoseconds(0);
+    }
+    auto time = [](timeval const& value) { return std::chrono::seconds(value.tv_sec) + std::chrono::microseconds(value.tv_usec); };
+    return time(usage.ru_utime) + time(usage.ru_stime);
+#endif
+}
+
+struct StressSessionResult
+{
+    std::string Name;
+    // Everything but Delivered covers only the measured window
+    uint64_t Frames = 0;
+    // Every frame the session recorded, startup and shutdown included
+    uint64_t Delivered = 0;
+    // Gaps in the frame sequence, for sources that number their frames
+    uint64_t Missed = 0;
+    double FramesPerSecond = 0.0;
+    // From the frame's timestamp to its handler
+    LatencyHistogram Latency;
+    // Time spent in the handler
+    std::chrono::nanoseconds HandlerTime{};
+};
+
+// One capture session in a stress run. The session's FrameArrived calls
+// Signal, which runs the handler on the pool. Signals that come while it's
+// queued or running are folded into one more run, so there's never more
+// than one handler running per session and it can pull every waiting frame
+// and record it without locking. Only what happens while the session is
+// measuring counts towards its result, so startup and shutdown frames don't
+// skew the latencies any more than they do the rates.
+class StressSession
+{
+public:
+    typedef std::function<void(StressSession&)> Handler;
+
+    StressSession(uint32_t index, std::string name, WorkStealingPool& pool) : m_index(index), m_name(std::move(name)), m_pool(pool) {}
+
+    StressSession(StressSession const&) = delete;
+    StressSession& operator=(StressSession const&) = delete;
+
+    uint32_t Index() const { return m_index; }
+    std::string const& Name() const { return m_name; }
+
+    // Before the session starts capturing
+    void SetHandler(Handler handler) { m_handler = std::move(handler); }
+
+    // Safe from any thread. A frame is measured if it's recorded while this
+    // is on, and handler time if the run finishes while it's on.
+    void Measure(bool measuring) { m_measuring.store(measuring, std::memory_order_relaxed); }
+
+    // Safe from any thread
+    void Signal()
+    {
+        if (m_signals.fetch_add(1, std::memory_order_acq_rel) == 0)
+        {
+            m_pool.Post([this]() { Run(); }, m_index);
+        }
+    }
+
+    // From the handler. sequence is the source's frame number, if it has one.
+    void RecordFrame(std::chrono::nanoseconds latency, std::optional<uint64_t> sequence = std::nullopt)
+    {
+        auto measuring = m_measuring.load(std::memory_order_relaxed);
+        if (sequence)
+        {
+            // A gap is counted against the frame that ends it
+            if (measuring && m_lastSequence && *sequence > *m_lastSequence + 1)
+            {
+                m_missed += *sequence - *m_lastSequence - 1;
+            }
+            m_lastSequence = sequence;
+        }
+        if (measuring)
+        {
+            m_latency.Record(latency);
+            m_frames++;
+        }
+        m_delivered++;
+    }
+
+    // Once the session has stopped and the pool is idle
+    StressSessionResult Result(std::chrono::duration<double> window) const
+    {
+        StressSessionResult result;
+        result.Name = m_name;
+        result.Frames = m_frames;
+        result.Delivered = m_delivered;
+        result.Missed = m_missed;
+        result.FramesPerSecond = window.count() > 0.0 ? m_frames / window.count() : 0.0;
+        result.Latency = m_latency;
+        result.HandlerTime = m_handlerTime;
+        return result;
+    }
+
+private:
+    void Run()
+    {
+        auto seen = m_signals.load(std::memory_order_acquire);
+        while (true)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (m_handler)
+            {
+                m_handler(*this);
+            }
+            if (m_measuring.load(std::memory_order_relaxed))
+            {
+                m_handlerTime += std::chrono::steady_clock::now() - start;
+            }
+            // Anything signalled while the handler ran gets another pass
+            auto previous = m_signals.fetch_sub(seen, std::memory_order_acq_rel);
+            if (previous == seen)
+            {
+                return;
+            }
+            seen = previous - seen;
+        }
+    }
+
+    uint32_t m_index;
+    std::string m_name;
+    WorkStealingPool& m_pool;
+    Handler m_handler;
+    std::atomic<uint64_t> m_signals = 0;
+    std::atomic<bool> m_measuring = false;
+    // Only touched by the handler
+    LatencyHistogram m_latency;
+    std::optional<uint64_t> m_lastSequence;
+    uint64_t m_frames = 0;
+    uint64_t m_delivered = 0;
+    uint64_t m_missed = 0;
+    std::chrono::nanoseconds m_handlerTime{};
+};
+
+// Everything a stress run measured with a given number of sessions. All of
+// it but Delivered covers the measured window only, which starts once every
+// session has started and ends before any is stopped.
+struct StressLevelResult
+{
+    uint32_t Sessions = 0;
+    std::chrono::duration<double> Window{};
+    std::vector<StressSessionResult> PerSession;
+    uint64_t Frames = 0;
+    uint64_t Delivered = 0;
+    uint64_t Missed = 0;
+    double AggregateFramesPerSecond = 0.0;
+    double MinSessionFramesPerSecond = 0.0;
+    double MeanSessionFramesPerSecond = 0.0;
+    LatencyHistogram Latency;
+    std::chrono::nanoseconds CpuTime{};
+    WorkStealingPoolStats Pool;
+
+    // How many cores were busy, on average
+    double CpuCores() const { return Window.count() > 0.0 ? std::chrono::duration<double>(CpuTime).count() / Window.count() : 0.0; }
+    double CpuMicrosecondsPerFrame() const { return Frames > 0 ? std::chrono::duration<double, std::micro>(CpuTime).count() / Frames : 0.0; }
+};
+
+// Starts capturing for a session, and returns what stops it. Once the stop
+// function returns the source mustn't signal the session again.
+typedef std::function<std::function<void()>(StressSession& session)> StressSessionStarter;
+
+// Runs sessionCount sessions at once for duration, with their handlers on
+// pool
+inline StressLevelResult RunStressLevel(uint32_t sessionCount, std::chrono::milliseconds duration, WorkStealingPool& pool, StressSessionStarter const& start, std::function<std::string(uint32_t)> const& name)
+{
+    std::vector<std::unique_ptr<StressSession>> sessions;
+    std::vector<std::function<void()>> stops;
+    for (uint32_t i = 0; i < sessionCount; i++)
+    {
+        sessions.push_back(std::make_unique<StressSession>(i, name(i), pool));
+        stops.push_back(start(*sessions.back()));
+    }
+
+    auto measure = [&sessions](bool measuring)
+    {
+        for (auto&& session : sessions)
+        {
+            session->Measure(measuring);
+        }
+    };
+    auto poolBefore = pool.Stats();
+    auto cpuStart = ProcessCpuTime();
+    auto wallStart = std::chrono::steady_clock::now();
+    measure(true);
+    std::this_thread::sleep_for(duration);
+    measure(false);
+    auto cpuEnd = ProcessCpuTime();
+    auto wallEnd = std::chrono::steady_clock::now();
+
+    for (auto&& stop : stops)
+    {
+        stop();
+    }
+    pool.WaitIdle();
+    auto poolAfter = pool.Stats();
+
+    StressLevelResult result;
+    result.Sessions = sessionCount;
+    result.Window = wallEnd - wallStart;
+    result.CpuTime = cpuEnd - cpuStart;
+    result.Pool.Executed = poolAfter.Executed - poolBefore.Executed;
+    result.Pool.Stolen = poolAfter.Stolen - poolBefore.Stolen;
+    result.MinSessionFramesPerSecond = sessionCount > 0 ? std::numeric_limits<double>::max() : 0.0;
+    for (uint32_t i = 0; i < sessionCount; i++)
+    {
+        auto session = sessions[i]->Result(result.Window);
+        result.Frames += session.Frames;
+        result.Delivered += session.Delivered;
+        result.Missed += session.Missed;
+        result.AggregateFramesPerSecond += session.FramesPerSecond;
+        result.MinSessionFramesPerSecond = std::min(result.MinSessionFramesPerSecond, session.FramesPerSecond);
+        result.Latency.Merge(session.Latency);
+        result.PerSession.push_back(std::move(session));
+    }
+    result.MeanSessionFramesPerSecond = sessionCount > 0 ? result.AggregateFramesPerSecond / sessionCount : 0.0;
+    return result;
+}
+
+// 1, 2, 4 ... up to and including maxSessions
+inline std::vector<uint32_t> StressSessionCounts(uint32_t maxSessions)
+{
+    std::vector<uint32_t> counts;
+    for (uint32_t count = 1; count < maxSessions; count *= 2)
+    {
+        counts.push_back(count);
+    }
+    counts.push_back(std::max(1u, maxSessions));
+    return counts;
+}
+
+// One line per session count, then the sessions of the last one
+inline void PrintStressReport(std::vector<StressLevelResult> const& levels)
+{
+    auto ms = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::milli>(value).count(); };
+    printf("%8s %10s %10s %10s %9s %9s %9s %8s %10s %8s\n", "sessions", "fps", "min fps", "mean fps", "p50 ms", "p99 ms", "max ms", "cpu", "us/frame", "stolen");
+    for (auto&& level : levels)
+    {
+        printf("%8u %10.1f %10.1f %10.1f %9.3f %9.3f %9.3f %7.0f%% %10.1f %8llu\n",
+            level.Sessions,
+            level.AggregateFramesPerSecond,
+            level.MinSessionFramesPerSecond,
+            level.MeanSessionFramesPerSecond,
+            ms(level.Latency.Percentile(50.0)),
+            ms(level.Latency.Percentile(99.0)),
+            ms(level.Latency.Max()),
+            level.CpuCores() * 100.0,
+            level.CpuMicrosecondsPerFrame(),
+            static_cast<unsigned long long>(level.Pool.Stolen));
+    }
+    if (levels.empty())
+    {
+        return;
+    }
+    printf("\n%-24s %10s %9s %9s %10s %8s\n", "session", "fps", "p50 ms", "p99 ms", "handler ms", "missed");
+    for (auto&& session : levels.back().PerSession)
+    {
+        printf("%-24s %10.1f %9.3f %9.3f %10.1f %8llu\n",
+            session.Name.c_str(),
+            session.FramesPerSecond,
+            ms(session.Latency.Percentile(50.0)),
+            ms(session.Latency.Percentile(99.0)),
+            ms(session.HandlerTime),
+            static_cast<unsigned long long>(session.Missed));
+    }
+}
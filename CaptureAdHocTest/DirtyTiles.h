@@ -0,0 +1,351 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "ImageView.h"
+#include "SimdSupport.h"
+
+// What changed between two consecutive frames, on a grid of tiles. Edge
+// tiles are cut short to the frame.
+struct DirtyTileResult
+{
+    uint32_t TileSize = 0;
+    uint32_t TilesX = 0;
+    uint32_t TilesY = 0;
+    // False if there was no previous frame of the same size to compare to,
+    // in which case every tile is dirty
+    bool Compared = false;
+    // One entry per tile, row by row, nonzero if anything in the tile changed
+    std::vector<uint8_t> Bitmap;
+    uint32_t DirtyTileCount = 0;
+    // Share of the frame's pixels that are in dirty tiles
+    double ChangedAreaPercent = 0.0;
+    // The dirty tiles merged into as few rects as a row-then-column merge finds.
+    // They never overlap.
+    std::vector<PixelRect> DirtyRects;
+
+    bool IsDirty(uint32_t tileX, uint32_t tileY) const { return Bitmap[(static_cast<size_t>(tileY) * TilesX) + tileX] != 0; }
+};
+
+namespace dirtytiles
+{
+    // Differences are looked for a block at a time, and only pinned down to
+    // a byte inside the block that has one
+    constexpr size_t BlockSize = 64;
+
+    inline size_t FirstDifferenceInBlock(uint8_t const* a, uint8_t const* b, size_t offset, size_t byteCount)
+    {
+        auto end = std::min(offset + BlockSize, byteCount);
+        for (; offset < end; offset++)
+        {
+            if (a[offset] != b[offset])
+            {
+                return offset;
+            }
+        }
+        return byteCount;
+    }
+
+    // The offset of the first byte that differs between a and b, or
+    // byteCount if they're the same
+    inline size_t FirstDifferenceScalar(uint8_t const* a, uint8_t const* b, size_t byteCount)
+    {
+        // memcmp is already vectorized by the C runtime, so the whole span
+        // goes to it first and is only walked a block at a time if it differs
+        if (std::memcmp(a, b, byteCount) == 0)
+        {
+            return byteCount;
+        }
+        size_t i = 0;
+        for (; i + BlockSize <= byteCount; i += BlockSize)
+        {
+            if (std::memcmp(a + i, b + i, BlockSize) != 0)
+            {
+                return FirstDifferenceInBlock(a, b, i, byteCount);
+            }
+        }
+        return FirstDifferenceInBlock(a, b, i, byteCount);
+    }
+
+    // The vector versions OR a block's differences together and branch once
+    // per block.
+#if defined(CAPTURE_SIMD_X86)
+    inline size_t FirstDifferenceSSE2(uint8_t const* a, uint8_t const* b, size_t byteCount)
+    {
+        size_t i = 0;
+        for (; i + BlockSize <= byteCount; i += BlockSize)
+        {
+            auto difference = _mm_setzero_si128();
+            for (size_t j = 0; j < BlockSize; j += 16)
+            {
+                auto left = _mm_loadu_si128(reinterpret_cast<__m128i const*>(a + i + j));
+                auto right = _mm_loadu_si128(reinterpret_cast<__m128i const*>(b + i + j));
+                difference = _mm_or_si128(difference, _mm_xor_si128(left, right));
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(difference, _mm_setzero_si128())) != 0xffff)
+            {
+                return FirstDifferenceInBlock(a, b, i, byteCount);
+            }
+        }
+        return FirstDifferenceInBlock(a, b, i, byteCount);
+    }
+
+    CAPTURE_TARGET_AVX2 inline size_t FirstDifferenceAVX2(uint8_t const* a, uint8_t const* b, size_t byteCount)
+    {
+        size_t i = 0;
+        for (; i + BlockSize <= byteCount; i += BlockSize)
+        {
+            auto left0 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a + i));
+            auto right0 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b + i));
+            auto left1 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a + i + 32));
+            auto right1 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b + i + 32));
+            auto difference = _mm256_or_si256(_mm256_xor_si256(left0, right0), _mm256_xor_si256(left1, right1));
+            if (!_mm256_testz_si256(difference, difference))
+            {
+                return FirstDifferenceInBlock(a, b, i, byteCount);
+            }
+        }
+        return FirstDifferenceInBlock(a, b, i, byteCount);
+    }
+#endif
+
+#if defined(CAPTURE_SIMD_NEON)
+    inline size_t FirstDifferenceNEON(uint8_t const* a, uint8_t const* b, size_t byteCount)
+    {
+        size_t i = 0;
+        for (; i + BlockSize <= byteCount; i += BlockSize)
+        {
+            auto difference = vdupq_n_u8(0);
+            for (size_t j = 0; j < BlockSize; j += 16)
+            {
+                difference = vorrq_u8(difference, veorq_u8(vld1q_u8(a + i + j), vld1q_u8(b + i + j)));
+            }
+            if (vmaxvq_u8(difference) != 0)
+            {
+                return FirstDifferenceInBlock(a, b, i, byteCount);
+            }
+        }
+        return FirstDifferenceInBlock(a, b, i, byteCount);
+    }
+#endif
+
+    // Marks the tiles that one row of pixels differs in. Tiles that are
+    // already marked are skipped, which is the early exit. Each run of clean
+    // tiles is compared as one span rather than tile by tile, so an
+    // unchanged row is a single pass over it.
+    template <size_t (*FirstDifference)(uint8_t const*, uint8_t const*, size_t)>
+    inline void MarkRow(uint8_t const* a, uint8_t const* b, uint32_t width, uint32_t tileSize, uint8_t* dirty)
+    {
+        auto tileBytes = static_cast<size_t>(tileSize) * 4;
+        auto rowBytes = static_cast<size_t>(width) * 4;
+        auto tiles = (width + tileSize - 1) / tileSize;
+        uint32_t tile = 0;
+        while (tile < tiles)
+        {
+            if (dirty[tile] != 0)
+            {
+                tile++;
+                continue;
+            }
+            auto runEnd = tile + 1;
+            while (runEnd < tiles && dirty[runEnd] == 0)
+            {
+                runEnd++;
+            }
+            auto start = tile * tileBytes;
+            auto bytes = std::min(runEnd * tileBytes, rowBytes) - start;
+            auto difference = FirstDifference(a + start, b + start, bytes);
+            if (difference == bytes)
+            {
+                tile = runEnd;
+                continue;
+            }
+            // Everything before the tile that differs is clean in this row,
+            // and the span picks up again after it
+            tile += static_cast<uint32_t>(difference / tileBytes);
+            dirty[tile] = 1;
+            tile++;
+        }
+    }
+
+#if defined(CAPTURE_SIMD_X86)
+    CAPTURE_TARGET_AVX2 inline void MarkRowAVX2(uint8_t const* a, uint8_t const* b, uint32_t width, uint32_t tileSize, uint8_t* dirty)
+    {
+        MarkRow<FirstDifferenceAVX2>(a, b, width, tileSize, dirty);
+    }
+#endif
+
+    inline void MarkRow(SimdLevel level, uint8_t const* a, uint8_t const* b, uint32_t width, uint32_t tileSize, uint8_t* dirty)
+    {
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+            return MarkRowAVX2(a, b, width, tileSize, dirty);
+        case SimdLevel::SSE2:
+            return MarkRow<FirstDifferenceSSE2>(a, b, width, tileSize, dirty);
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            return MarkRow<FirstDifferenceNEON>(a, b, width, tileSize, dirty);
+#endif
+        default:
+            return MarkRow<FirstDifferenceScalar>(a, b, width, tileSize, dirty);
+        }
+    }
+}
+
+// Compares each frame to the one before it on a grid of tiles. A tile stops
+// being compared as soon as one of its rows differs. The previous frame is
+// kept in a buffer that's only reallocated when the frame size changes, and
+// only the dirty tiles are copied into it, so at a steady size Compare
+// allocates nothing.
+class DirtyTileDetector
+{
+public:
+    static constexpr uint32_t DefaultTileSize = 32;
+
+    DirtyTileDetector(uint32_t tileSize = DefaultTileSize) : m_tileSize(tileSize)
+    {
+        if (tileSize == 0)
+        {
+            throw std::invalid_argument("Tile size must be at least 1");
+        }
+    }
+
+    uint32_t TileSize() const { return m_tileSize; }
+
+    // Forgets the previous frame, so the next one is all dirty
+    void Reset() { m_hasPrevious = false; }
+
+    // Compares the frame to the previous one and remembers it for next time.
+    // The first frame, and any frame that changes size, is all dirty. The
+    // result stays valid until the next call.
+    DirtyTileResult const& Compare(BgraImageView const& frame, SimdLevel level = DetectSimdLevel())
+    {
+        level = ResolveSimdLevel(level);
+        auto tilesX = (frame.Width + m_tileSize - 1) / m_tileSize;
+        auto tilesY = (frame.Height + m_tileSize - 1) / m_tileSize;
+        auto sizeChanged = frame.Width != m_width || frame.Height != m_height;
+        if (sizeChanged)
+        {
+            m_width = frame.Width;
+            m_height = frame.Height;
+            m_previous.resize(static_cast<size_t>(frame.Width) * frame.Height * BgraImageView::BytesPerPixel);
+        }
+        auto compare = m_hasPrevious && !sizeChanged;
+
+        m_result.TileSize = m_tileSize;
+        m_result.TilesX = tilesX;
+        m_result.TilesY = tilesY;
+        m_result.Compared = compare;
+        m_result.Bitmap.assign(static_cast<size_t>(tilesX) * tilesY, 0);
+        m_result.DirtyTileCount = 0;
+        m_result.DirtyRects.clear();
+
+        // Each band of tiles is walked a row of pixels at a time, so both
+        // frames are read front to back.
+        auto previousPitch = static_cast<size_t>(frame.Width) * BgraImageView::BytesPerPixel;
+        uint64_t dirtyPixels = 0;
+        for (uint32_t tileY = 0; tileY < tilesY; tileY++)
+        {
+            auto top = tileY * m_tileSize;
+            auto height = std::min(m_tileSize, frame.Height - top);
+            auto dirty = m_result.Bitmap.data() + (static_cast<size_t>(tileY) * tilesX);
+            if (!compare)
+            {
+                std::fill(dirty, dirty + tilesX, uint8_t(1));
+            }
+            else
+            {
+                for (uint32_t y = top; y < top + height; y++)
+                {
+                    dirtytiles::MarkRow(level, frame.Row(y), m_previous.data() + (previousPitch * y), frame.Width, m_tileSize, dirty);
+                }
+            }
+            for (uint32_t tileX = 0; tileX < tilesX; tileX++)
+            {
+                if (dirty[tileX] == 0)
+                {
+                    continue;
+                }
+                auto left = tileX * m_tileSize;
+                auto width = std::min(m_tileSize, frame.Width - left);
+                auto offset = static_cast<size_t>(left) * BgraImageView::BytesPerPixel;
+                auto rowBytes = static_cast<size_t>(width) * BgraImageView::BytesPerPixel;
+                m_result.DirtyTileCount++;
+                dirtyPixels += static_cast<uint64_t>(width) * height;
+                for (uint32_t y = top; y < top + height; y++)
+                {
+                    std::memcpy(m_previous.data() + (previousPitch * y) + offset, frame.Row(y) + offset, rowBytes);
+                }
+            }
+        }
+        m_hasPrevious = true;
+
+        auto totalPixels = static_cast<uint64_t>(frame.Width) * frame.Height;
+        m_result.ChangedAreaPercent = totalPixels > 0 ? (100.0 * dirtyPixels) / totalPixels : 0.0;
+        MergeDirtyRects(frame.Width, frame.Height);
+        return m_result;
+    }
+
+private:
+    // Runs of dirty tiles in a tile row become rects, and a rect grows down
+    // when the next tile row has a run with exactly the same span.
+    void MergeDirtyRects(uint32_t width, uint32_t height)
+    {
+        auto& rects = m_result.DirtyRects;
+        // Rects that reach the bottom of the previous tile row
+        m_openRects.clear();
+        for (uint32_t tileY = 0; tileY < m_result.TilesY; tileY++)
+        {
+            auto top = tileY * m_tileSize;
+            auto tileHeight = std::min(m_tileSize, height - top);
+            m_nextOpenRects.clear();
+            uint32_t tileX = 0;
+            while (tileX < m_result.TilesX)
+            {
+                if (!m_result.IsDirty(tileX, tileY))
+                {
+                    tileX++;
+                    continue;
+                }
+                auto runStart = tileX;
+                while (tileX < m_result.TilesX && m_result.IsDirty(tileX, tileY))
+                {
+                    tileX++;
+                }
+                auto left = runStart * m_tileSize;
+                auto right = std::min(tileX * m_tileSize, width);
+
+                auto open = std::find_if(m_openRects.begin(), m_openRects.end(), [&](size_t index)
+                {
+                    return rects[index].X == left && rects[index].Right() == right;
+                });
+                if (open != m_openRects.end())
+                {
+                    rects[*open].Height += tileHeight;
+                    m_nextOpenRects.push_back(*open);
+                }
+                else
+                {
+                    m_nextOpenRects.push_back(rects.size());
+                    rects.push_back(PixelRect{ left, top, right - left, tileHeight });
+                }
+            }
+            std::swap(m_openRects, m_nextOpenRects);
+        }
+    }
+
+private:
+    uint32_t m_tileSize;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    bool m_hasPrevious = false;
+    std::vector<uint8_t> m_previous;
+    DirtyTileResult m_result;
+    std::vector<size_t> m_openRects;
+    std::vector<size_t> m_nextOpenRects;
+};
@@ -0,0 +1,242 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "HalfFloat.h"
+#include "ParallelFor.h"
+#include "SimdSupport.h"
+
+// Writes FP16 frames as uncompressed scanline OpenEXR, which keeps every half
+// exactly as it was captured and opens in most HDR viewers. Without
+// compression every scanline's chunk is the same size, so the offset table is
+// known up front and the rows can be packed in any order.
+struct ExrOptions
+{
+    // Pack the rows on the band pool rather than the calling thread
+    bool Parallel = true;
+};
+
+namespace exr
+{
+    constexpr uint32_t MinRowsPerBand = 16;
+    // HALF in a channel list
+    constexpr int32_t HalfPixelType = 1;
+
+    inline void AppendBytes(std::vector<uint8_t>& out, void const* data, size_t size)
+    {
+        auto bytes = static_cast<uint8_t const*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    // EXR is little endian, like everything this runs on
+    template <typename T>
+    void AppendLittleEndian(std::vector<uint8_t>& out, T value)
+    {
+        AppendBytes(out, &value, sizeof(value));
+    }
+
+    inline void AppendAttribute(std::vector<uint8_t>& out, char const* name, char const* type, std::vector<uint8_t> const& value)
+    {
+        AppendBytes(out, name, std::strlen(name) + 1);
+        AppendBytes(out, type, std::strlen(type) + 1);
+        AppendLittleEndian(out, static_cast<int32_t>(value.size()));
+        out.insert(out.end(), value.begin(), value.end());
+    }
+
+    inline std::vector<uint8_t> Header(uint32_t width, uint32_t height)
+    {
+        std::vector<uint8_t> header = { 0x76, 0x2f, 0x31, 0x01, 2, 0, 0, 0 };
+
+        // Channels have to be in alphabetical order, which is also the order
+        // their planes are stored in each scanline
+        std::vector<uint8_t> channels;
+        for (auto name : { "A", "B", "G", "R" })
+        {
+            AppendBytes(channels, name, 2);
+            AppendLittleEndian(channels, HalfPixelType);
+            // pLinear and three reserved bytes, then the x and y sampling
+            AppendLittleEndian(channels, static_cast<uint32_t>(0));
+            AppendLittleEndian(channels, static_cast<int32_t>(1));
+            AppendLittleEndian(channels, static_cast<int32_t>(1));
+        }
+        channels.push_back(0);
+        AppendAttribute(header, "channels", "chlist", channels);
+        AppendAttribute(header, "compression", "compression", { 0 });
+
+        std::vector<uint8_t> window;
+        for (auto value : { 0, 0, static_cast<int32_t>(width) - 1, static_cast<int32_t>(height) - 1 })
+        {
+            AppendLittleEndian(window, static_cast<int32_t>(value));
+        }
+        AppendAttribute(header, "dataWindow", "box2i", window);
+        AppendAttribute(header, "displayWindow", "box2i", window);
+        AppendAttribute(header, "lineOrder", "lineOrder", { 0 });
+
+        std::vector<uint8_t> one;
+        AppendLittleEndian(one, 1.0f);
+        AppendAttribute(header, "pixelAspectRatio", "float", one);
+        AppendAttribute(header, "screenWindowCenter", "v2f", std::vector<uint8_t>(8, 0));
+        AppendAttribute(header, "screenWindowWidth", "float", one);
+        header.push_back(0);
+        return header;
+    }
+
+    // Splits a row of RGBA halves into A, B, G and R planes, each width halves
+    // long, starting at out. The vector versions return how many pixels they
+    // did.
+    inline void PackRowScalar(uint16_t const* source, uint8_t* out, uint32_t begin, uint32_t width)
+    {
+        auto planeSize = static_cast<size_t>(width) * sizeof(uint16_t);
+        for (auto x = begin; x < width; x++)
+        {
+            auto pixel = source + (static_cast<size_t>(x) * HalfImageView::ChannelsPerPixel);
+            auto offset = static_cast<size_t>(x) * sizeof(uint16_t);
+            std::memcpy(out + offset, pixel + 3, sizeof(uint16_t));
+            std::memcpy(out + planeSize + offset, pixel + 2, sizeof(uint16_t));
+            std::memcpy(out + (planeSize * 2) + offset, pixel + 1, sizeof(uint16_t));
+            std::memcpy(out + (planeSize * 3) + offset, pixel, sizeof(uint16_t));
+        }
+    }
+
+#if defined(CAPTURE_SIMD_X86)
+    // 8 pixels at a time, transposed with three rounds of unpacks
+    inline uint32_t PackRowSSE2(uint16_t const* source, uint8_t* out, uint32_t width)
+    {
+        auto planeSize = static_cast<size_t>(width) * sizeof(uint16_t);
+        uint32_t x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            auto pixels = reinterpret_cast<__m128i const*>(source + (static_cast<size_t>(x) * HalfImageView::ChannelsPerPixel));
+            auto p01 = _mm_loadu_si128(pixels);
+            auto p23 = _mm_loadu_si128(pixels + 1);
+            auto p45 = _mm_loadu_si128(pixels + 2);
+            auto p67 = _mm_loadu_si128(pixels + 3);
+            // r0 r2 g0 g2 b0 b2 a0 a2, and so on
+            auto t0 = _mm_unpacklo_epi16(p01, p23);
+            auto t1 = _mm_unpackhi_epi16(p01, p23);
+            auto t2 = _mm_unpacklo_epi16(p45, p67);
+            auto t3 = _mm_unpackhi_epi16(p45, p67);
+            // r0 r1 r2 r3 g0 g1 g2 g3, and so on
+            auto rg03 = _mm_unpacklo_epi16(t0, t1);
+            auto ba03 = _mm_unpackhi_epi16(t0, t1);
+            auto rg47 = _mm_unpacklo_epi16(t2, t3);
+            auto ba47 = _mm_unpackhi_epi16(t2, t3);
+
+            auto offset = static_cast<size_t>(x) * sizeof(uint16_t);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + offset), _mm_unpackhi_epi64(ba03, ba47));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + planeSize + offset), _mm_unpacklo_epi64(ba03, ba47));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + (planeSize * 2) + offset), _mm_unpackhi_epi64(rg03, rg47));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + (planeSize * 3) + offset), _mm_unpacklo_epi64(rg03, rg47));
+        }
+        return x;
+    }
+#endif
+
+#if defined(CAPTURE_SIMD_NEON)
+    inline uint32_t PackRowNEON(uint16_t const* source, uint8_t* out, uint32_t width)
+    {
+        auto planeSize = static_cast<size_t>(width) * sizeof(uint16_t);
+        uint32_t x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            auto channels = vld4q_u16(source + (static_cast<size_t>(x) * HalfImageView::ChannelsPerPixel));
+            auto offset = static_cast<size_t>(x) * sizeof(uint16_t);
+            vst1q_u8(out + offset, vreinterpretq_u8_u16(channels.val[3]));
+            vst1q_u8(out + planeSize + offset, vreinterpretq_u8_u16(channels.val[2]));
+            vst1q_u8(out + (planeSize * 2) + offset, vreinterpretq_u8_u16(channels.val[1]));
+            vst1q_u8(out + (planeSize * 3) + offset, vreinterpretq_u8_u16(channels.val[0]));
+        }
+        return x;
+    }
+#endif
+
+    inline void PackRow(SimdLevel level, uint16_t const* source, uint8_t* out, uint32_t width)
+    {
+        uint32_t done = 0;
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+        case SimdLevel::SSE2:
+            done = PackRowSSE2(source, out, width);
+            break;
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            done = PackRowNEON(source, out, width);
+            break;
+#endif
+        default:
+            break;
+        }
+        PackRowScalar(source, out, done, width);
+    }
+
+    // Each scanline's chunk: its y, the size of its pixel data, then the planes
+    inline void PackRows(HalfImageView const& image, uint8_t* chunks, size_t chunkSize, uint32_t firstRow, uint32_t rowCount, SimdLevel level)
+    {
+        auto dataSize = static_cast<int32_t>(chunkSize - 8);
+        for (auto y = firstRow; y < firstRow + rowCount; y++)
+        {
+            auto chunk = chunks + (chunkSize * y);
+            auto row = static_cast<int32_t>(y);
+            std::memcpy(chunk, &row, sizeof(row));
+            std::memcpy(chunk + 4, &dataSize, sizeof(dataSize));
+            PackRow(level, image.Row(y), chunk + 8, image.Width);
+        }
+    }
+}
+
+// How many bytes EncodeExr writes for an image of this size
+inline size_t ExrEncodedSize(uint32_t width, uint32_t height)
+{
+    auto chunkSize = 8 + (static_cast<size_t>(width) * HalfImageView::BytesPerPixel);
+    return exr::Header(width, height).size() + (static_cast<size_t>(height) * (sizeof(uint64_t) + chunkSize));
+}
+
+// Writes ExrEncodedSize bytes to out. Most of the cost of a large image is
+// touching that much memory for the first time, so callers that save more
+// than one keep the buffer (or lease it from a BufferPool).
+inline void EncodeExr(HalfImageView const& image, uint8_t* out, ExrOptions const& options = {}, SimdLevel level = DetectSimdLevel())
+{
+    if (image.Width == 0 || image.Height == 0)
+    {
+        throw std::invalid_argument("Image must not be empty");
+    }
+    level = ResolveSimdLevel(level);
+    auto header = exr::Header(image.Width, image.Height);
+    std::memcpy(out, header.data(), header.size());
+    auto chunkSize = 8 + (static_cast<size_t>(image.Width) * HalfImageView::BytesPerPixel);
+    auto firstChunk = header.size() + (static_cast<size_t>(image.Height) * sizeof(uint64_t));
+    for (uint32_t y = 0; y < image.Height; y++)
+    {
+        auto offset = static_cast<uint64_t>(firstChunk + (chunkSize * y));
+        std::memcpy(out + header.size() + (static_cast<size_t>(y) * sizeof(uint64_t)), &offset, sizeof(offset));
+    }
+
+    auto chunks = out + firstChunk;
+    if (options.Parallel)
+    {
+        ParallelForRowBands(image.Height, exr::MinRowsPerBand, [&](uint32_t first, uint32_t count)
+        {
+            exr::PackRows(image, chunks, chunkSize, first, count, level);
+        });
+    }
+    else
+    {
+        exr::PackRows(image, chunks, chunkSize, 0, image.Height, level);
+    }
+}
+
+inline std::vector<uint8_t> EncodeExr(HalfImageView const& image, ExrOptions const& options = {}, SimdLevel level = DetectSimdLevel())
+{
+    if (image.Width == 0 || image.Height == 0)
+    {
+        throw std::invalid_argument("Image must not be empty");
+    }
+    std::vector<uint8_t> exr(ExrEncodedSize(image.Width, image.Height));
+    EncodeExr(image, exr.data(), options, level);
+    return exr;
+}
@@ -0,0 +1,379 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "ImageView.h"
+
+// A frame number stamped into the top left corner of a rendered frame, so
+// the capture side can tell exactly which rendered frame it got.
+//
+// The code is a grid of square cells on a dark background, lit or dark:
+//   row 0:   a clock, lit on even columns, so the decoder can find every
+//            column at any scale
+//   row 1:   the bits, a start bit (always dark) then the frame number and
+//            a CRC-8 of it
+//   row 2:   the same bits inverted
+// with one dark cell of margin to the right and below. Every bit is read by
+// comparing a cell with the one under it, so no fixed threshold is involved
+// and scaling, filtering and color conversion only have to keep lit brighter
+// than dark. Only the luma is used.
+namespace framebarcode
+{
+    constexpr uint32_t PayloadBits = 32;
+    constexpr uint32_t CheckBits = 8;
+    // Odd, so the clock row ends on a lit cell
+    constexpr uint32_t Columns = 1 + PayloadBits + CheckBits;
+    constexpr uint32_t Rows = 3;
+    constexpr uint32_t DefaultCellSize = 8;
+    // How far the decoder looks for a code, in default sized cells. Enough
+    // for a code scaled up 3x.
+    constexpr uint32_t ScanColumns = (Columns + 1) * 3;
+    constexpr uint32_t ScanRows = (Rows + 1) * 3;
+
+    // The only part of a frame the decoder reads
+    inline PixelRect ScanRect(uint32_t width, uint32_t height)
+    {
+        return PixelRect{ 0, 0, std::min(width, ScanColumns * DefaultCellSize), std::min(height, ScanRows * DefaultCellSize) };
+    }
+    // Lit and dark have to be at least this far apart in luma
+    constexpr int MinContrast = 48;
+
+    constexpr BgraColor Lit = { 255, 255, 255, 255 };
+    constexpr BgraColor Dark = { 0, 0, 0, 255 };
+
+    inline uint8_t Crc8(uint32_t value)
+    {
+        uint8_t crc = 0;
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            crc ^= static_cast<uint8_t>(value >> shift);
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = static_cast<uint8_t>((crc & 0x80) ? ((crc << 1) ^ 0x07) : (crc << 1));
+            }
+        }
+        return crc;
+    }
+
+    // Bit i is the data cell in column i, most significant bits first
+    inline uint64_t Codeword(uint32_t frameNumber)
+    {
+        return (static_cast<uint64_t>(frameNumber) << CheckBits) | Crc8(frameNumber);
+    }
+    inline bool CodewordBit(uint64_t codeword, uint32_t column)
+    {
+        return column > 0 && ((codeword >> (Columns - 1 - column)) & 1) != 0;
+    }
+
+    // BT.709 weights, in 0-255
+    inline int Luma(uint8_t const* pixel)
+    {
+        return ((19 * pixel[0]) + (183 * pixel[1]) + (54 * pixel[2])) >> 8;
+    }
+
+    // Alternating lit and dark runs along a line of lumas, starting with a
+    // lit run at the first sample. Returns where each run ends, or nothing
+    // if there isn't enough contrast to tell them apart.
+    inline std::vector<uint32_t> FindRuns(std::vector<int> const& lumas, size_t maxRuns)
+    {
+        std::vector<uint32_t> runEnds;
+        if (lumas.empty())
+        {
+            return runEnds;
+        }
+        auto [low, high] = std::minmax_element(lumas.begin(), lumas.end());
+        if (*high - *low < MinContrast)
+        {
+            return runEnds;
+        }
+        auto threshold = (*high + *low) / 2;
+        auto lit = true;
+        if (lumas[0] <= threshold)
+        {
+            return runEnds;
+        }
+        for (uint32_t i = 1; i < lumas.size() && runEnds.size() < maxRuns; i++)
+        {
+            if ((lumas[i] > threshold) != lit)
+            {
+                runEnds.push_back(i);
+                lit = !lit;
+            }
+        }
+        return runEnds;
+    }
+
+    // Each run has to be roughly cellSize long. Blurred edges can move a
+    // boundary by up to half a cell.
+    inline bool RunsAreEven(std::vector<uint32_t> const& runEnds, size_t count, double cellSize)
+    {
+        uint32_t start = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            auto length = runEnds[i] - start;
+            if (length < cellSize * 0.5 || length > cellSize * 1.5)
+            {
+                return false;
+            }
+            start = runEnds[i];
+        }
+        return true;
+    }
+
+    inline int AverageLuma(BgraImageView const& image, double centerX, double centerY, uint32_t radiusX, uint32_t radiusY)
+    {
+        auto x = static_cast<uint32_t>(centerX);
+        auto y = static_cast<uint32_t>(centerY);
+        auto left = x - std::min(x, radiusX);
+        auto top = y - std::min(y, radiusY);
+        auto right = std::min(image.Width - 1, x + radiusX);
+        auto bottom = std::min(image.Height - 1, y + radiusY);
+        int total = 0;
+        int count = 0;
+        for (auto row = top; row <= bottom; row++)
+        {
+            for (auto column = left; column <= right; column++)
+            {
+                total += Luma(image.Row(row) + (column * BgraImageView::BytesPerPixel));
+                count++;
+            }
+        }
+        return total / count;
+    }
+}
+
+struct FrameBarcodeLayout
+{
+    uint32_t CellSize = framebarcode::DefaultCellSize;
+
+    // Everything the code covers, margin included
+    PixelRect Bounds() const { return PixelRect{ 0, 0, (framebarcode::Columns + 1) * CellSize, (framebarcode::Rows + 1) * CellSize }; }
+
+    // The lit parts of the code, with neighbouring cells in a row merged.
+    // The rest of Bounds is dark.
+    std::vector<PixelRect> LitRects(uint32_t frameNumber) const
+    {
+        auto codeword = framebarcode::Codeword(frameNumber);
+        std::vector<PixelRect> rects;
+        for (uint32_t row = 0; row < framebarcode::Rows; row++)
+        {
+            for (uint32_t column = 0; column < framebarcode::Columns; column++)
+            {
+                auto lit = row == 0 ? (column % 2) == 0 : framebarcode::CodewordBit(codeword, column) == (row == 1);
+                if (!lit)
+                {
+                    continue;
+                }
+                if (!rects.empty() && rects.back().Y == row * CellSize && rects.back().Right() == column * CellSize)
+                {
+                    rects.back().Width += CellSize;
+                }
+                else
+                {
+                    rects.push_back(PixelRect{ column * CellSize, row * CellSize, CellSize, CellSize });
+                }
+            }
+        }
+        return rects;
+    }
+
+    // Draws the code into B8G8R8A8 pixels, clipped to the image
+    void Stamp(uint8_t* data, uint32_t width, uint32_t height, uint32_t rowPitch, uint32_t frameNumber) const
+    {
+        auto fill = [&](PixelRect const& rect, BgraColor color)
+        {
+            auto packed = color.Packed();
+            auto right = std::min(width, rect.Right());
+            for (auto y = rect.Y; y < std::min(height, rect.Bottom()); y++)
+            {
+                auto row = data + (static_cast<size_t>(rowPitch) * y);
+                for (auto x = rect.X; x < right; x++)
+                {
+                    std::memcpy(row + (x * BgraImageView::BytesPerPixel), &packed, sizeof(packed));
+                }
+            }
+        };
+        fill(Bounds(), framebarcode::Dark);
+        for (auto&& rect : LitRects(frameNumber))
+        {
+            fill(rect, framebarcode::Lit);
+        }
+    }
+};
+
+// Finds and reads a frame number stamped with FrameBarcodeLayout, at any
+// cell size from about 4 pixels up (cells don't need to be square). Returns
+// nothing if there's no readable code, so a damaged code is never misread
+// as another frame number (short of the CRC being fooled).
+inline std::optional<uint32_t> DecodeFrameBarcode(BgraImageView const& image)
+{
+    using namespace framebarcode;
+    auto scanRect = ScanRect(image.Width, image.Height);
+    auto scanWidth = scanRect.Width;
+    auto scanHeight = scanRect.Height;
+    if (scanWidth == 0 || scanHeight == 0)
+    {
+        return std::nullopt;
+    }
+
+    // Down the first column: lit (clock), dark (start bit), lit (inverted
+    // start bit) then the margin gives the row height.
+    std::vector<int> lumas(scanHeight);
+    for (uint32_t y = 0; y < scanHeight; y++)
+    {
+        lumas[y] = Luma(image.Row(y));
+    }
+    auto rowEnds = FindRuns(lumas, Rows);
+    if (rowEnds.size() < Rows)
+    {
+        return std::nullopt;
+    }
+    auto cellHeight = rowEnds[Rows - 1] / static_cast<double>(Rows);
+    if (!RunsAreEven(rowEnds, Rows, cellHeight))
+    {
+        return std::nullopt;
+    }
+
+    // Along the clock row for the column width
+    auto clockY = static_cast<uint32_t>(cellHeight / 2);
+    lumas.resize(scanWidth);
+    for (uint32_t x = 0; x < scanWidth; x++)
+    {
+        lumas[x] = Luma(image.Row(clockY) + (x * BgraImageView::BytesPerPixel));
+    }
+    auto columnEnds = FindRuns(lumas, Columns);
+    if (columnEnds.size() < Columns)
+    {
+        return std::nullopt;
+    }
+    auto cellWidth = columnEnds[Columns - 1] / static_cast<double>(Columns);
+    if (!RunsAreEven(columnEnds, Columns, cellWidth))
+    {
+        return std::nullopt;
+    }
+
+    // Sample the middle half of each cell, away from blurred edges
+    auto radiusX = static_cast<uint32_t>(cellWidth / 4);
+    auto radiusY = static_cast<uint32_t>(cellHeight / 4);
+    auto [low, high] = std::minmax_element(lumas.begin(), lumas.begin() + columnEnds[Columns - 1]);
+    auto minDifference = std::max(MinContrast, (*high - *low) / 4);
+    uint64_t codeword = 0;
+    for (uint32_t column = 0; column < Columns; column++)
+    {
+        auto x = (column + 0.5) * cellWidth;
+        auto bits = AverageLuma(image, x, cellHeight * 1.5, radiusX, radiusY);
+        auto inverted = AverageLuma(image, x, cellHeight * 2.5, radiusX, radiusY);
+        if (std::abs(bits - inverted) < minDifference)
+        {
+            return std::nullopt;
+        }
+        codeword = (codeword << 1) | (bits > inverted ? 1 : 0);
+    }
+
+    auto frameNumber = static_cast<uint32_t>(codeword >> CheckBits);
+    auto startBit = codeword >> (Columns - 1);
+    if (startBit != 0 || static_cast<uint8_t>(codeword) != Crc8(frameNumber))
+    {
+        return std::nullopt;
+    }
+    return frameNumber;
+}
+
+// Tracks decoded frame numbers as they're captured: which rendered frames
+// never showed up, which were delivered more than once, and how long each
+// took from being presented to being captured. Rendered is called from the
+// render loop and Captured from the capture thread.
+class FrameSequenceTracker
+{
+public:
+    struct Delivery
+    {
+        // New frames only, not duplicates
+        std::optional<int64_t> Latency;
+        bool Duplicate = false;
+    };
+
+    struct Stats
+    {
+        uint64_t Rendered = 0;
+        uint64_t Captured = 0;
+        // Captured frames without a readable code
+        uint64_t Unreadable = 0;
+        // The same rendered frame delivered again
+        uint64_t Duplicates = 0;
+        // Rendered frames that were skipped over between two captured ones
+        uint64_t Dropped = 0;
+        // Frames older than one already delivered
+        uint64_t OutOfOrder = 0;
+    };
+
+    // Remembers the present times of the last historySize frames
+    FrameSequenceTracker(size_t historySize = 4096) : m_presentTimes(historySize, Entry{}) {}
+
+    void Rendered(uint32_t frameNumber, int64_t presentTime)
+    {
+        std::lock_guard lock(m_lock);
+        m_presentTimes[frameNumber % m_presentTimes.size()] = Entry{ frameNumber, presentTime, true };
+        m_stats.Rendered++;
+    }
+
+    // Latencies are in whatever unit the times are in
+    Delivery Captured(std::optional<uint32_t> frameNumber, int64_t captureTime)
+    {
+        std::lock_guard lock(m_lock);
+        m_stats.Captured++;
+        Delivery delivery;
+        if (!frameNumber)
+        {
+            m_stats.Unreadable++;
+            return delivery;
+        }
+        if (m_lastFrame && *frameNumber == *m_lastFrame)
+        {
+            m_stats.Duplicates++;
+            delivery.Duplicate = true;
+            return delivery;
+        }
+        if (m_lastFrame && *frameNumber < *m_lastFrame)
+        {
+            m_stats.OutOfOrder++;
+        }
+        else
+        {
+            if (m_lastFrame)
+            {
+                m_stats.Dropped += *frameNumber - *m_lastFrame - 1;
+            }
+            m_lastFrame = frameNumber;
+        }
+        auto& entry = m_presentTimes[*frameNumber % m_presentTimes.size()];
+        if (entry.Valid && entry.FrameNumber == *frameNumber)
+        {
+            delivery.Latency = captureTime - entry.PresentTime;
+        }
+        return delivery;
+    }
+
+    Stats GetStats() const
+    {
+        std::lock_guard lock(m_lock);
+        return m_stats;
+    }
+
+private:
+    struct Entry
+    {
+        uint32_t FrameNumber;
+        int64_t PresentTime;
+        bool Valid;
+    };
+
+    mutable std::mutex m_lock;
+    std::vector<Entry> m_presentTimes;
+    std::optional<uint32_t> m_lastFrame;
+    Stats m_stats;
+};
@@ -0,0 +1,338 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "ImageView.h"
+#include "ParallelFor.h"
+#include "SimdSupport.h"
+
+// A fast 64-bit content hash of a frame's visible pixels, for telling
+// frames apart (not for security). Row padding is ignored, so the same image
+// hashes the same whatever its RowPitch.
+//
+// Each row is hashed on its own: 64 byte stripes are folded into eight 64-bit
+// lanes, XXH3 style, with a key that changes per stripe so moving content
+// around within a row changes the hash. The row hashes are then chained in
+// order to get the frame hash. The SSE2, AVX2 and NEON versions work on the
+// same lanes and give exactly the same hashes as the scalar one.
+namespace framehash
+{
+    constexpr uint32_t LaneCount = 8;
+    constexpr uint32_t StripeSize = LaneCount * sizeof(uint64_t);
+
+    constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+    constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+    constexpr uint64_t Prime3 = 0x165667B19E3779F9ull;
+
+    constexpr uint64_t Keys[LaneCount] =
+    {
+        0xbe4ba423396cfeb8ull, 0x1cad21f72c81017cull, 0xdb979083e96dd4deull, 0x1f67b3b7a4a44072ull,
+        0x78e5c0cc4ee679cbull, 0x2172ffcc7dd05a82ull, 0x8e2443f7744608b8ull, 0x4c263a81e69035e0ull,
+    };
+    // Added to every lane's key after each stripe
+    constexpr uint64_t KeyStep = Prime3;
+
+    inline uint64_t Avalanche(uint64_t value)
+    {
+        value ^= value >> 33;
+        value *= Prime2;
+        value ^= value >> 29;
+        value *= Prime3;
+        value ^= value >> 32;
+        return value;
+    }
+
+    inline uint64_t Read64(uint8_t const* data)
+    {
+        uint64_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return value;
+    }
+
+    inline void AccumulateStripeScalar(uint64_t* accumulators, uint8_t const* stripe, uint64_t stripeIndex)
+    {
+        for (uint32_t i = 0; i < LaneCount; i++)
+        {
+            auto data = Read64(stripe + (i * sizeof(uint64_t)));
+            auto keyed = data ^ (Keys[i] + (stripeIndex * KeyStep));
+            accumulators[i ^ 1] += data;
+            accumulators[i] += (keyed & 0xffffffffull) * (keyed >> 32);
+        }
+    }
+
+    inline uint64_t FinishRow(uint64_t const* accumulators, size_t byteCount)
+    {
+        auto hash = byteCount * Prime1;
+        for (uint32_t i = 0; i < LaneCount; i++)
+        {
+            hash = Avalanche(hash ^ accumulators[i]) + Prime2;
+        }
+        return hash;
+    }
+
+    // The last partial stripe is hashed as if padded with zeros
+    inline uint64_t HashRowScalar(uint8_t const* row, size_t byteCount)
+    {
+        uint64_t accumulators[LaneCount] = {};
+        auto fullStripes = byteCount / StripeSize;
+        for (size_t stripe = 0; stripe < fullStripes; stripe++)
+        {
+            AccumulateStripeScalar(accumulators, row + (stripe * StripeSize), stripe);
+        }
+        auto remainder = byteCount % StripeSize;
+        if (remainder > 0)
+        {
+            uint8_t last[StripeSize] = {};
+            std::memcpy(last, row + (fullStripes * StripeSize), remainder);
+            AccumulateStripeScalar(accumulators, last, fullStripes);
+        }
+        return FinishRow(accumulators, byteCount);
+    }
+
+#if defined(CAPTURE_SIMD_X86)
+    // Lanes are paired up (0 and 1, 2 and 3, ...) for the data swap, which
+    // keeps every pair inside one 128-bit register. The data is summed
+    // separately and only swapped into the accumulators once, at the end.
+    inline uint64_t HashRowSSE2(uint8_t const* row, size_t byteCount)
+    {
+        __m128i accumulators[LaneCount / 2] = {};
+        __m128i sums[LaneCount / 2] = {};
+        __m128i keys[LaneCount / 2];
+        for (uint32_t i = 0; i < LaneCount / 2; i++)
+        {
+            keys[i] = _mm_set_epi64x(static_cast<int64_t>(Keys[(i * 2) + 1]), static_cast<int64_t>(Keys[i * 2]));
+        }
+        auto keyStep = _mm_set1_epi64x(static_cast<int64_t>(KeyStep));
+        auto fullStripes = byteCount / StripeSize;
+        for (size_t stripe = 0; stripe < fullStripes; stripe++)
+        {
+            auto data = reinterpret_cast<__m128i const*>(row + (stripe * StripeSize));
+            for (uint32_t i = 0; i < LaneCount / 2; i++)
+            {
+                auto value = _mm_loadu_si128(data + i);
+                auto keyed = _mm_xor_si128(value, keys[i]);
+                accumulators[i] = _mm_add_epi64(accumulators[i], _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32)));
+                sums[i] = _mm_add_epi64(sums[i], value);
+                keys[i] = _mm_add_epi64(keys[i], keyStep);
+            }
+        }
+        for (uint32_t i = 0; i < LaneCount / 2; i++)
+        {
+            accumulators[i] = _mm_add_epi64(accumulators[i], _mm_shuffle_epi32(sums[i], _MM_SHUFFLE(1, 0, 3, 2)));
+        }
+        uint64_t lanes[LaneCount];
+        std::memcpy(lanes, accumulators, sizeof(lanes));
+        auto remainder = byteCount % StripeSize;
+        if (remainder > 0)
+        {
+            uint8_t last[StripeSize] = {};
+            std::memcpy(last, row + (fullStripes * StripeSize), remainder);
+            AccumulateStripeScalar(lanes, last, fullStripes);
+        }
+        return FinishRow(lanes, byteCount);
+    }
+
+    CAPTURE_TARGET_AVX2 inline uint64_t HashRowAVX2(uint8_t const* row, size_t byteCount)
+    {
+        __m256i accumulators[LaneCount / 4] = {};
+        __m256i sums[LaneCount / 4] = {};
+        __m256i keys[LaneCount / 4];
+        for (uint32_t i = 0; i < LaneCount / 4; i++)
+        {
+            keys[i] = _mm256_set_epi64x(static_cast<int64_t>(Keys[(i * 4) + 3]), static_cast<int64_t>(Keys[(i * 4) + 2]),
+                static_cast<int64_t>(Keys[(i * 4) + 1]), static_cast<int64_t>(Keys[i * 4]));
+        }
+        auto keyStep = _mm256_set1_epi64x(static_cast<int64_t>(KeyStep));
+        auto fullStripes = byteCount / StripeSize;
+        for (size_t stripe = 0; stripe < fullStripes; stripe++)
+        {
+            auto data = reinterpret_cast<__m256i const*>(row + (stripe * StripeSize));
+            for (uint32_t i = 0; i < LaneCount / 4; i++)
+            {
+                auto value = _mm256_loadu_si256(data + i);
+                auto keyed = _mm256_xor_si256(value, keys[i]);
+                accumulators[i] = _mm256_add_epi64(accumulators[i], _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32)));
+                sums[i] = _mm256_add_epi64(sums[i], value);
+                keys[i] = _mm256_add_epi64(keys[i], keyStep);
+            }
+        }
+        for (uint32_t i = 0; i < LaneCount / 4; i++)
+        {
+            accumulators[i] = _mm256_add_epi64(accumulators[i], _mm256_shuffle_epi32(sums[i], _MM_SHUFFLE(1, 0, 3, 2)));
+        }
+        uint64_t lanes[LaneCount];
+        std::memcpy(lanes, accumulators, sizeof(lanes));
+        auto remainder = byteCount % StripeSize;
+        if (remainder > 0)
+        {
+            uint8_t last[StripeSize] = {};
+            std::memcpy(last, row + (fullStripes * StripeSize), remainder);
+            AccumulateStripeScalar(lanes, last, fullStripes);
+        }
+        return FinishRow(lanes, byteCount);
+    }
+#endif
+
+#if defined(CAPTURE_SIMD_NEON)
+    inline uint64_t HashRowNEON(uint8_t const* row, size_t byteCount)
+    {
+        uint64x2_t accumulators[LaneCount / 2];
+        uint64x2_t sums[LaneCount / 2];
+        uint64x2_t keys[LaneCount / 2];
+        for (uint32_t i = 0; i < LaneCount / 2; i++)
+        {
+            accumulators[i] = vdupq_n_u64(0);
+            sums[i] = vdupq_n_u64(0);
+            keys[i] = vld1q_u64(Keys + (i * 2));
+        }
+        auto keyStep = vdupq_n_u64(KeyStep);
+        auto fullStripes = byteCount / StripeSize;
+        for (size_t stripe = 0; stripe < fullStripes; stripe++)
+        {
+            auto data = row + (stripe * StripeSize);
+            for (uint32_t i = 0; i < LaneCount / 2; i++)
+            {
+                auto value = vreinterpretq_u64_u8(vld1q_u8(data + (i * 16)));
+                auto keyed = veorq_u64(value, keys[i]);
+                accumulators[i] = vaddq_u64(accumulators[i], vmull_u32(vmovn_u64(keyed), vshrn_n_u64(keyed, 32)));
+                sums[i] = vaddq_u64(sums[i], value);
+                keys[i] = vaddq_u64(keys[i], keyStep);
+            }
+        }
+        uint64_t lanes[LaneCount];
+        for (uint32_t i = 0; i < LaneCount / 2; i++)
+        {
+            vst1q_u64(lanes + (i * 2), vaddq_u64(accumulators[i], vextq_u64(sums[i], sums[i], 1)));
+        }
+        auto remainder = byteCount % StripeSize;
+        if (remainder > 0)
+        {
+            uint8_t last[StripeSize] = {};
+            std::memcpy(last, row + (fullStripes * StripeSize), remainder);
+            AccumulateStripeScalar(lanes, last, fullStripes);
+        }
+        return FinishRow(lanes, byteCount);
+    }
+#endif
+
+    inline uint64_t HashRow(SimdLevel level, uint8_t const* row, size_t byteCount)
+    {
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+            return HashRowAVX2(row, byteCount);
+        case SimdLevel::SSE2:
+            return HashRowSSE2(row, byteCount);
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            return HashRowNEON(row, byteCount);
+#endif
+        default:
+            return HashRowScalar(row, byteCount);
+        }
+    }
+
+    inline uint64_t Begin(BgraImageView const& image)
+    {
+        return Prime1 ^ ((static_cast<uint64_t>(image.Width) << 32) | image.Height);
+    }
+
+    inline uint64_t Chain(uint64_t hash, uint64_t rowHash)
+    {
+        hash ^= rowHash;
+        hash = (hash << 27) | (hash >> 37);
+        return (hash * Prime1) + Prime3;
+    }
+}
+
+// If rowHashes is given it's filled with one hash per row
+inline uint64_t HashImage(BgraImageView const& image, std::vector<uint64_t>* rowHashes = nullptr, SimdLevel level = DetectSimdLevel())
+{
+    level = ResolveSimdLevel(level);
+    auto rowBytes = static_cast<size_t>(image.Width) * BgraImageView::BytesPerPixel;
+    if (rowHashes != nullptr)
+    {
+        rowHashes->resize(image.Height);
+    }
+    auto hash = framehash::Begin(image);
+    for (uint32_t y = 0; y < image.Height; y++)
+    {
+        auto rowHash = framehash::HashRow(level, image.Row(y), rowBytes);
+        if (rowHashes != nullptr)
+        {
+            (*rowHashes)[y] = rowHash;
+        }
+        hash = framehash::Chain(hash, rowHash);
+    }
+    return framehash::Avalanche(hash);
+}
+
+// Same hash as HashImage, but the rows are hashed in bands on the shared
+// BandPool and only chained together at the end.
+inline uint64_t HashImageParallel(BgraImageView const& image, std::vector<uint64_t>* rowHashes = nullptr, SimdLevel level = DetectSimdLevel())
+{
+    // Small images aren't worth waking up the pool for
+    static constexpr uint32_t MinRowsPerBand = 64;
+    if (BandPool::Shared().ThreadCount() == 1 || image.Height < MinRowsPerBand * 2)
+    {
+        return HashImage(image, rowHashes, level);
+    }
+    level = ResolveSimdLevel(level);
+    auto rowBytes = static_cast<size_t>(image.Width) * BgraImageView::BytesPerPixel;
+    std::vector<uint64_t> localRowHashes;
+    auto& hashes = rowHashes != nullptr ? *rowHashes : localRowHashes;
+    hashes.resize(image.Height);
+    ParallelForRowBands(image.Height, MinRowsPerBand, [&](uint32_t first, uint32_t count)
+    {
+        for (auto y = first; y < first + count; y++)
+        {
+            hashes[y] = framehash::HashRow(level, image.Row(y), rowBytes);
+        }
+    });
+    auto hash = framehash::Begin(image);
+    for (auto rowHash : hashes)
+    {
+        hash = framehash::Chain(hash, rowHash);
+    }
+    return framehash::Avalanche(hash);
+}
+
+// Tells frames that actually changed apart from the same content being
+// delivered again, given each frame's hash in delivery order.
+class FrameChangeCounter
+{
+public:
+    // Returns true if the frame's content is different from the last one's
+    bool Add(uint64_t hash)
+    {
+        auto changed = m_frames == 0 || hash != m_lastHash;
+        m_frames++;
+        m_lastHash = hash;
+        if (changed)
+        {
+            m_uniqueFrames++;
+            m_currentRun = 1;
+        }
+        else
+        {
+            m_currentRun++;
+        }
+        m_longestRun = std::max(m_longestRun, m_currentRun);
+        return changed;
+    }
+
+    uint64_t Frames() const { return m_frames; }
+    uint64_t UniqueFrames() const { return m_uniqueFrames; }
+    // The most frames in a row with the same content, counting the first
+    uint64_t LongestIdenticalRun() const { return m_longestRun; }
+
+private:
+    uint64_t m_frames = 0;
+    uint64_t m_uniqueFrames = 0;
+    uint64_t m_lastHash = 0;
+    uint64_t m_currentRun = 0;
+    uint64_t m_longestRun = 0;
+};
@@ -0,0 +1,464 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <queue>
+#include <random>
+#include <vector>
+#include "FrameTimer.h"
+#include "FrameTrace.h"
+#include "ParallelFor.h"
+
+// A discrete event model of a free threaded Direct3D11CaptureFramePool, for
+// seeing how the buffer count and MinUpdateInterval trade latency against
+// dropped frames without a capture session. It models:
+//
+//   - A renderer presenting at its own cadence.
+//   - The compositor, which on every refresh captures the latest present if
+//     it hasn't been captured yet, MinUpdateInterval has passed since the
+//     last capture and one of the pool's buffers is free. Otherwise the
+//     content waits for a later refresh, and presents that are replaced
+//     before they're captured are never seen.
+//   - Delivery: a captured frame reaches the pool (and FrameArrived is
+//     raised) some time after the refresh that captured it.
+//   - One consumer, like a FrameArrived handler, that takes frames with
+//     TryGetNextFrame and holds each frame's buffer until it's done with it.
+//
+// Everything is in simulated time, so a minute of capture takes milliseconds
+// and the same options and seed always give the same result.
+struct SimTiming
+{
+    std::chrono::nanoseconds Mean{ 0 };
+    // Each sample is moved by up to this much either way
+    std::chrono::nanoseconds Jitter{ 0 };
+    // Recorded values, drawn at random in place of Mean and Jitter
+    std::vector<std::chrono::nanoseconds> Samples;
+
+    static SimTiming Constant(std::chrono::nanoseconds mean, std::chrono::nanoseconds jitter = std::chrono::nanoseconds(0))
+    {
+        SimTiming timing;
+        timing.Mean = mean;
+        timing.Jitter = jitter;
+        return timing;
+    }
+
+    static SimTiming Recorded(std::vector<std::chrono::nanoseconds> samples)
+    {
+        SimTiming timing;
+        timing.Samples = std::move(samples);
+        return timing;
+    }
+
+    // Never negative
+    template <typename Random>
+    std::chrono::nanoseconds Sample(Random& random) const
+    {
+        if (!Samples.empty())
+        {
+            std::uniform_int_distribution<size_t> index(0, Samples.size() - 1);
+            return std::max(Samples[index(random)], std::chrono::nanoseconds(0));
+        }
+        if (Jitter.count() <= 0)
+        {
+            return std::max(Mean, std::chrono::nanoseconds(0));
+        }
+        std::uniform_int_distribution<int64_t> jitter(-Jitter.count(), Jitter.count());
+        return std::max(Mean + std::chrono::nanoseconds(jitter(random)), std::chrono::nanoseconds(0));
+    }
+};
+
+enum class SimConsumerPolicy
+{
+    // One frame per TryGetNextFrame, like the rate tests
+    EachFrame,
+    // Take every waiting frame, close all but the newest and only process it
+    LatestOnly,
+};
+
+inline char const* SimConsumerPolicyName(SimConsumerPolicy policy)
+{
+    switch (policy)
+    {
+    case SimConsumerPolicy::EachFrame:
+        return "each";
+    case SimConsumerPolicy::LatestOnly:
+        return "latest";
+    }
+    return "unknown";
+}
+
+struct FramePoolSimOptions
+{
+    uint32_t BufferCount = 3;
+    std::chrono::nanoseconds MinUpdateInterval = std::chrono::milliseconds(1);
+    // A 60Hz renderer on a 60Hz display
+    SimTiming RenderInterval = SimTiming::Constant(std::chrono::nanoseconds(16'666'667));
+    std::chrono::nanoseconds RefreshInterval = std::chrono::nanoseconds(16'666'667);
+    // How long before the first refresh the renderer first presents. With a
+    // renderer locked to the display, this is how long every present waits
+    // to be captured.
+    std::chrono::nanoseconds RenderPhase{ 0 };
+    // From the refresh that captured a frame to FrameArrived
+    SimTiming DeliveryLatency = SimTiming::Constant(std::chrono::milliseconds(1));
+    // From TryGetNextFrame to closing the frame
+    SimTiming ServiceTime = SimTiming::Constant(std::chrono::milliseconds(2));
+    SimConsumerPolicy Policy = SimConsumerPolicy::EachFrame;
+    std::chrono::nanoseconds Duration = std::chrono::seconds(10);
+    uint32_t Seed = 1;
+};
+
+struct FramePoolSimResult
+{
+    uint64_t Presents = 0;
+    // Frames written to a buffer by the compositor
+    uint64_t Captured = 0;
+    // Frames the consumer processed
+    uint64_t Processed = 0;
+    // Frames the consumer took and closed unprocessed (LatestOnly)
+    uint64_t Discarded = 0;
+    // Presents replaced by a later one before they were captured
+    uint64_t Superseded = 0;
+    // Refreshes with new content that waited because every buffer was taken
+    uint64_t PoolFull = 0;
+    // Refreshes with new content that waited for MinUpdateInterval
+    uint64_t Throttled = 0;
+    uint32_t MaxBuffersInUse = 0;
+    // From the present a frame shows to FrameArrived
+    LatencyHistogram PresentToArrival;
+    // From the present a frame shows to the consumer being done with it
+    LatencyHistogram PresentToProcessed;
+    // From FrameArrived to TryGetNextFrame taking the frame
+    LatencyHistogram WaitInPool;
+    std::chrono::nanoseconds Duration{ 0 };
+
+    double ProcessedPerSecond() const
+    {
+        return Duration.count() > 0 ? Processed / std::chrono::duration<double>(Duration).count() : 0.0;
+    }
+    // Share of presents that never made it to the consumer
+    double MissedPercent() const
+    {
+        return Presents > 0 ? 100.0 * (1.0 - (static_cast<double>(Processed) / Presents)) : 0.0;
+    }
+};
+
+namespace framepoolsim
+{
+    enum class EventType
+    {
+        Present,
+        Refresh,
+        Arrive,
+        Done,
+    };
+
+    struct Event
+    {
+        std::chrono::nanoseconds Time;
+        // Keeps events at the same time in the order they were scheduled
+        uint64_t Order;
+        EventType Type;
+        // Which frame, for Arrive and Done
+        uint64_t Frame;
+
+        bool operator>(Event const& other) const { return Time != other.Time ? Time > other.Time : Order > other.Order; }
+    };
+
+    struct Frame
+    {
+        // When the present this frame shows happened
+        std::chrono::nanoseconds PresentTime;
+        std::chrono::nanoseconds ArrivalTime;
+    };
+
+    class Simulation
+    {
+    public:
+        Simulation(FramePoolSimOptions const& options) : m_options(options), m_random(options.Seed)
+        {
+            m_options.BufferCount = std::max(1u, m_options.BufferCount);
+            m_options.RefreshInterval = std::max(m_options.RefreshInterval, std::chrono::nanoseconds(1));
+        }
+
+        FramePoolSimResult Run()
+        {
+            m_result.Duration = m_options.Duration;
+            Schedule(std::chrono::nanoseconds(0), EventType::Present);
+            Schedule(std::max(m_options.RenderPhase, std::chrono::nanoseconds(0)), EventType::Refresh);
+            while (!m_events.empty())
+            {
+                auto event = m_events.top();
+                m_events.pop();
+                if (event.Time > m_options.Duration)
+                {
+                    break;
+                }
+                switch (event.Type)
+                {
+                case EventType::Present:
+                    Present(event.Time);
+                    break;
+                case EventType::Refresh:
+                    Refresh(event.Time);
+                    break;
+                case EventType::Arrive:
+                    Arrive(event.Time, event.Frame);
+                    break;
+                case EventType::Done:
+                    Done(event.Time, event.Frame);
+                    break;
+                }
+            }
+            return m_result;
+        }
+
+    private:
+        void Schedule(std::chrono::nanoseconds time, EventType type, uint64_t frame = 0)
+        {
+            m_events.push(Event{ time, m_order++, type, frame });
+        }
+
+        void Present(std::chrono::nanoseconds time)
+        {
+            m_result.Presents++;
+            if (m_hasPendingPresent)
+            {
+                m_result.Superseded++;
+            }
+            m_hasPendingPresent = true;
+            m_pendingPresentTime = time;
+            // A renderer can't present twice at the same instant
+            Schedule(time + std::max(m_options.RenderInterval.Sample(m_random), std::chrono::nanoseconds(1)), EventType::Present);
+        }
+
+        void Refresh(std::chrono::nanoseconds time)
+        {
+            Schedule(time + m_options.RefreshInterval, EventType::Refresh);
+            if (!m_hasPendingPresent)
+            {
+                return;
+            }
+            if (m_hasCaptured && time - m_lastCaptureTime < m_options.MinUpdateInterval)
+            {
+                m_result.Throttled++;
+                return;
+            }
+            if (m_buffersInUse >= m_options.BufferCount)
+            {
+                m_result.PoolFull++;
+                return;
+            }
+
+            m_hasPendingPresent = false;
+            m_hasCaptured = true;
+            m_lastCaptureTime = time;
+            m_buffersInUse++;
+            m_result.MaxBuffersInUse = std::max(m_result.MaxBuffersInUse, m_buffersInUse);
+            m_result.Captured++;
+            // Frames reach the pool in the order they were captured
+            auto arrival = std::max(time + m_options.DeliveryLatency.Sample(m_random), m_lastArrivalTime);
+            m_lastArrivalTime = arrival;
+            auto frame = m_frames.size();
+            m_frames.push_back(Frame{ m_pendingPresentTime, arrival });
+            Schedule(arrival, EventType::Arrive, frame);
+        }
+
+        void Arrive(std::chrono::nanoseconds time, uint64_t frame)
+        {
+            m_result.PresentToArrival.Record(time - m_frames[frame].PresentTime);
+            m_ready.push_back(frame);
+            if (!m_busy)
+            {
+                TakeFrame(time);
+            }
+        }
+
+        void Done(std::chrono::nanoseconds time, uint64_t frame)
+        {
+            m_result.PresentToProcessed.Record(time - m_frames[frame].PresentTime);
+            m_result.Processed++;
+            m_buffersInUse--;
+            m_busy = false;
+            // FrameArrived calls that queued up while we were busy
+            if (!m_ready.empty())
+            {
+                TakeFrame(time);
+            }
+        }
+
+        void TakeFrame(std::chrono::nanoseconds time)
+        {
+            if (m_options.Policy == SimConsumerPolicy::LatestOnly)
+            {
+                while (m_ready.size() > 1)
+                {
+                    m_result.WaitInPool.Record(time - m_frames[m_ready.front()].ArrivalTime);
+                    m_ready.pop_front();
+                    m_buffersInUse--;
+                    m_result.Discarded++;
+                }
+            }
+            auto frame = m_ready.front();
+            m_ready.pop_front();
+            m_result.WaitInPool.Record(time - m_frames[frame].ArrivalTime);
+            m_busy = true;
+            Schedule(time + m_options.ServiceTime.Sample(m_random), EventType::Done, frame);
+        }
+
+    private:
+        FramePoolSimOptions m_options;
+        std::mt19937_64 m_random;
+        std::priority_queue<Event, std::vector<Event>, std::greater<Event>> m_events;
+        uint64_t m_order = 0;
+        FramePoolSimResult m_result;
+
+        bool m_hasPendingPresent = false;
+        std::chrono::nanoseconds m_pendingPresentTime{ 0 };
+        bool m_hasCaptured = false;
+        std::chrono::nanoseconds m_lastCaptureTime{ 0 };
+        std::chrono::nanoseconds m_lastArrivalTime{ 0 };
+        uint32_t m_buffersInUse = 0;
+        std::vector<Frame> m_frames;
+        std::deque<uint64_t> m_ready;
+        bool m_busy = false;
+    };
+}
+
+inline FramePoolSimResult SimulateFramePool(FramePoolSimOptions const& options)
+{
+    return framepoolsim::Simulation(options).Run();
+}
+
+struct FramePoolSweepPoint
+{
+    uint32_t BufferCount = 0;
+    std::chrono::nanoseconds MinUpdateInterval{ 0 };
+    FramePoolSimResult Result;
+};
+
+// Every combination of buffer count and MinUpdateInterval, buffer count
+// first, with everything else from options. The points are simulated on the
+// shared BandPool, each with the same seed so they see the same renderer.
+inline std::vector<FramePoolSweepPoint> SweepFramePool(FramePoolSimOptions const& options,
+    std::vector<uint32_t> const& bufferCounts, std::vector<std::chrono::nanoseconds> const& minUpdateIntervals)
+{
+    std::vector<FramePoolSweepPoint> points;
+    for (auto bufferCount : bufferCounts)
+    {
+        for (auto interval : minUpdateIntervals)
+        {
+            FramePoolSweepPoint point;
+            point.BufferCount = bufferCount;
+            point.MinUpdateInterval = interval;
+            points.push_back(std::move(point));
+        }
+    }
+    BandPool::Shared().Run(static_cast<uint32_t>(points.size()), [&](uint32_t index)
+    {
+        auto& point = points[index];
+        auto pointOptions = options;
+        pointOptions.BufferCount = point.BufferCount;
+        pointOptions.MinUpdateInterval = point.MinUpdateInterval;
+        point.Result = SimulateFramePool(pointOptions);
+    });
+    return points;
+}
+
+// What a recorded trace says about the renderer, display and delivery, to
+// simulate that machine instead of made up timings.
+struct FramePoolCalibration
+{
+    // Changes in RenderFlipTime. Empty if the trace has no render side.
+    // Only presents that were captured are in a trace, so a renderer that
+    // outruns capture shows up slower than it is.
+    std::vector<std::chrono::nanoseconds> RenderIntervals;
+    // The display's refresh interval, taken as the shortest common gap
+    // between captured frames
+    std::chrono::nanoseconds RefreshInterval{ 0 };
+    // The typical time from a flip to the refresh that captured it
+    std::chrono::nanoseconds RenderPhase{ 0 };
+    // ArrivalTime - SystemRelativeTime, which is only meaningful where both
+    // come from the same clock (QPC on Windows)
+    std::vector<std::chrono::nanoseconds> DeliveryLatencies;
+    // What the trace saw, to check the model against
+    double ArrivalsPerSecond = 0.0;
+    LatencyHistogram FlipToArrival;
+
+    // options with the recorded timings swapped in
+    FramePoolSimOptions Apply(FramePoolSimOptions options) const
+    {
+        if (!RenderIntervals.empty())
+        {
+            options.RenderInterval = SimTiming::Recorded(RenderIntervals);
+        }
+        if (RefreshInterval.count() > 0)
+        {
+            options.RefreshInterval = RefreshInterval;
+            options.RenderPhase = RenderPhase;
+        }
+        if (!DeliveryLatencies.empty())
+        {
+            options.DeliveryLatency = SimTiming::Recorded(DeliveryLatencies);
+        }
+        return options;
+    }
+};
+
+// Throws runtime_error if there are too few records to learn anything from
+inline FramePoolCalibration CalibrateFramePool(std::vector<FrameTraceRecord> const& records)
+{
+    if (records.size() < 2)
+    {
+        throw std::runtime_error("Trace needs at least two frames to calibrate from");
+    }
+    auto toNanoseconds = [](int64_t ticks) { return std::chrono::duration_cast<std::chrono::nanoseconds>(FrameTimeSpan(ticks)); };
+    FramePoolCalibration calibration;
+    std::vector<std::chrono::nanoseconds> captureIntervals;
+    std::vector<std::chrono::nanoseconds> flipToCapture;
+    int64_t lastFlipTime = 0;
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        auto const& record = records[i];
+        calibration.DeliveryLatencies.push_back(std::max(toNanoseconds(record.ArrivalTime - record.SystemRelativeTime), std::chrono::nanoseconds(0)));
+        if (i > 0 && record.SystemRelativeTime > records[i - 1].SystemRelativeTime)
+        {
+            captureIntervals.push_back(toNanoseconds(record.SystemRelativeTime - records[i - 1].SystemRelativeTime));
+        }
+        if (record.RenderFlipTime != 0)
+        {
+            calibration.FlipToArrival.Record(toNanoseconds(record.ArrivalTime - record.RenderFlipTime));
+            if (record.SystemRelativeTime >= record.RenderFlipTime)
+            {
+                flipToCapture.push_back(toNanoseconds(record.SystemRelativeTime - record.RenderFlipTime));
+            }
+            if (lastFlipTime != 0 && record.RenderFlipTime > lastFlipTime)
+            {
+                calibration.RenderIntervals.push_back(toNanoseconds(record.RenderFlipTime - lastFlipTime));
+            }
+            lastFlipTime = record.RenderFlipTime;
+        }
+    }
+
+    // Missed refreshes only ever make gaps longer, so a low percentile is
+    // the refresh itself
+    if (!captureIntervals.empty())
+    {
+        auto index = captureIntervals.size() / 10;
+        std::nth_element(captureIntervals.begin(), captureIntervals.begin() + index, captureIntervals.end());
+        calibration.RefreshInterval = captureIntervals[index];
+    }
+    // Flips that waited more than a refresh were held up by something else
+    if (!flipToCapture.empty() && calibration.RefreshInterval.count() > 0)
+    {
+        auto middle = flipToCapture.size() / 2;
+        std::nth_element(flipToCapture.begin(), flipToCapture.begin() + middle, flipToCapture.end());
+        calibration.RenderPhase = flipToCapture[middle] % calibration.RefreshInterval;
+    }
+    auto span = records.back().ArrivalTime - records.front().ArrivalTime;
+    if (span > 0)
+    {
+        calibration.ArrivalsPerSecond = (records.size() - 1) / std::chrono::duration<double>(FrameTimeSpan(span)).count();
+    }
+    return calibration;
+}
@@ -0,0 +1,362 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "BufferPool.h"
+#include "FrameTimer.h"
+#include "ImageView.h"
+
+// The pixels behind one or more frames. Frames that didn't change (and
+// duplicated frames) share the same pixels.
+struct FramePixels
+{
+    BufferLease Buffer;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t RowPitch = 0;
+
+    BgraImageView View() const { return BgraImageView{ Buffer.Data(), Width, Height, RowPitch }; }
+};
+
+// The portable counterpart of Direct3D11CaptureFrame
+class SourceFrame
+{
+public:
+    SourceFrame(std::shared_ptr<FramePixels const> pixels, FrameTimeSpan systemRelativeTime, uint64_t sequence)
+        : m_pixels(std::move(pixels)), m_systemRelativeTime(systemRelativeTime), m_sequence(sequence) {}
+
+    BgraImageView Surface() const { return m_pixels->View(); }
+    FrameTimeSpan SystemRelativeTime() const { return m_systemRelativeTime; }
+    PixelRect ContentSize() const { return m_pixels->View().Bounds(); }
+    // Counts every frame the source produced, so gaps mean dropped frames
+    uint64_t Sequence() const { return m_sequence; }
+    // Frames with the same pixels compare equal here
+    FramePixels const* PixelsIdentity() const { return m_pixels.get(); }
+
+private:
+    std::shared_ptr<FramePixels const> m_pixels;
+    FrameTimeSpan m_systemRelativeTime;
+    uint64_t m_sequence;
+};
+
+// Shaped after Direct3D11CaptureFramePool: frames are pulled with
+// TryGetNextFrame, usually from a FrameArrived handler. At most BufferCount
+// frames wait to be pulled; frames that arrive while they're all taken are
+// lost, just like with a real frame pool.
+class IFrameSource
+{
+public:
+    typedef std::function<void(IFrameSource&)> FrameArrivedHandler;
+
+    virtual ~IFrameSource() = default;
+
+    virtual std::optional<SourceFrame> TryGetNextFrame() = 0;
+    virtual uint64_t FrameArrived(FrameArrivedHandler handler) = 0;
+    virtual void FrameArrived(uint64_t token) = 0;
+    virtual void StartCapture() = 0;
+    virtual void Close() = 0;
+};
+
+// Draws the content for a frame. Changes are only drawn when the script says
+// so, or on every frame when the content is animated.
+typedef std::function<void(uint64_t frameIndex, uint8_t* data, uint32_t width, uint32_t height, uint32_t rowPitch)> SyntheticPainter;
+
+struct SyntheticContentChange
+{
+    // Index of the first produced frame that shows this content
+    uint64_t AtFrame = 0;
+    SyntheticPainter Painter;
+    // Repaint every frame rather than just once
+    bool Animated = false;
+};
+
+inline SyntheticPainter SolidColorPainter(BgraColor color)
+{
+    return [color](uint64_t, uint8_t* data, uint32_t width, uint32_t height, uint32_t rowPitch)
+    {
+        auto packed = color.Packed();
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = data + (static_cast<size_t>(rowPitch) * y);
+            for (uint32_t x = 0; x < width; x++)
+            {
+                std::memcpy(row + (x * 4), &packed, 4);
+            }
+        }
+    };
+}
+
+// A vertical bar that moves a few pixels every frame, over a background
+inline SyntheticPainter MovingBarPainter(BgraColor background, BgraColor bar, uint32_t barWidth)
+{
+    auto fill = SolidColorPainter(background);
+    return [fill, bar, barWidth](uint64_t frameIndex, uint8_t* data, uint32_t width, uint32_t height, uint32_t rowPitch)
+    {
+        fill(frameIndex, data, width, height, rowPitch);
+        auto start = static_cast<uint32_t>((frameIndex * 8) % width);
+        auto end = std::min(width, start + barWidth);
+        auto packed = bar.Packed();
+        for (uint32_t y = 0; y < height; y++)
+        {
+            auto row = data + (static_cast<size_t>(rowPitch) * y);
+            for (auto x = start; x < end; x++)
+            {
+                std::memcpy(row + (x * 4), &packed, 4);
+            }
+        }
+    };
+}
+
+struct SyntheticFrameSourceOptions
+{
+    uint32_t Width = 1920;
+    uint32_t Height = 1080;
+    double FramesPerSecond = 60.0;
+    // Each timestamp is moved by up to this much either way
+    std::chrono::microseconds TimestampJitter{ 0 };
+    // Chance that a produced frame is never delivered
+    double DropProbability = 0.0;
+    // Chance that the next frame repeats the previous one's pixels, even if
+    // the content changed
+    double DuplicateProbability = 0.0;
+    uint32_t BufferCount = 2;
+    // Pace frames at FramesPerSecond. Otherwise frames are produced as fast
+    // as they're consumed (timestamps still follow FramesPerSecond).
+    bool RealTime = true;
+    // Stop after this many frames, 0 runs until Close
+    uint64_t FrameLimit = 0;
+    uint32_t Seed = 1;
+    // Ordered by AtFrame. Before the first change frames are black.
+    std::vector<SyntheticContentChange> Script;
+};
+
+struct SyntheticFrameSourceStats
+{
+    uint64_t Produced = 0;
+    uint64_t Delivered = 0;
+    // Dropped by DropProbability
+    uint64_t Dropped = 0;
+    // Lost because every buffer was waiting to be pulled
+    uint64_t PoolFull = 0;
+    uint64_t Duplicated = 0;
+    uint64_t Repaints = 0;
+};
+
+// Produces BGRA frames on its own thread and raises FrameArrived from it, like
+// a free threaded frame pool. Lets everything downstream of FrameArrived run
+// without a capture session, at real rates or as fast as it can.
+class SyntheticFrameSource : public IFrameSource
+{
+public:
+    SyntheticFrameSource(SyntheticFrameSourceOptions options, BufferPool& pool = BufferPool::Shared())
+        : m_options(std::move(options)), m_pool(pool), m_random(m_options.Seed)
+    {
+        m_options.BufferCount = std::max(1u, m_options.BufferCount);
+        m_options.FramesPerSecond = std::max(1e-3, m_options.FramesPerSecond);
+    }
+    ~SyntheticFrameSource() override
+    {
+        Close();
+    }
+
+    std::optional<SourceFrame> TryGetNextFrame() override
+    {
+        std::optional<SourceFrame> frame;
+        {
+            std::lock_guard lock(m_lock);
+            if (m_ready.empty())
+            {
+                return std::nullopt;
+            }
+            frame.emplace(std::move(m_ready.front()));
+            m_ready.pop_front();
+        }
+        m_pulled.notify_all();
+        return frame;
+    }
+
+    uint64_t FrameArrived(FrameArrivedHandler handler) override
+    {
+        std::lock_guard lock(m_lock);
+        auto token = ++m_lastToken;
+        m_handlers.emplace_back(token, std::move(handler));
+        return token;
+    }
+
+    void FrameArrived(uint64_t token) override
+    {
+        std::lock_guard lock(m_lock);
+        m_handlers.erase(std::remove_if(m_handlers.begin(), m_handlers.end(), [token](auto const& entry) { return entry.first == token; }), m_handlers.end());
+    }
+
+    void StartCapture() override
+    {
+        if (!m_thread.joinable())
+        {
+            m_thread = std::thread([this]() { ProducerLoop(); });
+        }
+    }
+
+    void Close() override
+    {
+        {
+            std::lock_guard lock(m_lock);
+            m_closed = true;
+        }
+        m_pulled.notify_all();
+        if (m_thread.joinable() && m_thread.get_id() != std::this_thread::get_id())
+        {
+            m_thread.join();
+        }
+        std::lock_guard lock(m_lock);
+        m_ready.clear();
+    }
+
+    // Waits for the producer to stop, either from FrameLimit or Close
+    void WaitForCompletion()
+    {
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    SyntheticFrameSourceStats Stats() const
+    {
+        std::lock_guard lock(m_lock);
+        return m_stats;
+    }
+
+private:
+    std::shared_ptr<FramePixels const> Paint(uint64_t frameIndex, SyntheticPainter const& painter)
+    {
+        auto pixels = std::make_shared<FramePixels>();
+        pixels->Width = m_options.Width;
+        pixels->Height = m_options.Height;
+        pixels->RowPitch = m_options.Width * BgraImageView::BytesPerPixel;
+        pixels->Buffer = m_pool.Lease(static_cast<size_t>(pixels->RowPitch) * pixels->Height);
+        if (painter)
+        {
+            painter(frameIndex, pixels->Buffer.Data(), pixels->Width, pixels->Height, pixels->RowPitch);
+        }
+        else
+        {
+            std::memset(pixels->Buffer.Data(), 0, pixels->Buffer.Size());
+        }
+        return pixels;
+    }
+
+    void ProducerLoop()
+    {
+        std::uniform_real_distribution<double> chance(0.0, 1.0);
+        auto jitterTicks = std::chrono::duration_cast<FrameTimeSpan>(m_options.TimestampJitter).count();
+        std::uniform_int_distribution<int64_t> jitter(-jitterTicks, jitterTicks);
+        auto interval = std::chrono::duration<double>(1.0 / m_options.FramesPerSecond);
+        auto start = std::chrono::steady_clock::now();
+        // Real frame times are relative to boot, so don't start at zero
+        auto baseTime = std::chrono::duration_cast<FrameTimeSpan>(start.time_since_epoch());
+        auto lastTime = FrameTimeSpan::min();
+
+        size_t scriptIndex = 0;
+        SyntheticContentChange const* content = nullptr;
+        std::shared_ptr<FramePixels const> pixels;
+        std::shared_ptr<FramePixels const> lastDelivered;
+
+        for (uint64_t frameIndex = 0; !m_closed && (m_options.FrameLimit == 0 || frameIndex < m_options.FrameLimit); frameIndex++)
+        {
+            auto offset = std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval * static_cast<double>(frameIndex));
+            if (m_options.RealTime)
+            {
+                std::this_thread::sleep_until(start + offset);
+            }
+
+            auto repaint = pixels == nullptr;
+            while (scriptIndex < m_options.Script.size() && m_options.Script[scriptIndex].AtFrame <= frameIndex)
+            {
+                content = &m_options.Script[scriptIndex++];
+                repaint = true;
+            }
+            if (repaint || (content != nullptr && content->Animated))
+            {
+                pixels = Paint(frameIndex, content != nullptr ? content->Painter : SyntheticPainter());
+                std::lock_guard lock(m_lock);
+                m_stats.Repaints++;
+            }
+
+            auto time = baseTime + std::chrono::duration_cast<FrameTimeSpan>(offset) + FrameTimeSpan(jitterTicks > 0 ? jitter(m_random) : 0);
+            // Frame times never go backwards
+            time = std::max(time, lastTime + FrameTimeSpan(1));
+            lastTime = time;
+
+            auto dropped = m_options.DropProbability > 0.0 && chance(m_random) < m_options.DropProbability;
+            auto duplicated = m_options.DuplicateProbability > 0.0 && lastDelivered != nullptr && chance(m_random) < m_options.DuplicateProbability;
+            {
+                std::unique_lock lock(m_lock);
+                m_stats.Produced++;
+                if (dropped)
+                {
+                    m_stats.Dropped++;
+                    continue;
+                }
+                // Without real time pacing the consumer sets the rate
+                if (!m_options.RealTime)
+                {
+                    m_pulled.wait(lock, [this]() { return m_closed || m_ready.size() < m_options.BufferCount; });
+                }
+                if (m_ready.size() >= m_options.BufferCount)
+                {
+                    m_stats.PoolFull++;
+                    continue;
+                }
+                auto const& framePixels = duplicated ? lastDelivered : pixels;
+                m_ready.emplace_back(framePixels, time, frameIndex);
+                lastDelivered = framePixels;
+                m_stats.Delivered++;
+                m_stats.Duplicated += duplicated ? 1 : 0;
+            }
+
+            RaiseFrameArrived();
+        }
+    }
+
+    void RaiseFrameArrived()
+    {
+        std::vector<FrameArrivedHandler> handlers;
+        {
+            std::lock_guard lock(m_lock);
+            for (auto&& entry : m_handlers)
+            {
+                handlers.push_back(entry.second);
+            }
+        }
+        for (auto&& handler : handlers)
+        {
+            handler(*this);
+        }
+    }
+
+private:
+    SyntheticFrameSourceOptions m_options;
+    BufferPool& m_pool;
+    std::mt19937 m_random;
+    mutable std::mutex m_lock;
+    std::condition_variable m_pulled;
+    std::deque<SourceFrame> m_ready;
+    std::vector<std::pair<uint64_t, FrameArrivedHandler>> m_handlers;
+    uint64_t m_lastToken = 0;
+    SyntheticFrameSourceStats m_stats;
+    std::atomic<bool> m_closed = false;
+    std::thread m_thread;
+};
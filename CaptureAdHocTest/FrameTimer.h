@@ -1,26 +1,253 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Same tick as winrt::Windows::Foundation::TimeSpan, but without pulling in
+// C++/WinRT so that this header can be used outside of the test app.
+typedef std::chrono::duration<int64_t, std::ratio<1, 10'000'000>> FrameTimeSpan;
+
+inline uint32_t HighestSetBit(uint64_t value)
+{
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index = 0;
+    _BitScanReverse64(&index, value);
+    return index;
+#elif defined(_MSC_VER)
+    unsigned long index = 0;
+    if (_BitScanReverse(&index, static_cast<unsigned long>(value >> 32)))
+    {
+        return index + 32;
+    }
+    _BitScanReverse(&index, static_cast<unsigned long>(value));
+    return index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+}
+
+// A fixed size log-linear histogram of durations, recorded in nanoseconds.
+// Every power of two range is split into SubBucketCount linear buckets, so
+// any reported value is within 1/SubBucketCount (~3%) of the recorded one.
+// Recording is O(1) and never allocates.
+class LatencyHistogram
+{
+public:
+    static constexpr uint32_t SubBucketBits = 5;
+    static constexpr uint32_t SubBucketCount = 1 << SubBucketBits;
+    static constexpr uint32_t BucketCount = (64 - SubBucketBits + 1) * SubBucketCount;
+
+    void Record(std::chrono::nanoseconds value)
+    {
+        auto nanoseconds = static_cast<uint64_t>(std::max<int64_t>(value.count(), 0));
+        m_counts[BucketIndex(nanoseconds)]++;
+        m_totalCount++;
+        m_min = std::min(m_min, nanoseconds);
+        m_max = std::max(m_max, nanoseconds);
+    }
+
+    void Merge(LatencyHistogram const& other)
+    {
+        for (uint32_t i = 0; i < BucketCount; i++)
+        {
+            m_counts[i] += other.m_counts[i];
+        }
+        m_totalCount += other.m_totalCount;
+        m_min = std::min(m_min, other.m_min);
+        m_max = std::max(m_max, other.m_max);
+    }
+
+    void Reset()
+    {
+        m_counts.fill(0);
+        m_totalCount = 0;
+        m_min = std::numeric_limits<uint64_t>::max();
+        m_max = 0;
+    }
+
+    uint64_t Count() const { return m_totalCount; }
+    std::chrono::nanoseconds Min() const { return std::chrono::nanoseconds(m_totalCount > 0 ? m_min : 0); }
+    std::chrono::nanoseconds Max() const { return std::chrono::nanoseconds(m_max); }
+
+    // percentile is in the range [0, 100]
+    std::chrono::nanoseconds Percentile(double percentile) const
+    {
+        if (m_totalCount == 0)
+        {
+            return std::chrono::nanoseconds(0);
+        }
+
+        auto clamped = std::clamp(percentile, 0.0, 100.0);
+        auto target = static_cast<uint64_t>(std::ceil((clamped / 100.0) * m_totalCount));
+        target = std::max<uint64_t>(target, 1);
+
+        uint64_t runningCount = 0;
+        for (uint32_t i = 0; i < BucketCount; i++)
+        {
+            runningCount += m_counts[i];
+            if (runningCount >= target)
+            {
+                // Report the middle of the bucket, but never outside of what we've seen.
+                auto lower = BucketLowerBound(i);
+                auto upper = BucketUpperBound(i);
+                auto middle = lower + (upper - lower) / 2;
+                return std::chrono::nanoseconds(std::clamp(middle, m_min, m_max));
+            }
+        }
+        return std::chrono::nanoseconds(m_max);
+    }
+
+    static uint32_t BucketIndex(uint64_t value)
+    {
+        if (value < SubBucketCount)
+        {
+            return static_cast<uint32_t>(value);
+        }
+        auto shift = HighestSetBit(value) - SubBucketBits;
+        auto subBucket = static_cast<uint32_t>(value >> shift) & (SubBucketCount - 1);
+        return ((shift + 1) * SubBucketCount) + subBucket;
+    }
+
+    static uint64_t BucketLowerBound(uint32_t index)
+    {
+        if (index < SubBucketCount)
+        {
+            return index;
+        }
+        auto shift = (index / SubBucketCount) - 1;
+        auto subBucket = index % SubBucketCount;
+        return static_cast<uint64_t>(SubBucketCount + subBucket) << shift;
+    }
+
+    static uint64_t BucketUpperBound(uint32_t index)
+    {
+        if (index < SubBucketCount)
+        {
+            return index;
+        }
+        auto shift = (index / SubBucketCount) - 1;
+        return BucketLowerBound(index) + ((uint64_t(1) << shift) - 1);
+    }
+
+private:
+    std::array<uint64_t, BucketCount> m_counts = {};
+    uint64_t m_totalCount = 0;
+    uint64_t m_min = std::numeric_limits<uint64_t>::max();
+    uint64_t m_max = 0;
+};
+
+struct FrameTimeStatistics
+{
+    typedef std::chrono::duration<double, std::milli> Milliseconds;
+
+    uint64_t Intervals = 0;
+    Milliseconds Mean{};
+    Milliseconds StandardDeviation{};
+    // Mean absolute difference between consecutive frame times
+    Milliseconds Jitter{};
+    Milliseconds Min{};
+    Milliseconds P50{};
+    Milliseconds P90{};
+    Milliseconds P99{};
+    Milliseconds P999{};
+    Milliseconds Max{};
+};
 
 template <typename T>
 struct FrameTimer
 {
     uint32_t m_totalFrames = 0;
-    winrt::Windows::Foundation::TimeSpan m_totalTimeBetweenFrames = winrt::Windows::Foundation::TimeSpan::zero();
+    FrameTimeSpan m_totalTimeBetweenFrames = FrameTimeSpan::zero();
     T m_lastTimestamp;
 
     void RecordTimestamp(T const& timestamp)
     {
         if (m_totalFrames > 0)
         {
-            auto timeBetweenFrames = std::chrono::duration_cast<winrt::Windows::Foundation::TimeSpan>(timestamp - m_lastTimestamp);
+            auto timeBetweenFrames = std::chrono::duration_cast<FrameTimeSpan>(timestamp - m_lastTimestamp);
             m_totalTimeBetweenFrames += timeBetweenFrames;
+            RecordInterval(std::chrono::duration_cast<std::chrono::nanoseconds>(timestamp - m_lastTimestamp));
         }
 
         m_totalFrames++;
         m_lastTimestamp = timestamp;
     }
 
-    std::chrono::duration<double, std::milli> ComputeAverageFrameTime()
+    std::chrono::duration<double, std::milli> ComputeAverageFrameTime() const
     {
-        return m_totalTimeBetweenFrames / (double)m_totalFrames;
+        if (m_totalFrames < 2)
+        {
+            return std::chrono::duration<double, std::milli>::zero();
+        }
+        return m_totalTimeBetweenFrames / (double)(m_totalFrames - 1);
+    }
+
+    std::chrono::duration<double, std::milli> ComputeStandardDeviation() const
+    {
+        if (m_intervalCount < 2)
+        {
+            return std::chrono::duration<double, std::milli>::zero();
+        }
+        return std::chrono::duration<double, std::milli>(std::sqrt(m_intervalM2 / (double)(m_intervalCount - 1)));
     }
-};
\ No newline at end of file
+
+    std::chrono::duration<double, std::milli> ComputeJitter() const
+    {
+        if (m_intervalCount < 2)
+        {
+            return std::chrono::duration<double, std::milli>::zero();
+        }
+        return std::chrono::duration<double, std::milli>(m_totalJitter / (double)(m_intervalCount - 1));
+    }
+
+    FrameTimeStatistics ComputeStatistics() const
+    {
+        typedef FrameTimeStatistics::Milliseconds Milliseconds;
+        FrameTimeStatistics stats;
+        stats.Intervals = m_intervalCount;
+        stats.Mean = ComputeAverageFrameTime();
+        stats.StandardDeviation = ComputeStandardDeviation();
+        stats.Jitter = ComputeJitter();
+        stats.Min = std::chrono::duration_cast<Milliseconds>(m_intervals.Min());
+        stats.P50 = std::chrono::duration_cast<Milliseconds>(m_intervals.Percentile(50.0));
+        stats.P90 = std::chrono::duration_cast<Milliseconds>(m_intervals.Percentile(90.0));
+        stats.P99 = std::chrono::duration_cast<Milliseconds>(m_intervals.Percentile(99.0));
+        stats.P999 = std::chrono::duration_cast<Milliseconds>(m_intervals.Percentile(99.9));
+        stats.Max = std::chrono::duration_cast<Milliseconds>(m_intervals.Max());
+        return stats;
+    }
+
+    LatencyHistogram const& Histogram() const { return m_intervals; }
+
+private:
+    void RecordInterval(std::chrono::nanoseconds interval)
+    {
+        m_intervals.Record(interval);
+
+        // Welford's online algorithm, in milliseconds
+        auto value = std::chrono::duration<double, std::milli>(interval).count();
+        m_intervalCount++;
+        auto delta = value - m_intervalMean;
+        m_intervalMean += delta / (double)m_intervalCount;
+        m_intervalM2 += delta * (value - m_intervalMean);
+
+        if (m_intervalCount > 1)
+        {
+            m_totalJitter += std::abs(value - m_lastInterval);
+        }
+        m_lastInterval = value;
+    }
+
+    LatencyHistogram m_intervals;
+    uint64_t m_intervalCount = 0;
+    double m_intervalMean = 0.0;
+    double m_intervalM2 = 0.0;
+    double m_totalJitter = 0.0;
+    double m_lastInterval = 0.0;
+};
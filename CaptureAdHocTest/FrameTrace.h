@@ -0,0 +1,223 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <vector>
+#include "FrameTimer.h"
+#include "MappedFile.h"
+
+// One record per captured frame. All times are in FrameTimeSpan (100ns) ticks.
+// ArrivalTime and RenderFlipTime are steady_clock based, SystemRelativeTime is
+// whatever the capture API stamped on the frame. RenderFlipTime is when the
+// captured frame was presented if the test could read its frame number (see
+// FrameBarcode.h), otherwise the last present before it arrived. Zero means
+// there was no render side to the test.
+struct FrameTraceRecord
+{
+    uint64_t Sequence = 0;
+    int64_t SystemRelativeTime = 0;
+    int64_t ArrivalTime = 0;
+    int64_t RenderFlipTime = 0;
+};
+
+inline int64_t ToTraceTicks(std::chrono::steady_clock::time_point const& time)
+{
+    return std::chrono::duration_cast<FrameTimeSpan>(time.time_since_epoch()).count();
+}
+
+// Trace files start with a small header followed by a stream of records. Each
+// field of a record is stored as the zigzag varint of its delta-of-delta, which
+// for a steady frame cadence is a handful of bytes per frame.
+//
+// The file grows in large zero filled steps, and zeros decode as records too,
+// so the header says how much of it was written. The writer updates it after
+// every record, and that's as far as a crashed run's file is read.
+struct FrameTraceHeader
+{
+    static constexpr std::array<char, 8> ExpectedMagic = { 'C', 'A', 'P', 'T', 'R', 'A', 'C', 'E' };
+    static constexpr uint32_t CurrentVersion = 2;
+
+    std::array<char, 8> Magic = ExpectedMagic;
+    uint32_t Version = CurrentVersion;
+    uint32_t TicksPerSecond = static_cast<uint32_t>(FrameTimeSpan::period::den);
+    uint64_t CommittedRecords = 0;
+    // Record bytes after the header
+    uint64_t CommittedBytes = 0;
+};
+
+class FrameTraceCodec
+{
+public:
+    static constexpr size_t FieldCount = 4;
+    // A 64-bit zigzag varint takes at most 10 bytes
+    static constexpr size_t MaxRecordSize = FieldCount * 10;
+
+    // Returns the number of bytes written to output
+    size_t Encode(FrameTraceRecord const& record, uint8_t* output)
+    {
+        auto values = ToFields(record);
+        size_t size = 0;
+        for (size_t i = 0; i < FieldCount; i++)
+        {
+            auto delta = static_cast<int64_t>(static_cast<uint64_t>(values[i]) - static_cast<uint64_t>(m_previous[i]));
+            auto deltaOfDelta = static_cast<int64_t>(static_cast<uint64_t>(delta) - static_cast<uint64_t>(m_previousDelta[i]));
+            size += WriteVarint(ZigZag(deltaOfDelta), output + size);
+            m_previous[i] = values[i];
+            m_previousDelta[i] = delta;
+        }
+        return size;
+    }
+
+    // Returns the number of bytes consumed, or zero if the input ends in the
+    // middle of a record.
+    size_t Decode(uint8_t const* input, size_t inputSize, FrameTraceRecord& record)
+    {
+        std::array<int64_t, FieldCount> values = {};
+        std::array<int64_t, FieldCount> deltas = {};
+        size_t size = 0;
+        for (size_t i = 0; i < FieldCount; i++)
+        {
+            uint64_t encoded = 0;
+            auto consumed = ReadVarint(input + size, inputSize - size, encoded);
+            if (consumed == 0)
+            {
+                return 0;
+            }
+            size += consumed;
+            deltas[i] = static_cast<int64_t>(static_cast<uint64_t>(m_previousDelta[i]) + static_cast<uint64_t>(UnZigZag(encoded)));
+            values[i] = static_cast<int64_t>(static_cast<uint64_t>(m_previous[i]) + static_cast<uint64_t>(deltas[i]));
+        }
+        m_previous = values;
+        m_previousDelta = deltas;
+        record = FromFields(values);
+        return size;
+    }
+
+private:
+    static std::array<int64_t, FieldCount> ToFields(FrameTraceRecord const& record)
+    {
+        return { static_cast<int64_t>(record.Sequence), record.SystemRelativeTime, record.ArrivalTime, record.RenderFlipTime };
+    }
+
+    static FrameTraceRecord FromFields(std::array<int64_t, FieldCount> const& values)
+    {
+        return FrameTraceRecord{ static_cast<uint64_t>(values[0]), values[1], values[2], values[3] };
+    }
+
+    static uint64_t ZigZag(int64_t value)
+    {
+        return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    static int64_t UnZigZag(uint64_t value)
+    {
+        return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    static size_t WriteVarint(uint64_t value, uint8_t* output)
+    {
+        size_t size = 0;
+        while (value >= 0x80)
+        {
+            output[size++] = static_cast<uint8_t>(value | 0x80);
+            value >>= 7;
+        }
+        output[size++] = static_cast<uint8_t>(value);
+        return size;
+    }
+
+    static size_t ReadVarint(uint8_t const* input, size_t inputSize, uint64_t& value)
+    {
+        value = 0;
+        for (size_t i = 0; i < inputSize && i < 10; i++)
+        {
+            value |= static_cast<uint64_t>(input[i] & 0x7F) << (7 * i);
+            if ((input[i] & 0x80) == 0)
+            {
+                return i + 1;
+            }
+        }
+        return 0;
+    }
+
+private:
+    std::array<int64_t, FieldCount> m_previous = {};
+    std::array<int64_t, FieldCount> m_previousDelta = {};
+};
+
+// Appends records to a trace file. Not thread safe, it's expected to only be
+// called from the FrameArrived handler.
+class FrameTraceWriter
+{
+public:
+    FrameTraceWriter(std::filesystem::path const& path) : m_file(path)
+    {
+        FrameTraceHeader header;
+        m_file.Append(&header, sizeof(header));
+    }
+
+    void Write(FrameTraceRecord const& record)
+    {
+        std::array<uint8_t, FrameTraceCodec::MaxRecordSize> buffer;
+        auto size = m_codec.Encode(record, buffer.data());
+        m_file.Append(buffer.data(), size);
+        m_recordCount++;
+        // Only once the record is in the file. The reader stops at whichever
+        // count runs out first, so a crash between the two is still consistent.
+        uint64_t committed[] = { m_recordCount, m_file.Size() - sizeof(FrameTraceHeader) };
+        m_file.Overwrite(offsetof(FrameTraceHeader, CommittedRecords), committed, sizeof(committed));
+    }
+
+    uint64_t RecordCount() const { return m_recordCount; }
+    uint64_t SizeInBytes() const { return m_file.Size(); }
+
+    void Close() { m_file.Close(); }
+
+private:
+    MappedAppendFile m_file;
+    FrameTraceCodec m_codec;
+    uint64_t m_recordCount = 0;
+};
+
+// Decodes every record the trace file's header says was written. A file that
+// was never closed (e.g. from a crashed run) has padding after them.
+inline std::vector<FrameTraceRecord> ReadFrameTrace(std::filesystem::path const& path)
+{
+    MappedReadOnlyFile file(path);
+    FrameTraceHeader header;
+    if (file.Size() < sizeof(header))
+    {
+        throw std::runtime_error("Trace file is too small!");
+    }
+    std::memcpy(&header, file.Data(), sizeof(header));
+    if (header.Magic != FrameTraceHeader::ExpectedMagic || header.Version != FrameTraceHeader::CurrentVersion)
+    {
+        throw std::runtime_error("Unrecognized trace file!");
+    }
+    if (header.TicksPerSecond != FrameTimeSpan::period::den)
+    {
+        throw std::runtime_error("Unsupported trace tick rate!");
+    }
+
+    std::vector<FrameTraceRecord> records;
+    FrameTraceCodec codec;
+    auto data = file.Data() + sizeof(header);
+    auto remaining = static_cast<size_t>(std::min<uint64_t>(header.CommittedBytes, file.Size() - sizeof(header)));
+    while (remaining > 0 && records.size() < header.CommittedRecords)
+    {
+        FrameTraceRecord record;
+        auto consumed = codec.Decode(data, remaining, record);
+        if (consumed == 0)
+        {
+            break;
+        }
+        records.push_back(record);
+        data += consumed;
+        remaining -= consumed;
+    }
+    return records;
+}
@@ -39,6 +39,7 @@ FullscreenMaxRateWindow::FullscreenMaxRateWindow(FullscreenMode mode)
 
     m_d3dDevice = util::CreateD3DDevice();
     m_d3dDevice->GetImmediateContext(m_d3dContext.put());
+    m_d3dContext1 = m_d3dContext.as<ID3D11DeviceContext1>();
     m_swapChain = util::CreateDXGISwapChainForWindow(m_d3dDevice, 800, 600, DXGI_FORMAT_B8G8R8A8_UNORM, 2, m_window);
 
     // Get the adapter from our d3d device
@@ -82,13 +83,28 @@ FullscreenMaxRateWindow::~FullscreenMaxRateWindow()
     winrt::check_hresult(m_swapChain->SetFullscreenState(false, nullptr));
 }
 
-void FullscreenMaxRateWindow::Flip()
+uint32_t FullscreenMaxRateWindow::Flip()
 {
     float color[4] = { 1.0f, 0.0f, 0.0f, 1.0f }; // RGBA
     m_d3dContext->ClearRenderTargetView(m_renderTargetView.get(), color);
+
+    // Stamp the frame number
+    auto frameNumber = m_frameNumber++;
+    auto toRect = [](PixelRect const& rect) { return D3D11_RECT{ static_cast<LONG>(rect.X), static_cast<LONG>(rect.Y), static_cast<LONG>(rect.Right()), static_cast<LONG>(rect.Bottom()) }; };
+    float dark[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+    float lit[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    auto bounds = toRect(m_barcode.Bounds());
+    m_d3dContext1->ClearView(m_renderTargetView.get(), dark, &bounds, 1);
+    std::vector<D3D11_RECT> litRects;
+    for (auto&& rect : m_barcode.LitRects(frameNumber))
+    {
+        litRects.push_back(toRect(rect));
+    }
+    m_d3dContext1->ClearView(m_renderTargetView.get(), lit, litRects.data(), static_cast<UINT>(litRects.size()));
     
     DXGI_PRESENT_PARAMETERS presentParameters{};
     winrt::check_hresult(m_swapChain->Present1(0, 0, &presentParameters));
+    return frameNumber;
 }
 
 LRESULT FullscreenMaxRateWindow::MessageHandler(UINT const message, WPARAM const wparam, LPARAM const lparam)
@@ -1,6 +1,7 @@
 #pragma once
 #include <robmikh.common/DesktopWindow.h>
 #include "TestParams.h"
+#include "FrameBarcode.h"
 
 struct FullscreenMaxRateWindow : robmikh::common::desktop::DesktopWindow<FullscreenMaxRateWindow>
 {
@@ -12,13 +13,18 @@ struct FullscreenMaxRateWindow : robmikh::common::desktop::DesktopWindow<Fullscr
 
     LRESULT MessageHandler(UINT const message, WPARAM const wparam, LPARAM const lparam);
 
-    void Flip();
+    // Stamps the next frame number into the top left corner (see
+    // FrameBarcode.h) and presents. Returns the frame number.
+    uint32_t Flip();
     bool Closed() { return m_windowClosed; }
 
 private:
     winrt::com_ptr<ID3D11Device> m_d3dDevice;
     winrt::com_ptr<IDXGISwapChain1> m_swapChain;
     winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+    winrt::com_ptr<ID3D11DeviceContext1> m_d3dContext1;
     winrt::com_ptr<ID3D11RenderTargetView> m_renderTargetView;
     bool m_windowClosed = false;
+    FrameBarcodeLayout m_barcode;
+    uint32_t m_frameNumber = 0;
 };
\ No newline at end of file
@@ -0,0 +1,627 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "FrameHash.h"
+#include "ImageDiff.h"
+#include "ImageView.h"
+#include "MappedFile.h"
+#include "ParallelFor.h"
+#include "SimdSupport.h"
+
+// Known good frames for tests to compare their captures against, one file
+// per test, resolution and DPI. A golden is split into tiles, and each tile
+// is stored with the hash HashImage gives that tile of the frame. Comparing
+// a capture then only takes hashing it: just the tiles whose hash differs
+// are decompressed and compared pixel by pixel, so a passing comparison
+// never touches the golden's pixels at all.
+//
+// Tiles are compressed on their own with run length encoding of whole
+// pixels. Test scenes are mostly flat color, which that squeezes down to
+// almost nothing, and a tile decodes without an inflater.
+struct GoldenKey
+{
+    std::string Test;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t Dpi = 96;
+
+    std::string FileName() const
+    {
+        return Test + "_" + std::to_string(Width) + "x" + std::to_string(Height) + "_" + std::to_string(Dpi) + "dpi.golden";
+    }
+};
+
+namespace golden
+{
+    constexpr char Magic[8] = { 'C', 'A', 'H', 'G', 'O', 'L', 'D', '1' };
+    constexpr uint32_t Version = 1;
+    constexpr uint32_t DefaultTileSize = 128;
+    // The most pixels one run or literal token covers
+    constexpr uint32_t MaxRun = 128;
+
+    enum class TileEncoding : uint32_t
+    {
+        Raw = 0,
+        RunLength = 1,
+    };
+
+    // Everything is little endian, like everything this runs on
+    struct FileHeader
+    {
+        char Magic[8];
+        uint32_t Version;
+        uint32_t Width;
+        uint32_t Height;
+        uint32_t Dpi;
+        uint32_t TileSize;
+        uint32_t Reserved;
+    };
+    static_assert(sizeof(FileHeader) == 32, "Golden header must be packed");
+
+    // One per tile, row by row, right after the header. Offset is from the
+    // start of the file.
+    struct TileEntry
+    {
+        uint64_t Hash;
+        uint64_t Offset;
+        uint32_t Size;
+        TileEncoding Encoding;
+    };
+    static_assert(sizeof(TileEntry) == 24, "Golden tile entry must be packed");
+
+    inline uint32_t TileCount(uint32_t size, uint32_t tileSize)
+    {
+        return (size + tileSize - 1) / tileSize;
+    }
+
+    // Edge tiles are cut short to the frame
+    inline PixelRect TileRect(uint32_t width, uint32_t height, uint32_t tileSize, uint32_t tileX, uint32_t tileY)
+    {
+        auto x = tileX * tileSize;
+        auto y = tileY * tileSize;
+        return PixelRect{ x, y, std::min(tileSize, width - x), std::min(tileSize, height - y) };
+    }
+
+    // A token byte with the top bit set is followed by one pixel, repeated
+    // (token & 0x7f) + 1 times. Otherwise token + 1 pixels follow as they are.
+    // Runs carry on from one tile row to the next.
+    inline void CompressTile(BgraImageView const& tile, std::vector<uint8_t>& out, std::vector<uint32_t>& pixels)
+    {
+        pixels.resize(static_cast<size_t>(tile.Width) * tile.Height);
+        for (uint32_t y = 0; y < tile.Height; y++)
+        {
+            std::memcpy(pixels.data() + (static_cast<size_t>(tile.Width) * y), tile.Row(y), static_cast<size_t>(tile.Width) * BgraImageView::BytesPerPixel);
+        }
+
+        auto flushLiteral = [&](size_t begin, size_t end)
+        {
+            while (begin < end)
+            {
+                auto count = std::min<size_t>(end - begin, MaxRun);
+                out.push_back(static_cast<uint8_t>(count - 1));
+                auto bytes = reinterpret_cast<uint8_t const*>(pixels.data() + begin);
+                out.insert(out.end(), bytes, bytes + (count * BgraImageView::BytesPerPixel));
+                begin += count;
+            }
+        };
+        size_t literalStart = 0;
+        size_t i = 0;
+        while (i < pixels.size())
+        {
+            size_t run = 1;
+            while (i + run < pixels.size() && run < MaxRun && pixels[i + run] == pixels[i])
+            {
+                run++;
+            }
+            if (run < 2)
+            {
+                i++;
+                continue;
+            }
+            flushLiteral(literalStart, i);
+            out.push_back(static_cast<uint8_t>(0x80 | (run - 1)));
+            auto bytes = reinterpret_cast<uint8_t const*>(pixels.data() + i);
+            out.insert(out.end(), bytes, bytes + BgraImageView::BytesPerPixel);
+            i += run;
+            literalStart = i;
+        }
+        flushLiteral(literalStart, pixels.size());
+    }
+
+    // Writes pixelCount pixels to out. Throws runtime_error if the data
+    // doesn't decode to exactly that many.
+    inline void DecompressTile(uint8_t const* data, size_t size, TileEncoding encoding, uint8_t* out, size_t pixelCount)
+    {
+        auto outSize = pixelCount * BgraImageView::BytesPerPixel;
+        if (encoding == TileEncoding::Raw)
+        {
+            if (size != outSize)
+            {
+                throw std::runtime_error("Corrupt golden tile");
+            }
+            std::memcpy(out, data, size);
+            return;
+        }
+        if (encoding != TileEncoding::RunLength)
+        {
+            throw std::runtime_error("Unknown golden tile encoding");
+        }
+        size_t read = 0;
+        size_t written = 0;
+        while (read < size)
+        {
+            auto token = data[read++];
+            size_t count = (token & 0x7f) + 1;
+            auto isRun = (token & 0x80) != 0;
+            auto bytes = isRun ? BgraImageView::BytesPerPixel : count * BgraImageView::BytesPerPixel;
+            if (size - read < bytes || outSize - written < count * BgraImageView::BytesPerPixel)
+            {
+                throw std::runtime_error("Corrupt golden tile");
+            }
+            if (isRun)
+            {
+                for (size_t p = 0; p < count; p++)
+                {
+                    std::memcpy(out + written + (p * BgraImageView::BytesPerPixel), data + read, BgraImageView::BytesPerPixel);
+                }
+            }
+            else
+            {
+                std::memcpy(out + written, data + read, bytes);
+            }
+            read += bytes;
+            written += count * BgraImageView::BytesPerPixel;
+        }
+        if (written != outSize)
+        {
+            throw std::runtime_error("Corrupt golden tile");
+        }
+    }
+
+    // A tile's hash is what HashImage gives for just that tile. A whole row
+    // of tiles is hashed a row of pixels at a time, carrying every tile's
+    // hash along, so the frame is read front to back rather than one narrow
+    // tile at a time.
+    inline void HashTileRow(BgraImageView const& image, uint32_t tileSize, uint32_t tileY, SimdLevel level, uint64_t* hashes)
+    {
+        auto tilesX = TileCount(image.Width, tileSize);
+        for (uint32_t tileX = 0; tileX < tilesX; tileX++)
+        {
+            hashes[tileX] = framehash::Begin(image.SubView(TileRect(image.Width, image.Height, tileSize, tileX, tileY)));
+        }
+        auto top = tileY * tileSize;
+        auto bottom = std::min(top + tileSize, image.Height);
+        for (auto y = top; y < bottom; y++)
+        {
+            auto row = image.Row(y);
+            for (uint32_t tileX = 0; tileX < tilesX; tileX++)
+            {
+                auto left = tileX * tileSize;
+                auto rowBytes = static_cast<size_t>(std::min(tileSize, image.Width - left)) * BgraImageView::BytesPerPixel;
+                auto rowHash = framehash::HashRow(level, row + (static_cast<size_t>(left) * BgraImageView::BytesPerPixel), rowBytes);
+                hashes[tileX] = framehash::Chain(hashes[tileX], rowHash);
+            }
+        }
+        for (uint32_t tileX = 0; tileX < tilesX; tileX++)
+        {
+            hashes[tileX] = framehash::Avalanche(hashes[tileX]);
+        }
+    }
+}
+
+// The golden file for image. Tiles are hashed and compressed a row of tiles
+// per band on the shared BandPool, and the file is the same either way.
+inline std::vector<uint8_t> EncodeGolden(BgraImageView const& image, uint32_t dpi, uint32_t tileSize = golden::DefaultTileSize, SimdLevel level = DetectSimdLevel())
+{
+    if (image.Width == 0 || image.Height == 0)
+    {
+        throw std::invalid_argument("Image must not be empty");
+    }
+    if (tileSize == 0)
+    {
+        throw std::invalid_argument("Tile size must be at least 1");
+    }
+    level = ResolveSimdLevel(level);
+    auto tilesX = golden::TileCount(image.Width, tileSize);
+    auto tilesY = golden::TileCount(image.Height, tileSize);
+
+    // Each row of tiles is compressed into its own buffer, and the buffers
+    // are joined in order afterwards
+    std::vector<std::vector<uint8_t>> tileRows(tilesY);
+    std::vector<golden::TileEntry> entries(static_cast<size_t>(tilesX) * tilesY);
+    ParallelForRowBands(tilesY, 1, [&](uint32_t first, uint32_t count)
+    {
+        std::vector<uint32_t> pixels;
+        std::vector<uint8_t> compressed;
+        std::vector<uint64_t> hashes(tilesX);
+        for (auto tileY = first; tileY < first + count; tileY++)
+        {
+            auto& data = tileRows[tileY];
+            golden::HashTileRow(image, tileSize, tileY, level, hashes.data());
+            for (uint32_t tileX = 0; tileX < tilesX; tileX++)
+            {
+                auto rect = golden::TileRect(image.Width, image.Height, tileSize, tileX, tileY);
+                auto& entry = entries[(static_cast<size_t>(tileY) * tilesX) + tileX];
+                entry.Hash = hashes[tileX];
+                compressed.clear();
+                golden::CompressTile(image.SubView(rect), compressed, pixels);
+                entry.Offset = data.size();
+                auto rawSize = static_cast<size_t>(rect.Width) * rect.Height * BgraImageView::BytesPerPixel;
+                if (compressed.size() < rawSize)
+                {
+                    entry.Encoding = golden::TileEncoding::RunLength;
+                    data.insert(data.end(), compressed.begin(), compressed.end());
+                }
+                else
+                {
+                    entry.Encoding = golden::TileEncoding::Raw;
+                    auto bytes = reinterpret_cast<uint8_t const*>(pixels.data());
+                    data.insert(data.end(), bytes, bytes + rawSize);
+                }
+                entry.Size = static_cast<uint32_t>(data.size() - entry.Offset);
+            }
+        }
+    });
+
+    golden::FileHeader header = {};
+    std::memcpy(header.Magic, golden::Magic, sizeof(header.Magic));
+    header.Version = golden::Version;
+    header.Width = image.Width;
+    header.Height = image.Height;
+    header.Dpi = dpi;
+    header.TileSize = tileSize;
+
+    auto offset = sizeof(header) + (entries.size() * sizeof(golden::TileEntry));
+    for (uint32_t tileY = 0; tileY < tilesY; tileY++)
+    {
+        for (uint32_t tileX = 0; tileX < tilesX; tileX++)
+        {
+            entries[(static_cast<size_t>(tileY) * tilesX) + tileX].Offset += offset;
+        }
+        offset += tileRows[tileY].size();
+    }
+    std::vector<uint8_t> file(offset);
+    std::memcpy(file.data(), &header, sizeof(header));
+    std::memcpy(file.data() + sizeof(header), entries.data(), entries.size() * sizeof(golden::TileEntry));
+    auto out = file.data() + sizeof(header) + (entries.size() * sizeof(golden::TileEntry));
+    for (auto&& row : tileRows)
+    {
+        std::memcpy(out, row.data(), row.size());
+        out += row.size();
+    }
+    return file;
+}
+
+// A golden file, either mapped from disk or in memory. The header and tile
+// table are checked up front, and a tile's pixels are only read when it's
+// decoded. Throws runtime_error if the file isn't a valid golden.
+class GoldenImage
+{
+public:
+    explicit GoldenImage(std::filesystem::path const& path) : m_file(std::make_shared<MappedReadOnlyFile>(path))
+    {
+        Parse(m_file->Data(), static_cast<size_t>(m_file->Size()));
+    }
+
+    // data must outlive the image
+    GoldenImage(uint8_t const* data, size_t size)
+    {
+        Parse(data, size);
+    }
+
+    uint32_t Width() const { return m_header.Width; }
+    uint32_t Height() const { return m_header.Height; }
+    uint32_t Dpi() const { return m_header.Dpi; }
+    uint32_t TileSize() const { return m_header.TileSize; }
+    uint32_t TilesX() const { return m_tilesX; }
+    uint32_t TilesY() const { return m_tilesY; }
+    uint32_t TileCount() const { return m_tilesX * m_tilesY; }
+    size_t FileSize() const { return m_size; }
+
+    PixelRect TileRect(uint32_t tileX, uint32_t tileY) const
+    {
+        return golden::TileRect(m_header.Width, m_header.Height, m_header.TileSize, tileX, tileY);
+    }
+
+    uint64_t TileHash(uint32_t tileX, uint32_t tileY) const { return Entry(tileX, tileY).Hash; }
+
+    // Writes the tile's pixels to out, TileRect(tileX, tileY).Width pixels per row
+    void DecodeTile(uint32_t tileX, uint32_t tileY, uint8_t* out) const
+    {
+        auto const& entry = Entry(tileX, tileY);
+        auto rect = TileRect(tileX, tileY);
+        golden::DecompressTile(m_data + entry.Offset, entry.Size, entry.Encoding, out, static_cast<size_t>(rect.Width) * rect.Height);
+    }
+
+    // The whole frame, without row padding
+    std::vector<uint8_t> Decode() const
+    {
+        auto pitch = static_cast<size_t>(m_header.Width) * BgraImageView::BytesPerPixel;
+        std::vector<uint8_t> pixels(pitch * m_header.Height);
+        std::vector<uint8_t> tile(static_cast<size_t>(m_header.TileSize) * m_header.TileSize * BgraImageView::BytesPerPixel);
+        for (uint32_t tileY = 0; tileY < m_tilesY; tileY++)
+        {
+            for (uint32_t tileX = 0; tileX < m_tilesX; tileX++)
+            {
+                auto rect = TileRect(tileX, tileY);
+                DecodeTile(tileX, tileY, tile.data());
+                auto rowBytes = static_cast<size_t>(rect.Width) * BgraImageView::BytesPerPixel;
+                for (uint32_t y = 0; y < rect.Height; y++)
+                {
+                    std::memcpy(pixels.data() + (pitch * (rect.Y + y)) + (static_cast<size_t>(rect.X) * BgraImageView::BytesPerPixel), tile.data() + (rowBytes * y), rowBytes);
+                }
+            }
+        }
+        return pixels;
+    }
+
+private:
+    void Parse(uint8_t const* data, size_t size)
+    {
+        if (data == nullptr || size < sizeof(golden::FileHeader))
+        {
+            throw std::runtime_error("Golden file is too small");
+        }
+        std::memcpy(&m_header, data, sizeof(m_header));
+        if (std::memcmp(m_header.Magic, golden::Magic, sizeof(golden::Magic)) != 0)
+        {
+            throw std::runtime_error("Not a golden file");
+        }
+        if (m_header.Version != golden::Version)
+        {
+            throw std::runtime_error("Unsupported golden file version " + std::to_string(m_header.Version));
+        }
+        if (m_header.Width == 0 || m_header.Height == 0 || m_header.TileSize == 0)
+        {
+            throw std::runtime_error("Golden file has no pixels");
+        }
+        m_tilesX = golden::TileCount(m_header.Width, m_header.TileSize);
+        m_tilesY = golden::TileCount(m_header.Height, m_header.TileSize);
+        auto tableSize = static_cast<uint64_t>(m_tilesX) * m_tilesY * sizeof(golden::TileEntry);
+        if (size - sizeof(golden::FileHeader) < tableSize)
+        {
+            throw std::runtime_error("Golden file's tile table is cut short");
+        }
+        m_entries.resize(static_cast<size_t>(m_tilesX) * m_tilesY);
+        std::memcpy(m_entries.data(), data + sizeof(golden::FileHeader), static_cast<size_t>(tableSize));
+        for (auto&& entry : m_entries)
+        {
+            if (entry.Offset > size || entry.Size > size - entry.Offset)
+            {
+                throw std::runtime_error("Golden file's tile data is cut short");
+            }
+        }
+        m_data = data;
+        m_size = size;
+    }
+
+    golden::TileEntry const& Entry(uint32_t tileX, uint32_t tileY) const
+    {
+        if (tileX >= m_tilesX || tileY >= m_tilesY)
+        {
+            throw std::out_of_range("Tile out of bounds");
+        }
+        return m_entries[(static_cast<size_t>(tileY) * m_tilesX) + tileX];
+    }
+
+private:
+    // Shared so that the image can be moved and copied
+    std::shared_ptr<MappedReadOnlyFile> m_file;
+    uint8_t const* m_data = nullptr;
+    size_t m_size = 0;
+    golden::FileHeader m_header = {};
+    uint32_t m_tilesX = 0;
+    uint32_t m_tilesY = 0;
+    std::vector<golden::TileEntry> m_entries;
+};
+
+struct GoldenCompareOptions
+{
+    // A pixel differs when any channel is off by more than this
+    BgraColor Tolerance;
+    // Hash and compare on the band pool rather than the calling thread
+    bool Parallel = true;
+};
+
+struct GoldenCompareResult
+{
+    bool SizeMatches = true;
+    uint32_t TileCount = 0;
+    // Tiles whose hash didn't match the golden's, so were decoded and compared
+    uint32_t ChangedTiles = 0;
+    // The changed tiles that have pixels over the tolerance, row by row
+    std::vector<PixelRect> FailedTiles;
+    uint64_t DifferingPixels = 0;
+    // Largest absolute difference seen in each channel of the changed tiles
+    BgraColor MaxError;
+
+    bool Passed() const { return SizeMatches && FailedTiles.empty(); }
+};
+
+namespace golden
+{
+    // The part of a comparison for one row of tiles
+    struct TileRowResult
+    {
+        uint32_t ChangedTiles = 0;
+        std::vector<PixelRect> FailedTiles;
+        imagediff::BandResult Diff;
+    };
+
+    inline void CompareTileRow(BgraImageView const& captured, GoldenImage const& golden, uint32_t tileY, BgraColor const& tolerance,
+        SimdLevel level, std::vector<uint64_t>& hashes, std::vector<uint8_t>& scratch, TileRowResult& result)
+    {
+        HashTileRow(captured, golden.TileSize(), tileY, level, hashes.data());
+        for (uint32_t tileX = 0; tileX < golden.TilesX(); tileX++)
+        {
+            auto rect = golden.TileRect(tileX, tileY);
+            if (hashes[tileX] == golden.TileHash(tileX, tileY))
+            {
+                continue;
+            }
+            result.ChangedTiles++;
+            golden.DecodeTile(tileX, tileY, scratch.data());
+            auto before = result.Diff.DifferingPixels;
+            auto tile = captured.SubView(rect);
+            auto rowBytes = static_cast<size_t>(rect.Width) * BgraImageView::BytesPerPixel;
+            for (uint32_t y = 0; y < rect.Height; y++)
+            {
+                imagediff::RunBuilder runs(result.Diff.Runs, y);
+                imagediff::DiffRow(level, tile.Row(y), scratch.data() + (rowBytes * y), rect.Width, tolerance, result.Diff, runs, nullptr);
+                // Only the count matters here
+                result.Diff.Runs.clear();
+            }
+            if (result.Diff.DifferingPixels != before)
+            {
+                result.FailedTiles.push_back(rect);
+            }
+        }
+    }
+}
+
+// Compares a captured frame against its golden. Only the tiles whose hash
+// doesn't match are decoded and diffed, so a hash collision could hide a
+// changed tile, but at 64 bits that isn't worth worrying about.
+inline GoldenCompareResult CompareToGolden(BgraImageView const& captured, GoldenImage const& golden, GoldenCompareOptions const& options = {}, SimdLevel level = DetectSimdLevel())
+{
+    GoldenCompareResult result;
+    result.TileCount = golden.TileCount();
+    if (captured.Width != golden.Width() || captured.Height != golden.Height())
+    {
+        result.SizeMatches = false;
+        return result;
+    }
+    level = ResolveSimdLevel(level);
+    std::vector<golden::TileRowResult> rows(golden.TilesY());
+    auto compareRows = [&](uint32_t first, uint32_t count)
+    {
+        std::vector<uint64_t> hashes(golden.TilesX());
+        std::vector<uint8_t> scratch(static_cast<size_t>(golden.TileSize()) * golden.TileSize() * BgraImageView::BytesPerPixel);
+        for (auto tileY = first; tileY < first + count; tileY++)
+        {
+            golden::CompareTileRow(captured, golden, tileY, options.Tolerance, level, hashes, scratch, rows[tileY]);
+        }
+    };
+    if (options.Parallel)
+    {
+        ParallelForRowBands(golden.TilesY(), 1, compareRows);
+    }
+    else
+    {
+        compareRows(0, golden.TilesY());
+    }
+
+    for (auto&& row : rows)
+    {
+        result.ChangedTiles += row.ChangedTiles;
+        result.FailedTiles.insert(result.FailedTiles.end(), row.FailedTiles.begin(), row.FailedTiles.end());
+        result.DifferingPixels += row.Diff.DifferingPixels;
+        result.MaxError.B = std::max(result.MaxError.B, row.Diff.MaxError.B);
+        result.MaxError.G = std::max(result.MaxError.G, row.Diff.MaxError.G);
+        result.MaxError.R = std::max(result.MaxError.R, row.Diff.MaxError.R);
+        result.MaxError.A = std::max(result.MaxError.A, row.Diff.MaxError.A);
+    }
+    return result;
+}
+
+// A directory of golden files, named by GoldenKey::FileName
+class GoldenStore
+{
+public:
+    explicit GoldenStore(std::filesystem::path directory) : m_directory(std::move(directory)) {}
+
+    std::filesystem::path const& Directory() const { return m_directory; }
+    std::filesystem::path PathFor(GoldenKey const& key) const { return m_directory / key.FileName(); }
+    bool Has(GoldenKey const& key) const { return std::filesystem::exists(PathFor(key)); }
+
+    // Nothing if there's no golden for key yet. Throws runtime_error if
+    // there is one but it can't be read.
+    std::optional<GoldenImage> Load(GoldenKey const& key) const
+    {
+        auto path = PathFor(key);
+        if (!std::filesystem::exists(path))
+        {
+            return std::nullopt;
+        }
+        return GoldenImage(path);
+    }
+
+    // Makes image the golden for key, replacing any that's there. The file
+    // is written next to the old one and then renamed over it, so an
+    // interrupted bless never leaves a half written golden behind.
+    std::filesystem::path Bless(GoldenKey const& key, BgraImageView const& image, uint32_t tileSize = golden::DefaultTileSize) const
+    {
+        if (image.Width != key.Width || image.Height != key.Height)
+        {
+            throw std::invalid_argument("Image size doesn't match the golden's key");
+        }
+        std::filesystem::create_directories(m_directory);
+        auto path = PathFor(key);
+        auto temporaryPath = path;
+        temporaryPath += ".tmp";
+        WriteFileBytes(temporaryPath, EncodeGolden(image, key.Dpi, tileSize));
+        std::filesystem::rename(temporaryPath, path);
+        return path;
+    }
+
+private:
+    std::filesystem::path m_directory;
+};
+
+struct GoldenOptions
+{
+    std::filesystem::path Directory;
+    // Replace the goldens with this run's frames instead of comparing
+    bool Bless = false;
+};
+
+// Takes "--goldens <dir>" and "--bless" out of a command line. Like the
+// result output options they're accepted on every command, and tests that
+// have goldens use them.
+template <typename String>
+std::optional<GoldenOptions> TakeGoldenOptions(std::vector<String>& arguments)
+{
+    std::optional<GoldenOptions> options;
+    auto bless = false;
+    for (size_t i = 0; i < arguments.size();)
+    {
+        auto const& argument = arguments[i];
+        if (argument == String({ '-', '-', 'b', 'l', 'e', 's', 's' }))
+        {
+            bless = true;
+            arguments.erase(arguments.begin() + i);
+            continue;
+        }
+        if (argument != String({ '-', '-', 'g', 'o', 'l', 'd', 'e', 'n', 's' }))
+        {
+            i++;
+            continue;
+        }
+        if (options)
+        {
+            throw std::runtime_error("--goldens may only be given once");
+        }
+        if (i + 1 >= arguments.size())
+        {
+            throw std::runtime_error("--goldens needs a directory");
+        }
+        options = GoldenOptions{ std::filesystem::path(arguments[i + 1]) };
+        arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+    }
+    if (bless && !options)
+    {
+        throw std::runtime_error("--bless needs --goldens");
+    }
+    if (options)
+    {
+        options->Bless = bless;
+    }
+    return options;
+}
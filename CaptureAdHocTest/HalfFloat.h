@@ -0,0 +1,195 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include "ImageView.h"
+#include "SimdSupport.h"
+
+// A non-owning view of R16G16B16A16Float pixels (scRGB, linear, 1.0 is 80
+// nits), where rows may be padded like a mapped texture's.
+struct HalfImageView
+{
+    uint8_t const* Data = nullptr;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t RowPitch = 0;
+
+    static constexpr uint32_t BytesPerPixel = 8;
+    static constexpr uint32_t ChannelsPerPixel = 4;
+
+    uint16_t const* Row(uint32_t y) const { return reinterpret_cast<uint16_t const*>(Data + (static_cast<size_t>(RowPitch) * y)); }
+
+    HalfImageView SubView(PixelRect const& rect) const
+    {
+        if (rect.Right() > Width || rect.Bottom() > Height)
+        {
+            throw std::out_of_range("Rect out of bounds");
+        }
+        return HalfImageView{ Data + (static_cast<size_t>(RowPitch) * rect.Y) + (static_cast<size_t>(rect.X) * BytesPerPixel), rect.Width, rect.Height, RowPitch };
+    }
+};
+
+// The reference conversion, exact for every half. NaNs keep their payload and
+// come out quiet, which is what vcvtph2ps and fcvtl do.
+inline float HalfToFloat(uint16_t half)
+{
+    uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits = 0;
+    if (exponent == 0)
+    {
+        // Zero or subnormal: mantissa * 2^-24, which a float holds exactly
+        float magnitude = static_cast<float>(mantissa) * (1.0f / 16777216.0f);
+        std::memcpy(&bits, &magnitude, sizeof(bits));
+        bits |= sign;
+    }
+    else if (exponent == 0x1f)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13) | (mantissa != 0 ? 0x00400000 : 0);
+    }
+    else
+    {
+        bits = sign | ((exponent + (127 - 15)) << 23) | (mantissa << 13);
+    }
+    float result = 0.0f;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// Rounds to nearest even. Anything too large for a half becomes infinity, and
+// every NaN becomes the same quiet NaN.
+inline uint16_t FloatToHalf(float value)
+{
+    uint32_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+    auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    auto magnitude = bits & 0x7fffffff;
+    if (magnitude >= 0x47800000)
+    {
+        return static_cast<uint16_t>(sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00));
+    }
+    if (magnitude < 0x38800000)
+    {
+        // Subnormal or zero. Adding 0.5 lines the half's mantissa up with the
+        // bottom of the float's, and the addition rounds it.
+        float shifted = 0.0f;
+        std::memcpy(&shifted, &magnitude, sizeof(shifted));
+        shifted += 0.5f;
+        uint32_t shiftedBits = 0;
+        std::memcpy(&shiftedBits, &shifted, sizeof(shiftedBits));
+        return static_cast<uint16_t>(sign | (shiftedBits - 0x3f000000));
+    }
+    auto odd = (magnitude >> 13) & 1;
+    magnitude += (static_cast<uint32_t>(15 - 127) << 23) + 0xfff + odd;
+    return static_cast<uint16_t>(sign | (magnitude >> 13));
+}
+
+namespace halffloat
+{
+    inline void ConvertScalar(uint16_t const* source, float* destination, size_t begin, size_t count)
+    {
+        for (auto i = begin; i < count; i++)
+        {
+            destination[i] = HalfToFloat(source[i]);
+        }
+    }
+
+    // The vector versions convert what they can in whole vectors and return
+    // how many values that was.
+#if defined(CAPTURE_SIMD_X86)
+    // Moves the exponent and mantissa into place, then rebiases the exponent.
+    // Subnormals are rebuilt with a float subtraction, which is exact.
+    inline __m128 HalfToFloatSSE2(__m128i halves)
+    {
+        auto shifted = _mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x7fff)), 13);
+        auto exponent = _mm_and_si128(shifted, _mm_set1_epi32(0x0f800000));
+        auto rebias = _mm_set1_epi32((127 - 15) << 23);
+        auto bits = _mm_add_epi32(shifted, rebias);
+
+        auto infinityOrNaN = _mm_cmpeq_epi32(exponent, _mm_set1_epi32(0x0f800000));
+        bits = _mm_add_epi32(bits, _mm_and_si128(infinityOrNaN, rebias));
+        auto nan = _mm_andnot_si128(_mm_cmpeq_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x3ff)), _mm_setzero_si128()), infinityOrNaN);
+        bits = _mm_or_si128(bits, _mm_and_si128(nan, _mm_set1_epi32(0x00400000)));
+
+        auto magic = _mm_set1_epi32(113 << 23);
+        auto subnormal = _mm_castps_si128(_mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(bits, _mm_set1_epi32(1 << 23))), _mm_castsi128_ps(magic)));
+        auto zeroExponent = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+        bits = _mm_or_si128(_mm_andnot_si128(zeroExponent, bits), _mm_and_si128(zeroExponent, subnormal));
+
+        auto sign = _mm_slli_epi32(_mm_and_si128(halves, _mm_set1_epi32(0x8000)), 16);
+        return _mm_castsi128_ps(_mm_or_si128(bits, sign));
+    }
+
+    inline size_t ConvertSSE2(uint16_t const* source, float* destination, size_t count)
+    {
+        auto zero = _mm_setzero_si128();
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto halves = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + i));
+            _mm_storeu_ps(destination + i, HalfToFloatSSE2(_mm_unpacklo_epi16(halves, zero)));
+            _mm_storeu_ps(destination + i + 4, HalfToFloatSSE2(_mm_unpackhi_epi16(halves, zero)));
+        }
+        return i;
+    }
+
+    CAPTURE_TARGET_F16C inline size_t ConvertF16C(uint16_t const* source, float* destination, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            _mm256_storeu_ps(destination + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(source + i))));
+        }
+        return i;
+    }
+#endif
+
+#if defined(CAPTURE_SIMD_NEON)
+    inline size_t ConvertNEON(uint16_t const* source, float* destination, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8)
+        {
+            auto halves = vreinterpretq_f16_u16(vld1q_u16(source + i));
+            vst1q_f32(destination + i, vcvt_f32_f16(vget_low_f16(halves)));
+            vst1q_f32(destination + i + 4, vcvt_high_f32_f16(halves));
+        }
+        return i;
+    }
+#endif
+
+    // level has to have been through ResolveSimdLevel. AVX2 means F16C when
+    // the CPU has it.
+    inline void Convert(SimdLevel level, uint16_t const* source, float* destination, size_t count)
+    {
+        size_t done = 0;
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+        {
+            static bool const f16c = CpuSupportsF16C();
+            done = f16c ? ConvertF16C(source, destination, count) : ConvertSSE2(source, destination, count);
+            break;
+        }
+        case SimdLevel::SSE2:
+            done = ConvertSSE2(source, destination, count);
+            break;
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            done = ConvertNEON(source, destination, count);
+            break;
+#endif
+        default:
+            break;
+        }
+        ConvertScalar(source, destination, done, count);
+    }
+}
+
+inline void ConvertHalfToFloat(uint16_t const* source, float* destination, size_t count, SimdLevel level = DetectSimdLevel())
+{
+    halffloat::Convert(ResolveSimdLevel(level), source, destination, count);
+}
@@ -0,0 +1,388 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <vector>
+#include "HalfFloat.h"
+#include "ParallelFor.h"
+#include "SimdSupport.h"
+
+// Statistics for a captured FP16 (scRGB) frame, to check HDR content
+// survived capture without being clamped or tone mapped.
+
+struct ScRgbColor
+{
+    float R = 0.0f;
+    float G = 0.0f;
+    float B = 0.0f;
+};
+
+struct HdrAnalysisOptions
+{
+    // The color the frame is expected to be, e.g. what the test cleared to
+    ScRgbColor Expected;
+    // How far each channel can be from Expected and still match. Halves have
+    // 11 bits of precision, so 3.0 is only accurate to about 0.002.
+    float Tolerance = 0.01f;
+};
+
+// Counts of pixels by luminance, in quarter stops. Each stop is split
+// linearly by the top two bits of the float's mantissa, so a bin is just a
+// shift of the float's bits. The first bin also has zero and negative
+// luminance, and the last one everything too bright, infinity and NaN.
+struct LuminanceHistogram
+{
+    static constexpr int MinStop = -10;
+    static constexpr int MaxStop = 8;
+    static constexpr int BinsPerStop = 4;
+    static constexpr int BinCount = ((MaxStop - MinStop) * BinsPerStop) + 2;
+    // The bits of 2^MinStop, shifted the same way, less the below-range bin
+    static constexpr int32_t BinBias = ((127 + MinStop) * BinsPerStop) - 1;
+
+    std::array<uint64_t, BinCount> Counts = {};
+
+    static int BinIndex(float luminance)
+    {
+        int32_t bits = 0;
+        std::memcpy(&bits, &luminance, sizeof(bits));
+        return std::clamp((bits >> 21) - BinBias, 0, BinCount - 1);
+    }
+
+    // In scRGB units. The first bin has no lower bound.
+    static double BinLowerBound(int bin)
+    {
+        if (bin == 0)
+        {
+            return -std::numeric_limits<double>::infinity();
+        }
+        auto stop = MinStop + ((bin - 1) / BinsPerStop);
+        return std::ldexp(1.0 + (((bin - 1) % BinsPerStop) / static_cast<double>(BinsPerStop)), stop);
+    }
+};
+
+struct HdrFrameStats
+{
+    uint64_t PixelCount = 0;
+    ScRgbColor Max;
+    ScRgbColor Mean;
+    // BT.709 luminance, in scRGB units (multiply by 80 for nits)
+    float MaxLuminance = 0.0f;
+    double MeanLuminance = 0.0;
+    uint64_t MatchingPixels = 0;
+    double MatchingPercent = 0.0;
+    LuminanceHistogram Histogram;
+};
+
+namespace hdranalysis
+{
+    constexpr float LuminanceR = 0.2126f;
+    constexpr float LuminanceG = 0.7152f;
+    constexpr float LuminanceB = 0.0722f;
+
+    inline float Luminance(float r, float g, float b)
+    {
+        return ((LuminanceR * r) + (LuminanceG * g)) + (LuminanceB * b);
+    }
+
+    // Running totals for a row. The sums are kept per row so the means don't
+    // depend on how the frame was split up.
+    struct RowTotals
+    {
+        // R, G, B and luminance
+        float Max[4];
+        float Sum[4];
+        uint64_t Matching;
+    };
+
+    inline void BeginRow(RowTotals& totals)
+    {
+        std::fill(std::begin(totals.Max), std::end(totals.Max), -std::numeric_limits<float>::infinity());
+        std::fill(std::begin(totals.Sum), std::end(totals.Sum), 0.0f);
+        totals.Matching = 0;
+    }
+
+    // pixels is RGBA floats. Analyzes columns [begin, width).
+    inline void AnalyzeRowScalar(float const* pixels, uint32_t begin, uint32_t width, HdrAnalysisOptions const& options, RowTotals& totals, uint64_t* histogram)
+    {
+        for (auto x = begin; x < width; x++)
+        {
+            auto pixel = pixels + (static_cast<size_t>(x) * 4);
+            float values[4] = { pixel[0], pixel[1], pixel[2], Luminance(pixel[0], pixel[1], pixel[2]) };
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                totals.Max[c] = std::max(totals.Max[c], values[c]);
+                totals.Sum[c] += values[c];
+            }
+            if (std::abs(values[0] - options.Expected.R) <= options.Tolerance &&
+                std::abs(values[1] - options.Expected.G) <= options.Tolerance &&
+                std::abs(values[2] - options.Expected.B) <= options.Tolerance)
+            {
+                totals.Matching++;
+            }
+            histogram[LuminanceHistogram::BinIndex(values[3])]++;
+        }
+    }
+
+    // The vector versions return how many columns they analyzed. Their sums
+    // are added up in a different order, so they can differ from the scalar
+    // version's in the last bits. Everything else is exactly the same.
+#if defined(CAPTURE_SIMD_X86)
+    inline float HorizontalMax(__m128 values)
+    {
+        values = _mm_max_ps(values, _mm_shuffle_ps(values, values, _MM_SHUFFLE(1, 0, 3, 2)));
+        values = _mm_max_ps(values, _mm_shuffle_ps(values, values, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtss_f32(values);
+    }
+
+    inline float HorizontalSum(__m128 values)
+    {
+        values = _mm_add_ps(values, _mm_shuffle_ps(values, values, _MM_SHUFFLE(1, 0, 3, 2)));
+        values = _mm_add_ps(values, _mm_shuffle_ps(values, values, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtss_f32(values);
+    }
+
+    inline __m128i ClampSSE2(__m128i values, __m128i low, __m128i high)
+    {
+        auto belowLow = _mm_cmplt_epi32(values, low);
+        values = _mm_or_si128(_mm_andnot_si128(belowLow, values), _mm_and_si128(belowLow, low));
+        auto aboveHigh = _mm_cmpgt_epi32(values, high);
+        return _mm_or_si128(_mm_andnot_si128(aboveHigh, values), _mm_and_si128(aboveHigh, high));
+    }
+
+    // 4 pixels at a time, transposed to a vector per channel
+    inline uint32_t AnalyzeRowSSE2(float const* pixels, uint32_t width, HdrAnalysisOptions const& options, RowTotals& totals, uint64_t* histogram)
+    {
+        auto absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        auto tolerance = _mm_set1_ps(options.Tolerance);
+        __m128 expected[3] = { _mm_set1_ps(options.Expected.R), _mm_set1_ps(options.Expected.G), _mm_set1_ps(options.Expected.B) };
+        auto binBias = _mm_set1_epi32(LuminanceHistogram::BinBias);
+        auto firstBin = _mm_setzero_si128();
+        auto lastBin = _mm_set1_epi32(LuminanceHistogram::BinCount - 1);
+        __m128 max[4];
+        __m128 sum[4];
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            max[c] = _mm_set1_ps(totals.Max[c]);
+            sum[c] = _mm_setzero_ps();
+        }
+        auto matching = _mm_setzero_si128();
+        alignas(16) int32_t bins[4];
+
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto pixel = pixels + (static_cast<size_t>(x) * 4);
+            __m128 channels[4] = { _mm_loadu_ps(pixel), _mm_loadu_ps(pixel + 4), _mm_loadu_ps(pixel + 8), _mm_loadu_ps(pixel + 12) };
+            _MM_TRANSPOSE4_PS(channels[0], channels[1], channels[2], channels[3]);
+            // Alpha isn't needed, so luminance takes its place
+            channels[3] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(LuminanceR), channels[0]), _mm_mul_ps(_mm_set1_ps(LuminanceG), channels[1])),
+                _mm_mul_ps(_mm_set1_ps(LuminanceB), channels[2]));
+
+            auto matches = _mm_set1_epi32(-1);
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                // max(value, current) keeps current when value is NaN, like std::max
+                max[c] = _mm_max_ps(channels[c], max[c]);
+                sum[c] = _mm_add_ps(sum[c], channels[c]);
+                if (c < 3)
+                {
+                    auto difference = _mm_and_ps(_mm_sub_ps(channels[c], expected[c]), absMask);
+                    matches = _mm_and_si128(matches, _mm_castps_si128(_mm_cmple_ps(difference, tolerance)));
+                }
+            }
+            // Each match is -1
+            matching = _mm_sub_epi32(matching, matches);
+
+            auto bin = _mm_sub_epi32(_mm_srai_epi32(_mm_castps_si128(channels[3]), 21), binBias);
+            _mm_store_si128(reinterpret_cast<__m128i*>(bins), ClampSSE2(bin, firstBin, lastBin));
+            for (auto index : bins)
+            {
+                histogram[index]++;
+            }
+        }
+
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            totals.Max[c] = HorizontalMax(max[c]);
+            totals.Sum[c] += HorizontalSum(sum[c]);
+        }
+        alignas(16) uint32_t counts[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(counts), matching);
+        totals.Matching += static_cast<uint64_t>(counts[0]) + counts[1] + counts[2] + counts[3];
+        return x;
+    }
+#endif
+
+#if defined(CAPTURE_SIMD_NEON)
+    inline uint32_t AnalyzeRowNEON(float const* pixels, uint32_t width, HdrAnalysisOptions const& options, RowTotals& totals, uint64_t* histogram)
+    {
+        auto tolerance = vdupq_n_f32(options.Tolerance);
+        float32x4_t expected[3] = { vdupq_n_f32(options.Expected.R), vdupq_n_f32(options.Expected.G), vdupq_n_f32(options.Expected.B) };
+        auto binBias = vdupq_n_s32(LuminanceHistogram::BinBias);
+        auto firstBin = vdupq_n_s32(0);
+        auto lastBin = vdupq_n_s32(LuminanceHistogram::BinCount - 1);
+        float32x4_t max[4];
+        float32x4_t sum[4];
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            max[c] = vdupq_n_f32(totals.Max[c]);
+            sum[c] = vdupq_n_f32(0.0f);
+        }
+        auto matching = vdupq_n_u32(0);
+        int32_t bins[4];
+
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto channels = vld4q_f32(pixels + (static_cast<size_t>(x) * 4));
+            channels.val[3] = vaddq_f32(vaddq_f32(vmulq_n_f32(channels.val[0], LuminanceR), vmulq_n_f32(channels.val[1], LuminanceG)),
+                vmulq_n_f32(channels.val[2], LuminanceB));
+
+            auto matches = vdupq_n_u32(1);
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                // NaN never compares greater, so it's skipped like std::max does
+                max[c] = vbslq_f32(vcgtq_f32(channels.val[c], max[c]), channels.val[c], max[c]);
+                sum[c] = vaddq_f32(sum[c], channels.val[c]);
+                if (c < 3)
+                {
+                    matches = vandq_u32(matches, vcleq_f32(vabdq_f32(channels.val[c], expected[c]), tolerance));
+                }
+            }
+            matching = vaddq_u32(matching, matches);
+
+            auto bin = vsubq_s32(vshrq_n_s32(vreinterpretq_s32_f32(channels.val[3]), 21), binBias);
+            vst1q_s32(bins, vminq_s32(vmaxq_s32(bin, firstBin), lastBin));
+            for (auto index : bins)
+            {
+                histogram[index]++;
+            }
+        }
+
+        for (uint32_t c = 0; c < 4; c++)
+        {
+            totals.Max[c] = vmaxvq_f32(max[c]);
+            totals.Sum[c] += vaddvq_f32(sum[c]);
+        }
+        totals.Matching += vaddvq_u32(matching);
+        return x;
+    }
+#endif
+
+    inline void AnalyzeRow(SimdLevel level, float const* pixels, uint32_t width, HdrAnalysisOptions const& options, RowTotals& totals, uint64_t* histogram)
+    {
+        uint32_t done = 0;
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+        case SimdLevel::SSE2:
+            done = AnalyzeRowSSE2(pixels, width, options, totals, histogram);
+            break;
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            done = AnalyzeRowNEON(pixels, width, options, totals, histogram);
+            break;
+#endif
+        default:
+            break;
+        }
+        AnalyzeRowScalar(pixels, done, width, options, totals, histogram);
+    }
+
+    // What a band of rows adds up to. Sums are per row.
+    struct BandTotals
+    {
+        float Max[4];
+        uint64_t Matching = 0;
+        std::array<uint64_t, LuminanceHistogram::BinCount> Histogram = {};
+    };
+
+    inline void AnalyzeRows(HalfImageView const& image, uint32_t firstRow, uint32_t rowCount, HdrAnalysisOptions const& options, SimdLevel level,
+        BandTotals& band, double* rowSums)
+    {
+        std::fill(std::begin(band.Max), std::end(band.Max), -std::numeric_limits<float>::infinity());
+        std::vector<float> pixels(static_cast<size_t>(image.Width) * HalfImageView::ChannelsPerPixel);
+        for (auto y = firstRow; y < firstRow + rowCount; y++)
+        {
+            halffloat::Convert(level, image.Row(y), pixels.data(), pixels.size());
+            RowTotals totals;
+            BeginRow(totals);
+            AnalyzeRow(level, pixels.data(), image.Width, options, totals, band.Histogram.data());
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                band.Max[c] = std::max(band.Max[c], totals.Max[c]);
+                rowSums[(static_cast<size_t>(y) * 4) + c] = totals.Sum[c];
+            }
+            band.Matching += totals.Matching;
+        }
+    }
+
+    inline HdrFrameStats Finish(HalfImageView const& image, std::vector<BandTotals> const& bands, std::vector<double> const& rowSums)
+    {
+        HdrFrameStats stats;
+        stats.PixelCount = static_cast<uint64_t>(image.Width) * image.Height;
+        if (stats.PixelCount == 0)
+        {
+            return stats;
+        }
+        float max[4] = { -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity() };
+        for (auto&& band : bands)
+        {
+            for (uint32_t c = 0; c < 4; c++)
+            {
+                max[c] = std::max(max[c], band.Max[c]);
+            }
+            stats.MatchingPixels += band.Matching;
+            for (size_t bin = 0; bin < band.Histogram.size(); bin++)
+            {
+                stats.Histogram.Counts[bin] += band.Histogram[bin];
+            }
+        }
+        double sums[4] = {};
+        for (size_t i = 0; i < rowSums.size(); i++)
+        {
+            sums[i % 4] += rowSums[i];
+        }
+        auto count = static_cast<double>(stats.PixelCount);
+        stats.Max = ScRgbColor{ max[0], max[1], max[2] };
+        stats.MaxLuminance = max[3];
+        stats.Mean = ScRgbColor{ static_cast<float>(sums[0] / count), static_cast<float>(sums[1] / count), static_cast<float>(sums[2] / count) };
+        stats.MeanLuminance = sums[3] / count;
+        stats.MatchingPercent = (100.0 * stats.MatchingPixels) / count;
+        return stats;
+    }
+}
+
+// Converts each row to floats and gathers everything in one pass
+inline HdrFrameStats AnalyzeHdrFrame(HalfImageView const& image, HdrAnalysisOptions const& options, SimdLevel level = DetectSimdLevel())
+{
+    level = ResolveSimdLevel(level);
+    std::vector<hdranalysis::BandTotals> bands(1);
+    std::vector<double> rowSums(static_cast<size_t>(image.Height) * 4);
+    hdranalysis::AnalyzeRows(image, 0, image.Height, options, level, bands[0], rowSums.data());
+    return hdranalysis::Finish(image, bands, rowSums);
+}
+
+// Same result as AnalyzeHdrFrame, in bands on the shared BandPool
+inline HdrFrameStats AnalyzeHdrFrameParallel(HalfImageView const& image, HdrAnalysisOptions const& options, SimdLevel level = DetectSimdLevel())
+{
+    static constexpr uint32_t MinRowsPerBand = 32;
+    level = ResolveSimdLevel(level);
+    std::vector<hdranalysis::BandTotals> bands;
+    std::mutex bandsLock;
+    std::vector<double> rowSums(static_cast<size_t>(image.Height) * 4);
+    ParallelForRowBands(image.Height, MinRowsPerBand, [&](uint32_t first, uint32_t count)
+    {
+        hdranalysis::BandTotals band;
+        hdranalysis::AnalyzeRows(image, first, count, options, level, band, rowSums.data());
+        std::lock_guard lock(bandsLock);
+        bands.push_back(band);
+    });
+    return hdranalysis::Finish(image, bands, rowSums);
+}
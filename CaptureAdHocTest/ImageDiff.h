@@ -0,0 +1,392 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include "ImageView.h"
+#include "ParallelFor.h"
+#include "SimdSupport.h"
+
+struct ImageDiffOptions
+{
+    // A pixel differs when any channel is off by more than this
+    BgraColor Threshold;
+    // Produce ImageDiffResult::Mask
+    bool GenerateMask = false;
+    // Only the largest regions are kept
+    uint32_t MaxRegions = 16;
+    SimdLevel Level = DetectSimdLevel();
+};
+
+struct ImageDiffRegion
+{
+    PixelRect Bounds;
+    uint64_t PixelCount = 0;
+};
+
+struct ImageDiffResult
+{
+    uint64_t PixelCount = 0;
+    uint64_t DifferingPixels = 0;
+    // Largest absolute difference seen in each channel, including pixels
+    // that were within the threshold
+    BgraColor MaxError;
+    // 8-connected areas of differing pixels, largest first
+    std::vector<ImageDiffRegion> Regions;
+    uint64_t TotalRegionCount = 0;
+    // One byte per pixel when requested: 255 for differing pixels, otherwise
+    // the largest channel error of that pixel
+    std::vector<uint8_t> Mask;
+    uint32_t MaskWidth = 0;
+    uint32_t MaskHeight = 0;
+
+    bool WithinThreshold() const { return DifferingPixels == 0; }
+};
+
+namespace imagediff
+{
+    // A horizontal run of differing pixels, [X0, X1)
+    struct Run
+    {
+        uint32_t X0 = 0;
+        uint32_t X1 = 0;
+        uint32_t Y = 0;
+    };
+
+    struct BandResult
+    {
+        uint64_t DifferingPixels = 0;
+        BgraColor MaxError;
+        std::vector<Run> Runs;
+    };
+
+    class RunBuilder
+    {
+    public:
+        RunBuilder(std::vector<Run>& runs, uint32_t y) : m_runs(runs), m_y(y) {}
+
+        // bits has one bit per pixel starting at x, count pixels in total
+        void Feed(uint32_t x, uint32_t bits, uint32_t count)
+        {
+            if (bits == 0 && !m_open)
+            {
+                return;
+            }
+            for (uint32_t i = 0; i < count; i++)
+            {
+                auto differs = (bits >> i) & 1;
+                if (differs && !m_open)
+                {
+                    m_open = true;
+                    m_start = x + i;
+                }
+                else if (!differs && m_open)
+                {
+                    m_open = false;
+                    m_runs.push_back(Run{ m_start, x + i, m_y });
+                }
+            }
+        }
+
+        void Finish(uint32_t width)
+        {
+            if (m_open)
+            {
+                m_runs.push_back(Run{ m_start, width, m_y });
+                m_open = false;
+            }
+        }
+
+    private:
+        std::vector<Run>& m_runs;
+        uint32_t m_y;
+        bool m_open = false;
+        uint32_t m_start = 0;
+    };
+
+    inline uint8_t AbsDiff(uint8_t a, uint8_t b)
+    {
+        return static_cast<uint8_t>(a > b ? a - b : b - a);
+    }
+
+    inline void DiffRowScalar(uint8_t const* actual, uint8_t const* expected, uint32_t begin, uint32_t end, BgraColor const& threshold,
+        BandResult& band, RunBuilder& runs, uint8_t* mask)
+    {
+        for (auto x = begin; x < end; x++)
+        {
+            auto a = actual + (x * 4);
+            auto e = expected + (x * 4);
+            auto b = AbsDiff(a[0], e[0]);
+            auto g = AbsDiff(a[1], e[1]);
+            auto r = AbsDiff(a[2], e[2]);
+            auto alpha = AbsDiff(a[3], e[3]);
+            band.MaxError.B = std::max(band.MaxError.B, b);
+            band.MaxError.G = std::max(band.MaxError.G, g);
+            band.MaxError.R = std::max(band.MaxError.R, r);
+            band.MaxError.A = std::max(band.MaxError.A, alpha);
+            auto differs = b > threshold.B || g > threshold.G || r > threshold.R || alpha > threshold.A;
+            band.DifferingPixels += differs;
+            runs.Feed(x, differs ? 1 : 0, 1);
+            if (mask != nullptr)
+            {
+                mask[x] = differs ? 255 : std::max(std::max(b, g), std::max(r, alpha));
+            }
+        }
+    }
+
+#if defined(CAPTURE_SIMD_X86)
+    inline void DiffRowSSE2(uint8_t const* actual, uint8_t const* expected, uint32_t width, BgraColor const& threshold,
+        BandResult& band, RunBuilder& runs, uint8_t* mask)
+    {
+        auto thresholdVector = _mm_set1_epi32(static_cast<int>(threshold.Packed()));
+        auto zero = _mm_setzero_si128();
+        auto allOnes = _mm_set1_epi32(-1);
+        auto maxError = _mm_setzero_si128();
+        uint64_t differing = 0;
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(actual + (x * 4)));
+            auto e = _mm_loadu_si128(reinterpret_cast<__m128i const*>(expected + (x * 4)));
+            auto difference = _mm_or_si128(_mm_subs_epu8(a, e), _mm_subs_epu8(e, a));
+            maxError = _mm_max_epu8(maxError, difference);
+            auto withinThreshold = _mm_cmpeq_epi32(_mm_subs_epu8(difference, thresholdVector), zero);
+            auto bits = static_cast<uint32_t>(~_mm_movemask_ps(_mm_castsi128_ps(withinThreshold)) & 0xF);
+            if (bits != 0)
+            {
+                differing += (bits & 1) + ((bits >> 1) & 1) + ((bits >> 2) & 1) + ((bits >> 3) & 1);
+            }
+            runs.Feed(x, bits, 4);
+            if (mask != nullptr)
+            {
+                // Largest channel ends up in the low byte of each pixel
+                auto largest = _mm_max_epu8(difference, _mm_srli_epi32(difference, 8));
+                largest = _mm_max_epu8(largest, _mm_srli_epi32(largest, 16));
+                largest = _mm_and_si128(largest, _mm_set1_epi32(0xFF));
+                largest = _mm_or_si128(largest, _mm_and_si128(_mm_xor_si128(withinThreshold, allOnes), _mm_set1_epi32(0xFF)));
+                auto packed = _mm_packus_epi16(_mm_packs_epi32(largest, zero), zero);
+                auto value = static_cast<uint32_t>(_mm_cvtsi128_si32(packed));
+                std::memcpy(mask + x, &value, 4);
+            }
+        }
+
+        alignas(16) uint8_t lanes[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), maxError);
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            band.MaxError.B = std::max(band.MaxError.B, lanes[(i * 4) + 0]);
+            band.MaxError.G = std::max(band.MaxError.G, lanes[(i * 4) + 1]);
+            band.MaxError.R = std::max(band.MaxError.R, lanes[(i * 4) + 2]);
+            band.MaxError.A = std::max(band.MaxError.A, lanes[(i * 4) + 3]);
+        }
+        band.DifferingPixels += differing;
+        DiffRowScalar(actual, expected, x, width, threshold, band, runs, mask);
+    }
+#endif
+
+    inline void DiffRow(SimdLevel level, uint8_t const* actual, uint8_t const* expected, uint32_t width, BgraColor const& threshold,
+        BandResult& band, RunBuilder& runs, uint8_t* mask)
+    {
+#if defined(CAPTURE_SIMD_X86)
+        if (level == SimdLevel::SSE2 || level == SimdLevel::AVX2)
+        {
+            DiffRowSSE2(actual, expected, width, threshold, band, runs, mask);
+            return;
+        }
+#endif
+        (void)level;
+        DiffRowScalar(actual, expected, 0, width, threshold, band, runs, mask);
+    }
+
+    class DisjointSet
+    {
+    public:
+        DisjointSet(size_t count) : m_parents(count)
+        {
+            std::iota(m_parents.begin(), m_parents.end(), 0);
+        }
+
+        size_t Find(size_t index)
+        {
+            while (m_parents[index] != index)
+            {
+                m_parents[index] = m_parents[m_parents[index]];
+                index = m_parents[index];
+            }
+            return index;
+        }
+
+        void Union(size_t a, size_t b)
+        {
+            auto rootA = Find(a);
+            auto rootB = Find(b);
+            if (rootA != rootB)
+            {
+                m_parents[std::max(rootA, rootB)] = std::min(rootA, rootB);
+            }
+        }
+
+    private:
+        std::vector<size_t> m_parents;
+    };
+
+    // Runs must be ordered by row, then by X0
+    inline void BuildRegions(std::vector<Run> const& runs, uint32_t maxRegions, ImageDiffResult& result)
+    {
+        if (runs.empty())
+        {
+            return;
+        }
+
+        // Two runs on adjacent rows are 8-connected if they overlap once
+        // extended by a pixel on each side.
+        DisjointSet sets(runs.size());
+        size_t previousRowStart = 0;
+        size_t previousRowEnd = 0;
+        size_t index = 0;
+        while (index < runs.size())
+        {
+            auto y = runs[index].Y;
+            auto rowStart = index;
+            while (index < runs.size() && runs[index].Y == y)
+            {
+                index++;
+            }
+            auto rowEnd = index;
+
+            if (previousRowEnd > previousRowStart && runs[previousRowStart].Y + 1 == y)
+            {
+                auto above = previousRowStart;
+                for (auto current = rowStart; current < rowEnd; current++)
+                {
+                    auto const& run = runs[current];
+                    while (above < previousRowEnd && runs[above].X1 < run.X0)
+                    {
+                        above++;
+                    }
+                    for (auto candidate = above; candidate < previousRowEnd && runs[candidate].X0 <= run.X1; candidate++)
+                    {
+                        sets.Union(current, candidate);
+                    }
+                }
+            }
+            previousRowStart = rowStart;
+            previousRowEnd = rowEnd;
+        }
+
+        std::vector<ImageDiffRegion> regions;
+        std::vector<size_t> regionForRoot(runs.size(), SIZE_MAX);
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            auto root = sets.Find(i);
+            auto const& run = runs[i];
+            auto& slot = regionForRoot[root];
+            if (slot == SIZE_MAX)
+            {
+                slot = regions.size();
+                regions.push_back(ImageDiffRegion{ PixelRect{ run.X0, run.Y, run.X1 - run.X0, 1 }, run.X1 - run.X0 });
+            }
+            else
+            {
+                auto& region = regions[slot];
+                auto left = std::min(region.Bounds.X, run.X0);
+                auto right = std::max(region.Bounds.Right(), run.X1);
+                auto bottom = std::max(region.Bounds.Bottom(), run.Y + 1);
+                region.Bounds = PixelRect{ left, region.Bounds.Y, right - left, bottom - region.Bounds.Y };
+                region.PixelCount += run.X1 - run.X0;
+            }
+        }
+
+        result.TotalRegionCount = regions.size();
+        auto keep = std::min<size_t>(regions.size(), maxRegions);
+        std::partial_sort(regions.begin(), regions.begin() + keep, regions.end(), [](auto const& a, auto const& b) { return a.PixelCount > b.PixelCount; });
+        regions.resize(keep);
+        result.Regions = std::move(regions);
+    }
+
+    // expectedRow(y, scratch) returns a pointer to the expected pixels for row
+    // y, optionally filling in scratch (width pixels) to do so.
+    template <typename ExpectedRow>
+    ImageDiffResult Diff(BgraImageView const& actual, ImageDiffOptions const& options, ExpectedRow const& expectedRow)
+    {
+        auto level = ResolveSimdLevel(options.Level);
+        ImageDiffResult result;
+        result.PixelCount = static_cast<uint64_t>(actual.Width) * actual.Height;
+        if (options.GenerateMask)
+        {
+            result.MaskWidth = actual.Width;
+            result.MaskHeight = actual.Height;
+            result.Mask.resize(static_cast<size_t>(actual.Width) * actual.Height);
+        }
+
+        static constexpr uint32_t MinRowsPerBand = 32;
+        auto& pool = BandPool::Shared();
+        auto bandCount = std::max(1u, std::min(pool.ThreadCount() * 2, actual.Height / MinRowsPerBand));
+        auto rowsPerBand = (actual.Height + bandCount - 1) / bandCount;
+        std::vector<BandResult> bands(bandCount);
+        pool.Run(bandCount, [&](uint32_t bandIndex)
+        {
+            auto& band = bands[bandIndex];
+            auto first = bandIndex * rowsPerBand;
+            auto last = std::min(first + rowsPerBand, actual.Height);
+            std::vector<uint8_t> scratch(static_cast<size_t>(actual.Width) * 4);
+            for (auto y = first; y < last; y++)
+            {
+                auto mask = options.GenerateMask ? result.Mask.data() + (static_cast<size_t>(actual.Width) * y) : nullptr;
+                RunBuilder runs(band.Runs, y);
+                DiffRow(level, actual.Row(y), expectedRow(y, scratch.data()), actual.Width, options.Threshold, band, runs, mask);
+                runs.Finish(actual.Width);
+            }
+        });
+
+        std::vector<Run> runs;
+        for (auto&& band : bands)
+        {
+            result.DifferingPixels += band.DifferingPixels;
+            result.MaxError.B = std::max(result.MaxError.B, band.MaxError.B);
+            result.MaxError.G = std::max(result.MaxError.G, band.MaxError.G);
+            result.MaxError.R = std::max(result.MaxError.R, band.MaxError.R);
+            result.MaxError.A = std::max(result.MaxError.A, band.MaxError.A);
+            runs.insert(runs.end(), band.Runs.begin(), band.Runs.end());
+        }
+        BuildRegions(runs, options.MaxRegions, result);
+        return result;
+    }
+}
+
+// Compares two images of the same size
+inline ImageDiffResult DiffImages(BgraImageView const& actual, BgraImageView const& expected, ImageDiffOptions const& options = {})
+{
+    if (actual.Width != expected.Width || actual.Height != expected.Height)
+    {
+        throw std::invalid_argument("Images must be the same size");
+    }
+    return imagediff::Diff(actual, options, [&](uint32_t y, uint8_t*) { return expected.Row(y); });
+}
+
+// Compares an image against expectedPixel(x, y), which returns a BgraColor.
+template <typename ExpectedPixel>
+ImageDiffResult DiffImageAgainst(BgraImageView const& actual, ExpectedPixel const& expectedPixel, ImageDiffOptions const& options = {})
+{
+    return imagediff::Diff(actual, options, [&](uint32_t y, uint8_t* scratch)
+    {
+        for (uint32_t x = 0; x < actual.Width; x++)
+        {
+            auto color = expectedPixel(x, y);
+            std::memcpy(scratch + (x * 4), &color, 4);
+        }
+        return static_cast<uint8_t const*>(scratch);
+    });
+}
+
+inline ImageDiffResult DiffImageAgainstColor(BgraImageView const& actual, BgraColor const& expected, ImageDiffOptions const& options = {})
+{
+    std::vector<uint8_t> row(static_cast<size_t>(actual.Width) * 4);
+    for (uint32_t x = 0; x < actual.Width; x++)
+    {
+        std::memcpy(row.data() + (x * 4), &expected, 4);
+    }
+    return imagediff::Diff(actual, options, [&](uint32_t, uint8_t*) { return static_cast<uint8_t const*>(row.data()); });
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <cstdint>
+#include <stdexcept>
+
+// Same memory layout as a B8G8R8A8 pixel
+struct BgraColor
+{
+    uint8_t B = 0;
+    uint8_t G = 0;
+    uint8_t R = 0;
+    uint8_t A = 0;
+
+    bool operator==(BgraColor const& other) const { return B == other.B && G == other.G && R == other.R && A == other.A; }
+    bool operator!=(BgraColor const& other) const { return !(*this == other); }
+
+    uint32_t Packed() const { return static_cast<uint32_t>(B) | (static_cast<uint32_t>(G) << 8) | (static_cast<uint32_t>(R) << 16) | (static_cast<uint32_t>(A) << 24); }
+    static BgraColor FromPacked(uint32_t value)
+    {
+        return BgraColor{ static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24) };
+    }
+};
+
+struct PixelRect
+{
+    uint32_t X = 0;
+    uint32_t Y = 0;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+
+    uint32_t Right() const { return X + Width; }
+    uint32_t Bottom() const { return Y + Height; }
+    bool Empty() const { return Width == 0 || Height == 0; }
+};
+
+// A non-owning view of B8G8R8A8 pixels, where rows may be padded (e.g. the
+// RowPitch of a mapped texture).
+struct BgraImageView
+{
+    uint8_t const* Data = nullptr;
+    uint32_t Width = 0;
+    uint32_t Height = 0;
+    uint32_t RowPitch = 0;
+
+    static constexpr uint32_t BytesPerPixel = 4;
+
+    uint8_t const* Row(uint32_t y) const { return Data + (static_cast<size_t>(RowPitch) * y); }
+    PixelRect Bounds() const { return PixelRect{ 0, 0, Width, Height }; }
+
+    bool Contains(PixelRect const& rect) const
+    {
+        return rect.X <= Width && rect.Y <= Height && rect.Width <= Width - rect.X && rect.Height <= Height - rect.Y;
+    }
+
+    // A view of just the given rect, which must be within the image
+    BgraImageView SubView(PixelRect const& rect) const
+    {
+        if (!Contains(rect))
+        {
+            throw std::out_of_range("Rect out of bounds");
+        }
+        return BgraImageView{ Row(rect.Y) + (static_cast<size_t>(rect.X) * BytesPerPixel), rect.Width, rect.Height, RowPitch };
+    }
+
+    BgraColor ReadPixel(uint32_t x, uint32_t y) const
+    {
+        if (x >= Width || y >= Height)
+        {
+            throw std::out_of_range("Pixel out of bounds");
+        }
+        auto pixel = Row(y) + (x * BytesPerPixel);
+        return BgraColor{ pixel[0], pixel[1], pixel[2], pixel[3] };
+    }
+};
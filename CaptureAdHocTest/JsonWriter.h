@@ -0,0 +1,222 @@
+#pragma once
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Writes JSON straight to a stream as values are added, without building a
+// document first. Commas are tracked per nesting level; nesting mistakes
+// (a value where a key is expected, unbalanced End calls) throw logic_error.
+class JsonWriter
+{
+public:
+    JsonWriter(std::ostream& stream) : m_stream(stream) {}
+
+    JsonWriter(JsonWriter const&) = delete;
+    JsonWriter& operator=(JsonWriter const&) = delete;
+
+    void BeginObject()
+    {
+        BeginValue();
+        m_stream.put('{');
+        m_scopes.push_back(Scope{ true, true, false });
+    }
+    void EndObject() { EndScope(true, '}'); }
+
+    void BeginArray()
+    {
+        BeginValue();
+        m_stream.put('[');
+        m_scopes.push_back(Scope{ false, true, false });
+    }
+    void EndArray() { EndScope(false, ']'); }
+
+    void Key(std::string_view key)
+    {
+        if (m_scopes.empty() || !m_scopes.back().IsObject || m_scopes.back().HasKey)
+        {
+            throw std::logic_error("JSON key outside of an object");
+        }
+        auto& scope = m_scopes.back();
+        if (!scope.First)
+        {
+            m_stream.put(',');
+        }
+        scope.First = false;
+        scope.HasKey = true;
+        WriteString(key);
+        m_stream.put(':');
+    }
+
+    void String(std::string_view value)
+    {
+        BeginValue();
+        WriteString(value);
+    }
+    void Bool(bool value)
+    {
+        BeginValue();
+        m_stream << (value ? "true" : "false");
+    }
+    void Null()
+    {
+        BeginValue();
+        m_stream << "null";
+    }
+    void Number(uint64_t value) { WriteInteger(value); }
+    void Number(int64_t value) { WriteInteger(value); }
+    void Number(uint32_t value) { WriteInteger(value); }
+    void Number(int32_t value) { WriteInteger(value); }
+    // NaN and infinity aren't valid JSON, so they're written as null
+    void Number(double value)
+    {
+        if (!std::isfinite(value))
+        {
+            Null();
+            return;
+        }
+        BeginValue();
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        m_stream.write(buffer, result.ptr - buffer);
+    }
+
+    // Shorthand for Key followed by a value
+    template <typename T>
+    void Field(std::string_view key, T value)
+    {
+        Key(key);
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            Bool(value);
+        }
+        else if constexpr (std::is_arithmetic_v<T>)
+        {
+            Number(value);
+        }
+        else
+        {
+            String(value);
+        }
+    }
+
+    // True once a single top level value has been completely written
+    bool Complete() const { return m_scopes.empty() && m_wroteRoot; }
+
+    // Starts the next top level value, for writing one document per line
+    void NextLine()
+    {
+        if (!m_scopes.empty())
+        {
+            throw std::logic_error("JSON value still open");
+        }
+        m_stream.put('\n');
+        m_wroteRoot = false;
+    }
+
+private:
+    struct Scope
+    {
+        bool IsObject;
+        bool First;
+        bool HasKey;
+    };
+
+    void BeginValue()
+    {
+        if (m_scopes.empty())
+        {
+            if (m_wroteRoot)
+            {
+                throw std::logic_error("JSON already has a top level value");
+            }
+            m_wroteRoot = true;
+            return;
+        }
+        auto& scope = m_scopes.back();
+        if (scope.IsObject)
+        {
+            if (!scope.HasKey)
+            {
+                throw std::logic_error("JSON value in an object needs a key");
+            }
+            scope.HasKey = false;
+        }
+        else
+        {
+            if (!scope.First)
+            {
+                m_stream.put(',');
+            }
+            scope.First = false;
+        }
+    }
+
+    void EndScope(bool isObject, char close)
+    {
+        if (m_scopes.empty() || m_scopes.back().IsObject != isObject || m_scopes.back().HasKey)
+        {
+            throw std::logic_error("Unbalanced JSON scope");
+        }
+        m_scopes.pop_back();
+        m_stream.put(close);
+    }
+
+    template <typename T>
+    void WriteInteger(T value)
+    {
+        BeginValue();
+        char buffer[24];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        m_stream.write(buffer, result.ptr - buffer);
+    }
+
+    void WriteString(std::string_view value)
+    {
+        static char const hex[] = "0123456789abcdef";
+        m_stream.put('"');
+        for (auto c : value)
+        {
+            auto byte = static_cast<uint8_t>(c);
+            switch (c)
+            {
+            case '"':
+                m_stream << "\\\"";
+                break;
+            case '\\':
+                m_stream << "\\\\";
+                break;
+            case '\n':
+                m_stream << "\\n";
+                break;
+            case '\r':
+                m_stream << "\\r";
+                break;
+            case '\t':
+                m_stream << "\\t";
+                break;
+            default:
+                if (byte < 0x20)
+                {
+                    char escaped[] = { '\\', 'u', '0', '0', hex[byte >> 4], hex[byte & 0xf] };
+                    m_stream.write(escaped, sizeof(escaped));
+                }
+                else
+                {
+                    m_stream.put(c);
+                }
+                break;
+            }
+        }
+        m_stream.put('"');
+    }
+
+private:
+    std::ostream& m_stream;
+    std::vector<Scope> m_scopes;
+    bool m_wroteRoot = false;
+};
@@ -0,0 +1,264 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// An append-only file that is written through a memory mapping. The file is
+// grown (and remapped) in large steps, and trimmed to the number of bytes
+// actually appended when it is closed. A process that dies before then
+// leaves the zero padding from the last grow behind, so formats that have to
+// be read back after a crash keep their own length (see FrameTraceHeader).
+class MappedAppendFile
+{
+public:
+    static constexpr uint64_t DefaultGrowSize = 16 * 1024 * 1024;
+
+    MappedAppendFile(std::filesystem::path const& path, uint64_t growSize = DefaultGrowSize)
+    {
+        m_growSize = growSize;
+#if defined(_WIN32)
+        m_file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("Could not create " + path.string());
+        }
+#else
+        m_file = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (m_file < 0)
+        {
+            throw std::runtime_error("Could not create " + path.string());
+        }
+#endif
+        Remap(m_growSize);
+    }
+    ~MappedAppendFile()
+    {
+        Close();
+    }
+
+    MappedAppendFile(MappedAppendFile const&) = delete;
+    MappedAppendFile& operator=(MappedAppendFile const&) = delete;
+
+    void Append(void const* data, size_t size)
+    {
+        if (m_size + size > m_capacity)
+        {
+            Remap(std::max(m_capacity + m_growSize, m_size + size));
+        }
+        std::memcpy(m_view + m_size, data, size);
+        m_size += size;
+    }
+
+    // Replaces bytes that were already appended, e.g. a header that says how
+    // much of the file is valid
+    void Overwrite(uint64_t offset, void const* data, size_t size)
+    {
+        if (offset + size > m_size)
+        {
+            throw std::out_of_range("Overwrite past the end of the file");
+        }
+        std::memcpy(m_view + offset, data, size);
+    }
+
+    uint64_t Size() const { return m_size; }
+
+    void Close()
+    {
+        if (!IsOpen())
+        {
+            return;
+        }
+        Unmap();
+#if defined(_WIN32)
+        LARGE_INTEGER size = {};
+        size.QuadPart = static_cast<LONGLONG>(m_size);
+        SetFilePointerEx(m_file, size, nullptr, FILE_BEGIN);
+        SetEndOfFile(m_file);
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        (void)ftruncate(m_file, static_cast<off_t>(m_size));
+        close(m_file);
+        m_file = -1;
+#endif
+    }
+
+private:
+#if defined(_WIN32)
+    bool IsOpen() const { return m_file != INVALID_HANDLE_VALUE; }
+#else
+    bool IsOpen() const { return m_file >= 0; }
+#endif
+
+    void Remap(uint64_t capacity)
+    {
+        Unmap();
+#if defined(_WIN32)
+        m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READWRITE, static_cast<DWORD>(capacity >> 32), static_cast<DWORD>(capacity), nullptr);
+        if (m_mapping == nullptr)
+        {
+            throw std::runtime_error("Could not map file for writing");
+        }
+        m_view = static_cast<uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(capacity)));
+#else
+        if (ftruncate(m_file, static_cast<off_t>(capacity)) != 0)
+        {
+            throw std::runtime_error("Could not grow file");
+        }
+        auto view = mmap(nullptr, static_cast<size_t>(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+        m_view = view == MAP_FAILED ? nullptr : static_cast<uint8_t*>(view);
+#endif
+        if (m_view == nullptr)
+        {
+            throw std::runtime_error("Could not map file for writing");
+        }
+        m_capacity = capacity;
+    }
+
+    void Unmap()
+    {
+#if defined(_WIN32)
+        if (m_view != nullptr)
+        {
+            UnmapViewOfFile(m_view);
+        }
+        if (m_mapping != nullptr)
+        {
+            CloseHandle(m_mapping);
+            m_mapping = nullptr;
+        }
+#else
+        if (m_view != nullptr)
+        {
+            munmap(m_view, static_cast<size_t>(m_capacity));
+        }
+#endif
+        m_view = nullptr;
+        m_capacity = 0;
+    }
+
+private:
+#if defined(_WIN32)
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#else
+    int m_file = -1;
+#endif
+    uint8_t* m_view = nullptr;
+    uint64_t m_size = 0;
+    uint64_t m_capacity = 0;
+    uint64_t m_growSize = DefaultGrowSize;
+};
+
+// A read-only view of an entire file. The file can still be open for writing
+// elsewhere, e.g. a trace that's being recorded.
+class MappedReadOnlyFile
+{
+public:
+    MappedReadOnlyFile(std::filesystem::path const& path)
+    {
+#if defined(_WIN32)
+        m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+        {
+            throw std::runtime_error("Could not open " + path.string());
+        }
+        LARGE_INTEGER size = {};
+        GetFileSizeEx(m_file, &size);
+        m_size = static_cast<uint64_t>(size.QuadPart);
+        if (m_size > 0)
+        {
+            m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (m_mapping != nullptr)
+            {
+                m_view = static_cast<uint8_t const*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+            }
+        }
+#else
+        m_file = open(path.c_str(), O_RDONLY);
+        if (m_file < 0)
+        {
+            throw std::runtime_error("Could not open " + path.string());
+        }
+        struct stat info = {};
+        fstat(m_file, &info);
+        m_size = static_cast<uint64_t>(info.st_size);
+        if (m_size > 0)
+        {
+            auto view = mmap(nullptr, static_cast<size_t>(m_size), PROT_READ, MAP_PRIVATE, m_file, 0);
+            m_view = view == MAP_FAILED ? nullptr : static_cast<uint8_t const*>(view);
+        }
+#endif
+        if (m_size > 0 && m_view == nullptr)
+        {
+            Close();
+            throw std::runtime_error("Could not map " + path.string());
+        }
+    }
+    ~MappedReadOnlyFile()
+    {
+        Close();
+    }
+
+    MappedReadOnlyFile(MappedReadOnlyFile const&) = delete;
+    MappedReadOnlyFile& operator=(MappedReadOnlyFile const&) = delete;
+
+    uint8_t const* Data() const { return m_view; }
+    uint64_t Size() const { return m_size; }
+
+private:
+    void Close()
+    {
+#if defined(_WIN32)
+        if (m_view != nullptr)
+        {
+            UnmapViewOfFile(m_view);
+        }
+        if (m_mapping != nullptr)
+        {
+            CloseHandle(m_mapping);
+            m_mapping = nullptr;
+        }
+        if (m_file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(m_file);
+            m_file = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (m_view != nullptr)
+        {
+            munmap(const_cast<uint8_t*>(m_view), static_cast<size_t>(m_size));
+        }
+        if (m_file >= 0)
+        {
+            close(m_file);
+            m_file = -1;
+        }
+#endif
+        m_view = nullptr;
+    }
+
+private:
+#if defined(_WIN32)
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+#else
+    int m_file = -1;
+#endif
+    uint8_t const* m_view = nullptr;
+    uint64_t m_size = 0;
+};
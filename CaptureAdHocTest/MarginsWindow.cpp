@@ -2,6 +2,7 @@
 #include "MarginsWindow.h"
 #include <robmikh.common/ControlsHelper.h>
 #include "testutils.h"
+#include "ArtifactWriter.h"
 
 namespace winrt
 {
@@ -9,9 +10,6 @@ namespace winrt
     using namespace Windows::Graphics::Capture;
     using namespace Windows::Graphics::DirectX;
     using namespace Windows::Graphics::DirectX::Direct3D11;
-    using namespace Windows::Graphics::Imaging;
-    using namespace Windows::Storage;
-    using namespace Windows::Storage::Streams;
     using namespace Windows::UI;
 }
 
@@ -175,34 +173,19 @@ void MarginsWindow::Fullscreen(bool isFullscreen)
     }
 }
 
-winrt::IAsyncAction SaveBitmapAsync(std::vector<byte> bits, uint32_t width, uint32_t height)
-{
-    // Get a file to save the screenshot
-    auto currentPath = std::filesystem::current_path();
-    auto folder = co_await winrt::StorageFolder::GetFolderFromPathAsync(currentPath.wstring());
-    auto file = co_await folder.CreateFileAsync(L"marginsSnapshot.png", winrt::CreationCollisionOption::ReplaceExisting);
-
-    auto stream = co_await file.OpenAsync(winrt::FileAccessMode::ReadWrite);
-    auto encoder = co_await winrt::BitmapEncoder::CreateAsync(winrt::BitmapEncoder::PngEncoderId(), stream);
-    encoder.SetPixelData(
-        winrt::BitmapPixelFormat::Bgra8,
-        winrt::BitmapAlphaMode::Premultiplied,
-        width,
-        height,
-        1.0,
-        1.0,
-        bits);
-    co_await encoder.FlushAsync();
-}
-
 winrt::fire_and_forget MarginsWindow::TakeSnapshot()
 {
-    // TODO: Don't create a new d3d device each time
-    auto d3dDevice = util::CreateD3DDevice();
+    // The device is created on the first snapshot and reused after that
+    if (m_d3dDevice == nullptr)
+    {
+        m_d3dDevice = util::CreateD3DDevice();
+        auto dxgiDevice = m_d3dDevice.as<IDXGIDevice>();
+        m_device = CreateDirect3DDevice(dxgiDevice.get());
+    }
+    auto d3dDevice = m_d3dDevice;
+    auto device = m_device;
     winrt::com_ptr<ID3D11DeviceContext> d3dContext;
     d3dDevice->GetImmediateContext(d3dContext.put());
-    auto dxgiDevice = d3dDevice.as<IDXGIDevice>();
-    auto device = CreateDirect3DDevice(dxgiDevice.get());
 
     auto item = util::CreateCaptureItemForWindow(m_window);
     auto framePool = winrt::Direct3D11CaptureFramePool::Create(
@@ -212,7 +195,7 @@ winrt::fire_and_forget MarginsWindow::TakeSnapshot()
         item.Size());
     auto session = framePool.CreateCaptureSession(item);
 
-    winrt::com_ptr<ID3D11Texture2D> result;
+    std::optional<StagingTextureCache::Lease> result;
     wil::shared_event captureEvent(wil::EventOptions::ManualReset);
     framePool.FrameArrived([session, d3dDevice, d3dContext, &result, captureEvent](auto& framePool, auto&)
         {
@@ -220,18 +203,7 @@ winrt::fire_and_forget MarginsWindow::TakeSnapshot()
             auto frameTexture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(frame.Surface());
 
             // Make a copy of the texture
-            D3D11_TEXTURE2D_DESC desc = {};
-            frameTexture->GetDesc(&desc);
-            // Clear flags that we don't need
-            desc.Usage = D3D11_USAGE_STAGING;
-            desc.BindFlags = 0;
-            desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
-            desc.MiscFlags = 0;
-            winrt::com_ptr<ID3D11Texture2D> textureCopy;
-            winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, textureCopy.put()));
-            d3dContext->CopyResource(textureCopy.get(), frameTexture.get());
-
-            result = textureCopy;
+            result.emplace(StagingTextureCache::Shared().Copy(d3dDevice, d3dContext, frameTexture));
 
             // End the capture
             session.Close();
@@ -244,13 +216,11 @@ winrt::fire_and_forget MarginsWindow::TakeSnapshot()
 
     // Don't return until the capture is finished
     co_await winrt::resume_on_signal(captureEvent.get());
-    WINRT_ASSERT(result != nullptr);
-
-    D3D11_TEXTURE2D_DESC desc = {};
-    result->GetDesc(&desc);
-    
-    auto bytes = util::CopyBytesFromTexture(result);
+    WINRT_ASSERT(result.has_value());
 
     // Save
-    co_await SaveBitmapAsync(bytes, desc.Width, desc.Height);
+    auto mapped = MappedTexture(d3dContext, result->Texture());
+    auto artifact = ImageArtifact::Copy(std::filesystem::current_path() / L"marginsSnapshot.png", mapped.View());
+    artifact.Premultiplied = true;
+    ArtifactWriter::Shared().Enqueue(std::move(artifact));
 }
\ No newline at end of file
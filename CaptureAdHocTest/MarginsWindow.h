@@ -29,4 +29,6 @@ private:
     wil::unique_hbrush m_brush;
     uint32_t m_initialWidth;
     uint32_t m_initialHeight;
+    winrt::com_ptr<ID3D11Device> m_d3dDevice;
+    winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice m_device{ nullptr };
 };
\ No newline at end of file
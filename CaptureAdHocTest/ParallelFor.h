@@ -0,0 +1,169 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small persistent pool for splitting image work into row bands. The calling
+// thread participates, so a single core machine runs everything inline. Only
+// one job runs at a time; concurrent callers are serialized.
+class BandPool
+{
+public:
+    static BandPool& Shared()
+    {
+        static BandPool pool(std::max(1u, std::thread::hardware_concurrency()));
+        return pool;
+    }
+
+    BandPool(uint32_t threadCount)
+    {
+        for (uint32_t i = 1; i < threadCount; i++)
+        {
+            m_workers.emplace_back([this]() { WorkerLoop(); });
+        }
+    }
+    ~BandPool()
+    {
+        {
+            std::lock_guard lock(m_lock);
+            m_exiting = true;
+        }
+        m_wake.notify_all();
+        for (auto&& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    BandPool(BandPool const&) = delete;
+    BandPool& operator=(BandPool const&) = delete;
+
+    uint32_t ThreadCount() const { return static_cast<uint32_t>(m_workers.size()) + 1; }
+
+    // Calls work(index) for every index in [0, count).
+    void Run(uint32_t count, std::function<void(uint32_t)> const& work)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if (count == 1 || m_workers.empty())
+        {
+            for (uint32_t i = 0; i < count; i++)
+            {
+                work(i);
+            }
+            return;
+        }
+
+        std::lock_guard jobLock(m_jobLock);
+        {
+            std::lock_guard lock(m_lock);
+            m_work = &work;
+            m_count = count;
+            m_next = 0;
+            m_remaining = count;
+            m_generation++;
+        }
+        m_wake.notify_all();
+
+        DoWork();
+
+        // Wait for stragglers too, so none of them can pick up indices from
+        // the next job with this job's work.
+        std::unique_lock lock(m_lock);
+        m_done.wait(lock, [this]() { return m_remaining == 0 && m_active == 0; });
+        m_work = nullptr;
+    }
+
+private:
+    void WorkerLoop()
+    {
+        uint64_t seenGeneration = 0;
+        while (true)
+        {
+            {
+                std::unique_lock lock(m_lock);
+                m_wake.wait(lock, [&]() { return m_exiting || m_generation != seenGeneration; });
+                if (m_exiting)
+                {
+                    return;
+                }
+                seenGeneration = m_generation;
+            }
+            DoWork();
+        }
+    }
+
+    void DoWork()
+    {
+        std::function<void(uint32_t)> const* work = nullptr;
+        uint32_t count = 0;
+        {
+            std::lock_guard lock(m_lock);
+            if (m_work == nullptr)
+            {
+                return;
+            }
+            work = m_work;
+            count = m_count;
+            m_active++;
+        }
+
+        uint32_t completed = 0;
+        while (true)
+        {
+            auto index = m_next.fetch_add(1);
+            if (index >= count)
+            {
+                break;
+            }
+            (*work)(index);
+            completed++;
+        }
+
+        std::lock_guard lock(m_lock);
+        m_remaining -= completed;
+        m_active--;
+        if (m_remaining == 0 && m_active == 0)
+        {
+            m_done.notify_all();
+        }
+    }
+
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_jobLock;
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::function<void(uint32_t)> const* m_work = nullptr;
+    uint32_t m_count = 0;
+    std::atomic<uint32_t> m_next = 0;
+    uint32_t m_remaining = 0;
+    uint32_t m_active = 0;
+    uint64_t m_generation = 0;
+    bool m_exiting = false;
+};
+
+// Splits [0, rows) into bands of at least minRowsPerBand rows and runs
+// work(firstRow, rowCount) for each band on the shared pool.
+inline void ParallelForRowBands(uint32_t rows, uint32_t minRowsPerBand, std::function<void(uint32_t, uint32_t)> const& work)
+{
+    auto& pool = BandPool::Shared();
+    auto bandCount = std::max(1u, std::min(pool.ThreadCount() * 4, rows / std::max(1u, minRowsPerBand)));
+    auto rowsPerBand = (rows + bandCount - 1) / bandCount;
+    pool.Run(bandCount, [&](uint32_t band)
+    {
+        auto first = band * rowsPerBand;
+        if (first < rows)
+        {
+            work(first, std::min(rowsPerBand, rows - first));
+        }
+    });
+}
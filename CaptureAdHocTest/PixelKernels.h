@@ -0,0 +1,842 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include "ImageView.h"
+#include "ParallelFor.h"
+#include "SimdSupport.h"
+
+// Whole-image pixel format conversions. Every kernel has a scalar reference,
+// and the vector versions give exactly the same bytes. The kernels that keep
+// 4 bytes per pixel can convert in place.
+
+// The three planes of an I420 image. U and V are half the width and height,
+// rounded up.
+struct I420Planes
+{
+    uint8_t* Y = nullptr;
+    uint32_t YPitch = 0;
+    uint8_t* U = nullptr;
+    uint8_t* V = nullptr;
+    uint32_t ChromaPitch = 0;
+};
+
+// The same samples as I420, with U and V interleaved in one plane
+struct NV12Planes
+{
+    uint8_t* Y = nullptr;
+    uint32_t YPitch = 0;
+    uint8_t* UV = nullptr;
+    uint32_t UVPitch = 0;
+};
+
+inline uint32_t ChromaSize(uint32_t size) { return (size + 1) / 2; }
+
+// Bytes for a tightly packed I420 or NV12 image
+inline size_t I420Size(uint32_t width, uint32_t height)
+{
+    return (static_cast<size_t>(width) * height) + (2 * static_cast<size_t>(ChromaSize(width)) * ChromaSize(height));
+}
+
+// Points the planes at a tightly packed I420 image: Y, then U, then V
+inline I420Planes I420PlanesFor(uint8_t* data, uint32_t width, uint32_t height)
+{
+    auto chromaBytes = static_cast<size_t>(ChromaSize(width)) * ChromaSize(height);
+    auto u = data + (static_cast<size_t>(width) * height);
+    return I420Planes{ data, width, u, u + chromaBytes, ChromaSize(width) };
+}
+
+// Points the planes at a tightly packed NV12 image: Y, then UV
+inline NV12Planes NV12PlanesFor(uint8_t* data, uint32_t width, uint32_t height)
+{
+    return NV12Planes{ data, width, data + (static_cast<size_t>(width) * height), ChromaSize(width) * 2 };
+}
+
+namespace pixelkernels
+{
+    // Each vector row kernel converts as much of the row as it can in whole
+    // vectors and returns how many pixels that was. The scalar kernel takes
+    // the rest, starting from there.
+
+    // BGRA <-> RGBA
+    inline void SwapRedBlueRowScalar(uint8_t const* source, uint8_t* destination, uint32_t begin, uint32_t width)
+    {
+        for (auto x = begin; x < width; x++)
+        {
+            auto pixel = source + (x * 4);
+            uint8_t swapped[4] = { pixel[2], pixel[1], pixel[0], pixel[3] };
+            std::memcpy(destination + (x * 4), swapped, 4);
+        }
+    }
+
+    // c * a / 255, rounded to nearest
+    inline uint8_t MultiplyAlpha(uint32_t value, uint32_t alpha)
+    {
+        auto product = (value * alpha) + 128;
+        return static_cast<uint8_t>((product + (product >> 8)) >> 8);
+    }
+
+    inline void PremultiplyRowScalar(uint8_t const* source, uint8_t* destination, uint32_t begin, uint32_t width)
+    {
+        for (auto x = begin; x < width; x++)
+        {
+            auto pixel = source + (x * 4);
+            auto alpha = pixel[3];
+            uint8_t result[4] = { MultiplyAlpha(pixel[0], alpha), MultiplyAlpha(pixel[1], alpha), MultiplyAlpha(pixel[2], alpha), alpha };
+            std::memcpy(destination + (x * 4), result, 4);
+        }
+    }
+
+    // c * 255 / a in single precision, rounded to nearest even (which is what
+    // cvtps2dq and fcvtns do) and clamped to 255. Fully transparent pixels
+    // come out black.
+    inline uint8_t DivideAlpha(uint32_t value, uint32_t alpha)
+    {
+        if (alpha == 0)
+        {
+            return 0;
+        }
+        auto quotient = std::nearbyint(static_cast<float>(value * 255) / static_cast<float>(alpha));
+        return static_cast<uint8_t>(std::min(quotient, 255.0f));
+    }
+
+    inline void UnpremultiplyRowScalar(uint8_t const* source, uint8_t* destination, uint32_t begin, uint32_t width)
+    {
+        for (auto x = begin; x < width; x++)
+        {
+            auto pixel = source + (x * 4);
+            auto alpha = pixel[3];
+            uint8_t result[4] = { DivideAlpha(pixel[0], alpha), DivideAlpha(pixel[1], alpha), DivideAlpha(pixel[2], alpha), alpha };
+            std::memcpy(destination + (x * 4), result, 4);
+        }
+    }
+
+    // BT.709 luma, full range, in 8.8 fixed point
+    constexpr int GrayB = 19;
+    constexpr int GrayG = 183;
+    constexpr int GrayR = 54;
+
+    inline uint8_t Gray(int b, int g, int r)
+    {
+        return static_cast<uint8_t>((GrayB * b + GrayG * g + GrayR * r + 128) >> 8);
+    }
+
+    inline void GrayRowScalar(uint8_t const* source, uint8_t* destination, uint32_t begin, uint32_t width)
+    {
+        for (auto x = begin; x < width; x++)
+        {
+            auto pixel = source + (x * 4);
+            destination[x] = Gray(pixel[0], pixel[1], pixel[2]);
+        }
+    }
+
+    // BGRA to BT.709 limited range YUV, in 8.8 fixed point. Each chroma sample is
+    // the average of a 2x2 block, taken as the rounded average of the two rows
+    // and then of the two columns (which is what pavgb/vrhadd do). Past the right
+    // or bottom edge the last column or row is repeated.
+    constexpr int LumaB = 16;
+    constexpr int LumaG = 157;
+    constexpr int LumaR = 47;
+    constexpr int ChromaUB = 113;
+    constexpr int ChromaUG = -87;
+    constexpr int ChromaUR = -26;
+    constexpr int ChromaVB = -10;
+    constexpr int ChromaVG = -102;
+    constexpr int ChromaVR = 112;
+
+    inline uint8_t Luma(int b, int g, int r)
+    {
+        return static_cast<uint8_t>(((LumaB * b + LumaG * g + LumaR * r + 128) >> 8) + 16);
+    }
+    inline uint8_t Chroma(int b, int g, int r, int cb, int cg, int cr)
+    {
+        return static_cast<uint8_t>(std::clamp(((cb * b + cg * g + cr * r + 128) >> 8) + 128, 0, 255));
+    }
+    inline int Average(int a, int b) { return (a + b + 1) >> 1; }
+
+    // The YUV row kernels write I420 chroma to uRow and vRow, or with
+    // Interleaved (NV12) write UVUV... to uRow and leave vRow alone.
+
+    // Converts columns [begin, width) of a pair of rows. row1 and yRow1 are the
+    // same as row0 and yRow0 for the last row of an odd height image.
+    template <bool Interleaved>
+    inline void RowPairToYuvScalar(uint8_t const* row0, uint8_t const* row1, uint32_t begin, uint32_t width,
+        uint8_t* yRow0, uint8_t* yRow1, uint8_t* uRow, uint8_t* vRow)
+    {
+        for (auto x = begin; x < width; x++)
+        {
+            auto p0 = row0 + (x * 4);
+            auto p1 = row1 + (x * 4);
+            yRow0[x] = Luma(p0[0], p0[1], p0[2]);
+            yRow1[x] = Luma(p1[0], p1[1], p1[2]);
+        }
+        for (auto x = begin; x < width; x += 2)
+        {
+            auto right = std::min(x + 1, width - 1);
+            int channels[3];
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                auto left = Average(row0[(x * 4) + c], row1[(x * 4) + c]);
+                channels[c] = Average(left, Average(row0[(right * 4) + c], row1[(right * 4) + c]));
+            }
+            auto u = Chroma(channels[0], channels[1], channels[2], ChromaUB, ChromaUG, ChromaUR);
+            auto v = Chroma(channels[0], channels[1], channels[2], ChromaVB, ChromaVG, ChromaVR);
+            if (Interleaved)
+            {
+                uRow[x] = u;
+                uRow[x + 1] = v;
+            }
+            else
+            {
+                uRow[x / 2] = u;
+                vRow[x / 2] = v;
+            }
+        }
+    }
+
+#if defined(CAPTURE_SIMD_X86)
+    inline uint32_t SwapRedBlueRowSSE2(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        auto greenAlphaMask = _mm_set1_epi32(static_cast<int>(0xff00ff00));
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto pixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + (x * 4)));
+            auto redBlue = _mm_andnot_si128(greenAlphaMask, pixels);
+            auto swapped = _mm_or_si128(_mm_slli_epi32(redBlue, 16), _mm_srli_epi32(redBlue, 16));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + (x * 4)), _mm_or_si128(_mm_and_si128(greenAlphaMask, pixels), swapped));
+        }
+        return x;
+    }
+
+    // c * a / 255 on 16-bit lanes
+    inline __m128i MultiplyAlphaSSE2(__m128i values, __m128i alphas)
+    {
+        auto product = _mm_add_epi16(_mm_mullo_epi16(values, alphas), _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(product, _mm_srli_epi16(product, 8)), 8);
+    }
+
+    // Copies each 16-bit pixel's alpha over its other channels
+    inline __m128i BroadcastAlphaSSE2(__m128i pixels)
+    {
+        return _mm_shufflehi_epi16(_mm_shufflelo_epi16(pixels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    }
+
+    inline uint32_t PremultiplyRowSSE2(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        auto zero = _mm_setzero_si128();
+        auto alphaMask = _mm_set1_epi32(static_cast<int>(0xff000000));
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto pixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + (x * 4)));
+            auto low = _mm_unpacklo_epi8(pixels, zero);
+            auto high = _mm_unpackhi_epi8(pixels, zero);
+            auto result = _mm_packus_epi16(MultiplyAlphaSSE2(low, BroadcastAlphaSSE2(low)), MultiplyAlphaSSE2(high, BroadcastAlphaSSE2(high)));
+            result = _mm_or_si128(_mm_andnot_si128(alphaMask, result), _mm_and_si128(alphaMask, pixels));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + (x * 4)), result);
+        }
+        return x;
+    }
+
+    // One pixel's channels on 32-bit lanes. A zero alpha divides to infinity
+    // or NaN, which converts to INT_MIN and then packs to 0.
+    inline __m128i DivideAlphaSSE2(__m128i pixel)
+    {
+        auto scaled = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_slli_epi32(pixel, 8), pixel));
+        auto alpha = _mm_cvtepi32_ps(_mm_shuffle_epi32(pixel, _MM_SHUFFLE(3, 3, 3, 3)));
+        return _mm_cvtps_epi32(_mm_div_ps(scaled, alpha));
+    }
+
+    inline uint32_t UnpremultiplyRowSSE2(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        auto zero = _mm_setzero_si128();
+        auto alphaMask = _mm_set1_epi32(static_cast<int>(0xff000000));
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto pixels = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + (x * 4)));
+            auto low = _mm_unpacklo_epi8(pixels, zero);
+            auto high = _mm_unpackhi_epi8(pixels, zero);
+            auto first = _mm_packs_epi32(DivideAlphaSSE2(_mm_unpacklo_epi16(low, zero)), DivideAlphaSSE2(_mm_unpackhi_epi16(low, zero)));
+            auto second = _mm_packs_epi32(DivideAlphaSSE2(_mm_unpacklo_epi16(high, zero)), DivideAlphaSSE2(_mm_unpackhi_epi16(high, zero)));
+            auto result = _mm_packus_epi16(first, second);
+            result = _mm_or_si128(_mm_andnot_si128(alphaMask, result), _mm_and_si128(alphaMask, pixels));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + (x * 4)), result);
+        }
+        return x;
+    }
+
+    // 8.8 weighted sums of 4 pixels' B, G and R, as 32-bit values
+    inline __m128i WeightedSumSSE2(__m128i pixels, __m128i weights)
+    {
+        auto zero = _mm_setzero_si128();
+        auto low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+        auto high = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+        auto blueGreen = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(2, 0, 2, 0)));
+        auto redAlpha = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(low), _mm_castsi128_ps(high), _MM_SHUFFLE(3, 1, 3, 1)));
+        return _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(blueGreen, redAlpha), _mm_set1_epi32(128)), 8);
+    }
+
+    // 16 pixels' weighted sums plus offset, as bytes
+    inline void StoreWeightedSSE2(__m128i const* pixels, __m128i weights, int16_t offset, uint8_t* destination)
+    {
+        auto offsets = _mm_set1_epi16(offset);
+        auto low = _mm_add_epi16(_mm_packs_epi32(WeightedSumSSE2(pixels[0], weights), WeightedSumSSE2(pixels[1], weights)), offsets);
+        auto high = _mm_add_epi16(_mm_packs_epi32(WeightedSumSSE2(pixels[2], weights), WeightedSumSSE2(pixels[3], weights)), offsets);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), _mm_packus_epi16(low, high));
+    }
+
+    inline uint32_t GrayRowSSE2(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        auto weights = _mm_setr_epi16(GrayB, GrayG, GrayR, 0, GrayB, GrayG, GrayR, 0);
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i pixels[4];
+            for (uint32_t i = 0; i < 4; i++)
+            {
+                pixels[i] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + ((x + (i * 4)) * 4)));
+            }
+            StoreWeightedSSE2(pixels, weights, 0, destination + x);
+        }
+        return x;
+    }
+
+    // The 2x2 averages of 4 pixel pairs from two rows of 8 pixels
+    inline __m128i AverageBlocksSSE2(__m128i top0, __m128i top1, __m128i bottom0, __m128i bottom1)
+    {
+        auto first = _mm_avg_epu8(top0, bottom0);
+        auto second = _mm_avg_epu8(top1, bottom1);
+        auto even = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(first), _mm_castsi128_ps(second), _MM_SHUFFLE(2, 0, 2, 0)));
+        auto odd = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(first), _mm_castsi128_ps(second), _MM_SHUFFLE(3, 1, 3, 1)));
+        return _mm_avg_epu8(even, odd);
+    }
+
+    // 8 chroma samples of each, from 16-bit lanes. index is the first sample.
+    template <bool Interleaved>
+    inline void StoreChromaSSE2(__m128i u, __m128i v, uint8_t* uRow, uint8_t* vRow, uint32_t index)
+    {
+        auto uBytes = _mm_packus_epi16(u, u);
+        auto vBytes = _mm_packus_epi16(v, v);
+        if (Interleaved)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(uRow + (index * 2)), _mm_unpacklo_epi8(uBytes, vBytes));
+        }
+        else
+        {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(uRow + index), uBytes);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(vRow + index), vBytes);
+        }
+    }
+
+    template <bool Interleaved>
+    inline uint32_t RowPairToYuvSSE2(uint8_t const* row0, uint8_t const* row1, uint32_t width,
+        uint8_t* yRow0, uint8_t* yRow1, uint8_t* uRow, uint8_t* vRow)
+    {
+        auto lumaWeights = _mm_setr_epi16(LumaB, LumaG, LumaR, 0, LumaB, LumaG, LumaR, 0);
+        auto uWeights = _mm_setr_epi16(ChromaUB, ChromaUG, ChromaUR, 0, ChromaUB, ChromaUG, ChromaUR, 0);
+        auto vWeights = _mm_setr_epi16(ChromaVB, ChromaVG, ChromaVR, 0, ChromaVB, ChromaVG, ChromaVR, 0);
+        auto chromaOffset = _mm_set1_epi16(128);
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            __m128i top[4];
+            __m128i bottom[4];
+            for (uint32_t i = 0; i < 4; i++)
+            {
+                top[i] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row0 + ((x + (i * 4)) * 4)));
+                bottom[i] = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row1 + ((x + (i * 4)) * 4)));
+            }
+            StoreWeightedSSE2(top, lumaWeights, 16, yRow0 + x);
+            StoreWeightedSSE2(bottom, lumaWeights, 16, yRow1 + x);
+
+            auto blocks0 = AverageBlocksSSE2(top[0], top[1], bottom[0], bottom[1]);
+            auto blocks1 = AverageBlocksSSE2(top[2], top[3], bottom[2], bottom[3]);
+            auto u = _mm_add_epi16(_mm_packs_epi32(WeightedSumSSE2(blocks0, uWeights), WeightedSumSSE2(blocks1, uWeights)), chromaOffset);
+            auto v = _mm_add_epi16(_mm_packs_epi32(WeightedSumSSE2(blocks0, vWeights), WeightedSumSSE2(blocks1, vWeights)), chromaOffset);
+            StoreChromaSSE2<Interleaved>(u, v, uRow, vRow, x / 2);
+        }
+        return x;
+    }
+
+    CAPTURE_TARGET_AVX2 inline uint32_t SwapRedBlueRowAVX2(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        auto order = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15, 2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+        uint32_t x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            auto pixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(source + (x * 4)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + (x * 4)), _mm256_shuffle_epi8(pixels, order));
+        }
+        return x;
+    }
+
+    CAPTURE_TARGET_AVX2 inline __m256i MultiplyAlphaAVX2(__m256i values, __m256i alphas)
+    {
+        auto product = _mm256_add_epi16(_mm256_mullo_epi16(values, alphas), _mm256_set1_epi16(128));
+        return _mm256_srli_epi16(_mm256_add_epi16(product, _mm256_srli_epi16(product, 8)), 8);
+    }
+
+    CAPTURE_TARGET_AVX2 inline uint32_t PremultiplyRowAVX2(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        auto zero = _mm256_setzero_si256();
+        auto alphaMask = _mm256_set1_epi32(static_cast<int>(0xff000000));
+        auto broadcastAlpha = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15, 6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+        uint32_t x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            auto pixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(source + (x * 4)));
+            auto low = _mm256_unpacklo_epi8(pixels, zero);
+            auto high = _mm256_unpackhi_epi8(pixels, zero);
+            auto result = _mm256_packus_epi16(MultiplyAlphaAVX2(low, _mm256_shuffle_epi8(low, broadcastAlpha)), MultiplyAlphaAVX2(high, _mm256_shuffle_epi8(high, broadcastAlpha)));
+            result = _mm256_or_si256(_mm256_andnot_si256(alphaMask, result), _mm256_and_si256(alphaMask, pixels));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + (x * 4)), result);
+        }
+        return x;
+    }
+
+    // Two pixels, one per 128-bit lane
+    CAPTURE_TARGET_AVX2 inline __m256i DivideAlphaAVX2(uint8_t const* pixels)
+    {
+        auto values = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<__m128i const*>(pixels)));
+        auto scaled = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_slli_epi32(values, 8), values));
+        auto alpha = _mm256_cvtepi32_ps(_mm256_shuffle_epi32(values, _MM_SHUFFLE(3, 3, 3, 3)));
+        return _mm256_cvtps_epi32(_mm256_div_ps(scaled, alpha));
+    }
+
+    CAPTURE_TARGET_AVX2 inline uint32_t UnpremultiplyRowAVX2(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        auto alphaMask = _mm256_set1_epi32(static_cast<int>(0xff000000));
+        // The packs leave the pixels as 0, 2, 4, 6, 1, 3, 5, 7
+        auto pixelOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        uint32_t x = 0;
+        for (; x + 8 <= width; x += 8)
+        {
+            auto row = source + (x * 4);
+            auto pixels = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row));
+            auto first = _mm256_packs_epi32(DivideAlphaAVX2(row), DivideAlphaAVX2(row + 8));
+            auto second = _mm256_packs_epi32(DivideAlphaAVX2(row + 16), DivideAlphaAVX2(row + 24));
+            auto result = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(first, second), pixelOrder);
+            result = _mm256_or_si256(_mm256_andnot_si256(alphaMask, result), _mm256_and_si256(alphaMask, pixels));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + (x * 4)), result);
+        }
+        return x;
+    }
+
+    // Same as the SSE2 version, but 8 pixels at a time. The in-lane shuffles
+    // keep the pixels in order, so only the final packs need 128-bit halves.
+    CAPTURE_TARGET_AVX2 inline __m256i WeightedSumAVX2(__m256i pixels, __m256i weights)
+    {
+        auto zero = _mm256_setzero_si256();
+        auto low = _mm256_madd_epi16(_mm256_unpacklo_epi8(pixels, zero), weights);
+        auto high = _mm256_madd_epi16(_mm256_unpackhi_epi8(pixels, zero), weights);
+        auto blueGreen = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(low), _mm256_castsi256_ps(high), _MM_SHUFFLE(2, 0, 2, 0)));
+        auto redAlpha = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(low), _mm256_castsi256_ps(high), _MM_SHUFFLE(3, 1, 3, 1)));
+        return _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(blueGreen, redAlpha), _mm256_set1_epi32(128)), 8);
+    }
+
+    CAPTURE_TARGET_AVX2 inline __m128i PackSumsAVX2(__m256i sums)
+    {
+        return _mm_packs_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    }
+
+    // 16 pixels' weighted sums plus offset, as bytes
+    CAPTURE_TARGET_AVX2 inline void StoreWeightedAVX2(__m256i first, __m256i second, __m256i weights, int16_t offset, uint8_t* destination)
+    {
+        auto offsets = _mm_set1_epi16(offset);
+        auto low = _mm_add_epi16(PackSumsAVX2(WeightedSumAVX2(first, weights)), offsets);
+        auto high = _mm_add_epi16(PackSumsAVX2(WeightedSumAVX2(second, weights)), offsets);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination), _mm_packus_epi16(low, high));
+    }
+
+    CAPTURE_TARGET_AVX2 inline uint32_t GrayRowAVX2(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        auto weights = _mm256_setr_epi16(GrayB, GrayG, GrayR, 0, GrayB, GrayG, GrayR, 0, GrayB, GrayG, GrayR, 0, GrayB, GrayG, GrayR, 0);
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            auto first = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(source + (x * 4)));
+            auto second = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(source + ((x + 8) * 4)));
+            StoreWeightedAVX2(first, second, weights, 0, destination + x);
+        }
+        return x;
+    }
+
+    template <bool Interleaved>
+    CAPTURE_TARGET_AVX2 inline uint32_t RowPairToYuvAVX2(uint8_t const* row0, uint8_t const* row1, uint32_t width,
+        uint8_t* yRow0, uint8_t* yRow1, uint8_t* uRow, uint8_t* vRow)
+    {
+        auto lumaWeights = _mm256_setr_epi16(LumaB, LumaG, LumaR, 0, LumaB, LumaG, LumaR, 0, LumaB, LumaG, LumaR, 0, LumaB, LumaG, LumaR, 0);
+        auto uWeights = _mm256_setr_epi16(ChromaUB, ChromaUG, ChromaUR, 0, ChromaUB, ChromaUG, ChromaUR, 0, ChromaUB, ChromaUG, ChromaUR, 0, ChromaUB, ChromaUG, ChromaUR, 0);
+        auto vWeights = _mm256_setr_epi16(ChromaVB, ChromaVG, ChromaVR, 0, ChromaVB, ChromaVG, ChromaVR, 0, ChromaVB, ChromaVG, ChromaVR, 0, ChromaVB, ChromaVG, ChromaVR, 0);
+        // The block averages come out as blocks 0, 1, 4, 5, 2, 3, 6, 7
+        auto blockOrder = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+        auto chromaOffset = _mm_set1_epi16(128);
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            auto top0 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row0 + (x * 4)));
+            auto top1 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row0 + ((x + 8) * 4)));
+            auto bottom0 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row1 + (x * 4)));
+            auto bottom1 = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(row1 + ((x + 8) * 4)));
+            StoreWeightedAVX2(top0, top1, lumaWeights, 16, yRow0 + x);
+            StoreWeightedAVX2(bottom0, bottom1, lumaWeights, 16, yRow1 + x);
+
+            auto first = _mm256_avg_epu8(top0, bottom0);
+            auto second = _mm256_avg_epu8(top1, bottom1);
+            auto even = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(first), _mm256_castsi256_ps(second), _MM_SHUFFLE(2, 0, 2, 0)));
+            auto odd = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(first), _mm256_castsi256_ps(second), _MM_SHUFFLE(3, 1, 3, 1)));
+            auto blocks = _mm256_avg_epu8(even, odd);
+            auto u = _mm_add_epi16(PackSumsAVX2(_mm256_permutevar8x32_epi32(WeightedSumAVX2(blocks, uWeights), blockOrder)), chromaOffset);
+            auto v = _mm_add_epi16(PackSumsAVX2(_mm256_permutevar8x32_epi32(WeightedSumAVX2(blocks, vWeights), blockOrder)), chromaOffset);
+            StoreChromaSSE2<Interleaved>(u, v, uRow, vRow, x / 2);
+        }
+        return x;
+    }
+#endif
+
+#if defined(CAPTURE_SIMD_NEON)
+    inline uint32_t SwapRedBlueRowNEON(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            auto pixels = vld4q_u8(source + (x * 4));
+            std::swap(pixels.val[0], pixels.val[2]);
+            vst4q_u8(destination + (x * 4), pixels);
+        }
+        return x;
+    }
+
+    inline uint8x16_t MultiplyAlphaNEON(uint8x16_t values, uint8x16_t alphas)
+    {
+        auto low = vaddq_u16(vmull_u8(vget_low_u8(values), vget_low_u8(alphas)), vdupq_n_u16(128));
+        auto high = vaddq_u16(vmull_u8(vget_high_u8(values), vget_high_u8(alphas)), vdupq_n_u16(128));
+        return vcombine_u8(vshrn_n_u16(vsraq_n_u16(low, low, 8), 8), vshrn_n_u16(vsraq_n_u16(high, high, 8), 8));
+    }
+
+    inline uint32_t PremultiplyRowNEON(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            auto pixels = vld4q_u8(source + (x * 4));
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                pixels.val[c] = MultiplyAlphaNEON(pixels.val[c], pixels.val[3]);
+            }
+            vst4q_u8(destination + (x * 4), pixels);
+        }
+        return x;
+    }
+
+    // 4 values of one channel, saturated to 16 bits
+    inline uint16x4_t DivideAlphaNEON(uint16x4_t values, float32x4_t alphas)
+    {
+        auto scaled = vcvtq_f32_u32(vmull_n_u16(values, 255));
+        return vqmovn_u32(vcvtnq_u32_f32(vdivq_f32(scaled, alphas)));
+    }
+
+    inline uint32_t UnpremultiplyRowNEON(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            auto pixels = vld4q_u8(source + (x * 4));
+            auto alphaLow = vmovl_u8(vget_low_u8(pixels.val[3]));
+            auto alphaHigh = vmovl_u8(vget_high_u8(pixels.val[3]));
+            float32x4_t alphas[4] = {
+                vcvtq_f32_u32(vmovl_u16(vget_low_u16(alphaLow))), vcvtq_f32_u32(vmovl_u16(vget_high_u16(alphaLow))),
+                vcvtq_f32_u32(vmovl_u16(vget_low_u16(alphaHigh))), vcvtq_f32_u32(vmovl_u16(vget_high_u16(alphaHigh))) };
+            // A zero alpha divides to infinity or NaN, so those are masked to 0
+            auto visible = vtstq_u8(pixels.val[3], pixels.val[3]);
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                auto low = vmovl_u8(vget_low_u8(pixels.val[c]));
+                auto high = vmovl_u8(vget_high_u8(pixels.val[c]));
+                auto first = vcombine_u16(DivideAlphaNEON(vget_low_u16(low), alphas[0]), DivideAlphaNEON(vget_high_u16(low), alphas[1]));
+                auto second = vcombine_u16(DivideAlphaNEON(vget_low_u16(high), alphas[2]), DivideAlphaNEON(vget_high_u16(high), alphas[3]));
+                pixels.val[c] = vandq_u8(vcombine_u8(vqmovn_u16(first), vqmovn_u16(second)), visible);
+            }
+            vst4q_u8(destination + (x * 4), pixels);
+        }
+        return x;
+    }
+
+    inline uint8x8_t WeightedSumNEON(uint8x8_t b, uint8x8_t g, uint8x8_t r, uint8_t wb, uint8_t wg, uint8_t wr)
+    {
+        auto sum = vmull_u8(b, vdup_n_u8(wb));
+        sum = vmlal_u8(sum, g, vdup_n_u8(wg));
+        sum = vmlal_u8(sum, r, vdup_n_u8(wr));
+        return vrshrn_n_u16(sum, 8);
+    }
+
+    inline uint8x16_t WeightedSumNEON(uint8x16x4_t const& pixels, uint8_t wb, uint8_t wg, uint8_t wr)
+    {
+        return vcombine_u8(
+            WeightedSumNEON(vget_low_u8(pixels.val[0]), vget_low_u8(pixels.val[1]), vget_low_u8(pixels.val[2]), wb, wg, wr),
+            WeightedSumNEON(vget_high_u8(pixels.val[0]), vget_high_u8(pixels.val[1]), vget_high_u8(pixels.val[2]), wb, wg, wr));
+    }
+
+    inline uint32_t GrayRowNEON(uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            vst1q_u8(destination + x, WeightedSumNEON(vld4q_u8(source + (x * 4)), GrayB, GrayG, GrayR));
+        }
+        return x;
+    }
+
+    // The weights all fit in 16 bits, and so do the sums
+    inline uint8x8_t ChromaNEON(int16x8_t b, int16x8_t g, int16x8_t r, int16_t cb, int16_t cg, int16_t cr)
+    {
+        auto sum = vmulq_n_s16(b, cb);
+        sum = vmlaq_n_s16(sum, g, cg);
+        sum = vmlaq_n_s16(sum, r, cr);
+        sum = vshrq_n_s16(vaddq_s16(sum, vdupq_n_s16(128)), 8);
+        return vqmovun_s16(vaddq_s16(sum, vdupq_n_s16(128)));
+    }
+
+    template <bool Interleaved>
+    inline uint32_t RowPairToYuvNEON(uint8_t const* row0, uint8_t const* row1, uint32_t width,
+        uint8_t* yRow0, uint8_t* yRow1, uint8_t* uRow, uint8_t* vRow)
+    {
+        auto lumaOffset = vdupq_n_u8(16);
+        uint32_t x = 0;
+        for (; x + 16 <= width; x += 16)
+        {
+            auto top = vld4q_u8(row0 + (x * 4));
+            auto bottom = vld4q_u8(row1 + (x * 4));
+            vst1q_u8(yRow0 + x, vaddq_u8(WeightedSumNEON(top, LumaB, LumaG, LumaR), lumaOffset));
+            vst1q_u8(yRow1 + x, vaddq_u8(WeightedSumNEON(bottom, LumaB, LumaG, LumaR), lumaOffset));
+
+            int16x8_t channels[3];
+            for (uint32_t c = 0; c < 3; c++)
+            {
+                auto rows = vrhaddq_u8(top.val[c], bottom.val[c]);
+                channels[c] = vreinterpretq_s16_u16(vrshrq_n_u16(vpaddlq_u8(rows), 1));
+            }
+            auto u = ChromaNEON(channels[0], channels[1], channels[2], ChromaUB, ChromaUG, ChromaUR);
+            auto v = ChromaNEON(channels[0], channels[1], channels[2], ChromaVB, ChromaVG, ChromaVR);
+            if (Interleaved)
+            {
+                vst2_u8(uRow + x, uint8x8x2_t{ { u, v } });
+            }
+            else
+            {
+                vst1_u8(uRow + (x / 2), u);
+                vst1_u8(vRow + (x / 2), v);
+            }
+        }
+        return x;
+    }
+#endif
+
+    // The row dispatchers, for callers that convert a row at a time (e.g. the
+    // PNG encoder). level has to have been through ResolveSimdLevel.
+    inline void SwapRedBlueRow(SimdLevel level, uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        uint32_t done = 0;
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+            done = SwapRedBlueRowAVX2(source, destination, width);
+            break;
+        case SimdLevel::SSE2:
+            done = SwapRedBlueRowSSE2(source, destination, width);
+            break;
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            done = SwapRedBlueRowNEON(source, destination, width);
+            break;
+#endif
+        default:
+            break;
+        }
+        SwapRedBlueRowScalar(source, destination, done, width);
+    }
+
+    inline void PremultiplyRow(SimdLevel level, uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        uint32_t done = 0;
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+            done = PremultiplyRowAVX2(source, destination, width);
+            break;
+        case SimdLevel::SSE2:
+            done = PremultiplyRowSSE2(source, destination, width);
+            break;
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            done = PremultiplyRowNEON(source, destination, width);
+            break;
+#endif
+        default:
+            break;
+        }
+        PremultiplyRowScalar(source, destination, done, width);
+    }
+
+    inline void UnpremultiplyRow(SimdLevel level, uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        uint32_t done = 0;
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+            done = UnpremultiplyRowAVX2(source, destination, width);
+            break;
+        case SimdLevel::SSE2:
+            done = UnpremultiplyRowSSE2(source, destination, width);
+            break;
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            done = UnpremultiplyRowNEON(source, destination, width);
+            break;
+#endif
+        default:
+            break;
+        }
+        UnpremultiplyRowScalar(source, destination, done, width);
+    }
+
+    inline void GrayRow(SimdLevel level, uint8_t const* source, uint8_t* destination, uint32_t width)
+    {
+        uint32_t done = 0;
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+            done = GrayRowAVX2(source, destination, width);
+            break;
+        case SimdLevel::SSE2:
+            done = GrayRowSSE2(source, destination, width);
+            break;
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            done = GrayRowNEON(source, destination, width);
+            break;
+#endif
+        default:
+            break;
+        }
+        GrayRowScalar(source, destination, done, width);
+    }
+
+    template <bool Interleaved>
+    inline void RowPairToYuv(SimdLevel level, uint8_t const* row0, uint8_t const* row1, uint32_t width,
+        uint8_t* yRow0, uint8_t* yRow1, uint8_t* uRow, uint8_t* vRow)
+    {
+        uint32_t done = 0;
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+            done = RowPairToYuvAVX2<Interleaved>(row0, row1, width, yRow0, yRow1, uRow, vRow);
+            break;
+        case SimdLevel::SSE2:
+            done = RowPairToYuvSSE2<Interleaved>(row0, row1, width, yRow0, yRow1, uRow, vRow);
+            break;
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            done = RowPairToYuvNEON<Interleaved>(row0, row1, width, yRow0, yRow1, uRow, vRow);
+            break;
+#endif
+        default:
+            break;
+        }
+        RowPairToYuvScalar<Interleaved>(row0, row1, done, width, yRow0, yRow1, uRow, vRow);
+    }
+
+    inline void ConvertRows(void (*convertRow)(SimdLevel, uint8_t const*, uint8_t*, uint32_t),
+        BgraImageView const& source, uint8_t* destination, uint32_t destinationPitch, SimdLevel level)
+    {
+        level = ResolveSimdLevel(level);
+        for (uint32_t y = 0; y < source.Height; y++)
+        {
+            convertRow(level, source.Row(y), destination + (static_cast<size_t>(destinationPitch) * y), source.Width);
+        }
+    }
+
+    // For NV12, u is the UV plane and v isn't used
+    template <bool Interleaved>
+    inline void ConvertChromaRows(BgraImageView const& image, uint8_t* y, uint32_t yPitch, uint8_t* u, uint8_t* v, uint32_t chromaPitch,
+        uint32_t firstChromaRow, uint32_t chromaRows, SimdLevel level)
+    {
+        for (auto chromaY = firstChromaRow; chromaY < firstChromaRow + chromaRows; chromaY++)
+        {
+            auto y0 = chromaY * 2;
+            auto y1 = std::min(y0 + 1, image.Height - 1);
+            auto chromaOffset = static_cast<size_t>(chromaPitch) * chromaY;
+            RowPairToYuv<Interleaved>(level, image.Row(y0), image.Row(y1), image.Width,
+                y + (static_cast<size_t>(yPitch) * y0), y + (static_cast<size_t>(yPitch) * y1),
+                u + chromaOffset, Interleaved ? nullptr : v + chromaOffset);
+        }
+    }
+
+    constexpr uint32_t MinChromaRowsPerBand = 32;
+}
+
+// BGRA to RGBA, or back
+inline void SwapRedBlue(BgraImageView const& source, uint8_t* destination, uint32_t destinationPitch, SimdLevel level = DetectSimdLevel())
+{
+    pixelkernels::ConvertRows(pixelkernels::SwapRedBlueRow, source, destination, destinationPitch, level);
+}
+
+// Straight to premultiplied alpha
+inline void PremultiplyAlpha(BgraImageView const& source, uint8_t* destination, uint32_t destinationPitch, SimdLevel level = DetectSimdLevel())
+{
+    pixelkernels::ConvertRows(pixelkernels::PremultiplyRow, source, destination, destinationPitch, level);
+}
+
+// Premultiplied to straight alpha
+inline void UnpremultiplyAlpha(BgraImageView const& source, uint8_t* destination, uint32_t destinationPitch, SimdLevel level = DetectSimdLevel())
+{
+    pixelkernels::ConvertRows(pixelkernels::UnpremultiplyRow, source, destination, destinationPitch, level);
+}
+
+// One byte of full range BT.709 luma per pixel
+inline void ConvertBgraToGray(BgraImageView const& source, uint8_t* destination, uint32_t destinationPitch, SimdLevel level = DetectSimdLevel())
+{
+    pixelkernels::ConvertRows(pixelkernels::GrayRow, source, destination, destinationPitch, level);
+}
+
+inline void ConvertBgraToI420(BgraImageView const& image, I420Planes const& planes, SimdLevel level = DetectSimdLevel())
+{
+    pixelkernels::ConvertChromaRows<false>(image, planes.Y, planes.YPitch, planes.U, planes.V, planes.ChromaPitch, 0, ChromaSize(image.Height), ResolveSimdLevel(level));
+}
+
+// Same output as ConvertBgraToI420, in bands of row pairs on the shared BandPool
+inline void ConvertBgraToI420Parallel(BgraImageView const& image, I420Planes const& planes, SimdLevel level = DetectSimdLevel())
+{
+    level = ResolveSimdLevel(level);
+    ParallelForRowBands(ChromaSize(image.Height), pixelkernels::MinChromaRowsPerBand, [&](uint32_t first, uint32_t count)
+    {
+        pixelkernels::ConvertChromaRows<false>(image, planes.Y, planes.YPitch, planes.U, planes.V, planes.ChromaPitch, first, count, level);
+    });
+}
+
+inline void ConvertBgraToNV12(BgraImageView const& image, NV12Planes const& planes, SimdLevel level = DetectSimdLevel())
+{
+    pixelkernels::ConvertChromaRows<true>(image, planes.Y, planes.YPitch, planes.UV, nullptr, planes.UVPitch, 0, ChromaSize(image.Height), ResolveSimdLevel(level));
+}
+
+inline void ConvertBgraToNV12Parallel(BgraImageView const& image, NV12Planes const& planes, SimdLevel level = DetectSimdLevel())
+{
+    level = ResolveSimdLevel(level);
+    ParallelForRowBands(ChromaSize(image.Height), pixelkernels::MinChromaRowsPerBand, [&](uint32_t first, uint32_t count)
+    {
+        pixelkernels::ConvertChromaRows<true>(image, planes.Y, planes.YPitch, planes.UV, nullptr, planes.UVPitch, first, count, level);
+    });
+}
@@ -0,0 +1,988 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+#include "ImageView.h"
+#include "ParallelFor.h"
+#include "PixelKernels.h"
+#include "SimdSupport.h"
+
+// A self-contained PNG encoder for mapped frames. The image is split into
+// chunks of rows that are filtered and deflated independently on the band
+// pool. Each chunk ends with a sync flush (an empty stored block) so the
+// compressed pieces can simply be concatenated, and each piece is written as
+// its own IDAT chunk so its CRC can be computed by the thread that made it.
+// The only cost is that matches can't reach back across chunk boundaries.
+struct PngOptions
+{
+    // 0 picks a size of roughly 1MB of pixels per chunk
+    uint32_t RowsPerChunk = 0;
+    // How many earlier positions are tried when looking for a match
+    uint32_t MaxChainLength = 8;
+    // Run the chunks on the band pool rather than the calling thread
+    bool Parallel = true;
+    // The pixels have premultiplied alpha, which PNG doesn't, so they're
+    // unpremultiplied as they're encoded
+    bool Premultiplied = false;
+    // Every row uses the Up filter and the only matches are runs of the same
+    // byte, like zlib's Z_RLE strategy. Several times faster and a little
+    // larger, for files like previews where the time matters more.
+    bool Fast = false;
+};
+
+namespace png
+{
+    inline std::array<uint32_t, 256> const& CrcTable()
+    {
+        static std::array<uint32_t, 256> const table = []()
+        {
+            std::array<uint32_t, 256> result = {};
+            for (uint32_t i = 0; i < 256; i++)
+            {
+                auto value = i;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+                }
+                result[i] = value;
+            }
+            return result;
+        }();
+        return table;
+    }
+
+    inline uint32_t Crc32(uint8_t const* data, size_t size, uint32_t crc = 0)
+    {
+        auto const& table = CrcTable();
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++)
+        {
+            crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    static constexpr uint32_t AdlerBase = 65521;
+
+    inline uint32_t Adler32(uint8_t const* data, size_t size, uint32_t adler = 1)
+    {
+        uint32_t a = adler & 0xFFFF;
+        uint32_t b = adler >> 16;
+        while (size > 0)
+        {
+            // The largest run that can't overflow b
+            auto count = std::min<size_t>(size, 5552);
+            size -= count;
+            for (size_t i = 0; i < count; i++)
+            {
+                a += data[i];
+                b += a;
+            }
+            data += count;
+            a %= AdlerBase;
+            b %= AdlerBase;
+        }
+        return a | (b << 16);
+    }
+
+    // The Adler-32 of two concatenated buffers, given the checksum of each
+    // and the length of the second.
+    inline uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, size_t length2)
+    {
+        auto remainder = static_cast<uint32_t>(length2 % AdlerBase);
+        uint32_t sum1 = adler1 & 0xFFFF;
+        uint32_t sum2 = static_cast<uint32_t>((static_cast<uint64_t>(remainder) * sum1) % AdlerBase);
+        sum1 += (adler2 & 0xFFFF) + AdlerBase - 1;
+        sum2 += (adler1 >> 16) + (adler2 >> 16) + AdlerBase - remainder;
+        if (sum1 >= AdlerBase) sum1 -= AdlerBase;
+        if (sum1 >= AdlerBase) sum1 -= AdlerBase;
+        if (sum2 >= (AdlerBase << 1)) sum2 -= (AdlerBase << 1);
+        if (sum2 >= AdlerBase) sum2 -= AdlerBase;
+        return sum1 | (sum2 << 16);
+    }
+
+    inline void AppendBigEndian(std::vector<uint8_t>& out, uint32_t value)
+    {
+        out.push_back(static_cast<uint8_t>(value >> 24));
+        out.push_back(static_cast<uint8_t>(value >> 16));
+        out.push_back(static_cast<uint8_t>(value >> 8));
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    inline void AppendChunk(std::vector<uint8_t>& out, char const (&type)[5], uint8_t const* data, size_t size)
+    {
+        AppendBigEndian(out, static_cast<uint32_t>(size));
+        auto typeStart = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        AppendBigEndian(out, Crc32(out.data() + typeStart, size + 4));
+    }
+
+    // Deflate writes bits starting from the least significant bit of each byte
+    class BitWriter
+    {
+    public:
+        BitWriter(std::vector<uint8_t>& out) : m_out(out) {}
+
+        void Write(uint32_t value, uint32_t count)
+        {
+            m_bits |= static_cast<uint64_t>(value) << m_count;
+            m_count += count;
+            if (m_count >= 32)
+            {
+                uint8_t bytes[4] = { static_cast<uint8_t>(m_bits), static_cast<uint8_t>(m_bits >> 8), static_cast<uint8_t>(m_bits >> 16), static_cast<uint8_t>(m_bits >> 24) };
+                m_out.insert(m_out.end(), bytes, bytes + 4);
+                m_bits >>= 32;
+                m_count -= 32;
+            }
+        }
+
+        void AlignToByte()
+        {
+            while (m_count > 0)
+            {
+                m_out.push_back(static_cast<uint8_t>(m_bits));
+                m_bits >>= 8;
+                m_count = m_count > 8 ? m_count - 8 : 0;
+            }
+            m_bits = 0;
+        }
+
+        std::vector<uint8_t>& Output() { return m_out; }
+
+    private:
+        std::vector<uint8_t>& m_out;
+        uint64_t m_bits = 0;
+        uint32_t m_count = 0;
+    };
+
+    static constexpr uint32_t LiteralCount = 286;
+    static constexpr uint32_t DistanceCount = 30;
+    static constexpr uint32_t EndOfBlock = 256;
+    static constexpr uint32_t MinMatch = 4;
+    static constexpr uint32_t MaxMatch = 258;
+    static constexpr uint32_t WindowSize = 32768;
+
+    static constexpr uint16_t LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static constexpr uint8_t LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static constexpr uint16_t DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static constexpr uint8_t DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    static constexpr uint8_t CodeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    // Index into LengthBase for every match length
+    inline uint8_t LengthCode(uint32_t length)
+    {
+        static std::array<uint8_t, MaxMatch + 1> const table = []()
+        {
+            std::array<uint8_t, MaxMatch + 1> result = {};
+            for (uint8_t code = 0; code < 29; code++)
+            {
+                auto end = code == 28 ? MaxMatch + 1 : LengthBase[code + 1];
+                for (uint32_t length = LengthBase[code]; length < end && length <= MaxMatch; length++)
+                {
+                    result[length] = code;
+                }
+            }
+            result[MaxMatch] = 28;
+            return result;
+        }();
+        return table[length];
+    }
+
+    // Distances up to 256 are looked up directly, larger ones by distance / 128
+    inline uint8_t DistanceCode(uint32_t distance)
+    {
+        static std::array<uint8_t, 512> const table = []()
+        {
+            std::array<uint8_t, 512> result = {};
+            for (uint8_t code = 0; code < 30; code++)
+            {
+                uint32_t end = code == 29 ? WindowSize + 1 : DistanceBase[code + 1];
+                for (uint32_t distance = DistanceBase[code]; distance < end; distance++)
+                {
+                    auto index = distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7);
+                    result[index] = code;
+                }
+            }
+            return result;
+        }();
+        return distance <= 256 ? table[distance - 1] : table[256 + ((distance - 1) >> 7)];
+    }
+
+    // Code lengths for the given symbol frequencies, no longer than maxBits
+    inline std::vector<uint8_t> BuildLengths(std::vector<uint32_t> frequencies, uint32_t maxBits)
+    {
+        std::vector<uint8_t> lengths(frequencies.size(), 0);
+        std::vector<uint32_t> used;
+        for (uint32_t i = 0; i < frequencies.size(); i++)
+        {
+            if (frequencies[i] > 0)
+            {
+                used.push_back(i);
+            }
+        }
+        if (used.empty())
+        {
+            return lengths;
+        }
+        if (used.size() == 1)
+        {
+            // A complete code needs two symbols
+            lengths[used[0]] = 1;
+            lengths[used[0] == 0 ? 1 : 0] = 1;
+            return lengths;
+        }
+
+        while (true)
+        {
+            // Leaves are [0, used.size()), internal nodes come after
+            std::vector<uint32_t> parents(used.size() * 2, 0);
+            using Node = std::pair<uint64_t, uint32_t>;
+            std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+            for (uint32_t i = 0; i < used.size(); i++)
+            {
+                queue.push({ frequencies[used[i]], i });
+            }
+            auto next = static_cast<uint32_t>(used.size());
+            while (queue.size() > 1)
+            {
+                auto a = queue.top();
+                queue.pop();
+                auto b = queue.top();
+                queue.pop();
+                parents[a.second] = next;
+                parents[b.second] = next;
+                queue.push({ a.first + b.first, next });
+                next++;
+            }
+            auto root = next - 1;
+
+            std::vector<uint32_t> depths(next, 0);
+            uint32_t longest = 0;
+            for (auto node = root; node-- > 0;)
+            {
+                depths[node] = depths[parents[node]] + 1;
+            }
+            for (uint32_t i = 0; i < used.size(); i++)
+            {
+                longest = std::max(longest, depths[i]);
+            }
+            if (longest <= maxBits)
+            {
+                for (uint32_t i = 0; i < used.size(); i++)
+                {
+                    lengths[used[i]] = static_cast<uint8_t>(depths[i]);
+                }
+                return lengths;
+            }
+
+            // Flatten the distribution and try again
+            for (auto symbol : used)
+            {
+                frequencies[symbol] = (frequencies[symbol] >> 1) | 1;
+            }
+        }
+    }
+
+    // Canonical codes, bit reversed so they can go straight to the BitWriter
+    inline std::vector<uint16_t> BuildCodes(std::vector<uint8_t> const& lengths)
+    {
+        uint32_t counts[16] = {};
+        for (auto length : lengths)
+        {
+            counts[length]++;
+        }
+        counts[0] = 0;
+        uint32_t nextCode[16] = {};
+        uint32_t code = 0;
+        for (uint32_t bits = 1; bits < 16; bits++)
+        {
+            code = (code + counts[bits - 1]) << 1;
+            nextCode[bits] = code;
+        }
+
+        std::vector<uint16_t> codes(lengths.size(), 0);
+        for (size_t symbol = 0; symbol < lengths.size(); symbol++)
+        {
+            auto length = lengths[symbol];
+            if (length == 0)
+            {
+                continue;
+            }
+            auto value = nextCode[length]++;
+            uint32_t reversed = 0;
+            for (uint32_t bit = 0; bit < length; bit++)
+            {
+                reversed |= ((value >> bit) & 1) << (length - 1 - bit);
+            }
+            codes[symbol] = static_cast<uint16_t>(reversed);
+        }
+        return codes;
+    }
+
+    // A literal, or a match when the high bit is set
+    struct Token
+    {
+        uint32_t Value;
+
+        static Token Literal(uint8_t value) { return Token{ value }; }
+        static Token Match(uint32_t length, uint32_t distance) { return Token{ 0x80000000u | (length << 16) | (distance - 1) }; }
+
+        bool IsMatch() const { return (Value & 0x80000000u) != 0; }
+        uint32_t Length() const { return (Value >> 16) & 0x1FF; }
+        uint32_t Distance() const { return (Value & 0xFFFF) + 1; }
+    };
+
+    class Deflater
+    {
+    public:
+        // With runsOnly the only matches are runs of the previous byte, so
+        // there are no hash chains to keep
+        Deflater(uint32_t maxChainLength, bool runsOnly = false) : m_maxChainLength(std::max(1u, maxChainLength)), m_runsOnly(runsOnly)
+        {
+            if (!m_runsOnly)
+            {
+                m_head.assign(HashSize, -1);
+                m_previous.assign(WindowSize, -1);
+            }
+        }
+
+        // Compresses data as a series of non-final blocks followed by a sync
+        // flush, so the output ends on a byte boundary.
+        void Compress(uint8_t const* data, size_t size, std::vector<uint8_t>& out)
+        {
+            BitWriter writer(out);
+            std::vector<Token> tokens;
+            tokens.reserve(BlockTokens + MaxMatch);
+            size_t blockStart = 0;
+            size_t position = 0;
+            while (position < size)
+            {
+                auto match = m_runsOnly ? FindRun(data, size, position) : FindMatch(data, size, position);
+                if (match.first >= MinMatch)
+                {
+                    tokens.push_back(Token::Match(match.first, match.second));
+                    // Long matches are usually runs, skip indexing them
+                    auto end = position + match.first;
+                    if (match.first <= 32 && !m_runsOnly)
+                    {
+                        for (auto i = position + 1; i < end && i + MinMatch <= size; i++)
+                        {
+                            Insert(data, i);
+                        }
+                    }
+                    position = end;
+                }
+                else
+                {
+                    tokens.push_back(Token::Literal(data[position]));
+                    position++;
+                }
+
+                if (tokens.size() >= BlockTokens)
+                {
+                    WriteBlock(writer, tokens, data + blockStart, position - blockStart);
+                    tokens.clear();
+                    blockStart = position;
+                }
+            }
+            if (!tokens.empty())
+            {
+                WriteBlock(writer, tokens, data + blockStart, position - blockStart);
+            }
+
+            // Sync flush
+            writer.Write(0, 3);
+            writer.AlignToByte();
+            out.insert(out.end(), { 0x00, 0x00, 0xFF, 0xFF });
+        }
+
+    private:
+        static constexpr uint32_t HashBits = 15;
+        static constexpr uint32_t HashSize = 1u << HashBits;
+        static constexpr size_t BlockTokens = 1 << 16;
+
+        static uint32_t Load32(uint8_t const* data)
+        {
+            uint32_t value;
+            std::memcpy(&value, data, sizeof(value));
+            return value;
+        }
+
+        static uint32_t Hash(uint8_t const* data)
+        {
+            return (Load32(data) * 2654435761u) >> (32 - HashBits);
+        }
+
+        static uint32_t MatchLength(uint8_t const* a, uint8_t const* b, uint32_t limit)
+        {
+            uint32_t length = 0;
+            while (length + 8 <= limit)
+            {
+                uint64_t x, y;
+                std::memcpy(&x, a + length, 8);
+                std::memcpy(&y, b + length, 8);
+                auto difference = x ^ y;
+                if (difference != 0)
+                {
+                    while ((difference & 0xFF) == 0)
+                    {
+                        difference >>= 8;
+                        length++;
+                    }
+                    return length;
+                }
+                length += 8;
+            }
+            while (length < limit && a[length] == b[length])
+            {
+                length++;
+            }
+            return length;
+        }
+
+        int32_t Insert(uint8_t const* data, size_t position)
+        {
+            auto hash = Hash(data + position);
+            auto candidate = m_head[hash];
+            m_head[hash] = static_cast<int32_t>(position);
+            m_previous[position & (WindowSize - 1)] = candidate;
+            return candidate;
+        }
+
+        // A match against the byte before position, if it repeats
+        static std::pair<uint32_t, uint32_t> FindRun(uint8_t const* data, size_t size, size_t position)
+        {
+            if (position == 0 || position + MinMatch > size)
+            {
+                return { 0, 0 };
+            }
+            auto limit = static_cast<uint32_t>(std::min<size_t>(MaxMatch, size - position));
+            return { MatchLength(data + position - 1, data + position, limit), 1 };
+        }
+
+        // Returns the length and distance of the best match at position
+        std::pair<uint32_t, uint32_t> FindMatch(uint8_t const* data, size_t size, size_t position)
+        {
+            if (position + MinMatch > size)
+            {
+                return { 0, 0 };
+            }
+            auto candidate = Insert(data, position);
+            auto limit = static_cast<uint32_t>(std::min<size_t>(MaxMatch, size - position));
+            uint32_t bestLength = 0;
+            uint32_t bestDistance = 0;
+            auto chain = m_maxChainLength;
+            while (candidate >= 0 && position - candidate <= WindowSize && chain-- > 0)
+            {
+                auto length = MatchLength(data + candidate, data + position, limit);
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    bestDistance = static_cast<uint32_t>(position - candidate);
+                    if (length == limit)
+                    {
+                        break;
+                    }
+                }
+                auto next = m_previous[candidate & (WindowSize - 1)];
+                if (next >= candidate)
+                {
+                    break;
+                }
+                candidate = next;
+            }
+            return { bestLength, bestDistance };
+        }
+
+        static void WriteStored(BitWriter& writer, uint8_t const* data, size_t size)
+        {
+            do
+            {
+                auto count = static_cast<uint32_t>(std::min<size_t>(size, 65535));
+                writer.Write(0, 3);
+                writer.AlignToByte();
+                auto& out = writer.Output();
+                out.push_back(static_cast<uint8_t>(count));
+                out.push_back(static_cast<uint8_t>(count >> 8));
+                out.push_back(static_cast<uint8_t>(~count));
+                out.push_back(static_cast<uint8_t>(~count >> 8));
+                out.insert(out.end(), data, data + count);
+                data += count;
+                size -= count;
+            } while (size > 0);
+        }
+
+        // Run length encodes the code lengths of both trees. Each entry is
+        // the symbol in the low byte and its extra bits above that.
+        static std::vector<uint32_t> EncodeCodeLengths(std::vector<uint8_t> const& lengths)
+        {
+            std::vector<uint32_t> symbols;
+            size_t i = 0;
+            while (i < lengths.size())
+            {
+                auto length = lengths[i];
+                size_t run = 1;
+                while (i + run < lengths.size() && lengths[i + run] == length)
+                {
+                    run++;
+                }
+                i += run;
+                if (length == 0)
+                {
+                    while (run >= 11)
+                    {
+                        auto count = std::min<size_t>(run, 138);
+                        symbols.push_back(18 | static_cast<uint32_t>((count - 11) << 8));
+                        run -= count;
+                    }
+                    if (run >= 3)
+                    {
+                        symbols.push_back(17 | static_cast<uint32_t>((run - 3) << 8));
+                        run = 0;
+                    }
+                }
+                else
+                {
+                    symbols.push_back(length);
+                    run--;
+                    while (run >= 3)
+                    {
+                        auto count = std::min<size_t>(run, 6);
+                        symbols.push_back(16 | static_cast<uint32_t>((count - 3) << 8));
+                        run -= count;
+                    }
+                }
+                while (run-- > 0)
+                {
+                    symbols.push_back(length);
+                }
+            }
+            return symbols;
+        }
+
+        static uint32_t CodeLengthExtraBits(uint32_t symbol)
+        {
+            return symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0;
+        }
+
+        // Writes a dynamic Huffman block, or stored blocks if those are smaller
+        static void WriteBlock(BitWriter& writer, std::vector<Token> const& tokens, uint8_t const* raw, size_t rawSize)
+        {
+            std::vector<uint32_t> literalFrequencies(LiteralCount, 0);
+            std::vector<uint32_t> distanceFrequencies(DistanceCount, 0);
+            for (auto token : tokens)
+            {
+                if (token.IsMatch())
+                {
+                    literalFrequencies[257 + LengthCode(token.Length())]++;
+                    distanceFrequencies[DistanceCode(token.Distance())]++;
+                }
+                else
+                {
+                    literalFrequencies[token.Value]++;
+                }
+            }
+            literalFrequencies[EndOfBlock]++;
+
+            auto literalLengths = BuildLengths(literalFrequencies, 15);
+            auto distanceLengths = BuildLengths(distanceFrequencies, 15);
+            uint32_t literalCount = LiteralCount;
+            while (literalCount > 257 && literalLengths[literalCount - 1] == 0)
+            {
+                literalCount--;
+            }
+            uint32_t distanceCount = DistanceCount;
+            while (distanceCount > 1 && distanceLengths[distanceCount - 1] == 0)
+            {
+                distanceCount--;
+            }
+
+            std::vector<uint8_t> allLengths(literalLengths.begin(), literalLengths.begin() + literalCount);
+            allLengths.insert(allLengths.end(), distanceLengths.begin(), distanceLengths.begin() + distanceCount);
+            auto lengthSymbols = EncodeCodeLengths(allLengths);
+            std::vector<uint32_t> codeLengthFrequencies(19, 0);
+            for (auto symbol : lengthSymbols)
+            {
+                codeLengthFrequencies[symbol & 0xFF]++;
+            }
+            auto codeLengthLengths = BuildLengths(codeLengthFrequencies, 7);
+            uint32_t codeLengthCount = 19;
+            while (codeLengthCount > 4 && codeLengthLengths[CodeLengthOrder[codeLengthCount - 1]] == 0)
+            {
+                codeLengthCount--;
+            }
+
+            uint64_t dynamicBits = 3 + 5 + 5 + 4 + (codeLengthCount * 3);
+            for (auto symbol : lengthSymbols)
+            {
+                dynamicBits += codeLengthLengths[symbol & 0xFF] + CodeLengthExtraBits(symbol & 0xFF);
+            }
+            for (uint32_t i = 0; i < LiteralCount; i++)
+            {
+                auto extra = i > 256 ? LengthExtra[i - 257] : 0;
+                dynamicBits += static_cast<uint64_t>(literalFrequencies[i]) * (literalLengths[i] + extra);
+            }
+            for (uint32_t i = 0; i < DistanceCount; i++)
+            {
+                dynamicBits += static_cast<uint64_t>(distanceFrequencies[i]) * (distanceLengths[i] + DistanceExtra[i]);
+            }
+            auto storedBits = (static_cast<uint64_t>(rawSize) + (5 * ((rawSize / 65535) + 1))) * 8;
+            if (storedBits < dynamicBits)
+            {
+                WriteStored(writer, raw, rawSize);
+                return;
+            }
+
+            auto literalCodes = BuildCodes(literalLengths);
+            auto distanceCodes = BuildCodes(distanceLengths);
+            auto codeLengthCodes = BuildCodes(codeLengthLengths);
+
+            writer.Write(2 << 1, 3);
+            writer.Write(literalCount - 257, 5);
+            writer.Write(distanceCount - 1, 5);
+            writer.Write(codeLengthCount - 4, 4);
+            for (uint32_t i = 0; i < codeLengthCount; i++)
+            {
+                writer.Write(codeLengthLengths[CodeLengthOrder[i]], 3);
+            }
+            for (auto symbol : lengthSymbols)
+            {
+                auto code = symbol & 0xFF;
+                writer.Write(codeLengthCodes[code], codeLengthLengths[code]);
+                if (auto extraBits = CodeLengthExtraBits(code))
+                {
+                    writer.Write(symbol >> 8, extraBits);
+                }
+            }
+
+            for (auto token : tokens)
+            {
+                if (token.IsMatch())
+                {
+                    auto length = token.Length();
+                    auto lengthCode = LengthCode(length);
+                    writer.Write(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+                    writer.Write(length - LengthBase[lengthCode], LengthExtra[lengthCode]);
+                    auto distance = token.Distance();
+                    auto distanceCode = DistanceCode(distance);
+                    writer.Write(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+                    writer.Write(distance - DistanceBase[distanceCode], DistanceExtra[distanceCode]);
+                }
+                else
+                {
+                    writer.Write(literalCodes[token.Value], literalLengths[token.Value]);
+                }
+            }
+            writer.Write(literalCodes[EndOfBlock], literalLengths[EndOfBlock]);
+        }
+
+    private:
+        uint32_t m_maxChainLength;
+        bool m_runsOnly = false;
+        std::vector<int32_t> m_head;
+        std::vector<int32_t> m_previous;
+    };
+
+    inline uint8_t Paeth(uint8_t a, uint8_t b, uint8_t c)
+    {
+        int p = a + b - c;
+        int pa = std::abs(p - a);
+        int pb = std::abs(p - b);
+        int pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc)
+        {
+            return a;
+        }
+        return pb <= pc ? b : c;
+    }
+
+    // Computes the Sub, Up, Average and Paeth candidates for bytes [begin, end)
+    // and adds up the absolute value of each (None included) into sums.
+    inline void FilterCandidatesScalar(uint8_t const* row, uint8_t const* prior, size_t begin, size_t end, uint32_t bytesPerPixel, uint8_t* const* candidates, uint64_t* sums)
+    {
+        for (auto i = begin; i < end; i++)
+        {
+            uint8_t left = i >= bytesPerPixel ? row[i - bytesPerPixel] : 0;
+            uint8_t up = prior[i];
+            uint8_t upLeft = i >= bytesPerPixel ? prior[i - bytesPerPixel] : 0;
+            uint8_t values[5] =
+            {
+                row[i],
+                static_cast<uint8_t>(row[i] - left),
+                static_cast<uint8_t>(row[i] - up),
+                static_cast<uint8_t>(row[i] - ((left + up) >> 1)),
+                static_cast<uint8_t>(row[i] - Paeth(left, up, upLeft)),
+            };
+            for (int filter = 0; filter < 5; filter++)
+            {
+                sums[filter] += std::abs(static_cast<int8_t>(values[filter]));
+            }
+            for (int filter = 1; filter < 5; filter++)
+            {
+                candidates[filter - 1][i] = values[filter];
+            }
+        }
+    }
+
+#if defined(CAPTURE_SIMD_X86)
+    // The filters only read unfiltered bytes, so every lane is independent.
+    // begin must be at least 4 (one BGRA pixel). Returns where it stopped.
+    inline size_t FilterCandidatesSSE2(uint8_t const* row, uint8_t const* prior, size_t begin, size_t end, uint8_t* const* candidates, uint64_t* sums)
+    {
+        auto zero = _mm_setzero_si128();
+        auto one = _mm_set1_epi8(1);
+        __m128i totals[5] = { zero, zero, zero, zero, zero };
+        auto absoluteSum = [&](__m128i value)
+        {
+            return _mm_sad_epu8(_mm_min_epu8(value, _mm_sub_epi8(zero, value)), zero);
+        };
+        // Paeth on 8 pixels' worth of 16-bit lanes
+        auto paeth = [&](__m128i a, __m128i b, __m128i c)
+        {
+            auto pa = _mm_sub_epi16(b, c);
+            auto pb = _mm_sub_epi16(a, c);
+            auto pc = _mm_add_epi16(pa, pb);
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(_mm_setzero_si128(), pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(_mm_setzero_si128(), pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(_mm_setzero_si128(), pc));
+            auto useA = _mm_andnot_si128(_mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc)), _mm_set1_epi16(-1));
+            auto useB = _mm_andnot_si128(_mm_or_si128(useA, _mm_cmpgt_epi16(pb, pc)), _mm_set1_epi16(-1));
+            auto result = _mm_or_si128(_mm_and_si128(useA, a), _mm_and_si128(useB, b));
+            return _mm_or_si128(result, _mm_andnot_si128(_mm_or_si128(useA, useB), c));
+        };
+
+        auto i = begin;
+        for (; i + 16 <= end; i += 16)
+        {
+            auto x = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + i));
+            auto a = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + i - 4));
+            auto b = _mm_loadu_si128(reinterpret_cast<__m128i const*>(prior + i));
+            auto c = _mm_loadu_si128(reinterpret_cast<__m128i const*>(prior + i - 4));
+
+            auto sub = _mm_sub_epi8(x, a);
+            auto up = _mm_sub_epi8(x, b);
+            auto average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            average = _mm_sub_epi8(x, average);
+            auto predictorLow = paeth(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(c, zero));
+            auto predictorHigh = paeth(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(c, zero));
+            auto paethResult = _mm_sub_epi8(x, _mm_packus_epi16(predictorLow, predictorHigh));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(candidates[0] + i), sub);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(candidates[1] + i), up);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(candidates[2] + i), average);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(candidates[3] + i), paethResult);
+            totals[0] = _mm_add_epi64(totals[0], absoluteSum(x));
+            totals[1] = _mm_add_epi64(totals[1], absoluteSum(sub));
+            totals[2] = _mm_add_epi64(totals[2], absoluteSum(up));
+            totals[3] = _mm_add_epi64(totals[3], absoluteSum(average));
+            totals[4] = _mm_add_epi64(totals[4], absoluteSum(paethResult));
+        }
+
+        for (int filter = 0; filter < 5; filter++)
+        {
+            alignas(16) uint64_t lanes[2];
+            _mm_store_si128(reinterpret_cast<__m128i*>(lanes), totals[filter]);
+            sums[filter] += lanes[0] + lanes[1];
+        }
+        return i;
+    }
+#endif
+
+    // Writes the filter type byte and the filtered row to out, picking the
+    // filter with the smallest sum of absolute values like libpng does. A
+    // null prior means this is the first row.
+    inline void FilterRow(uint8_t const* row, uint8_t const* prior, size_t size, uint32_t bytesPerPixel, uint8_t* out, std::vector<uint8_t>& scratch)
+    {
+        scratch.assign(size * 5, 0);
+        uint8_t* candidates[4] = { scratch.data(), scratch.data() + size, scratch.data() + (size * 2), scratch.data() + (size * 3) };
+        if (prior == nullptr)
+        {
+            prior = scratch.data() + (size * 4);
+        }
+
+        uint64_t sums[5] = {};
+        size_t i = std::min<size_t>(bytesPerPixel, size);
+        FilterCandidatesScalar(row, prior, 0, i, bytesPerPixel, candidates, sums);
+#if defined(CAPTURE_SIMD_X86)
+        if (bytesPerPixel == 4)
+        {
+            i = FilterCandidatesSSE2(row, prior, i, size, candidates, sums);
+        }
+#endif
+        FilterCandidatesScalar(row, prior, i, size, bytesPerPixel, candidates, sums);
+
+        auto best = static_cast<int>(std::min_element(sums, sums + 5) - sums);
+        out[0] = static_cast<uint8_t>(best);
+        std::memcpy(out + 1, best == 0 ? row : candidates[best - 1], size);
+    }
+
+    // Writes the Up filter type byte and the row minus the one above it. A
+    // null prior means this is the first row, which Up leaves as it is.
+    inline void FilterRowUp(uint8_t const* row, uint8_t const* prior, size_t size, uint8_t* out)
+    {
+        out[0] = 2;
+        if (prior == nullptr)
+        {
+            std::memcpy(out + 1, row, size);
+            return;
+        }
+        for (size_t i = 0; i < size; i++)
+        {
+            out[i + 1] = static_cast<uint8_t>(row[i] - prior[i]);
+        }
+    }
+
+    // getRow(y, out) writes row y as PNG samples (RGBA or gray) into out
+    template <typename GetRow>
+    std::vector<uint8_t> Encode(uint32_t width, uint32_t height, uint32_t bytesPerPixel, uint8_t colorType, PngOptions const& options, GetRow const& getRow)
+    {
+        if (width == 0 || height == 0)
+        {
+            throw std::invalid_argument("Image must not be empty");
+        }
+        auto rowSize = static_cast<size_t>(width) * bytesPerPixel;
+        auto rowsPerChunk = options.RowsPerChunk;
+        if (rowsPerChunk == 0)
+        {
+            rowsPerChunk = static_cast<uint32_t>(std::max<size_t>(16, (1 << 20) / (rowSize + 1)));
+        }
+        auto chunkCount = (height + rowsPerChunk - 1) / rowsPerChunk;
+
+        struct Chunk
+        {
+            std::vector<uint8_t> Idat;
+            uint32_t Adler = 1;
+            size_t RawSize = 0;
+        };
+        std::vector<Chunk> chunks(chunkCount);
+        auto encodeChunk = [&](uint32_t index)
+        {
+            auto first = index * rowsPerChunk;
+            auto last = std::min(first + rowsPerChunk, height);
+            std::vector<uint8_t> filtered((rowSize + 1) * (last - first));
+            std::vector<uint8_t> previous(rowSize);
+            std::vector<uint8_t> current(rowSize);
+            std::vector<uint8_t> scratch;
+            if (first > 0)
+            {
+                getRow(first - 1, previous.data());
+            }
+            for (auto y = first; y < last; y++)
+            {
+                getRow(y, current.data());
+                auto out = filtered.data() + ((rowSize + 1) * (y - first));
+                if (options.Fast)
+                {
+                    FilterRowUp(current.data(), y > 0 ? previous.data() : nullptr, rowSize, out);
+                }
+                else
+                {
+                    FilterRow(current.data(), y > 0 ? previous.data() : nullptr, rowSize, bytesPerPixel, out, scratch);
+                }
+                std::swap(previous, current);
+            }
+
+            auto& chunk = chunks[index];
+            chunk.RawSize = filtered.size();
+            chunk.Adler = Adler32(filtered.data(), filtered.size());
+            std::vector<uint8_t> compressed;
+            compressed.reserve(filtered.size() / 2);
+            if (index == 0)
+            {
+                // zlib header: deflate with a 32K window, no dictionary
+                compressed.insert(compressed.end(), { 0x78, 0x01 });
+            }
+            Deflater deflater(options.MaxChainLength, options.Fast);
+            deflater.Compress(filtered.data(), filtered.size(), compressed);
+            AppendChunk(chunk.Idat, "IDAT", compressed.data(), compressed.size());
+        };
+        if (options.Parallel)
+        {
+            BandPool::Shared().Run(chunkCount, encodeChunk);
+        }
+        else
+        {
+            for (uint32_t i = 0; i < chunkCount; i++)
+            {
+                encodeChunk(i);
+            }
+        }
+
+        std::vector<uint8_t> png = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+        std::vector<uint8_t> header;
+        AppendBigEndian(header, width);
+        AppendBigEndian(header, height);
+        header.insert(header.end(), { 8, colorType, 0, 0, 0 });
+        AppendChunk(png, "IHDR", header.data(), header.size());
+
+        uint32_t adler = 1;
+        for (auto&& chunk : chunks)
+        {
+            png.insert(png.end(), chunk.Idat.begin(), chunk.Idat.end());
+            adler = Adler32Combine(adler, chunk.Adler, chunk.RawSize);
+        }
+
+        // An empty final fixed Huffman block, then the checksum
+        std::vector<uint8_t> trailer = { 0x03, 0x00 };
+        AppendBigEndian(trailer, adler);
+        AppendChunk(png, "IDAT", trailer.data(), trailer.size());
+        AppendChunk(png, "IEND", nullptr, 0);
+        return png;
+    }
+}
+
+inline std::vector<uint8_t> EncodePng(BgraImageView const& image, PngOptions const& options = {})
+{
+    auto level = ResolveSimdLevel(DetectSimdLevel());
+    return png::Encode(image.Width, image.Height, 4, 6, options, [&](uint32_t y, uint8_t* out)
+    {
+        auto row = image.Row(y);
+        if (options.Premultiplied)
+        {
+            pixelkernels::UnpremultiplyRow(level, row, out, image.Width);
+            row = out;
+        }
+        pixelkernels::SwapRedBlueRow(level, row, out, image.Width);
+    });
+}
+
+// For single channel images like ImageDiffResult::Mask
+inline std::vector<uint8_t> EncodeGrayPng(uint8_t const* data, uint32_t width, uint32_t height, uint32_t rowPitch, PngOptions const& options = {})
+{
+    return png::Encode(width, height, 1, 0, options, [&](uint32_t y, uint8_t* out)
+    {
+        std::memcpy(out, data + (static_cast<size_t>(rowPitch) * y), width);
+    });
+}
+
+inline void WriteFileBytes(std::filesystem::path const& path, uint8_t const* data, size_t size)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        throw std::runtime_error("Could not open " + path.string() + " for writing");
+    }
+    file.write(reinterpret_cast<char const*>(data), static_cast<std::streamsize>(size));
+    if (!file)
+    {
+        throw std::runtime_error("Could not write " + path.string());
+    }
+}
+
+inline void WriteFileBytes(std::filesystem::path const& path, std::vector<uint8_t> const& bytes)
+{
+    WriteFileBytes(path, bytes.data(), bytes.size());
+}
+
+inline void WritePngFile(std::filesystem::path const& path, BgraImageView const& image, PngOptions const& options = {})
+{
+    WriteFileBytes(path, EncodePng(image, options));
+}
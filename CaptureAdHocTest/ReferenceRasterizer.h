@@ -0,0 +1,524 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "ImageView.h"
+#include "ParallelFor.h"
+#include "RegionVerifier.h"
+#include "SimdSupport.h"
+
+// Draws the simple shapes the tests put in their visual trees on the CPU, so
+// a whole captured frame can be compared against what it should look like.
+// Colors are premultiplied BGRA, like captured frames.
+//
+// Nobody's anti-aliasing matches exactly, so along with the expected image
+// this keeps a low and a high bound for every pixel. Away from edges the
+// bounds are the expected color, so those pixels have to match exactly. On an
+// edge (the fringe) they span everything from the shape not covering the pixel
+// at all to it covering all of it.
+struct ReferenceRect
+{
+    float X = 0.0f;
+    float Y = 0.0f;
+    float Width = 0.0f;
+    float Height = 0.0f;
+};
+
+struct ReferenceEllipse
+{
+    float CenterX = 0.0f;
+    float CenterY = 0.0f;
+    float RadiusX = 0.0f;
+    float RadiusY = 0.0f;
+};
+
+namespace referenceraster
+{
+    constexpr uint32_t MinRowsPerBand = 16;
+
+    // How far (in pixels) p is outside the ellipse's edge, negative when it's
+    // inside. This is the first order approximation, which is very close
+    // near the edge and only needs to be rough further away.
+    inline double EllipseSignedDistance(double dx, double dy, double radiusX, double radiusY)
+    {
+        auto nx = dx / radiusX;
+        auto ny = dy / radiusY;
+        auto q = std::sqrt((nx * nx) + (ny * ny));
+        if (q == 0.0)
+        {
+            return -std::min(radiusX, radiusY);
+        }
+        auto gx = nx / radiusX;
+        auto gy = ny / radiusY;
+        return ((q - 1.0) * q) / std::sqrt((gx * gx) + (gy * gy));
+    }
+
+    // How much of the pixel a shape covers, from the distance of its center
+    // to the shape's edge
+    inline float CoverageFromDistance(double distance)
+    {
+        return static_cast<float>(std::clamp(0.5 - distance, 0.0, 1.0));
+    }
+
+    // How much of [x, x + 1) lies within [begin, end)
+    inline float Overlap(int64_t x, float begin, float end)
+    {
+        return std::clamp(std::min(static_cast<float>(x + 1), end) - std::max(static_cast<float>(x), begin), 0.0f, 1.0f);
+    }
+
+    // Source over, with color scaled by coverage
+    class Blender
+    {
+    public:
+        Blender(BgraColor const& color, float coverage)
+        {
+            uint8_t channels[4] = { color.B, color.G, color.R, color.A };
+            for (int c = 0; c < 4; c++)
+            {
+                m_source[c] = channels[c] * coverage;
+            }
+            m_inverseAlpha = 1.0f - ((color.A / 255.0f) * coverage);
+        }
+
+        uint8_t Blend(uint8_t destination, int channel) const
+        {
+            return static_cast<uint8_t>(std::min((m_source[channel] + (destination * m_inverseAlpha)) + 0.5f, 255.0f));
+        }
+
+    private:
+        float m_source[4];
+        float m_inverseAlpha;
+    };
+
+    struct Rows
+    {
+        uint8_t* Expected;
+        uint8_t* Low;
+        uint8_t* High;
+    };
+}
+
+class ReferenceRasterizer
+{
+public:
+    // The images aren't zeroed first, since Clear writes all of them anyway
+    ReferenceRasterizer(uint32_t width, uint32_t height, BgraColor const& clearColor = {}) :
+        m_width(width), m_height(height), m_size(static_cast<size_t>(width) * height * BgraImageView::BytesPerPixel),
+        m_expected(new uint8_t[m_size]), m_low(new uint8_t[m_size]), m_high(new uint8_t[m_size])
+    {
+        Clear(clearColor);
+    }
+
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+    uint32_t RowPitch() const { return m_width * BgraImageView::BytesPerPixel; }
+
+    // Pixels whose center is closer than this to an ellipse's edge are in
+    // the fringe. Rects only have a fringe where an edge isn't on a pixel
+    // boundary. At least half a pixel.
+    float EdgeBand() const { return m_edgeBand; }
+    void EdgeBand(float value) { m_edgeBand = std::max(value, 0.5f); }
+
+    // What the frame should look like, with analytic coverage on the edges
+    BgraImageView View() const { return BgraImageView{ m_expected.get(), m_width, m_height, RowPitch() }; }
+    BgraImageView LowView() const { return BgraImageView{ m_low.get(), m_width, m_height, RowPitch() }; }
+    BgraImageView HighView() const { return BgraImageView{ m_high.get(), m_width, m_height, RowPitch() }; }
+
+    void Clear(BgraColor const& color)
+    {
+        if (m_size == 0)
+        {
+            return;
+        }
+        // One row, copied to every other row of every image
+        auto packed = color.Packed();
+        for (uint32_t x = 0; x < m_width; x++)
+        {
+            std::memcpy(m_expected.get() + (static_cast<size_t>(x) * 4), &packed, sizeof(packed));
+        }
+        for (auto buffer : { m_expected.get(), m_low.get(), m_high.get() })
+        {
+            for (size_t offset = buffer == m_expected.get() ? RowPitch() : 0; offset < m_size; offset += RowPitch())
+            {
+                std::memcpy(buffer + offset, m_expected.get(), RowPitch());
+            }
+        }
+    }
+
+    void FillRect(ReferenceRect const& rect, BgraColor const& color)
+    {
+        auto left = rect.X;
+        auto right = rect.X + rect.Width;
+        auto top = rect.Y;
+        auto bottom = rect.Y + rect.Height;
+        if (!(rect.Width > 0.0f && rect.Height > 0.0f))
+        {
+            return;
+        }
+        auto firstX = ClampColumn(std::floor(left));
+        auto endX = ClampColumn(std::ceil(right));
+        auto firstY = ClampRow(std::floor(top));
+        auto endY = ClampRow(std::ceil(bottom));
+        if (firstX >= endX || firstY >= endY)
+        {
+            return;
+        }
+        std::vector<float> columnCoverage(endX - firstX);
+        for (auto x = firstX; x < endX; x++)
+        {
+            columnCoverage[x - firstX] = referenceraster::Overlap(x, left, right);
+        }
+
+        ParallelForRowBands(endY - firstY, referenceraster::MinRowsPerBand, [&](uint32_t first, uint32_t count)
+        {
+            for (auto y = firstY + first; y < firstY + first + count; y++)
+            {
+                auto rowCoverage = referenceraster::Overlap(y, top, bottom);
+                auto rows = RowsAt(y);
+                uint32_t spanStart = endX;
+                for (auto x = firstX; x < endX; x++)
+                {
+                    auto coverage = columnCoverage[x - firstX] * rowCoverage;
+                    if (coverage >= 1.0f)
+                    {
+                        // Whole pixels go in spans, which are quicker
+                        spanStart = std::min(spanStart, x);
+                        continue;
+                    }
+                    if (spanStart < x)
+                    {
+                        FillSpan(rows, spanStart, x, color);
+                        spanStart = endX;
+                    }
+                    if (coverage > 0.0f)
+                    {
+                        BlendFringe(rows, x, color, coverage);
+                    }
+                }
+                if (spanStart < endX)
+                {
+                    FillSpan(rows, spanStart, endX, color);
+                }
+            }
+        });
+    }
+
+    void FillEllipse(ReferenceEllipse const& ellipse, BgraColor const& color)
+    {
+        double centerX = ellipse.CenterX;
+        double centerY = ellipse.CenterY;
+        double radiusX = ellipse.RadiusX;
+        double radiusY = ellipse.RadiusY;
+        if (!(radiusX > 0.0 && radiusY > 0.0))
+        {
+            return;
+        }
+        // Outside the ellipse grown by this, nothing is in the fringe, and
+        // inside the one shrunk by it everything is covered
+        double margin = (2.0 * m_edgeBand) + 1.0;
+        auto firstY = ClampRow(std::floor(centerY - radiusY - margin));
+        auto endY = ClampRow(std::ceil(centerY + radiusY + margin));
+        if (firstY >= endY)
+        {
+            return;
+        }
+        auto band = static_cast<double>(m_edgeBand);
+
+        ParallelForRowBands(endY - firstY, referenceraster::MinRowsPerBand, [&](uint32_t first, uint32_t count)
+        {
+            for (auto y = firstY + first; y < firstY + first + count; y++)
+            {
+                auto dy = (y + 0.5) - centerY;
+                auto outerHalfWidth = HalfWidthAt(dy, radiusX + margin, radiusY + margin);
+                auto innerHalfWidth = HalfWidthAt(dy, radiusX - margin, radiusY - margin);
+                // Pixel centers are at x + 0.5
+                auto firstX = ClampColumn(std::floor(centerX - outerHalfWidth - 0.5));
+                auto endX = ClampColumn(std::ceil(centerX + outerHalfWidth + 0.5));
+                auto innerFirstX = endX;
+                auto innerEndX = endX;
+                if (innerHalfWidth > 0.0)
+                {
+                    innerFirstX = std::clamp(ClampColumn(std::ceil(centerX - innerHalfWidth - 0.5)), firstX, endX);
+                    innerEndX = std::clamp(ClampColumn(std::floor(centerX + innerHalfWidth - 0.5) + 1.0), innerFirstX, endX);
+                }
+
+                auto rows = RowsAt(y);
+                auto blendEdge = [&](uint32_t x)
+                {
+                    auto distance = referenceraster::EllipseSignedDistance((x + 0.5) - centerX, dy, radiusX, radiusY);
+                    if (distance <= -band)
+                    {
+                        FillSpan(rows, x, x + 1, color);
+                    }
+                    else if (distance < band)
+                    {
+                        BlendFringe(rows, x, color, referenceraster::CoverageFromDistance(distance));
+                    }
+                };
+                for (auto x = firstX; x < innerFirstX; x++)
+                {
+                    blendEdge(x);
+                }
+                FillSpan(rows, innerFirstX, innerEndX, color);
+                for (auto x = innerEndX; x < endX; x++)
+                {
+                    blendEdge(x);
+                }
+            }
+        });
+    }
+
+    // How many pixels can be anywhere between their bounds
+    uint64_t FringePixels() const
+    {
+        uint64_t count = 0;
+        for (size_t i = 0; i < m_size; i += 4)
+        {
+            count += std::memcmp(m_low.get() + i, m_high.get() + i, 4) != 0 ? 1 : 0;
+        }
+        return count;
+    }
+
+private:
+    uint32_t ClampColumn(double x) const { return static_cast<uint32_t>(std::clamp(x, 0.0, static_cast<double>(m_width))); }
+    uint32_t ClampRow(double y) const { return static_cast<uint32_t>(std::clamp(y, 0.0, static_cast<double>(m_height))); }
+
+    // Half the width of the ellipse dy from its center, or 0 outside of it
+    static double HalfWidthAt(double dy, double radiusX, double radiusY)
+    {
+        if (radiusX <= 0.0 || radiusY <= 0.0 || std::abs(dy) >= radiusY)
+        {
+            return 0.0;
+        }
+        auto ny = dy / radiusY;
+        return radiusX * std::sqrt(1.0 - (ny * ny));
+    }
+
+    referenceraster::Rows RowsAt(uint32_t y)
+    {
+        auto offset = static_cast<size_t>(RowPitch()) * y;
+        return referenceraster::Rows{ m_expected.get() + offset, m_low.get() + offset, m_high.get() + offset };
+    }
+
+    // Fully covered pixels in [begin, end), so every image gets the same blend
+    static void FillSpan(referenceraster::Rows const& rows, uint32_t begin, uint32_t end, BgraColor const& color)
+    {
+        if (begin >= end)
+        {
+            return;
+        }
+        auto offset = static_cast<size_t>(begin) * 4;
+        auto size = static_cast<size_t>(end - begin) * 4;
+        if (color.A == 255)
+        {
+            auto packed = color.Packed();
+            for (auto i = offset; i < offset + size; i += 4)
+            {
+                std::memcpy(rows.Expected + i, &packed, sizeof(packed));
+            }
+            std::memcpy(rows.Low + offset, rows.Expected + offset, size);
+            std::memcpy(rows.High + offset, rows.Expected + offset, size);
+            return;
+        }
+        // A table is quicker than blending each channel, and gives the same
+        // results
+        referenceraster::Blender blender(color, 1.0f);
+        uint8_t table[4][256];
+        for (int c = 0; c < 4; c++)
+        {
+            for (uint32_t value = 0; value < 256; value++)
+            {
+                table[c][value] = blender.Blend(static_cast<uint8_t>(value), c);
+            }
+        }
+        for (auto row : { rows.Expected, rows.Low, rows.High })
+        {
+            for (auto i = offset; i < offset + size; i += 4)
+            {
+                row[i] = table[0][row[i]];
+                row[i + 1] = table[1][row[i + 1]];
+                row[i + 2] = table[2][row[i + 2]];
+                row[i + 3] = table[3][row[i + 3]];
+            }
+        }
+    }
+
+    // The bounds widen to cover both no coverage and full coverage. Blending
+    // only ever moves a channel monotonically, so the extremes are enough.
+    static void BlendFringe(referenceraster::Rows const& rows, uint32_t x, BgraColor const& color, float coverage)
+    {
+        referenceraster::Blender partial(color, coverage);
+        referenceraster::Blender full(color, 1.0f);
+        auto offset = static_cast<size_t>(x) * 4;
+        for (int c = 0; c < 4; c++)
+        {
+            rows.Expected[offset + c] = partial.Blend(rows.Expected[offset + c], c);
+            rows.Low[offset + c] = std::min(rows.Low[offset + c], full.Blend(rows.Low[offset + c], c));
+            rows.High[offset + c] = std::max(rows.High[offset + c], full.Blend(rows.High[offset + c], c));
+        }
+    }
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    float m_edgeBand = 1.0f;
+    size_t m_size = 0;
+    std::unique_ptr<uint8_t[]> m_expected;
+    std::unique_ptr<uint8_t[]> m_low;
+    std::unique_ptr<uint8_t[]> m_high;
+};
+
+namespace referenceraster
+{
+    inline bool PixelOutOfBounds(uint8_t const* pixel, uint8_t const* low, uint8_t const* high, BgraColor const& tolerance)
+    {
+        uint8_t channelTolerance[4] = { tolerance.B, tolerance.G, tolerance.R, tolerance.A };
+        for (int c = 0; c < 4; c++)
+        {
+            if (pixel[c] + channelTolerance[c] < low[c] || pixel[c] > high[c] + channelTolerance[c])
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline void ScanRowScalar(uint8_t const* row, uint8_t const* low, uint8_t const* high, uint32_t begin, uint32_t width, BgraColor const& tolerance, regionverifier::RowMismatches& result)
+    {
+        for (auto x = begin; x < width; x++)
+        {
+            if (PixelOutOfBounds(row + (x * 4), low + (x * 4), high + (x * 4), tolerance))
+            {
+                result.Add(x, 1, x);
+            }
+        }
+    }
+
+    // The vector versions return how many pixels they checked
+#if defined(CAPTURE_SIMD_X86)
+    inline uint32_t ScanRowSSE2(uint8_t const* row, uint8_t const* low, uint8_t const* high, uint32_t width, BgraColor const& tolerance, regionverifier::RowMismatches& result)
+    {
+        auto toleranceVector = _mm_set1_epi32(static_cast<int>(tolerance.Packed()));
+        auto allSet = _mm_set1_epi32(-1);
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto value = _mm_loadu_si128(reinterpret_cast<__m128i const*>(row + (x * 4)));
+            auto lowVector = _mm_subs_epu8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(low + (x * 4))), toleranceVector);
+            auto highVector = _mm_adds_epu8(_mm_loadu_si128(reinterpret_cast<__m128i const*>(high + (x * 4))), toleranceVector);
+            // Each byte is set when its channel is in bounds
+            auto inBounds = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(value, lowVector), value), _mm_cmpeq_epi8(_mm_min_epu8(value, highVector), value));
+            auto matches = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(inBounds, allSet)));
+            if (matches != 0xF)
+            {
+                regionverifier::AddMask(x, ~matches & 0xF, result);
+            }
+        }
+        return x;
+    }
+#endif
+
+#if defined(CAPTURE_SIMD_NEON)
+    inline uint32_t ScanRowNEON(uint8_t const* row, uint8_t const* low, uint8_t const* high, uint32_t width, BgraColor const& tolerance, regionverifier::RowMismatches& result)
+    {
+        auto toleranceVector = vreinterpretq_u8_u32(vdupq_n_u32(tolerance.Packed()));
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto value = vld1q_u8(row + (x * 4));
+            auto lowVector = vqsubq_u8(vld1q_u8(low + (x * 4)), toleranceVector);
+            auto highVector = vqaddq_u8(vld1q_u8(high + (x * 4)), toleranceVector);
+            auto outOfBounds = vorrq_u8(vcltq_u8(value, lowVector), vcgtq_u8(value, highVector));
+            auto pixels = vreinterpretq_u32_u8(outOfBounds);
+            if (vmaxvq_u32(pixels) != 0)
+            {
+                uint32_t mask = 0;
+                mask |= vgetq_lane_u32(pixels, 0) ? 1 : 0;
+                mask |= vgetq_lane_u32(pixels, 1) ? 2 : 0;
+                mask |= vgetq_lane_u32(pixels, 2) ? 4 : 0;
+                mask |= vgetq_lane_u32(pixels, 3) ? 8 : 0;
+                regionverifier::AddMask(x, mask, result);
+            }
+        }
+        return x;
+    }
+#endif
+
+    inline void ScanRow(SimdLevel level, uint8_t const* row, uint8_t const* low, uint8_t const* high, uint32_t width, BgraColor const& tolerance, regionverifier::RowMismatches& result)
+    {
+        uint32_t done = 0;
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+        case SimdLevel::SSE2:
+            done = ScanRowSSE2(row, low, high, width, tolerance, result);
+            break;
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            done = ScanRowNEON(row, low, high, width, tolerance, result);
+            break;
+#endif
+        default:
+            break;
+        }
+        ScanRowScalar(row, low, high, done, width, tolerance, result);
+    }
+
+    inline void CompareRows(SimdLevel level, BgraImageView const& actual, ReferenceRasterizer const& reference, BgraColor const& tolerance,
+        uint32_t firstRow, uint32_t rowCount, regionverifier::RowMismatches* rows)
+    {
+        auto low = reference.LowView();
+        auto high = reference.HighView();
+        for (auto y = firstRow; y < firstRow + rowCount; y++)
+        {
+            ScanRow(level, actual.Row(y), low.Row(y), high.Row(y), reference.Width(), tolerance, rows[y]);
+        }
+    }
+
+    inline RegionVerifyResult MergeRows(BgraImageView const& actual, ReferenceRasterizer const& reference, std::vector<regionverifier::RowMismatches> const& rows)
+    {
+        RegionVerifyResult result;
+        for (uint32_t y = 0; y < reference.Height(); y++)
+        {
+            regionverifier::MergeRow(result, rows[y], y, actual.Row(y));
+        }
+        result.PixelCount = static_cast<uint64_t>(reference.Width()) * reference.Height();
+        return result;
+    }
+
+    inline void CheckSize(BgraImageView const& actual, ReferenceRasterizer const& reference)
+    {
+        if (actual.Width < reference.Width() || actual.Height < reference.Height())
+        {
+            throw std::out_of_range("Image is smaller than the reference");
+        }
+    }
+}
+
+// Checks the top left of actual, the size of the reference, against it. A
+// channel passes when it's within its bounds, give or take tolerance.
+inline RegionVerifyResult CompareToReference(BgraImageView const& actual, ReferenceRasterizer const& reference, BgraColor const& tolerance = {}, SimdLevel level = DetectSimdLevel())
+{
+    referenceraster::CheckSize(actual, reference);
+    std::vector<regionverifier::RowMismatches> rows(reference.Height());
+    referenceraster::CompareRows(ResolveSimdLevel(level), actual, reference, tolerance, 0, reference.Height(), rows.data());
+    return referenceraster::MergeRows(actual, reference, rows);
+}
+
+// Same result as CompareToReference, in bands on the shared BandPool
+inline RegionVerifyResult CompareToReferenceParallel(BgraImageView const& actual, ReferenceRasterizer const& reference, BgraColor const& tolerance = {}, SimdLevel level = DetectSimdLevel())
+{
+    referenceraster::CheckSize(actual, reference);
+    level = ResolveSimdLevel(level);
+    std::vector<regionverifier::RowMismatches> rows(reference.Height());
+    ParallelForRowBands(reference.Height(), referenceraster::MinRowsPerBand, [&](uint32_t first, uint32_t count)
+    {
+        referenceraster::CompareRows(level, actual, reference, tolerance, first, count, rows.data());
+    });
+    return referenceraster::MergeRows(actual, reference, rows);
+}
@@ -0,0 +1,351 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "ImageView.h"
+#include "ParallelFor.h"
+#include "SimdSupport.h"
+
+struct RegionVerifyResult
+{
+    uint64_t PixelCount = 0;
+    uint64_t MismatchCount = 0;
+    // The rest is only meaningful when MismatchCount > 0
+    uint32_t FirstMismatchX = 0;
+    uint32_t FirstMismatchY = 0;
+    BgraColor FirstMismatchValue;
+    PixelRect MismatchBounds;
+
+    bool Passed() const { return MismatchCount == 0; }
+};
+
+namespace regionverifier
+{
+    struct RowMismatches
+    {
+        uint32_t Count = 0;
+        uint32_t First = 0;
+        uint32_t Last = 0;
+
+        void Add(uint32_t x, uint32_t count, uint32_t last)
+        {
+            if (Count == 0)
+            {
+                First = x;
+            }
+            Count += count;
+            Last = last;
+        }
+    };
+
+    inline bool ChannelMismatch(uint8_t value, uint8_t expected, uint8_t tolerance)
+    {
+        auto difference = value > expected ? value - expected : expected - value;
+        return difference > tolerance;
+    }
+
+    inline bool PixelMismatch(uint8_t const* pixel, BgraColor const& expected, BgraColor const& tolerance)
+    {
+        return ChannelMismatch(pixel[0], expected.B, tolerance.B) ||
+            ChannelMismatch(pixel[1], expected.G, tolerance.G) ||
+            ChannelMismatch(pixel[2], expected.R, tolerance.R) ||
+            ChannelMismatch(pixel[3], expected.A, tolerance.A);
+    }
+
+    inline void ScanRowScalar(uint8_t const* row, uint32_t begin, uint32_t end, BgraColor const& expected, BgraColor const& tolerance, RowMismatches& result)
+    {
+        for (uint32_t x = begin; x < end; x++)
+        {
+            if (PixelMismatch(row + (x * 4), expected, tolerance))
+            {
+                result.Add(x, 1, x);
+            }
+        }
+    }
+
+    // Adds the pixels flagged in a movemask style bitmask starting at x
+    inline void AddMask(uint32_t x, uint32_t mask, RowMismatches& result)
+    {
+        uint32_t first = 0;
+        while ((mask & (1u << first)) == 0)
+        {
+            first++;
+        }
+        uint32_t last = first;
+        uint32_t count = 0;
+        for (uint32_t bit = first; mask >> bit; bit++)
+        {
+            if (mask & (1u << bit))
+            {
+                count++;
+                last = bit;
+            }
+        }
+        result.Add(x + first, count, x + last);
+    }
+
+#if defined(CAPTURE_SIMD_X86)
+    inline __m128i AbsDiffOverTolerance(__m128i value, __m128i expected, __m128i tolerance)
+    {
+        auto difference = _mm_or_si128(_mm_subs_epu8(value, expected), _mm_subs_epu8(expected, value));
+        return _mm_subs_epu8(difference, tolerance);
+    }
+
+    inline void AddOverMaskSSE2(uint32_t x, __m128i over, RowMismatches& result)
+    {
+        auto matches = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(over, _mm_setzero_si128())));
+        if (matches != 0xF)
+        {
+            AddMask(x, ~matches & 0xF, result);
+        }
+    }
+
+    inline void ScanRowSSE2(uint8_t const* row, uint32_t width, BgraColor const& expected, BgraColor const& tolerance, RowMismatches& result)
+    {
+        auto expectedVector = _mm_set1_epi32(static_cast<int>(expected.Packed()));
+        auto toleranceVector = _mm_set1_epi32(static_cast<int>(tolerance.Packed()));
+        auto zero = _mm_setzero_si128();
+        auto pixels = reinterpret_cast<__m128i const*>(row);
+        uint32_t x = 0;
+        // Matching pixels are the common case, so check 16 at a time and only
+        // work out which ones failed when something did.
+        for (; x + 16 <= width; x += 16)
+        {
+            auto over0 = AbsDiffOverTolerance(_mm_loadu_si128(pixels + (x / 4) + 0), expectedVector, toleranceVector);
+            auto over1 = AbsDiffOverTolerance(_mm_loadu_si128(pixels + (x / 4) + 1), expectedVector, toleranceVector);
+            auto over2 = AbsDiffOverTolerance(_mm_loadu_si128(pixels + (x / 4) + 2), expectedVector, toleranceVector);
+            auto over3 = AbsDiffOverTolerance(_mm_loadu_si128(pixels + (x / 4) + 3), expectedVector, toleranceVector);
+            auto any = _mm_or_si128(_mm_or_si128(over0, over1), _mm_or_si128(over2, over3));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) != 0xFFFF)
+            {
+                AddOverMaskSSE2(x + 0, over0, result);
+                AddOverMaskSSE2(x + 4, over1, result);
+                AddOverMaskSSE2(x + 8, over2, result);
+                AddOverMaskSSE2(x + 12, over3, result);
+            }
+        }
+        for (; x + 4 <= width; x += 4)
+        {
+            AddOverMaskSSE2(x, AbsDiffOverTolerance(_mm_loadu_si128(pixels + (x / 4)), expectedVector, toleranceVector), result);
+        }
+        ScanRowScalar(row, x, width, expected, tolerance, result);
+    }
+
+    CAPTURE_TARGET_AVX2 inline __m256i AbsDiffOverToleranceAVX2(__m256i value, __m256i expected, __m256i tolerance)
+    {
+        auto difference = _mm256_or_si256(_mm256_subs_epu8(value, expected), _mm256_subs_epu8(expected, value));
+        return _mm256_subs_epu8(difference, tolerance);
+    }
+
+    CAPTURE_TARGET_AVX2 inline void AddOverMaskAVX2(uint32_t x, __m256i over, RowMismatches& result)
+    {
+        auto matches = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(over, _mm256_setzero_si256())));
+        if (matches != 0xFF)
+        {
+            AddMask(x, ~matches & 0xFF, result);
+        }
+    }
+
+    CAPTURE_TARGET_AVX2 inline void ScanRowAVX2(uint8_t const* row, uint32_t width, BgraColor const& expected, BgraColor const& tolerance, RowMismatches& result)
+    {
+        auto expectedVector = _mm256_set1_epi32(static_cast<int>(expected.Packed()));
+        auto toleranceVector = _mm256_set1_epi32(static_cast<int>(tolerance.Packed()));
+        auto pixels = reinterpret_cast<__m256i const*>(row);
+        uint32_t x = 0;
+        for (; x + 32 <= width; x += 32)
+        {
+            auto over0 = AbsDiffOverToleranceAVX2(_mm256_loadu_si256(pixels + (x / 8) + 0), expectedVector, toleranceVector);
+            auto over1 = AbsDiffOverToleranceAVX2(_mm256_loadu_si256(pixels + (x / 8) + 1), expectedVector, toleranceVector);
+            auto over2 = AbsDiffOverToleranceAVX2(_mm256_loadu_si256(pixels + (x / 8) + 2), expectedVector, toleranceVector);
+            auto over3 = AbsDiffOverToleranceAVX2(_mm256_loadu_si256(pixels + (x / 8) + 3), expectedVector, toleranceVector);
+            auto any = _mm256_or_si256(_mm256_or_si256(over0, over1), _mm256_or_si256(over2, over3));
+            if (!_mm256_testz_si256(any, any))
+            {
+                AddOverMaskAVX2(x + 0, over0, result);
+                AddOverMaskAVX2(x + 8, over1, result);
+                AddOverMaskAVX2(x + 16, over2, result);
+                AddOverMaskAVX2(x + 24, over3, result);
+            }
+        }
+        for (; x + 8 <= width; x += 8)
+        {
+            AddOverMaskAVX2(x, AbsDiffOverToleranceAVX2(_mm256_loadu_si256(pixels + (x / 8)), expectedVector, toleranceVector), result);
+        }
+        ScanRowScalar(row, x, width, expected, tolerance, result);
+    }
+#endif
+
+#if defined(CAPTURE_SIMD_NEON)
+    inline void ScanRowNEON(uint8_t const* row, uint32_t width, BgraColor const& expected, BgraColor const& tolerance, RowMismatches& result)
+    {
+        auto expectedVector = vreinterpretq_u8_u32(vdupq_n_u32(expected.Packed()));
+        auto toleranceVector = vreinterpretq_u8_u32(vdupq_n_u32(tolerance.Packed()));
+        uint32_t x = 0;
+        for (; x + 4 <= width; x += 4)
+        {
+            auto value = vld1q_u8(row + (x * 4));
+            auto over = vcgtq_u8(vabdq_u8(value, expectedVector), toleranceVector);
+            auto pixels = vreinterpretq_u32_u8(over);
+            if (vmaxvq_u32(pixels) != 0)
+            {
+                uint32_t mask = 0;
+                mask |= vgetq_lane_u32(pixels, 0) ? 1 : 0;
+                mask |= vgetq_lane_u32(pixels, 1) ? 2 : 0;
+                mask |= vgetq_lane_u32(pixels, 2) ? 4 : 0;
+                mask |= vgetq_lane_u32(pixels, 3) ? 8 : 0;
+                AddMask(x, mask, result);
+            }
+        }
+        ScanRowScalar(row, x, width, expected, tolerance, result);
+    }
+#endif
+
+    inline void ScanRow(SimdLevel level, uint8_t const* row, uint32_t width, BgraColor const& expected, BgraColor const& tolerance, RowMismatches& result)
+    {
+        switch (level)
+        {
+#if defined(CAPTURE_SIMD_X86)
+        case SimdLevel::AVX2:
+            ScanRowAVX2(row, width, expected, tolerance, result);
+            return;
+        case SimdLevel::SSE2:
+            ScanRowSSE2(row, width, expected, tolerance, result);
+            return;
+#endif
+#if defined(CAPTURE_SIMD_NEON)
+        case SimdLevel::NEON:
+            ScanRowNEON(row, width, expected, tolerance, result);
+            return;
+#endif
+        default:
+            ScanRowScalar(row, 0, width, expected, tolerance, result);
+            return;
+        }
+    }
+
+    inline void MergeRow(RegionVerifyResult& result, RowMismatches const& row, uint32_t y, uint8_t const* rowData)
+    {
+        if (row.Count == 0)
+        {
+            return;
+        }
+        if (result.MismatchCount == 0)
+        {
+            result.FirstMismatchX = row.First;
+            result.FirstMismatchY = y;
+            auto pixel = rowData + (row.First * 4);
+            result.FirstMismatchValue = BgraColor{ pixel[0], pixel[1], pixel[2], pixel[3] };
+            result.MismatchBounds = PixelRect{ row.First, y, row.Last - row.First + 1, 1 };
+        }
+        else
+        {
+            auto left = std::min(result.MismatchBounds.X, row.First);
+            auto right = std::max(result.MismatchBounds.Right(), row.Last + 1);
+            result.MismatchBounds = PixelRect{ left, result.MismatchBounds.Y, right - left, y - result.MismatchBounds.Y + 1 };
+        }
+        result.MismatchCount += row.Count;
+    }
+
+    inline void Merge(RegionVerifyResult& result, RegionVerifyResult const& band)
+    {
+        if (band.MismatchCount > 0)
+        {
+            if (result.MismatchCount == 0)
+            {
+                auto pixelCount = result.PixelCount;
+                result = band;
+                result.PixelCount = pixelCount;
+            }
+            else
+            {
+                // Bands are merged in order, so the first mismatch stays put
+                auto left = std::min(result.MismatchBounds.X, band.MismatchBounds.X);
+                auto right = std::max(result.MismatchBounds.Right(), band.MismatchBounds.Right());
+                auto bottom = std::max(result.MismatchBounds.Bottom(), band.MismatchBounds.Bottom());
+                result.MismatchBounds = PixelRect{ left, result.MismatchBounds.Y, right - left, bottom - result.MismatchBounds.Y };
+                result.MismatchCount += band.MismatchCount;
+            }
+        }
+        result.PixelCount += band.PixelCount;
+    }
+
+    inline RegionVerifyResult VerifyRows(SimdLevel level, BgraImageView const& view, PixelRect const& rect, uint32_t firstRow, uint32_t rowCount, BgraColor const& expected, BgraColor const& tolerance)
+    {
+        RegionVerifyResult result;
+        for (auto y = firstRow; y < firstRow + rowCount; y++)
+        {
+            auto row = view.Row(y) + (static_cast<size_t>(rect.X) * BgraImageView::BytesPerPixel);
+            RowMismatches mismatches;
+            ScanRow(level, row, rect.Width, expected, tolerance, mismatches);
+            if (mismatches.Count > 0)
+            {
+                mismatches.First += rect.X;
+                mismatches.Last += rect.X;
+                MergeRow(result, mismatches, y, view.Row(y));
+            }
+        }
+        result.PixelCount = static_cast<uint64_t>(rect.Width) * rowCount;
+        return result;
+    }
+}
+
+// Checks every pixel in rect against expected. A channel passes when it's
+// within the matching channel of tolerance (inclusive). Rows are read using the
+// view's RowPitch.
+inline RegionVerifyResult VerifyRegion(
+    BgraImageView const& view,
+    PixelRect const& rect,
+    BgraColor const& expected,
+    BgraColor const& tolerance = {},
+    SimdLevel level = DetectSimdLevel())
+{
+    if (!view.Contains(rect))
+    {
+        throw std::out_of_range("Region is outside of the image");
+    }
+    return regionverifier::VerifyRows(ResolveSimdLevel(level), view, rect, rect.Y, rect.Height, expected, tolerance);
+}
+
+// Same as VerifyRegion, but large regions are split into row bands that are
+// verified on the shared BandPool.
+inline RegionVerifyResult VerifyRegionParallel(
+    BgraImageView const& view,
+    PixelRect const& rect,
+    BgraColor const& expected,
+    BgraColor const& tolerance = {},
+    SimdLevel level = DetectSimdLevel())
+{
+    if (!view.Contains(rect))
+    {
+        throw std::out_of_range("Region is outside of the image");
+    }
+    level = ResolveSimdLevel(level);
+
+    // Small regions aren't worth waking up the pool for
+    static constexpr uint32_t MinRowsPerBand = 64;
+    auto& pool = BandPool::Shared();
+    auto bandCount = std::max(1u, std::min(pool.ThreadCount(), rect.Height / MinRowsPerBand));
+    if (bandCount == 1)
+    {
+        return regionverifier::VerifyRows(level, view, rect, rect.Y, rect.Height, expected, tolerance);
+    }
+
+    auto rowsPerBand = (rect.Height + bandCount - 1) / bandCount;
+    std::vector<RegionVerifyResult> bands(bandCount);
+    pool.Run(bandCount, [&](uint32_t band)
+    {
+        auto first = band * rowsPerBand;
+        if (first < rect.Height)
+        {
+            auto count = std::min(rowsPerBand, rect.Height - first);
+            bands[band] = regionverifier::VerifyRows(level, view, rect, rect.Y + first, count, expected, tolerance);
+        }
+    });
+
+    RegionVerifyResult result;
+    for (auto&& band : bands)
+    {
+        regionverifier::Merge(result, band);
+    }
+    return result;
+}
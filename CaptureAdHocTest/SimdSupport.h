@@ -0,0 +1,156 @@
+#pragma once
+#include <cstdint>
+
+// Which instruction sets the pixel kernels can be compiled for. SSE2 is part of
+// the x64 baseline, AVX2 has to be checked for at runtime. On GCC/Clang the
+// AVX2 kernels are compiled per function with CAPTURE_TARGET_AVX2 so the rest
+// of the binary doesn't require it.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define CAPTURE_SIMD_X86 1
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(_M_ARM64) || defined(__aarch64__)
+#define CAPTURE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(CAPTURE_SIMD_X86) && !defined(_MSC_VER)
+#define CAPTURE_TARGET_AVX2 __attribute__((target("avx2")))
+#define CAPTURE_TARGET_F16C __attribute__((target("avx2,f16c")))
+#else
+#define CAPTURE_TARGET_AVX2
+#define CAPTURE_TARGET_F16C
+#endif
+
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    AVX2,
+    NEON
+};
+
+inline char const* SimdLevelName(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::SSE2:
+        return "SSE2";
+    case SimdLevel::AVX2:
+        return "AVX2";
+    case SimdLevel::NEON:
+        return "NEON";
+    default:
+        return "Scalar";
+    }
+}
+
+inline bool CpuSupportsAVX2()
+{
+#if defined(CAPTURE_SIMD_X86)
+#if defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuid(info, 1);
+    auto osxsave = (info[2] & (1 << 27)) != 0;
+    auto avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+    auto osxsave = (ecx & (1u << 27)) != 0;
+    auto avx = (ecx & (1u << 28)) != 0;
+    if (!osxsave || !avx)
+    {
+        return false;
+    }
+    unsigned int xcr0Low = 0, xcr0High = 0;
+    __asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+    if ((xcr0Low & 0x6) != 0x6)
+    {
+        return false;
+    }
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    {
+        return false;
+    }
+    return (ebx & (1u << 5)) != 0;
+#endif
+#else
+    return false;
+#endif
+}
+
+// The half float conversions (vcvtph2ps). Every AVX2 CPU so far has them, but
+// they have their own CPUID bit, so the AVX2 half float kernels check it too.
+inline bool CpuSupportsF16C()
+{
+#if defined(CAPTURE_SIMD_X86)
+    if (!CpuSupportsAVX2())
+    {
+        return false;
+    }
+#if defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 1);
+    return (info[2] & (1 << 29)) != 0;
+#else
+    unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 29)) != 0;
+#endif
+#else
+    return false;
+#endif
+}
+
+// The best instruction set available on this machine. Computed once.
+inline SimdLevel DetectSimdLevel()
+{
+    static SimdLevel const level = []()
+    {
+#if defined(CAPTURE_SIMD_X86)
+        return CpuSupportsAVX2() ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#elif defined(CAPTURE_SIMD_NEON)
+        return SimdLevel::NEON;
+#else
+        return SimdLevel::Scalar;
+#endif
+    }();
+    return level;
+}
+
+// Clamps a requested level to what both the build and the machine support.
+inline SimdLevel ResolveSimdLevel(SimdLevel requested)
+{
+    auto best = DetectSimdLevel();
+    switch (requested)
+    {
+    case SimdLevel::AVX2:
+        return best == SimdLevel::AVX2 ? SimdLevel::AVX2 : ResolveSimdLevel(SimdLevel::SSE2);
+    case SimdLevel::SSE2:
+        return (best == SimdLevel::AVX2 || best == SimdLevel::SSE2) ? SimdLevel::SSE2 : SimdLevel::Scalar;
+    case SimdLevel::NEON:
+        return best == SimdLevel::NEON ? SimdLevel::NEON : SimdLevel::Scalar;
+    default:
+        return SimdLevel::Scalar;
+    }
+}
@@ -0,0 +1,448 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include "BoundedQueue.h"
+#include "TimerQueue.h"
+
+// An item and where it came in the push order. Sequences start at 0 and go
+// up by one per push, so a gap means the ring threw items away.
+template <typename T>
+struct SequencedItem
+{
+    uint64_t Sequence;
+    T Value;
+};
+
+// What PopMatchingAsync found
+template <typename T>
+struct RingMatch
+{
+    // Empty if nothing matched before the timeout, or the ring was closed
+    std::optional<SequencedItem<T>> Item;
+    // The newest item that didn't match, kept for describing a failure
+    std::optional<SequencedItem<T>> LastMiss;
+    // Items that didn't match, LastMiss included
+    uint64_t Skipped = 0;
+    // From the co_await to the match, or to giving up
+    std::chrono::steady_clock::duration Elapsed{};
+};
+
+namespace spsc
+{
+    // Someone parked until the other side of the ring does something. Whoever
+    // takes it out of the ring's slot calls Wake, exactly once.
+    struct Waiter
+    {
+        void (*Wake)(Waiter* waiter) = nullptr;
+    };
+
+    // Parks a thread
+    struct ThreadWaiter : Waiter
+    {
+        ThreadWaiter()
+        {
+            Wake = [](Waiter* waiter)
+            {
+                auto self = static_cast<ThreadWaiter*>(waiter);
+                // Notify under the lock, the waiter can go away as soon as it
+                // sees Woken
+                std::lock_guard lock(self->Lock);
+                self->Woken = true;
+                self->Condition.notify_one();
+            };
+        }
+
+        bool WaitUntil(std::chrono::steady_clock::time_point deadline)
+        {
+            std::unique_lock lock(Lock);
+            return Condition.wait_until(lock, deadline, [this]() { return Woken; });
+        }
+        void Wait()
+        {
+            std::unique_lock lock(Lock);
+            Condition.wait(lock, [this]() { return Woken; });
+        }
+
+        std::mutex Lock;
+        std::condition_variable Condition;
+        bool Woken = false;
+    };
+}
+
+// A bounded ring with one producer and one consumer, for handing frames from
+// FrameArrived to the test waiting on them. Push and TryPop don't take locks:
+// each slot has a turn counter that says whose it is, and the consumer claims
+// the oldest item by moving the head along with a compare exchange. With
+// DropOldest the producer claims it the same way when the ring is full, so a
+// slow consumer always gets the newest frames. Block parks the producer until
+// there's room, DropNewest turns the new item away. Either way that counts as
+// an overflow.
+//
+// Only the waits park anything. The consumer can wait from a thread (Pop) or
+// a coroutine (PopAsync); the producer only parks under Block.
+template <typename T>
+class SpscRing
+{
+public:
+    SpscRing(size_t capacity, QueueFullPolicy policy) : m_capacity(std::max<size_t>(1, capacity)), m_policy(policy), m_slots(std::make_unique<Slot[]>(m_capacity))
+    {
+        for (size_t i = 0; i < m_capacity; i++)
+        {
+            m_slots[i].Turn.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    SpscRing(SpscRing const&) = delete;
+    SpscRing& operator=(SpscRing const&) = delete;
+
+    // Producer only. Blocks under QueueFullPolicy::Block until there's room or
+    // the ring is closed.
+    QueuePushResult Push(T&& item)
+    {
+        auto result = QueuePushResult::Queued;
+        auto tail = m_tail.load(std::memory_order_relaxed);
+        auto countedOverflow = false;
+        while (true)
+        {
+            if (m_closed.load())
+            {
+                return QueuePushResult::Closed;
+            }
+            auto head = m_head.load();
+            if (tail - head < m_capacity)
+            {
+                break;
+            }
+            if (!countedOverflow)
+            {
+                m_overflows.fetch_add(1, std::memory_order_relaxed);
+                countedOverflow = true;
+            }
+            if (m_policy == QueueFullPolicy::DropNewest)
+            {
+                return QueuePushResult::Dropped;
+            }
+            if (m_policy == QueueFullPolicy::DropOldest)
+            {
+                // Race the consumer for the oldest item. If it wins there's
+                // room now anyway.
+                if (m_head.compare_exchange_strong(head, head + 1))
+                {
+                    Release(head);
+                    result = QueuePushResult::QueuedDroppedOldest;
+                }
+                continue;
+            }
+            WaitForRoom(tail);
+        }
+
+        // The consumer may still be moving the last item out of this slot
+        auto& slot = m_slots[tail % m_capacity];
+        while (slot.Turn.load(std::memory_order_acquire) != tail)
+        {
+            std::this_thread::yield();
+        }
+        slot.Value.emplace(std::move(item));
+        slot.Turn.store(tail + 1, std::memory_order_release);
+        m_tail.store(tail + 1);
+        WakeWaiter(m_consumerWaiter);
+        return result;
+    }
+
+    // Consumer only
+    std::optional<SequencedItem<T>> TryPop()
+    {
+        auto head = m_head.load();
+        do
+        {
+            if (head == m_tail.load())
+            {
+                return std::nullopt;
+            }
+        } while (!m_head.compare_exchange_weak(head, head + 1));
+
+        auto& slot = m_slots[head % m_capacity];
+        std::optional<SequencedItem<T>> item(SequencedItem<T>{ head, std::move(*slot.Value) });
+        Release(head);
+        WakeWaiter(m_producerWaiter);
+        return item;
+    }
+
+    // Consumer only. Waits on the calling thread for an item. Returns nothing
+    // if the timeout passes first, or the ring is closed and empty. A timeout
+    // of duration::max() waits for as long as it takes.
+    std::optional<SequencedItem<T>> Pop(std::chrono::steady_clock::duration timeout)
+    {
+        auto forever = timeout == std::chrono::steady_clock::duration::max();
+        auto deadline = forever ? std::chrono::steady_clock::time_point::max() : std::chrono::steady_clock::now() + timeout;
+        while (true)
+        {
+            auto item = TryPop();
+            if (item || IsClosed())
+            {
+                return item;
+            }
+            // A push that was already waking someone can wake this waiter
+            // after the item it pushed has been taken, so go round again
+            // until there's something there
+            spsc::ThreadWaiter waiter;
+            if (Park(m_consumerWaiter, &waiter, [this]() { return !Empty() || IsClosed(); }))
+            {
+                if (forever)
+                {
+                    waiter.Wait();
+                }
+                else if (!waiter.WaitUntil(deadline))
+                {
+                    if (Unpark(m_consumerWaiter, &waiter))
+                    {
+                        return TryPop();
+                    }
+                    // Lost the race to a push, which is in the middle of
+                    // waking us
+                    waiter.Wait();
+                }
+            }
+        }
+    }
+
+    // Consumer only. co_await ring.PopAsync(timeout) gives what Pop would. The
+    // coroutine resumes on the producer's thread, or the shared TimerQueue's
+    // when it times out, so switch threads afterwards if that matters.
+    auto PopAsync(std::chrono::steady_clock::duration timeout) { return PopAwaiter(*this, timeout); }
+
+    // Consumer only. co_await ring.PopMatchingAsync(predicate, timeout) takes
+    // items until predicate(item) is true, the timeout passes or the ring is
+    // closed, and gives a RingMatch. The predicate runs on whichever thread
+    // is consuming at the time, usually the producer's, which is where the
+    // coroutine resumes too.
+    template <typename Predicate>
+    auto PopMatchingAsync(Predicate predicate, std::chrono::steady_clock::duration timeout) { return MatchAwaiter<Predicate>(*this, std::move(predicate), timeout); }
+
+    // Wakes up both sides. Items already in the ring can still be popped.
+    void Close()
+    {
+        m_closed.store(true);
+        WakeWaiter(m_consumerWaiter);
+        WakeWaiter(m_producerWaiter);
+    }
+    bool IsClosed() const { return m_closed.load(); }
+
+    bool Empty() const { return m_head.load() == m_tail.load(); }
+    size_t Size() const
+    {
+        auto head = m_head.load();
+        auto tail = m_tail.load();
+        return static_cast<size_t>(tail > head ? tail - head : 0);
+    }
+    size_t Capacity() const { return m_capacity; }
+    // Items that have gone into the ring, which is also the next one's
+    // sequence. DropNewest's rejects don't count.
+    uint64_t Pushed() const { return m_tail.load(); }
+    // Pushes that found the ring full, whatever the policy did about it
+    uint64_t Overflows() const { return m_overflows.load(std::memory_order_relaxed); }
+
+private:
+    struct Slot
+    {
+        // The position this slot is waiting for: Turn == p means it's free for
+        // the push at p, Turn == p + 1 means that push has filled it
+        std::atomic<uint64_t> Turn{ 0 };
+        std::optional<T> Value;
+    };
+
+    template <typename Predicate>
+    class MatchAwaiter : public spsc::Waiter
+    {
+    public:
+        MatchAwaiter(SpscRing& ring, Predicate predicate, std::chrono::steady_clock::duration timeout) :
+            m_ring(ring), m_predicate(std::move(predicate)), m_timeout(timeout), m_start(std::chrono::steady_clock::now()) {}
+
+        bool await_ready() { return Ready(); }
+
+        // Generic over the handle type, so this works with std:: and
+        // std::experimental:: coroutines alike
+        template <typename Handle>
+        bool await_suspend(Handle handle)
+        {
+            m_handle = handle.address();
+            m_resume = [](void* address) { Handle::from_address(address).resume(); };
+            Wake = [](spsc::Waiter* waiter)
+            {
+                // A wake that comes while the awaiter is still parking leaves
+                // it to the parking thread, rather than resuming under it
+                auto self = static_cast<MatchAwaiter*>(waiter);
+                if (self->m_state.exchange(Woken) == Suspended)
+                {
+                    self->Settle();
+                }
+            };
+            // The timer can fire before the awaiter is parked, so it leaves a
+            // flag for the check after parking. Cancelling it in
+            // await_resume keeps the awaiter alive until it's done.
+            if (m_timeout != std::chrono::steady_clock::duration::max())
+            {
+                m_timer = TimerQueue::Shared().Schedule(m_start + m_timeout, [ring = &m_ring, this]()
+                {
+                    m_timedOut.store(true);
+                    if (ring->Unpark(ring->m_consumerWaiter, this))
+                    {
+                        Wake(this);
+                    }
+                });
+            }
+            return ParkUntilReady();
+        }
+
+        RingMatch<T> await_resume()
+        {
+            if (m_timer != 0)
+            {
+                TimerQueue::Shared().Cancel(m_timer);
+            }
+            m_match.Elapsed = std::chrono::steady_clock::now() - m_start;
+            return std::move(m_match);
+        }
+
+    private:
+        enum State { Suspending, Suspended, Woken };
+
+        // Consumes everything that's there until something matches. It gets
+        // asked again after Park's recheck, so a match has to stick.
+        bool Ready()
+        {
+            if (m_match.Item)
+            {
+                return true;
+            }
+            while (auto item = m_ring.TryPop())
+            {
+                if (m_predicate(item->Value))
+                {
+                    m_match.Item = std::move(item);
+                    return true;
+                }
+                m_match.Skipped++;
+                m_match.LastMiss = std::move(item);
+            }
+            return m_ring.IsClosed() || m_timedOut.load();
+        }
+
+        // Returns false if the coroutine should carry on now. Once it's
+        // returned true anything else could resume the coroutine and finish
+        // it, so the awaiter and ring are off limits. Wakes can be spurious
+        // (see Pop), which just means parking again.
+        bool ParkUntilReady()
+        {
+            auto ring = &m_ring;
+            while (!Ready())
+            {
+                m_state.store(Suspending);
+                if (ring->Park(ring->m_consumerWaiter, this, [this]() { return Ready(); }) && m_state.exchange(Suspended) != Woken)
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        // Called by whoever woke the coroutine while it was suspended, which
+        // makes them the only one who can resume it
+        void Settle()
+        {
+            auto resume = m_resume;
+            auto handle = m_handle;
+            if (!ParkUntilReady())
+            {
+                resume(handle);
+            }
+        }
+
+        SpscRing& m_ring;
+        Predicate m_predicate;
+        std::chrono::steady_clock::duration m_timeout;
+        std::chrono::steady_clock::time_point m_start;
+        RingMatch<T> m_match;
+        void* m_handle = nullptr;
+        void (*m_resume)(void* address) = nullptr;
+        uint64_t m_timer = 0;
+        std::atomic<bool> m_timedOut{ false };
+        std::atomic<State> m_state{ Suspending };
+    };
+
+    struct AcceptAll
+    {
+        bool operator()(T const&) const { return true; }
+    };
+
+    class PopAwaiter : public MatchAwaiter<AcceptAll>
+    {
+    public:
+        PopAwaiter(SpscRing& ring, std::chrono::steady_clock::duration timeout) : MatchAwaiter<AcceptAll>(ring, AcceptAll{}, timeout) {}
+
+        std::optional<SequencedItem<T>> await_resume() { return MatchAwaiter<AcceptAll>::await_resume().Item; }
+    };
+
+    // Empties the slot holding position, handing it to the push that's a lap
+    // behind
+    void Release(uint64_t position)
+    {
+        auto& slot = m_slots[position % m_capacity];
+        slot.Value.reset();
+        slot.Turn.store(position + m_capacity, std::memory_order_release);
+    }
+
+    // Puts the waiter in the slot, then checks ready again in case the other
+    // side did something in between. Returns false if the waiter shouldn't
+    // wait after all. If it can't take itself back out, someone else has it
+    // and is waking it, so it waits for that instead.
+    template <typename Ready>
+    bool Park(std::atomic<spsc::Waiter*>& slot, spsc::Waiter* waiter, Ready&& ready)
+    {
+        slot.store(waiter);
+        if (ready() && Unpark(slot, waiter))
+        {
+            return false;
+        }
+        return true;
+    }
+    bool Unpark(std::atomic<spsc::Waiter*>& slot, spsc::Waiter* waiter)
+    {
+        return slot.compare_exchange_strong(waiter, nullptr);
+    }
+    void WakeWaiter(std::atomic<spsc::Waiter*>& slot)
+    {
+        if (slot.load() != nullptr)
+        {
+            if (auto waiter = slot.exchange(nullptr))
+            {
+                waiter->Wake(waiter);
+            }
+        }
+    }
+
+    void WaitForRoom(uint64_t tail)
+    {
+        spsc::ThreadWaiter waiter;
+        if (Park(m_producerWaiter, &waiter, [this, tail]() { return tail - m_head.load() < m_capacity || IsClosed(); }))
+        {
+            waiter.Wait();
+        }
+    }
+
+    size_t const m_capacity;
+    QueueFullPolicy const m_policy;
+    std::unique_ptr<Slot[]> m_slots;
+    std::atomic<uint64_t> m_head{ 0 };
+    std::atomic<uint64_t> m_tail{ 0 };
+    std::atomic<uint64_t> m_overflows{ 0 };
+    std::atomic<spsc::Waiter*> m_consumerWaiter{ nullptr };
+    std::atomic<spsc::Waiter*> m_producerWaiter{ nullptr };
+    std::atomic<bool> m_closed{ false };
+};
@@ -0,0 +1,368 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Global state a test takes over while it runs. Tests that need the same
+// resource never run at the same time; everything else runs in parallel.
+enum class SuiteResource : uint32_t
+{
+    None = 0,
+    // System cursor shapes (CursorScope) and the cursor position
+    Cursor = 1 << 0,
+    // An output owned by a fullscreen window
+    FullscreenOutput = 1 << 1,
+    // Turning the monitors off and back on
+    MonitorPower = 1 << 2,
+    // Nothing else may run at the same time, e.g. monitor captures that
+    // would see other tests' windows, or tests that measure frame rates.
+    Exclusive = 1u << 31,
+};
+
+inline SuiteResource operator|(SuiteResource left, SuiteResource right)
+{
+    return static_cast<SuiteResource>(static_cast<uint32_t>(left) | static_cast<uint32_t>(right));
+}
+inline SuiteResource operator&(SuiteResource left, SuiteResource right)
+{
+    return static_cast<SuiteResource>(static_cast<uint32_t>(left) & static_cast<uint32_t>(right));
+}
+inline bool HasResource(SuiteResource resources, SuiteResource resource)
+{
+    return (resources & resource) != SuiteResource::None;
+}
+
+inline std::string SuiteResourceNames(SuiteResource resources)
+{
+    std::string names;
+    auto add = [&](SuiteResource resource, char const* name)
+    {
+        if (HasResource(resources, resource))
+        {
+            names += (names.empty() ? "" : ",");
+            names += name;
+        }
+    };
+    add(SuiteResource::Cursor, "cursor");
+    add(SuiteResource::FullscreenOutput, "fullscreen-output");
+    add(SuiteResource::MonitorPower, "monitor-power");
+    add(SuiteResource::Exclusive, "exclusive");
+    return names.empty() ? "none" : names;
+}
+
+// Whether two tests can't run at the same time
+inline bool SuiteResourcesConflict(SuiteResource left, SuiteResource right)
+{
+    if (HasResource(left, SuiteResource::Exclusive) || HasResource(right, SuiteResource::Exclusive))
+    {
+        return true;
+    }
+    return (left & right) != SuiteResource::None;
+}
+
+struct SuiteTest
+{
+    std::string Name;
+    // The test's command line, without the program name
+    std::vector<std::string> Arguments;
+    SuiteResource Resources = SuiteResource::None;
+    // Zero waits forever
+    std::chrono::milliseconds Timeout = std::chrono::milliseconds(0);
+};
+
+enum class SuiteVerdict
+{
+    Passed,
+    Failed,
+    // The worker process died while running the test
+    Crashed,
+    TimedOut,
+};
+
+inline char const* SuiteVerdictName(SuiteVerdict verdict)
+{
+    switch (verdict)
+    {
+    case SuiteVerdict::Passed:
+        return "PASSED";
+    case SuiteVerdict::Failed:
+        return "FAILED";
+    case SuiteVerdict::Crashed:
+        return "CRASHED";
+    default:
+        return "TIMED OUT";
+    }
+}
+
+struct SuiteTestResult
+{
+    std::string Name;
+    SuiteVerdict Verdict = SuiteVerdict::Failed;
+    // Everything the test printed
+    std::string Output;
+    uint32_t Worker = 0;
+    // Milliseconds since the suite started
+    double StartTime = 0.0;
+    double WallTime = 0.0;
+};
+
+struct SuiteReport
+{
+    // In the same order as the suite
+    std::vector<SuiteTestResult> Results;
+    uint32_t Workers = 0;
+    double WallTime = 0.0;
+
+    size_t Count(SuiteVerdict verdict) const
+    {
+        return std::count_if(Results.begin(), Results.end(), [verdict](SuiteTestResult const& result) { return result.Verdict == verdict; });
+    }
+    bool Passed() const { return Count(SuiteVerdict::Passed) == Results.size(); }
+};
+
+// Runs one test on a worker slot and reports how it went. Each slot always
+// calls from the same thread, one test at a time. The scheduler fills in the
+// name, worker and timing.
+typedef std::function<SuiteTestResult(uint32_t worker, SuiteTest const& test)> SuiteRunner;
+
+// Hands tests out to a fixed number of worker slots, in suite order, never
+// running two tests with conflicting resources at once. A test that's held
+// up by a conflict is skipped over, except for exclusive tests: nothing
+// after them starts until they've run, so they can't be starved.
+class SuiteScheduler
+{
+public:
+    SuiteScheduler(uint32_t workerCount, SuiteRunner runner) : m_workerCount(std::max(1u, workerCount)), m_runner(std::move(runner)) {}
+
+    SuiteReport Run(std::vector<SuiteTest> const& tests)
+    {
+        m_tests = &tests;
+        m_started.assign(tests.size(), false);
+        m_running.clear();
+        m_remaining = tests.size();
+
+        SuiteReport report;
+        report.Workers = m_workerCount;
+        report.Results.resize(tests.size());
+        m_start = std::chrono::steady_clock::now();
+        std::vector<std::thread> workers;
+        for (uint32_t i = 0; i < std::min<size_t>(m_workerCount, tests.size()); i++)
+        {
+            workers.emplace_back([this, i, &report]() { WorkerLoop(i, report); });
+        }
+        for (auto&& worker : workers)
+        {
+            worker.join();
+        }
+        report.WallTime = Milliseconds(std::chrono::steady_clock::now());
+        m_tests = nullptr;
+        return report;
+    }
+
+private:
+    double Milliseconds(std::chrono::steady_clock::time_point time) const
+    {
+        return std::chrono::duration<double, std::milli>(time - m_start).count();
+    }
+
+    // Called with the lock held. Returns tests.size() if nothing can start yet.
+    size_t NextRunnable() const
+    {
+        auto& tests = *m_tests;
+        for (size_t i = 0; i < tests.size(); i++)
+        {
+            if (m_started[i])
+            {
+                continue;
+            }
+            auto blocked = std::any_of(m_running.begin(), m_running.end(), [&](size_t running)
+            {
+                return SuiteResourcesConflict(tests[running].Resources, tests[i].Resources);
+            });
+            if (!blocked)
+            {
+                return i;
+            }
+            if (HasResource(tests[i].Resources, SuiteResource::Exclusive))
+            {
+                break;
+            }
+        }
+        return tests.size();
+    }
+
+    void WorkerLoop(uint32_t worker, SuiteReport& report)
+    {
+        auto& tests = *m_tests;
+        while (true)
+        {
+            size_t index = 0;
+            {
+                std::unique_lock lock(m_lock);
+                m_changed.wait(lock, [&]()
+                {
+                    index = NextRunnable();
+                    return m_remaining == 0 || index < tests.size();
+                });
+                if (index >= tests.size())
+                {
+                    return;
+                }
+                m_started[index] = true;
+                m_running.push_back(index);
+                m_remaining--;
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            SuiteTestResult result;
+            try
+            {
+                result = m_runner(worker, tests[index]);
+            }
+            catch (std::exception const& error)
+            {
+                result.Verdict = SuiteVerdict::Failed;
+                result.Output = std::string("Failed to run the test! ") + error.what() + "\n";
+            }
+            auto end = std::chrono::steady_clock::now();
+            result.Name = tests[index].Name;
+            result.Worker = worker;
+            result.StartTime = Milliseconds(start);
+            result.WallTime = std::chrono::duration<double, std::milli>(end - start).count();
+
+            {
+                std::lock_guard lock(m_lock);
+                report.Results[index] = std::move(result);
+                m_running.erase(std::find(m_running.begin(), m_running.end(), index));
+            }
+            m_changed.notify_all();
+        }
+    }
+
+private:
+    uint32_t m_workerCount;
+    SuiteRunner m_runner;
+    std::vector<SuiteTest> const* m_tests = nullptr;
+    std::mutex m_lock;
+    std::condition_variable m_changed;
+    std::vector<bool> m_started;
+    std::vector<size_t> m_running;
+    size_t m_remaining = 0;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Splits a command line the way CommandLineToArgvW does, so suite files
+// hold Windows paths as they are. Whitespace separates arguments except
+// inside double quotes. Backslashes are literal unless they come before a
+// double quote: 2n of them then give n and the quote opens or closes, 2n+1
+// give n and a literal quote. Inside quotes "" is a literal quote.
+inline std::vector<std::string> SplitCommandLine(std::string_view line)
+{
+    std::vector<std::string> arguments;
+    std::string current;
+    auto inArgument = false;
+    auto quoted = false;
+    for (size_t i = 0; i < line.size(); i++)
+    {
+        auto c = line[i];
+        if (c == '\\')
+        {
+            size_t backslashes = 0;
+            while (i < line.size() && line[i] == '\\')
+            {
+                backslashes++;
+                i++;
+            }
+            inArgument = true;
+            if (i < line.size() && line[i] == '"')
+            {
+                current.append(backslashes / 2, '\\');
+                if ((backslashes % 2) == 1)
+                {
+                    current.push_back('"');
+                    continue;
+                }
+                // An even run leaves the quote to open or close
+                i--;
+            }
+            else
+            {
+                current.append(backslashes, '\\');
+                i--;
+            }
+        }
+        else if (c == '"')
+        {
+            if (quoted && i + 1 < line.size() && line[i + 1] == '"')
+            {
+                current.push_back('"');
+                i++;
+            }
+            else
+            {
+                quoted = !quoted;
+            }
+            inArgument = true;
+        }
+        else if (!quoted && (c == ' ' || c == '\t' || c == '\r' || c == '\n'))
+        {
+            if (inArgument)
+            {
+                arguments.push_back(std::move(current));
+                current.clear();
+                inArgument = false;
+            }
+        }
+        else
+        {
+            current.push_back(c);
+            inArgument = true;
+        }
+    }
+    if (quoted)
+    {
+        throw std::runtime_error("Unterminated quote");
+    }
+    if (inArgument)
+    {
+        arguments.push_back(std::move(current));
+    }
+    return arguments;
+}
+
+// A suite file has one test command line per line. Blank lines and lines
+// starting with # are ignored. Resources are left for the caller to fill in.
+inline std::vector<SuiteTest> LoadSuiteFile(std::filesystem::path const& path)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        throw std::runtime_error("Could not open suite file: " + path.u8string());
+    }
+    std::vector<SuiteTest> tests;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        auto first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+        {
+            continue;
+        }
+        auto last = line.find_last_not_of(" \t\r");
+        SuiteTest test;
+        test.Name = line.substr(first, last - first + 1);
+        test.Arguments = SplitCommandLine(test.Name);
+        tests.push_back(std::move(test));
+    }
+    return tests;
+}
@@ -0,0 +1,640 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "SuiteScheduler.h"
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+// Suite workers are long lived child processes that run one test at a time,
+// so a suite only pays for process startup once per worker. The protocol is
+// line based over the worker's stdin and stdout:
+//
+//   parent -> worker   @@suite run <id> <argument> <argument> ...
+//   worker -> parent   @@suite result <id> passed|failed
+//
+// Arguments are escaped so they contain no spaces or newlines. Any other
+// line the worker prints is the running test's output. The worker exits when
+// its stdin is closed.
+namespace suiteprotocol
+{
+    constexpr std::string_view Prefix = "@@suite ";
+
+    inline std::string Escape(std::string_view value)
+    {
+        if (value.empty())
+        {
+            return "\\e";
+        }
+        std::string escaped;
+        for (auto c : value)
+        {
+            switch (c)
+            {
+            case '\\':
+                escaped += "\\\\";
+                break;
+            case ' ':
+                escaped += "\\s";
+                break;
+            case '\t':
+                escaped += "\\t";
+                break;
+            case '\r':
+                escaped += "\\r";
+                break;
+            case '\n':
+                escaped += "\\n";
+                break;
+            default:
+                escaped.push_back(c);
+                break;
+            }
+        }
+        return escaped;
+    }
+
+    inline std::string Unescape(std::string_view value)
+    {
+        std::string result;
+        for (size_t i = 0; i < value.size(); i++)
+        {
+            if (value[i] != '\\' || i + 1 >= value.size())
+            {
+                result.push_back(value[i]);
+                continue;
+            }
+            switch (value[++i])
+            {
+            case 's':
+                result.push_back(' ');
+                break;
+            case 't':
+                result.push_back('\t');
+                break;
+            case 'r':
+                result.push_back('\r');
+                break;
+            case 'n':
+                result.push_back('\n');
+                break;
+            case 'e':
+                break;
+            default:
+                result.push_back(value[i]);
+                break;
+            }
+        }
+        return result;
+    }
+
+    inline std::vector<std::string_view> SplitWords(std::string_view line)
+    {
+        std::vector<std::string_view> words;
+        size_t start = 0;
+        while (start < line.size())
+        {
+            auto end = std::min(line.find(' ', start), line.size());
+            if (end > start)
+            {
+                words.push_back(line.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+        return words;
+    }
+
+    inline std::string FormatRun(uint64_t id, std::vector<std::string> const& arguments)
+    {
+        auto line = std::string(Prefix) + "run " + std::to_string(id);
+        for (auto&& argument : arguments)
+        {
+            line += " " + Escape(argument);
+        }
+        return line;
+    }
+
+    inline bool ParseRun(std::string_view line, uint64_t& id, std::vector<std::string>& arguments)
+    {
+        if (line.substr(0, Prefix.size()) != Prefix)
+        {
+            return false;
+        }
+        auto words = SplitWords(line.substr(Prefix.size()));
+        if (words.size() < 2 || words[0] != "run")
+        {
+            return false;
+        }
+        id = std::stoull(std::string(words[1]));
+        arguments.clear();
+        for (size_t i = 2; i < words.size(); i++)
+        {
+            arguments.push_back(Unescape(words[i]));
+        }
+        return true;
+    }
+
+    inline std::string FormatResult(uint64_t id, bool passed)
+    {
+        return std::string(Prefix) + "result " + std::to_string(id) + (passed ? " passed" : " failed");
+    }
+
+    inline bool ParseResult(std::string_view line, uint64_t& id, bool& passed)
+    {
+        if (line.substr(0, Prefix.size()) != Prefix)
+        {
+            return false;
+        }
+        auto words = SplitWords(line.substr(Prefix.size()));
+        if (words.size() != 3 || words[0] != "result" || (words[2] != "passed" && words[2] != "failed"))
+        {
+            return false;
+        }
+        id = std::stoull(std::string(words[1]));
+        passed = words[2] == "passed";
+        return true;
+    }
+}
+
+// The worker side of the protocol. Reads requests until input closes and
+// runs each one with runTest, which returns whether the test passed.
+// writeLine must flush, so results never overtake the test's own output.
+inline int RunSuiteWorkerLoop(
+    std::istream& input,
+    std::function<void(std::string const&)> const& writeLine,
+    std::function<bool(std::vector<std::string> const&)> const& runTest)
+{
+    std::string line;
+    while (std::getline(input, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        uint64_t id = 0;
+        std::vector<std::string> arguments;
+        if (!suiteprotocol::ParseRun(line, id, arguments))
+        {
+            continue;
+        }
+        auto passed = false;
+        try
+        {
+            passed = runTest(arguments);
+        }
+        catch (std::exception const& error)
+        {
+            writeLine(std::string("Test threw an exception! ") + error.what());
+        }
+        writeLine(suiteprotocol::FormatResult(id, passed));
+    }
+    return 0;
+}
+
+// A child process with its stdin and stdout (and stderr) redirected to us.
+// Output is read on a background thread and handed out a line at a time.
+class SuiteWorkerProcess
+{
+public:
+    SuiteWorkerProcess(std::vector<std::string> const& commandLine)
+    {
+        if (commandLine.empty())
+        {
+            throw std::invalid_argument("Empty worker command line");
+        }
+        Start(commandLine);
+        m_reader = std::thread([this]() { ReadLoop(); });
+    }
+    ~SuiteWorkerProcess()
+    {
+        // Closing stdin asks the worker to exit, give it a moment to do so
+        CloseInput();
+        {
+            std::unique_lock lock(m_lock);
+            m_changed.wait_for(lock, std::chrono::seconds(5), [this]() { return m_ended; });
+        }
+        Kill();
+        m_reader.join();
+        Wait();
+    }
+
+    SuiteWorkerProcess(SuiteWorkerProcess const&) = delete;
+    SuiteWorkerProcess& operator=(SuiteWorkerProcess const&) = delete;
+
+    // Returns false if the worker has gone away
+    bool WriteLine(std::string const& line)
+    {
+        auto data = line + "\n";
+        size_t written = 0;
+        while (written < data.size())
+        {
+#if defined(_WIN32)
+            DWORD count = 0;
+            if (!WriteFile(m_input, data.data() + written, static_cast<DWORD>(data.size() - written), &count, nullptr))
+            {
+                return false;
+            }
+#else
+            auto count = write(m_input, data.data() + written, data.size() - written);
+            if (count <= 0)
+            {
+                return false;
+            }
+#endif
+            written += static_cast<size_t>(count);
+        }
+        return true;
+    }
+
+    // Waits for the next line of output. Returns nothing if the timeout
+    // passes first (zero waits forever) or the worker's output has ended.
+    std::optional<std::string> ReadLine(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock lock(m_lock);
+        auto ready = [this]() { return !m_lines.empty() || m_ended; };
+        if (timeout.count() > 0)
+        {
+            m_changed.wait_for(lock, timeout, ready);
+        }
+        else
+        {
+            m_changed.wait(lock, ready);
+        }
+        if (m_lines.empty())
+        {
+            return std::nullopt;
+        }
+        auto line = std::move(m_lines.front());
+        m_lines.pop_front();
+        return line;
+    }
+
+    // True once the worker has closed its output (usually by exiting) and
+    // every line has been read
+    bool Ended() const
+    {
+        std::lock_guard lock(m_lock);
+        return m_ended && m_lines.empty();
+    }
+
+    void Kill()
+    {
+        std::lock_guard lock(m_processLock);
+#if defined(_WIN32)
+        if (m_process != nullptr)
+        {
+            TerminateProcess(m_process, 1);
+        }
+#else
+        if (m_pid > 0)
+        {
+            kill(m_pid, SIGKILL);
+        }
+#endif
+    }
+
+private:
+    // Pipes are created and handed to the child under one lock, so a worker
+    // started at the same time on another thread can't inherit our ends and
+    // keep them open after we're done with them.
+    static std::mutex& SpawnLock()
+    {
+        static std::mutex lock;
+        return lock;
+    }
+
+#if defined(_WIN32)
+    static std::wstring Widen(std::string const& value)
+    {
+        if (value.empty())
+        {
+            return {};
+        }
+        auto length = MultiByteToWideChar(CP_UTF8, 0, value.data(), static_cast<int>(value.size()), nullptr, 0);
+        std::wstring result(length, L'\0');
+        MultiByteToWideChar(CP_UTF8, 0, value.data(), static_cast<int>(value.size()), result.data(), length);
+        return result;
+    }
+
+    // Quotes an argument so CommandLineToArgvW (and the CRT) give it back unchanged
+    static std::wstring QuoteArgument(std::wstring const& argument)
+    {
+        if (!argument.empty() && argument.find_first_of(L" \t\n\v\"") == std::wstring::npos)
+        {
+            return argument;
+        }
+        std::wstring quoted = L"\"";
+        size_t backslashes = 0;
+        for (auto c : argument)
+        {
+            if (c == L'\\')
+            {
+                backslashes++;
+                continue;
+            }
+            quoted.append(c == L'"' ? (backslashes * 2) + 1 : backslashes, L'\\');
+            quoted.push_back(c);
+            backslashes = 0;
+        }
+        quoted.append(backslashes * 2, L'\\');
+        quoted.push_back(L'"');
+        return quoted;
+    }
+
+    void Start(std::vector<std::string> const& commandLine)
+    {
+        std::wstring line;
+        for (auto&& argument : commandLine)
+        {
+            line += (line.empty() ? L"" : L" ") + QuoteArgument(Widen(argument));
+        }
+
+        std::lock_guard lock(SpawnLock());
+        SECURITY_ATTRIBUTES attributes = { sizeof(attributes), nullptr, TRUE };
+        HANDLE childInput = nullptr;
+        HANDLE childOutput = nullptr;
+        if (!CreatePipe(&childInput, &m_input, &attributes, 0) || !CreatePipe(&m_output, &childOutput, &attributes, 0))
+        {
+            throw std::runtime_error("Failed to create worker pipes");
+        }
+        SetHandleInformation(m_input, HANDLE_FLAG_INHERIT, 0);
+        SetHandleInformation(m_output, HANDLE_FLAG_INHERIT, 0);
+
+        STARTUPINFOW startupInfo = {};
+        startupInfo.cb = sizeof(startupInfo);
+        startupInfo.dwFlags = STARTF_USESTDHANDLES;
+        startupInfo.hStdInput = childInput;
+        startupInfo.hStdOutput = childOutput;
+        startupInfo.hStdError = childOutput;
+        PROCESS_INFORMATION processInfo = {};
+        auto created = CreateProcessW(nullptr, line.data(), nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startupInfo, &processInfo);
+        CloseHandle(childInput);
+        CloseHandle(childOutput);
+        if (!created)
+        {
+            CloseHandle(m_input);
+            CloseHandle(m_output);
+            throw std::runtime_error("Failed to start worker: " + commandLine[0]);
+        }
+        CloseHandle(processInfo.hThread);
+        m_process = processInfo.hProcess;
+    }
+
+    size_t ReadOutput(char* buffer, size_t size)
+    {
+        DWORD count = 0;
+        if (!ReadFile(m_output, buffer, static_cast<DWORD>(size), &count, nullptr))
+        {
+            return 0;
+        }
+        return count;
+    }
+
+    void CloseInput()
+    {
+        if (m_input != nullptr)
+        {
+            CloseHandle(m_input);
+            m_input = nullptr;
+        }
+    }
+
+    void Wait()
+    {
+        WaitForSingleObject(m_process, INFINITE);
+        CloseHandle(m_process);
+        CloseHandle(m_output);
+        m_process = nullptr;
+    }
+#else
+    void Start(std::vector<std::string> const& commandLine)
+    {
+        // A worker that dies while we're writing to it shouldn't take us down too
+        static auto const ignoreSigPipe = signal(SIGPIPE, SIG_IGN);
+        (void)ignoreSigPipe;
+
+        std::vector<char*> argv;
+        for (auto&& argument : commandLine)
+        {
+            argv.push_back(const_cast<char*>(argument.c_str()));
+        }
+        argv.push_back(nullptr);
+
+        std::lock_guard lock(SpawnLock());
+        int inputPipe[2] = { -1, -1 };
+        int outputPipe[2] = { -1, -1 };
+        if (pipe(inputPipe) != 0 || pipe(outputPipe) != 0)
+        {
+            throw std::runtime_error("Failed to create worker pipes");
+        }
+        for (auto fd : { inputPipe[0], inputPipe[1], outputPipe[0], outputPipe[1] })
+        {
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, inputPipe[0], STDIN_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, outputPipe[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, outputPipe[1], STDERR_FILENO);
+        auto result = posix_spawnp(&m_pid, argv[0], &actions, nullptr, argv.data(), environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(inputPipe[0]);
+        close(outputPipe[1]);
+        m_input = inputPipe[1];
+        m_output = outputPipe[0];
+        if (result != 0)
+        {
+            close(m_input);
+            close(m_output);
+            m_pid = -1;
+            throw std::runtime_error("Failed to start worker: " + commandLine[0]);
+        }
+    }
+
+    size_t ReadOutput(char* buffer, size_t size)
+    {
+        while (true)
+        {
+            auto count = read(m_output, buffer, size);
+            if (count < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return count > 0 ? static_cast<size_t>(count) : 0;
+        }
+    }
+
+    void CloseInput()
+    {
+        if (m_input >= 0)
+        {
+            close(m_input);
+            m_input = -1;
+        }
+    }
+
+    void Wait()
+    {
+        int status = 0;
+        waitpid(m_pid, &status, 0);
+        close(m_output);
+        std::lock_guard lock(m_processLock);
+        m_pid = -1;
+    }
+#endif
+
+    void ReadLoop()
+    {
+        char buffer[4096];
+        std::string pending;
+        while (auto count = ReadOutput(buffer, sizeof(buffer)))
+        {
+            pending.append(buffer, count);
+            size_t start = 0;
+            size_t end = 0;
+            std::vector<std::string> lines;
+            while ((end = pending.find('\n', start)) != std::string::npos)
+            {
+                auto length = end - start;
+                if (length > 0 && pending[end - 1] == '\r')
+                {
+                    length--;
+                }
+                lines.push_back(pending.substr(start, length));
+                start = end + 1;
+            }
+            pending.erase(0, start);
+            if (!lines.empty())
+            {
+                std::lock_guard lock(m_lock);
+                for (auto&& line : lines)
+                {
+                    m_lines.push_back(std::move(line));
+                }
+            }
+            m_changed.notify_all();
+        }
+        {
+            std::lock_guard lock(m_lock);
+            if (!pending.empty())
+            {
+                m_lines.push_back(std::move(pending));
+            }
+            m_ended = true;
+        }
+        m_changed.notify_all();
+    }
+
+private:
+#if defined(_WIN32)
+    HANDLE m_process = nullptr;
+    HANDLE m_input = nullptr;
+    HANDLE m_output = nullptr;
+#else
+    pid_t m_pid = -1;
+    int m_input = -1;
+    int m_output = -1;
+#endif
+    std::mutex m_processLock;
+    std::thread m_reader;
+    mutable std::mutex m_lock;
+    std::condition_variable m_changed;
+    std::deque<std::string> m_lines;
+    bool m_ended = false;
+};
+
+// Sends each test to a worker process, one per slot. Workers are started on
+// first use and replaced after a crash or timeout. Not copyable, so hand the
+// scheduler a lambda that calls it.
+class SuiteWorkerRunner
+{
+public:
+    SuiteWorkerRunner(std::vector<std::string> workerCommandLine, uint32_t workerCount) :
+        m_commandLine(std::move(workerCommandLine)), m_workers(workerCount) {}
+
+    SuiteTestResult operator()(uint32_t worker, SuiteTest const& test)
+    {
+        auto& process = m_workers.at(worker);
+        if (process == nullptr || process->Ended())
+        {
+            process = std::make_unique<SuiteWorkerProcess>(m_commandLine);
+            m_processesStarted++;
+        }
+
+        SuiteTestResult result;
+        auto id = ++m_nextId;
+        if (!process->WriteLine(suiteprotocol::FormatRun(id, test.Arguments)))
+        {
+            result.Verdict = SuiteVerdict::Crashed;
+            process.reset();
+            return result;
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + test.Timeout;
+        while (true)
+        {
+            auto remaining = std::chrono::milliseconds(0);
+            if (test.Timeout.count() > 0)
+            {
+                remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+                remaining = std::max(remaining, std::chrono::milliseconds(1));
+            }
+            auto line = process->ReadLine(remaining);
+            if (!line)
+            {
+                result.Verdict = process->Ended() ? SuiteVerdict::Crashed : SuiteVerdict::TimedOut;
+                process->Kill();
+                process.reset();
+                return result;
+            }
+            // Output that didn't end with a newline runs into the result line
+            uint64_t resultId = 0;
+            auto passed = false;
+            auto marker = line->find(suiteprotocol::Prefix);
+            if (marker != std::string::npos && suiteprotocol::ParseResult(std::string_view(*line).substr(marker), resultId, passed) && resultId == id)
+            {
+                if (marker > 0)
+                {
+                    result.Output += line->substr(0, marker) + "\n";
+                }
+                result.Verdict = passed ? SuiteVerdict::Passed : SuiteVerdict::Failed;
+                return result;
+            }
+            result.Output += *line + "\n";
+        }
+    }
+
+    uint64_t ProcessesStarted() const { return m_processesStarted; }
+
+private:
+    std::vector<std::string> m_commandLine;
+    std::vector<std::unique_ptr<SuiteWorkerProcess>> m_workers;
+    std::atomic<uint64_t> m_nextId = 0;
+    std::atomic<uint64_t> m_processesStarted = 0;
+};
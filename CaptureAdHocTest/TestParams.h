@@ -28,11 +28,23 @@ namespace testparams
         AdHoc,
         Automated
     };
+    enum class HDRContentTestMode
+    {
+        AdHoc,
+        Automated
+    };
+    enum class CaptureStressSource
+    {
+        Windows,
+        Monitors,
+        Mixed
+    };
 
     struct Alpha {};
     struct FullscreenRate
     {
         FullscreenMode FullscreenMode = FullscreenMode::SetFullscreenState;
+        std::wstring TracePath;
     };
     struct FullscreenTransition
     {
@@ -43,13 +55,21 @@ namespace testparams
         std::wstring WindowTitle;
         std::chrono::seconds Delay = std::chrono::seconds(0);
         std::chrono::seconds Duration = std::chrono::seconds(10);
+        std::wstring TracePath;
+        bool HashFrames = false;
+        // Zero turns dirty tile tracking off
+        uint32_t DirtyTileSize = 0;
+        std::wstring RecordPath;
     };
     struct CursorDisable
     {
         bool Monitor = false;
         bool Window = false;
     };
-    struct HDRContent {};
+    struct HDRContent
+    {
+        HDRContentTestMode TestMode = HDRContentTestMode::AdHoc;
+    };
     struct DisplayAffinity
     {
         DisplayAffinityMode Mode = DisplayAffinityMode::None;
@@ -65,6 +85,22 @@ namespace testparams
     struct MonitorOff {};
     struct PCInfo {};
     struct MonitorInfo {};
+    struct Suite
+    {
+        std::wstring SuitePath;
+        uint32_t Workers = 4;
+        std::chrono::seconds Timeout = std::chrono::seconds(600);
+    };
+    struct SuiteWorker {};
+    struct CaptureStress
+    {
+        CaptureStressSource Source = CaptureStressSource::Mixed;
+        // Runs 1, 2, 4 ... up to this many sessions at once
+        uint32_t MaxSessions = 64;
+        std::chrono::seconds Duration = std::chrono::seconds(5);
+        // Zero is one per core
+        uint32_t Workers = 0;
+    };
 
     typedef std::variant<
         Alpha,
@@ -78,6 +114,9 @@ namespace testparams
         WindowMargins,
         MonitorOff,
         PCInfo,
-        MonitorInfo
+        MonitorInfo,
+        Suite,
+        SuiteWorker,
+        CaptureStress
     > TestParams;
 };
\ No newline at end of file
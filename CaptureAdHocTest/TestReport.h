@@ -0,0 +1,385 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include "FrameTimer.h"
+#include "FrameTrace.h"
+#include "JsonWriter.h"
+
+// Everything a test found out, beyond what it printed
+struct TestResult
+{
+    std::string Test;
+    std::vector<std::string> Arguments;
+    // PASSED or FAILED, or a suite verdict for suite entries
+    std::string Verdict;
+    double Milliseconds = 0.0;
+    // Each list keeps the order things were first recorded in
+    std::vector<std::pair<std::string, double>> Phases;
+    std::vector<std::pair<std::string, uint64_t>> Counts;
+    std::vector<std::pair<std::string, double>> Values;
+    std::vector<std::pair<std::string, FrameTimeStatistics>> Statistics;
+    std::vector<std::string> Messages;
+    // Frames are only ever streamed out, this is how many there were
+    uint64_t FrameCount = 0;
+    // Per-test results of a suite, or per session count of a stress run
+    std::vector<TestResult> Subtests;
+
+    bool Passed() const { return Verdict == "PASSED"; }
+};
+
+enum class ResultFormat
+{
+    // One document: the per-frame records are streamed into a "frames" array
+    // and the summary follows it.
+    Json,
+    // One document per line: a start line, a line per frame and a result line
+    JsonLines,
+};
+
+// Streams a test result out as it happens. Per-frame records go straight to
+// the stream, so a long rate run costs the same memory as a short one.
+class TestResultWriter
+{
+public:
+    TestResultWriter(std::filesystem::path const& path, ResultFormat format) :
+        m_file(std::make_unique<std::ofstream>(path, std::ios::binary | std::ios::trunc)), m_stream(*m_file), m_json(m_stream), m_format(format)
+    {
+        if (!*m_file)
+        {
+            throw std::runtime_error("Could not create result file: " + path.u8string());
+        }
+    }
+    TestResultWriter(std::ostream& stream, ResultFormat format) : m_stream(stream), m_json(m_stream), m_format(format) {}
+
+    TestResultWriter(TestResultWriter const&) = delete;
+    TestResultWriter& operator=(TestResultWriter const&) = delete;
+
+    void Begin(std::string const& test, std::vector<std::string> const& arguments)
+    {
+        m_json.BeginObject();
+        if (m_format == ResultFormat::JsonLines)
+        {
+            m_json.Field("type", "start");
+        }
+        m_json.Field("test", test);
+        m_json.Key("arguments");
+        m_json.BeginArray();
+        for (auto&& argument : arguments)
+        {
+            m_json.String(argument);
+        }
+        m_json.EndArray();
+        m_json.Field("ticks_per_second", static_cast<uint64_t>(FrameTimeSpan::period::den / FrameTimeSpan::period::num));
+        if (m_format == ResultFormat::Json)
+        {
+            m_json.Key("frames");
+            m_json.BeginArray();
+        }
+        else
+        {
+            m_json.EndObject();
+            m_json.NextLine();
+        }
+    }
+
+    void Frame(FrameTraceRecord const& record, std::optional<uint32_t> renderedFrame)
+    {
+        m_json.BeginObject();
+        if (m_format == ResultFormat::JsonLines)
+        {
+            m_json.Field("type", "frame");
+        }
+        m_json.Field("sequence", record.Sequence);
+        if (renderedFrame)
+        {
+            m_json.Field("rendered_frame", *renderedFrame);
+        }
+        m_json.Field("system_relative_time", record.SystemRelativeTime);
+        m_json.Field("arrival_time", record.ArrivalTime);
+        if (record.RenderFlipTime != 0)
+        {
+            m_json.Field("render_flip_time", record.RenderFlipTime);
+        }
+        m_json.EndObject();
+        if (m_format == ResultFormat::JsonLines)
+        {
+            m_json.NextLine();
+        }
+    }
+
+    // Returns false if anything failed to write
+    bool End(TestResult const& result)
+    {
+        if (m_format == ResultFormat::Json)
+        {
+            m_json.EndArray();
+        }
+        else
+        {
+            m_json.BeginObject();
+            m_json.Field("type", "result");
+        }
+        WriteSummary(result);
+        m_json.EndObject();
+        m_stream.put('\n');
+        m_stream.flush();
+        return static_cast<bool>(m_stream);
+    }
+
+private:
+    void WriteSummary(TestResult const& result)
+    {
+        m_json.Field("verdict", result.Verdict);
+        m_json.Field("passed", result.Passed());
+        m_json.Field("duration_ms", result.Milliseconds);
+        m_json.Field("frame_count", result.FrameCount);
+        m_json.Key("phases_ms");
+        m_json.BeginObject();
+        for (auto&& [name, milliseconds] : result.Phases)
+        {
+            m_json.Field(name, milliseconds);
+        }
+        m_json.EndObject();
+        m_json.Key("counts");
+        m_json.BeginObject();
+        for (auto&& [name, count] : result.Counts)
+        {
+            m_json.Field(name, count);
+        }
+        m_json.EndObject();
+        m_json.Key("values");
+        m_json.BeginObject();
+        for (auto&& [name, value] : result.Values)
+        {
+            m_json.Field(name, value);
+        }
+        m_json.EndObject();
+        m_json.Key("statistics_ms");
+        m_json.BeginObject();
+        for (auto&& [name, stats] : result.Statistics)
+        {
+            m_json.Key(name);
+            WriteStatistics(stats);
+        }
+        m_json.EndObject();
+        m_json.Key("messages");
+        m_json.BeginArray();
+        for (auto&& message : result.Messages)
+        {
+            m_json.String(message);
+        }
+        m_json.EndArray();
+        if (!result.Subtests.empty())
+        {
+            m_json.Key("subtests");
+            m_json.BeginArray();
+            for (auto&& subtest : result.Subtests)
+            {
+                m_json.BeginObject();
+                m_json.Field("test", subtest.Test);
+                WriteSummary(subtest);
+                m_json.EndObject();
+            }
+            m_json.EndArray();
+        }
+    }
+
+    void WriteStatistics(FrameTimeStatistics const& stats)
+    {
+        m_json.BeginObject();
+        m_json.Field("intervals", stats.Intervals);
+        m_json.Field("mean", stats.Mean.count());
+        m_json.Field("stddev", stats.StandardDeviation.count());
+        m_json.Field("jitter", stats.Jitter.count());
+        m_json.Field("min", stats.Min.count());
+        m_json.Field("p50", stats.P50.count());
+        m_json.Field("p90", stats.P90.count());
+        m_json.Field("p99", stats.P99.count());
+        m_json.Field("p99.9", stats.P999.count());
+        m_json.Field("max", stats.Max.count());
+        m_json.EndObject();
+    }
+
+private:
+    std::unique_ptr<std::ofstream> m_file;
+    std::ostream& m_stream;
+    JsonWriter m_json;
+    ResultFormat m_format;
+};
+
+// What a running test records its findings into. Shared with capture
+// callbacks, so every method can be called from any thread.
+class TestReport
+{
+public:
+    // Times a phase of the test until it's destroyed or Stop is called.
+    // A phase that runs more than once adds up.
+    class PhaseScope
+    {
+    public:
+        PhaseScope(TestReport& report, std::string name) : m_report(&report), m_name(std::move(name)), m_start(std::chrono::steady_clock::now()) {}
+        PhaseScope(PhaseScope&& other) noexcept : m_report(std::exchange(other.m_report, nullptr)), m_name(std::move(other.m_name)), m_start(other.m_start) {}
+        PhaseScope(PhaseScope const&) = delete;
+        PhaseScope& operator=(PhaseScope const&) = delete;
+        PhaseScope& operator=(PhaseScope&&) = delete;
+        ~PhaseScope() { Stop(); }
+
+        void Stop()
+        {
+            if (m_report != nullptr)
+            {
+                auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start);
+                std::exchange(m_report, nullptr)->AddPhase(m_name, elapsed.count());
+            }
+        }
+
+    private:
+        TestReport* m_report;
+        std::string m_name;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    TestReport(std::string test, std::vector<std::string> arguments, std::shared_ptr<TestResultWriter> writer = nullptr) :
+        m_writer(std::move(writer)), m_start(std::chrono::steady_clock::now())
+    {
+        m_result.Test = std::move(test);
+        m_result.Arguments = std::move(arguments);
+        if (m_writer)
+        {
+            m_writer->Begin(m_result.Test, m_result.Arguments);
+        }
+    }
+
+    TestReport(TestReport const&) = delete;
+    TestReport& operator=(TestReport const&) = delete;
+
+    [[nodiscard]] PhaseScope Phase(std::string name) { return PhaseScope(*this, std::move(name)); }
+
+    void AddPhase(std::string const& name, double milliseconds)
+    {
+        std::lock_guard lock(m_lock);
+        Find(m_result.Phases, name, 0.0) += milliseconds;
+    }
+    void Count(std::string const& name, uint64_t count)
+    {
+        std::lock_guard lock(m_lock);
+        Find(m_result.Counts, name, uint64_t(0)) = count;
+    }
+    void Value(std::string const& name, double value)
+    {
+        std::lock_guard lock(m_lock);
+        Find(m_result.Values, name, 0.0) = value;
+    }
+    void Statistics(std::string const& name, FrameTimeStatistics const& stats)
+    {
+        std::lock_guard lock(m_lock);
+        Find(m_result.Statistics, name, FrameTimeStatistics{}) = stats;
+    }
+    void Message(std::string message)
+    {
+        std::lock_guard lock(m_lock);
+        m_result.Messages.push_back(std::move(message));
+    }
+    void Subtest(TestResult result)
+    {
+        std::lock_guard lock(m_lock);
+        m_result.Subtests.push_back(std::move(result));
+    }
+
+    // Per-frame records are only kept if something is writing them out.
+    // renderedFrame is the frame number the test rendered, if it knows it.
+    void Frame(FrameTraceRecord const& record, std::optional<uint32_t> renderedFrame = std::nullopt)
+    {
+        std::lock_guard lock(m_lock);
+        m_result.FrameCount++;
+        if (m_writer && !m_finished)
+        {
+            m_writer->Frame(record, renderedFrame);
+        }
+    }
+
+    // Closes out the result and writes it. Anything recorded afterwards is
+    // ignored by the writer. Throws if the result couldn't be written.
+    TestResult FinishWithVerdict(std::string verdict)
+    {
+        std::lock_guard lock(m_lock);
+        if (!m_finished)
+        {
+            m_finished = true;
+            m_result.Verdict = std::move(verdict);
+            m_result.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_start).count();
+            if (m_writer && !m_writer->End(m_result))
+            {
+                throw std::runtime_error("Failed to write the test result");
+            }
+        }
+        return m_result;
+    }
+    TestResult Finish(bool passed) { return FinishWithVerdict(passed ? "PASSED" : "FAILED"); }
+
+private:
+    template <typename T>
+    static T& Find(std::vector<std::pair<std::string, T>>& entries, std::string const& name, T initial)
+    {
+        for (auto&& entry : entries)
+        {
+            if (entry.first == name)
+            {
+                return entry.second;
+            }
+        }
+        return entries.emplace_back(name, initial).second;
+    }
+
+private:
+    std::mutex m_lock;
+    std::shared_ptr<TestResultWriter> m_writer;
+    std::chrono::steady_clock::time_point m_start;
+    TestResult m_result;
+    bool m_finished = false;
+};
+
+struct ResultOutputOptions
+{
+    std::filesystem::path Path;
+    ResultFormat Format = ResultFormat::Json;
+};
+
+// Takes "--json <path>" or "--jsonl <path>" out of a command line. They're
+// accepted on every command, so they're handled before the command is parsed.
+template <typename String>
+std::optional<ResultOutputOptions> TakeResultOutputOption(std::vector<String>& arguments)
+{
+    std::optional<ResultOutputOptions> options;
+    for (size_t i = 0; i < arguments.size();)
+    {
+        auto const& argument = arguments[i];
+        auto isJson = argument == String({ '-', '-', 'j', 's', 'o', 'n' });
+        auto isJsonLines = argument == String({ '-', '-', 'j', 's', 'o', 'n', 'l' });
+        if (!isJson && !isJsonLines)
+        {
+            i++;
+            continue;
+        }
+        if (options)
+        {
+            throw std::runtime_error("Only one of --json and --jsonl may be given");
+        }
+        if (i + 1 >= arguments.size())
+        {
+            throw std::runtime_error("--json and --jsonl need a path");
+        }
+        options = ResultOutputOptions{ std::filesystem::path(arguments[i + 1]), isJson ? ResultFormat::Json : ResultFormat::JsonLines };
+        arguments.erase(arguments.begin() + i, arguments.begin() + i + 2);
+    }
+    return options;
+}
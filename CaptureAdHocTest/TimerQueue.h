@@ -0,0 +1,127 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+// One thread that calls callbacks once their deadline passes. Timeouts on
+// waits that can't use a kernel timer (the SPSC ring's awaitable pop, for
+// one) schedule themselves here. Callbacks run one at a time on the timer
+// thread, so they should be short or hand their work off.
+class TimerQueue
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static TimerQueue& Shared()
+    {
+        static TimerQueue queue;
+        return queue;
+    }
+
+    TimerQueue() : m_thread([this]() { ThreadLoop(); }) {}
+    ~TimerQueue()
+    {
+        {
+            std::lock_guard lock(m_lock);
+            m_exiting = true;
+        }
+        m_wake.notify_all();
+        m_thread.join();
+    }
+
+    TimerQueue(TimerQueue const&) = delete;
+    TimerQueue& operator=(TimerQueue const&) = delete;
+
+    // Returns an id to pass to Cancel. Ids are never 0.
+    uint64_t Schedule(Clock::time_point deadline, std::function<void()> callback)
+    {
+        uint64_t id = 0;
+        bool earliest = false;
+        {
+            std::lock_guard lock(m_lock);
+            id = ++m_lastId;
+            auto entry = m_pending.emplace(deadline, Entry{ id, std::move(callback) });
+            earliest = entry == m_pending.begin();
+        }
+        if (earliest)
+        {
+            m_wake.notify_all();
+        }
+        return id;
+    }
+    uint64_t Schedule(Clock::duration delay, std::function<void()> callback)
+    {
+        return Schedule(Clock::now() + delay, std::move(callback));
+    }
+
+    // Once this returns the callback won't run, and isn't running, unless
+    // it's the callback calling. Returns false if it already ran (or is the
+    // one running).
+    bool Cancel(uint64_t id)
+    {
+        std::unique_lock lock(m_lock);
+        for (auto it = m_pending.begin(); it != m_pending.end(); it++)
+        {
+            if (it->second.Id == id)
+            {
+                m_pending.erase(it);
+                return true;
+            }
+        }
+        if (m_runningId == id && std::this_thread::get_id() != m_thread.get_id())
+        {
+            m_done.wait(lock, [this, id]() { return m_runningId != id; });
+        }
+        return false;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t Id;
+        std::function<void()> Callback;
+    };
+
+    void ThreadLoop()
+    {
+        std::unique_lock lock(m_lock);
+        while (!m_exiting)
+        {
+            if (m_pending.empty())
+            {
+                m_wake.wait(lock);
+                continue;
+            }
+            // A copy, Cancel can erase the entry while this waits
+            auto next = m_pending.begin();
+            auto deadline = next->first;
+            if (Clock::now() < deadline)
+            {
+                m_wake.wait_until(lock, deadline);
+                continue;
+            }
+            auto entry = std::move(next->second);
+            m_pending.erase(next);
+            m_runningId = entry.Id;
+            lock.unlock();
+            entry.Callback();
+            lock.lock();
+            m_runningId = 0;
+            m_done.notify_all();
+        }
+    }
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::multimap<Clock::time_point, Entry> m_pending;
+    uint64_t m_lastId = 0;
+    uint64_t m_runningId = 0;
+    bool m_exiting = false;
+    std::thread m_thread;
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "HalfFloat.h"
+#include "ParallelFor.h"
+
+// Tone maps FP16 (scRGB) frames down to 8-bit BGRA, so an HDR failure can be
+// looked at in any image viewer. Both curves work on each channel by itself,
+// so they're baked into a table indexed by the bits of the half. That's exact,
+// and a lookup is cheaper than the pow() either curve would need per value.
+enum class ToneMapOperator
+{
+    // Extended Reinhard, then the sRGB curve
+    Reinhard,
+    // The SMPTE ST 2084 (HDR10) signal, scaled so WhitePoint is full scale.
+    // Flatter than Reinhard, but every highlight stays distinguishable.
+    Pq,
+};
+
+inline char const* ToneMapOperatorName(ToneMapOperator op)
+{
+    switch (op)
+    {
+    case ToneMapOperator::Reinhard:
+        return "Reinhard";
+    case ToneMapOperator::Pq:
+        return "PQ";
+    }
+    return "Unknown";
+}
+
+struct ToneMapOptions
+{
+    ToneMapOperator Operator = ToneMapOperator::Reinhard;
+    // The scRGB value that maps to white. 12.5 is 1000 nits.
+    float WhitePoint = 12.5f;
+};
+
+namespace tonemap
+{
+    constexpr double NitsPerScRgb = 80.0;
+
+    inline double LinearToSrgb(double value)
+    {
+        return value <= 0.0031308 ? value * 12.92 : (1.055 * std::pow(value, 1.0 / 2.4)) - 0.055;
+    }
+
+    // Absolute luminance to the PQ signal, both from 0 to 1
+    inline double PqEncode(double nits)
+    {
+        constexpr double m1 = 2610.0 / 16384.0;
+        constexpr double m2 = 2523.0 / 4096.0 * 128.0;
+        constexpr double c1 = 3424.0 / 4096.0;
+        constexpr double c2 = 2413.0 / 4096.0 * 32.0;
+        constexpr double c3 = 2392.0 / 4096.0 * 32.0;
+        auto y = std::pow(std::clamp(nits / 10000.0, 0.0, 1.0), m1);
+        return std::pow((c1 + (c2 * y)) / (1.0 + (c3 * y)), m2);
+    }
+}
+
+// The display value, from 0 to 1, for one linear scRGB channel. Negative
+// values and NaN are black, and anything past the white point is white.
+inline double ToneMapValue(double value, ToneMapOptions const& options)
+{
+    if (!(value > 0.0))
+    {
+        return 0.0;
+    }
+    double white = std::max(options.WhitePoint, 1e-3f);
+    if (value >= white)
+    {
+        return 1.0;
+    }
+    switch (options.Operator)
+    {
+    case ToneMapOperator::Pq:
+        return tonemap::PqEncode(value * tonemap::NitsPerScRgb) / tonemap::PqEncode(white * tonemap::NitsPerScRgb);
+    case ToneMapOperator::Reinhard:
+    default:
+        return tonemap::LinearToSrgb(std::min((value * (1.0 + (value / (white * white)))) / (1.0 + value), 1.0));
+    }
+}
+
+// ToneMapValue for every half, rounded to 8 bits
+class ToneMapTable
+{
+public:
+    explicit ToneMapTable(ToneMapOptions const& options = {}) : m_options(options), m_table(1 << 16)
+    {
+        for (uint32_t half = 0; half < m_table.size(); half++)
+        {
+            auto value = ToneMapValue(HalfToFloat(static_cast<uint16_t>(half)), options);
+            m_table[half] = static_cast<uint8_t>(std::lround(value * 255.0));
+        }
+    }
+
+    ToneMapOptions const& Options() const { return m_options; }
+    uint8_t operator[](uint16_t half) const { return m_table[half]; }
+
+private:
+    ToneMapOptions m_options;
+    std::vector<uint8_t> m_table;
+};
+
+namespace tonemap
+{
+    constexpr uint32_t MinRowsPerBand = 16;
+
+    // Captured frames are premultiplied, so mapping the color as it is shows
+    // the frame composited onto black. The preview is always opaque.
+    inline void MapRows(HalfImageView const& image, ToneMapTable const& table, uint8_t* destination, uint32_t pitch, uint32_t firstRow, uint32_t rowCount)
+    {
+        for (auto y = firstRow; y < firstRow + rowCount; y++)
+        {
+            auto source = image.Row(y);
+            auto out = destination + (static_cast<size_t>(pitch) * y);
+            for (uint32_t x = 0; x < image.Width; x++)
+            {
+                auto pixel = source + (static_cast<size_t>(x) * HalfImageView::ChannelsPerPixel);
+                out[(x * 4) + 0] = table[pixel[2]];
+                out[(x * 4) + 1] = table[pixel[1]];
+                out[(x * 4) + 2] = table[pixel[0]];
+                out[(x * 4) + 3] = 255;
+            }
+        }
+    }
+}
+
+// Writes image to destination as BGRA with the given curve
+inline void ToneMapToBgra(HalfImageView const& image, uint8_t* destination, uint32_t pitch, ToneMapTable const& table)
+{
+    tonemap::MapRows(image, table, destination, pitch, 0, image.Height);
+}
+
+// Same output as ToneMapToBgra, in bands on the shared BandPool
+inline void ToneMapToBgraParallel(HalfImageView const& image, uint8_t* destination, uint32_t pitch, ToneMapTable const& table)
+{
+    ParallelForRowBands(image.Height, tonemap::MinRowsPerBand, [&](uint32_t first, uint32_t count)
+    {
+        tonemap::MapRows(image, table, destination, pitch, first, count);
+    });
+}
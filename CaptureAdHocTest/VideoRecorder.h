@@ -0,0 +1,271 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include "BoundedQueue.h"
+#include "BufferPool.h"
+#include "FrameTimer.h"
+#include "ImageView.h"
+#include "MappedFile.h"
+#include "PixelKernels.h"
+
+// Writes uncompressed I420 frames as a Y4M (YUV4MPEG2) stream, through a
+// file mapping that grows in large steps so writing is one big sequential
+// copy per frame. Y4M only has a nominal frame rate, so the real frame
+// timing has to come from somewhere else (e.g. a frame trace).
+class Y4mWriter
+{
+public:
+    // 4k I420 frames are about 12MB, so this is a remap every ~20 frames
+    static constexpr uint64_t GrowSize = 256 * 1024 * 1024;
+
+    Y4mWriter(std::filesystem::path const& path, uint32_t width, uint32_t height, uint32_t frameRate) :
+        m_file(path, GrowSize), m_frameBytes(I420Size(width, height))
+    {
+        // C420jpeg: chroma is sited between the pixels it was averaged from
+        auto header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F" + std::to_string(frameRate) +
+            ":1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n";
+        m_file.Append(header.data(), header.size());
+    }
+
+    Y4mWriter(Y4mWriter const&) = delete;
+    Y4mWriter& operator=(Y4mWriter const&) = delete;
+
+    // frame is a tightly packed I420 image of the stream's size
+    void WriteFrame(uint8_t const* frame)
+    {
+        static char const marker[] = "FRAME\n";
+        m_file.Append(marker, sizeof(marker) - 1);
+        m_file.Append(frame, m_frameBytes);
+        m_frameCount++;
+    }
+
+    uint64_t FrameCount() const { return m_frameCount; }
+    uint64_t SizeInBytes() const { return m_file.Size(); }
+    size_t FrameBytes() const { return m_frameBytes; }
+
+    void Close() { m_file.Close(); }
+
+private:
+    MappedAppendFile m_file;
+    size_t m_frameBytes = 0;
+    uint64_t m_frameCount = 0;
+};
+
+struct VideoRecorderStats
+{
+    uint64_t Submitted = 0;
+    uint64_t Written = 0;
+    // Frames thrown away because the writer was behind
+    uint64_t Dropped = 0;
+    uint64_t Failed = 0;
+    uint64_t BytesWritten = 0;
+    size_t MaxQueueDepth = 0;
+    // Time spent converting to I420. Submit pays it on the calling thread,
+    // SubmitDeferred on the writer thread.
+    LatencyHistogram ConvertLatency;
+    // Time from Submit until the frame was in the file
+    LatencyHistogram WriteLatency;
+    std::string LastError;
+};
+
+// Records captured frames to a Y4M file. Submit converts the frame to I420
+// on the calling thread (it has to be read before the texture is unmapped
+// anyway, and I420 is 3/8 the size of BGRA), then hands it to a writer
+// thread. SubmitDeferred instead hands over a frame that's still being read
+// back, and the writer thread reads and converts it. Neither waits on the
+// writer: when the queue is full the frame is dropped and counted.
+class VideoRecorder
+{
+public:
+    // Reads a frame that's still on its way back from the GPU. Called once,
+    // on the writer thread, and calls back with the frame's pixels before it
+    // returns.
+    using DeferredFrame = std::function<void(std::function<void(BgraImageView const&)> const&)>;
+
+    static constexpr uint32_t DefaultFrameRate = 60;
+    static constexpr size_t DefaultQueueCapacity = 8;
+
+    // Every frame is recorded at this size. Larger frames are cropped and
+    // smaller ones padded with black.
+    VideoRecorder(std::filesystem::path const& path, uint32_t width, uint32_t height, uint32_t frameRate = DefaultFrameRate,
+        size_t queueCapacity = DefaultQueueCapacity, BufferPool& pool = BufferPool::Shared()) :
+        m_writer(path, width, height, frameRate), m_queue(queueCapacity, QueueFullPolicy::DropNewest), m_pool(pool), m_width(width), m_height(height)
+    {
+        m_thread = std::thread([this]() { WriterLoop(); });
+    }
+    ~VideoRecorder()
+    {
+        Close();
+    }
+
+    VideoRecorder(VideoRecorder const&) = delete;
+    VideoRecorder& operator=(VideoRecorder const&) = delete;
+
+    uint32_t Width() const { return m_width; }
+    uint32_t Height() const { return m_height; }
+
+    // Returns false if the frame was dropped
+    bool Submit(BgraImageView const& frame)
+    {
+        {
+            std::lock_guard lock(m_lock);
+            m_stats.Submitted++;
+        }
+        // No point converting a frame that can't be queued
+        if (m_queue.Size() >= m_queue.Capacity())
+        {
+            std::lock_guard lock(m_lock);
+            m_stats.Dropped++;
+            return false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto pixels = Convert(frame);
+        auto end = std::chrono::steady_clock::now();
+
+        auto result = m_queue.Push(Pending{ std::move(pixels), {}, start });
+        std::lock_guard lock(m_lock);
+        m_stats.ConvertLatency.Record(end - start);
+        if (result != QueuePushResult::Queued)
+        {
+            m_stats.Dropped++;
+            return false;
+        }
+        return true;
+    }
+
+    // Returns false if the frame was dropped, in which case read is destroyed
+    // without being called
+    bool SubmitDeferred(DeferredFrame&& read)
+    {
+        {
+            std::lock_guard lock(m_lock);
+            m_stats.Submitted++;
+        }
+        auto result = m_queue.Push(Pending{ {}, std::move(read), std::chrono::steady_clock::now() });
+        if (result != QueuePushResult::Queued)
+        {
+            std::lock_guard lock(m_lock);
+            m_stats.Dropped++;
+            return false;
+        }
+        return true;
+    }
+
+    // For a frame the caller had to drop before it could be submitted, so
+    // that Dropped still counts every frame that isn't in the file
+    void CountDropped()
+    {
+        std::lock_guard lock(m_lock);
+        m_stats.Submitted++;
+        m_stats.Dropped++;
+    }
+
+    // Writes out everything queued so far and closes the file
+    void Close()
+    {
+        m_queue.Close();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+        m_writer.Close();
+    }
+
+    VideoRecorderStats Stats() const
+    {
+        std::lock_guard lock(m_lock);
+        auto stats = m_stats;
+        stats.MaxQueueDepth = m_queue.MaxDepth();
+        return stats;
+    }
+
+private:
+    struct Pending
+    {
+        // Already converted, or empty if Read still has to be called
+        BufferLease Pixels;
+        DeferredFrame Read;
+        std::chrono::steady_clock::time_point SubmittedAt;
+    };
+
+    // Crops or pads the frame to the recording size, as I420
+    BufferLease Convert(BgraImageView const& frame)
+    {
+        auto pixels = m_pool.Lease(I420Size(m_width, m_height));
+        auto planes = I420PlanesFor(pixels.Data(), m_width, m_height);
+        auto content = frame.SubView(PixelRect{ 0, 0, std::min(frame.Width, m_width), std::min(frame.Height, m_height) });
+        if (content.Width != m_width || content.Height != m_height)
+        {
+            auto lumaBytes = static_cast<size_t>(m_width) * m_height;
+            std::memset(pixels.Data(), 16, lumaBytes);
+            std::memset(pixels.Data() + lumaBytes, 128, pixels.Size() - lumaBytes);
+        }
+        ConvertBgraToI420Parallel(content, planes);
+        return pixels;
+    }
+
+    void WriterLoop()
+    {
+        while (auto pending = m_queue.Pop())
+        {
+            std::string error;
+            try
+            {
+                if (pending->Read)
+                {
+                    auto start = std::chrono::steady_clock::now();
+                    pending->Read([&](BgraImageView const& frame) { pending->Pixels = Convert(frame); });
+                    // Lets go of whatever the frame was read from
+                    pending->Read = nullptr;
+                    auto end = std::chrono::steady_clock::now();
+                    std::lock_guard lock(m_lock);
+                    m_stats.ConvertLatency.Record(end - start);
+                }
+                if (!pending->Pixels)
+                {
+                    throw std::runtime_error("Deferred frame wasn't read");
+                }
+                m_writer.WriteFrame(pending->Pixels.Data());
+            }
+            catch (std::exception const& exception)
+            {
+                error = exception.what();
+            }
+            auto end = std::chrono::steady_clock::now();
+            pending->Pixels.Reset();
+
+            std::lock_guard lock(m_lock);
+            if (error.empty())
+            {
+                m_stats.Written++;
+                m_stats.BytesWritten = m_writer.SizeInBytes();
+                m_stats.WriteLatency.Record(end - pending->SubmittedAt);
+            }
+            else
+            {
+                m_stats.Failed++;
+                m_stats.LastError = error;
+            }
+        }
+    }
+
+private:
+    Y4mWriter m_writer;
+    BoundedQueue<Pending> m_queue;
+    BufferPool& m_pool;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    std::thread m_thread;
+    mutable std::mutex m_lock;
+    VideoRecorderStats m_stats;
+};
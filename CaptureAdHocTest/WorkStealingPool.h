@@ -0,0 +1,175 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct WorkStealingPoolStats
+{
+    uint64_t Executed = 0;
+    // Run by a worker other than the one whose queue they were posted to
+    uint64_t Stolen = 0;
+};
+
+// A fixed set of threads, each with its own queue. Work posted with a hint
+// goes to that worker's queue, so related work (one capture session's
+// frames, say) tends to stay on one thread, and a worker that runs out
+// takes from the back of another's queue rather than going to sleep. The
+// queues are short and mutex guarded, which is plenty at frame rates.
+class WorkStealingPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    WorkStealingPool(uint32_t threadCount)
+    {
+        threadCount = std::max(1u, threadCount);
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            m_queues.push_back(std::make_unique<Queue>());
+        }
+        for (uint32_t i = 0; i < threadCount; i++)
+        {
+            m_workers.emplace_back([this, i]() { WorkerLoop(i); });
+        }
+    }
+    // Runs whatever is still queued before the workers exit
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard lock(m_lock);
+            m_exiting = true;
+        }
+        m_wake.notify_all();
+        for (auto&& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    WorkStealingPool(WorkStealingPool const&) = delete;
+    WorkStealingPool& operator=(WorkStealingPool const&) = delete;
+
+    uint32_t ThreadCount() const { return static_cast<uint32_t>(m_workers.size()); }
+
+    void Post(Task task, uint32_t hint)
+    {
+        {
+            // Counted first, so a worker never sees a task it can't account for
+            std::lock_guard lock(m_lock);
+            m_queued++;
+        }
+        auto& queue = *m_queues[hint % m_queues.size()];
+        {
+            std::lock_guard lock(queue.Lock);
+            queue.Tasks.push_back(std::move(task));
+        }
+        m_wake.notify_one();
+    }
+    void Post(Task task)
+    {
+        Post(std::move(task), m_nextQueue.fetch_add(1, std::memory_order_relaxed));
+    }
+
+    // Waits until every queue is empty and no task is running. Tasks posted
+    // from running tasks are waited for too.
+    void WaitIdle()
+    {
+        std::unique_lock lock(m_lock);
+        m_idle.wait(lock, [this]() { return m_queued == 0 && m_running == 0; });
+    }
+
+    WorkStealingPoolStats Stats() const
+    {
+        std::lock_guard lock(m_lock);
+        return m_stats;
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex Lock;
+        std::deque<Task> Tasks;
+    };
+
+    void WorkerLoop(uint32_t index)
+    {
+        while (true)
+        {
+            Task task;
+            auto stolen = false;
+            if (!TryTake(index, task, stolen))
+            {
+                std::unique_lock lock(m_lock);
+                if (m_queued == 0 && m_exiting)
+                {
+                    return;
+                }
+                // A task that's counted but not pushed yet shows up as a
+                // retry rather than a missed wake
+                m_wake.wait(lock, [this]() { return m_queued > 0 || m_exiting; });
+                continue;
+            }
+
+            task();
+
+            std::lock_guard lock(m_lock);
+            m_running--;
+            m_stats.Executed++;
+            m_stats.Stolen += stolen ? 1 : 0;
+            if (m_queued == 0 && m_running == 0)
+            {
+                m_idle.notify_all();
+            }
+        }
+    }
+
+    // Oldest first from our own queue, newest first from everyone else's
+    bool TryTake(uint32_t index, Task& task, bool& stolen)
+    {
+        for (size_t i = 0; i < m_queues.size(); i++)
+        {
+            auto& queue = *m_queues[(index + i) % m_queues.size()];
+            {
+                std::lock_guard lock(queue.Lock);
+                if (queue.Tasks.empty())
+                {
+                    continue;
+                }
+                if (i == 0)
+                {
+                    task = std::move(queue.Tasks.front());
+                    queue.Tasks.pop_front();
+                }
+                else
+                {
+                    task = std::move(queue.Tasks.back());
+                    queue.Tasks.pop_back();
+                }
+            }
+            stolen = i != 0;
+            std::lock_guard lock(m_lock);
+            m_queued--;
+            m_running++;
+            return true;
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<Queue>> m_queues;
+    std::vector<std::thread> m_workers;
+    std::atomic<uint32_t> m_nextQueue = 0;
+    mutable std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    uint64_t m_queued = 0;
+    uint64_t m_running = 0;
+    WorkStealingPoolStats m_stats;
+    bool m_exiting = false;
+};
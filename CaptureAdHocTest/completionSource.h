@@ -1,58 +1,144 @@
 #pragma once
-// taken from https://gist.github.com/kennykerr/2a5b5995d0b2d9a0b646218d6a6cecb7
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include "TimerQueue.h"
+
+// Thrown by co_await on a completion_source that was cancelled
+struct completion_canceled : std::runtime_error
+{
+    completion_canceled() : std::runtime_error("The operation was cancelled") {}
+};
+
+// A one shot value for one coroutine to co_await. Setting it resumes the
+// waiting coroutine directly on the setting thread, with no event, no
+// threadpool wait and no allocation; only wait_for's timeout schedules
+// anything (on the shared TimerQueue). The first of set, cancel and the
+// timeout wins, the rest return false.
+//
+// await_suspend is generic over the handle type: it gets a
+// std::coroutine_handle under C++20 and nothing here depends on
+// std::experimental.
 template <typename T>
 struct completion_source
 {
-    completion_source()
+    completion_source() = default;
+    completion_source(completion_source const&) = delete;
+    completion_source& operator=(completion_source const&) = delete;
+
+    bool set(T value)
     {
-        m_signal.attach(CreateEvent(nullptr, true, false, nullptr));
+        return complete(result::value, &value);
     }
-
-    void set(T const& value)
+    bool cancel()
     {
-        m_value = value;
-        SetEvent(m_signal.get());
+        return complete(result::canceled, nullptr);
     }
 
     bool await_ready() const noexcept
     {
-        return WaitForSingleObject(m_signal.get(), 0) == 0;
+        return m_state.load(std::memory_order_acquire) == state::completed;
     }
-
-    void await_suspend(std::experimental::coroutine_handle<> resume)
+    template <typename Handle>
+    bool await_suspend(Handle handle) noexcept
     {
-        m_wait.attach(winrt::check_pointer(CreateThreadpoolWait(callback, resume.address(), nullptr)));
-        SetThreadpoolWait(m_wait.get(), m_signal.get(), nullptr);
+        return park(handle);
     }
-
-    T await_resume() const noexcept
+    // Throws completion_canceled if it was cancelled
+    T await_resume()
     {
-        return m_value;
+        if (m_result != result::value)
+        {
+            throw completion_canceled();
+        }
+        return std::move(*m_value);
     }
 
+    // co_await source.wait_for(timeout) gives the value, or nothing if it was
+    // cancelled or the timeout passed first. A timeout resumes the coroutine
+    // on the TimerQueue's thread. duration::max() never times out.
+    auto wait_for(std::chrono::steady_clock::duration timeout) { return timed_awaiter(*this, timeout); }
+
 private:
+    enum class state { idle, waiting, completed };
+    enum class result { value, canceled, timed_out };
 
-    static void __stdcall callback(PTP_CALLBACK_INSTANCE, void* context, PTP_WAIT, TP_WAIT_RESULT) noexcept
+    class timed_awaiter
     {
-        std::experimental::coroutine_handle<>::from_address(context)();
-    }
+    public:
+        timed_awaiter(completion_source& source, std::chrono::steady_clock::duration timeout) : m_source(source), m_timeout(timeout) {}
 
-    struct wait_traits
+        bool await_ready() const noexcept { return m_source.await_ready(); }
+        template <typename Handle>
+        bool await_suspend(Handle handle)
+        {
+            // Cancelling the timer in await_resume waits for a callback
+            // that's running, so the source outlives it
+            if (m_timeout != std::chrono::steady_clock::duration::max())
+            {
+                m_timer = TimerQueue::Shared().Schedule(m_timeout, [source = &m_source]()
+                {
+                    source->complete(result::timed_out, nullptr);
+                });
+            }
+            return m_source.park(handle);
+        }
+        std::optional<T> await_resume()
+        {
+            if (m_timer != 0)
+            {
+                TimerQueue::Shared().Cancel(m_timer);
+            }
+            if (m_source.m_result != result::value)
+            {
+                return std::nullopt;
+            }
+            return std::move(m_source.m_value);
+        }
+
+    private:
+        completion_source& m_source;
+        std::chrono::steady_clock::duration m_timeout;
+        uint64_t m_timer = 0;
+    };
+
+    // Returns false if it's already complete and the coroutine should carry on
+    template <typename Handle>
+    bool park(Handle handle) noexcept
     {
-        using type = PTP_WAIT;
+        m_handle = handle.address();
+        m_resume = [](void* address) { Handle::from_address(address).resume(); };
+        auto expected = state::idle;
+        return m_state.compare_exchange_strong(expected, state::waiting, std::memory_order_acq_rel);
+    }
 
-        static void close(type value) noexcept
+    bool complete(result outcome, T* value)
+    {
+        if (m_claimed.exchange(true, std::memory_order_acq_rel))
         {
-            CloseThreadpoolWait(value);
+            return false;
         }
-
-        static constexpr type invalid() noexcept
+        m_result = outcome;
+        if (value != nullptr)
         {
-            return nullptr;
+            m_value.emplace(std::move(*value));
         }
-    };
+        // The coroutine can finish and destroy this as soon as it's resumed,
+        // so nothing touches it after
+        if (m_state.exchange(state::completed, std::memory_order_acq_rel) == state::waiting)
+        {
+            m_resume(m_handle);
+        }
+        return true;
+    }
 
-    winrt::handle m_signal;
-    winrt::handle_type<wait_traits> m_wait;
-    T m_value{};
-};
\ No newline at end of file
+    std::atomic<state> m_state{ state::idle };
+    std::atomic<bool> m_claimed{ false };
+    result m_result = result::value;
+    std::optional<T> m_value;
+    void* m_handle = nullptr;
+    void (*m_resume)(void* address) = nullptr;
+};
@@ -8,6 +8,19 @@
 #include "AdHocTestCliParser.h"
 #include "StyleChangingWindow.h"
 #include "MarginsWindow.h"
+#include "FrameTrace.h"
+#include "ArtifactWriter.h"
+#include "SuiteScheduler.h"
+#include "SuiteWorker.h"
+#include "TestReport.h"
+#include "FrameBarcode.h"
+#include "FrameHash.h"
+#include "DirtyTiles.h"
+#include "HdrAnalysis.h"
+#include "VideoRecorder.h"
+#include "GoldenStore.h"
+#include "CaptureStress.h"
+#include "SpscRing.h"
 #include <dwmapi.h>
 
 using namespace winrt;
@@ -56,57 +69,112 @@ std::future<std::shared_ptr<T>> CreateSharedOnThreadAsync(DispatcherQueue const&
     co_return thing;
 }
 
+void PrintFrameTimeStatistics(std::wstring const& name, FrameTimeStatistics const& stats)
+{
+    wprintf(L"%s frame time: mean %fms, stddev %fms, jitter %fms\n", name.c_str(), stats.Mean.count(), stats.StandardDeviation.count(), stats.Jitter.count());
+    wprintf(L"%s frame time: min %fms, p50 %fms, p90 %fms, p99 %fms, p99.9 %fms, max %fms\n", 
+        name.c_str(), stats.Min.count(), stats.P50.count(), stats.P90.count(), stats.P99.count(), stats.P999.count(), stats.Max.count());
+}
+
 template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
 template<class... Ts> overloaded(Ts...)->overloaded<Ts...>;
 
-IAsyncOperation<StorageFile> SaveFrameAsync(IDirect3DDevice device, IDirect3DSurface surface, std::wstring fileName)
+// Copies the frame out and hands it to the artifact writer, which encodes and
+// writes it in the background. FP16 frames are saved losslessly as an EXR
+// (whatever extension fileName has), along with a tone mapped PNG preview.
+// Returns nothing if the writer dropped the frame.
+std::optional<std::filesystem::path> SaveFrame(IDirect3DDevice const& device, IDirect3DSurface const& surface, std::wstring const& fileName, ToneMapOptions const& previewToneMap = {})
 {
-    // Get a file to save the screenshot
-    auto currentPath = std::filesystem::current_path();
-    auto folder = co_await StorageFolder::GetFolderFromPathAsync(currentPath.wstring());
-    auto file = co_await folder.CreateFileAsync(fileName.c_str(), CreationCollisionOption::ReplaceExisting);
+    auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
+    com_ptr<ID3D11DeviceContext> d3dContext;
+    d3dDevice->GetImmediateContext(d3dContext.put());
 
-    // Get the file stream
-    auto randomAccessStream = co_await file.OpenAsync(FileAccessMode::ReadWrite);
-    auto stream = util::CreateStreamFromRandomAccessStream(randomAccessStream);
+    auto staging = StagingTextureCache::Shared().Copy(d3dDevice, d3dContext, GetDXGIInterfaceFromObject<ID3D11Texture2D>(surface));
+    D3D11_TEXTURE2D_DESC desc = {};
+    staging.Texture()->GetDesc(&desc);
+    auto mapped = MappedTexture(d3dContext, staging.Texture());
+    auto path = std::filesystem::current_path() / fileName;
+    ImageArtifact artifact;
+    if (desc.Format == DXGI_FORMAT_R16G16B16A16_FLOAT)
+    {
+        path.replace_extension(L".exr");
+        artifact = ImageArtifact::Copy(path, mapped.HalfView());
+        artifact.PreviewPath = path.parent_path() / (path.stem().wstring() + L"_preview.png");
+        artifact.PreviewToneMap = previewToneMap;
+    }
+    else
+    {
+        artifact = ImageArtifact::Copy(path, mapped.View());
+        artifact.Premultiplied = true;
+    }
+    if (!ArtifactWriter::Shared().Enqueue(std::move(artifact)))
+    {
+        return std::nullopt;
+    }
+    return path;
+}
 
-    // Get the DXGI surface from the frame
-    auto dxgiFrameTexture = GetDXGIInterfaceFromObject<IDXGISurface>(surface);
+void PrintArtifactStats(ArtifactWriterStats const& stats)
+{
+    wprintf(L"Artifacts: %llu written (%llu bytes), %llu dropped, %llu failed, max queue depth %zu\n",
+        stats.Written, stats.BytesWritten, stats.Dropped, stats.Failed, stats.MaxQueueDepth);
+    auto toMilliseconds = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::milli>(value).count(); };
+    wprintf(L"Artifact encode time: p50 %fms, p99 %fms, max %fms (queued p50 %fms, max %fms)\n",
+        toMilliseconds(stats.EncodeLatency.Percentile(50.0)), toMilliseconds(stats.EncodeLatency.Percentile(99.0)), toMilliseconds(stats.EncodeLatency.Max()),
+        toMilliseconds(stats.QueueLatency.Percentile(50.0)), toMilliseconds(stats.QueueLatency.Max()));
+    if (stats.Dropped > 0)
+    {
+        wprintf(L"Last dropped artifact: %s\n", stats.LastDropped.c_str());
+    }
+    if (stats.Failed > 0)
+    {
+        wprintf(L"Last artifact error: %S\n", stats.LastError.c_str());
+    }
+}
 
-    // Create graphics resources
-    auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
+// Blesses the frame as the golden for key, or checks it against the golden
+// that's there. A test without a golden yet passes, so that new tests can be
+// blessed after their first run. Throws hresult_error if the frame doesn't
+// match, after queueing the golden to be saved next to the failure.
+void VerifyGolden(GoldenOptions const& options, GoldenKey const& key, BgraImageView const& frame, std::shared_ptr<TestReport> const& report)
+{
+    auto store = GoldenStore(options.Directory);
+    std::optional<GoldenImage> golden;
+    try
+    {
+        if (options.Bless)
+        {
+            auto path = store.Bless(key, frame);
+            wprintf(L"Golden blessed: %s\n", path.c_str());
+            return;
+        }
+        golden = store.Load(key);
+    }
+    catch (std::runtime_error const& error)
+    {
+        throw hresult_error(E_FAIL, to_hstring(error.what()));
+    }
+    if (!golden)
+    {
+        wprintf(L"No golden for %S yet, run with --bless to create it\n", key.FileName().c_str());
+        return;
+    }
 
-    // Get a D2D bitmap for our snapshot
-    // TODO: Since this sample doesn't use D2D any other way, it may be better to map 
-    //       the pixels manually and hand them to WIC. However, using d2d is easier for now.
-    auto d2dFactory = util::CreateD2DFactory();
-    auto d2dDevice = util::CreateD2DDevice(d2dFactory, d3dDevice);
-    winrt::com_ptr<ID2D1DeviceContext> d2dContext;
-    check_hresult(d2dDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, d2dContext.put()));
-    com_ptr<ID2D1Bitmap1> d2dBitmap;
-    check_hresult(d2dContext->CreateBitmapFromDxgiSurface(dxgiFrameTexture.get(), nullptr, d2dBitmap.put()));
-
-    // Encode the snapshot
-    auto wicFactory = util::CreateWICFactory();
-    com_ptr<IWICBitmapEncoder> encoder;
-    check_hresult(wicFactory->CreateEncoder(GUID_ContainerFormatPng, nullptr, encoder.put()));
-    check_hresult(encoder->Initialize(stream.get(), WICBitmapEncoderNoCache));
-
-    com_ptr<IWICBitmapFrameEncode> wicFrame;
-    com_ptr<IPropertyBag2> frameProperties;
-    check_hresult(encoder->CreateNewFrame(wicFrame.put(), frameProperties.put()));
-    check_hresult(wicFrame->Initialize(frameProperties.get()));
-
-    com_ptr<IWICImageEncoder> imageEncoder;
-    check_hresult(wicFactory->CreateImageEncoder(d2dDevice.get(), imageEncoder.put()));
-    check_hresult(imageEncoder->WriteFrame(d2dBitmap.get(), wicFrame.get(), nullptr));
-    check_hresult(wicFrame->Commit());
-    check_hresult(encoder->Commit());
-
-    co_return file;
+    auto result = CompareToGolden(frame, *golden);
+    report->Count("golden_changed_tiles", result.ChangedTiles);
+    report->Count("golden_differing_pixels", result.DifferingPixels);
+    if (!result.Passed() && result.SizeMatches)
+    {
+        auto pixels = golden->Decode();
+        auto expected = BgraImageView{ pixels.data(), golden->Width(), golden->Height(), golden->Width() * BgraImageView::BytesPerPixel };
+        auto artifact = ImageArtifact::Copy(std::filesystem::current_path() / (key.Test + "_golden.png"), expected);
+        artifact.Premultiplied = true;
+        ArtifactWriter::Shared().Enqueue(std::move(artifact));
+    }
+    check_golden(result, *golden);
 }
 
-IAsyncOperation<bool> TransparencyTest(CompositorController compositorController, IDirect3DDevice device)
+IAsyncOperation<bool> TransparencyTest(CompositorController compositorController, IDirect3DDevice device, std::optional<GoldenOptions> goldens, std::shared_ptr<TestReport> report)
 {
     auto compositor = compositorController.Compositor();
     auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
@@ -132,36 +200,120 @@ IAsyncOperation<bool> TransparencyTest(CompositorController compositorController
         auto item = GraphicsCaptureItem::CreateFromVisual(visual);
         auto asyncOperation = CaptureSnapshot::TakeAsync(device, item, true); // we want the texture to be a staging texture
         // We need to commit before we wait on this
+        auto capturePhase = report->Phase("capture");
         compositorController.Commit();
         frame = co_await asyncOperation;
+        capturePhase.Stop();
         auto frameTexture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(frame);
 
         // Map the texture and check the image
         {
+            auto verifyPhase = report->Phase("verify");
             auto mapped = MappedTexture(d3dContext, frameTexture);
 
-            check_color(mapped.ReadBGRAPixel(50, 50), Colors::Red());
-            // We don't use Colors::Transparent() here becuase that is transparent white.
-            // Right now the capture API uses transparent black to clear.
-            check_color(mapped.ReadBGRAPixel(5, 5), Color{ 0, 0, 0, 0 });
+            // Every pixel of the frame: exactly red inside the circle and
+            // transparent black outside of it, with some room on the edge
+            // for anti-aliasing. We don't use Colors::Transparent() here
+            // becuase that is transparent white. Right now the capture API
+            // uses transparent black to clear.
+            auto reference = ReferenceRasterizer(100, 100, BgraColor{ 0, 0, 0, 0 });
+            reference.FillEllipse(ReferenceEllipse{ 50, 50, 50, 50 }, to_bgra(Colors::Red()));
+            auto result = mapped.CompareToReference(reference);
+            if (!result.Passed())
+            {
+                auto diff = mapped.DiffReference(reference);
+                check_reference(result, reference, &diff);
+            }
+
+            // Anything the reference allows on the edges has to stay the
+            // same from run to run
+            if (goldens)
+            {
+                VerifyGolden(*goldens, GoldenKey{ "alpha", 100, 100, GetDpiForSystem() }, mapped.View(), report);
+            }
         }
     }
     catch (hresult_error const& error)
     {
         wprintf(L"Transparency test failed! 0x%08x - %s \n", error.code().value, error.message().c_str());
+        report->Message(winrt::to_string(error.message()));
         success = false;
     }
 
     if (!success && frame != nullptr)
     {
-        auto file = co_await SaveFrameAsync(device, frame, L"alpha_failure.png");
-        wprintf(L"Failure file saved: %s\n", file.Path().c_str());
+        if (auto path = SaveFrame(device, frame, L"alpha_failure.png"))
+        {
+            wprintf(L"Failure file queued: %s\n", path->c_str());
+        }
+        else
+        {
+            wprintf(L"Failure file dropped, the artifact queue is full\n");
+        }
     }
 
     co_return success;
 }
 
-IAsyncOperation<bool> RenderRateTest(CompositorController compositorController, IDirect3DDevice device, DispatcherQueue compositorThreadQueue, testparams::FullscreenMode mode)
+// Reads the frame number FullscreenMaxRateWindow stamped into the frame.
+// Only the corner the code can be in is copied back.
+std::optional<uint32_t> ReadFrameBarcode(com_ptr<ID3D11Device> const& d3dDevice, com_ptr<ID3D11DeviceContext> const& d3dContext, IDirect3DSurface const& surface)
+{
+    auto texture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(surface);
+    D3D11_TEXTURE2D_DESC desc = {};
+    texture->GetDesc(&desc);
+    auto staging = StagingTextureCache::Shared().CopyRegion(d3dDevice, d3dContext, texture, framebarcode::ScanRect(desc.Width, desc.Height));
+    auto mapped = MappedTexture(d3dContext, staging.Texture());
+    return DecodeFrameBarcode(mapped.View());
+}
+
+// The part of the frame's texture that has content in it
+PixelRect CapturedContentRect(Direct3D11CaptureFrame const& frame, com_ptr<ID3D11Texture2D> const& texture)
+{
+    D3D11_TEXTURE2D_DESC desc = {};
+    texture->GetDesc(&desc);
+    auto contentSize = frame.ContentSize();
+    auto width = std::min(static_cast<uint32_t>(contentSize.Width), desc.Width);
+    auto height = std::min(static_cast<uint32_t>(contentSize.Height), desc.Height);
+    return PixelRect{ 0, 0, width, height };
+}
+
+// Maps the part of the frame that has content in it, for as long as the callback runs
+void ReadCapturedContent(com_ptr<ID3D11Device> const& d3dDevice, com_ptr<ID3D11DeviceContext> const& d3dContext, Direct3D11CaptureFrame const& frame, std::function<void(BgraImageView const&)> const& callback)
+{
+    auto texture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(frame.Surface());
+    auto staging = StagingTextureCache::Shared().CopyRegion(d3dDevice, d3dContext, texture, CapturedContentRect(frame, texture));
+    auto mapped = MappedTexture(d3dContext, staging.Texture());
+    callback(mapped.View());
+}
+
+// How long FrameArrived itself took, which is time the frame pool's buffer
+// (and the next FrameArrived) waited on the test
+void ReportHandlerTime(LatencyHistogram const& handlerTime, std::shared_ptr<TestReport> const& report)
+{
+    auto toMilliseconds = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::milli>(value).count(); };
+    wprintf(L"FrameArrived handler time: p50 %fms, p99 %fms, max %fms\n",
+        toMilliseconds(handlerTime.Percentile(50.0)), toMilliseconds(handlerTime.Percentile(99.0)), toMilliseconds(handlerTime.Max()));
+    report->Value("frame_handler_p50_ms", toMilliseconds(handlerTime.Percentile(50.0)));
+    report->Value("frame_handler_p99_ms", toMilliseconds(handlerTime.Percentile(99.0)));
+    report->Value("frame_handler_max_ms", toMilliseconds(handlerTime.Max()));
+}
+
+void PrintFrameSequenceStats(FrameSequenceTracker::Stats const& stats, LatencyHistogram const& latency)
+{
+    wprintf(L"Captured frames by frame number: %llu dropped, %llu duplicated, %llu out of order, %llu unreadable\n",
+        stats.Dropped, stats.Duplicates, stats.OutOfOrder, stats.Unreadable);
+    auto toMilliseconds = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::milli>(value).count(); };
+    wprintf(L"Present to capture latency: p50 %fms, p99 %fms, max %fms\n",
+        toMilliseconds(latency.Percentile(50.0)), toMilliseconds(latency.Percentile(99.0)), toMilliseconds(latency.Max()));
+}
+
+void PrintTraceSummary(std::wstring const& tracePath, FrameTraceWriter const& traceWriter)
+{
+    wprintf(L"Frame trace saved: %s (%llu frames, %llu bytes)\n", tracePath.c_str(), traceWriter.RecordCount(), traceWriter.SizeInBytes());
+}
+
+IAsyncOperation<bool> RenderRateTest(CompositorController compositorController, IDirect3DDevice device, DispatcherQueue compositorThreadQueue, testparams::FullscreenMode mode, std::wstring tracePath, std::shared_ptr<TestReport> report)
 {
     auto compositor = compositorController.Compositor();
     auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
@@ -181,13 +333,60 @@ IAsyncOperation<bool> RenderRateTest(CompositorController compositorController,
             3,
             item.Size());
         auto session = framePool.CreateCaptureSession(item);
+        std::unique_ptr<FrameTraceWriter> traceWriter;
+        if (!tracePath.empty())
+        {
+            traceWriter = std::make_unique<FrameTraceWriter>(tracePath);
+        }
+        std::atomic<int64_t> lastFlipTime = 0;
         FrameTimer<TimeSpan> captureTimer;
-        framePool.FrameArrived([&captureTimer](auto& framePool, auto&)
+        // Every rendered frame carries its frame number, so we know exactly
+        // which one each captured frame is
+        FrameSequenceTracker sequenceTracker;
+        LatencyHistogram presentToCapture;
+        LatencyHistogram handlerTime;
+        // Closing doesn't wait for a FrameArrived that's already running, and
+        // the handler uses the locals above, so stopping takes the lock to know
+        // the last one has finished
+        struct Delivery
+        {
+            std::mutex Lock;
+            bool Stopped = false;
+        };
+        auto delivery = std::make_shared<Delivery>();
+        framePool.FrameArrived([delivery, &captureTimer, &traceWriter, &lastFlipTime, &sequenceTracker, &presentToCapture, &handlerTime, d3dDevice, d3dContext, report](auto& framePool, auto&)
         {
+            std::lock_guard lock(delivery->Lock);
+            if (delivery->Stopped)
+            {
+                return;
+            }
             auto frame = framePool.TryGetNextFrame();
             auto timestamp = frame.SystemRelativeTime();
-
+            auto arrivalTime = std::chrono::steady_clock::now();
+            auto arrivalTicks = ToTraceTicks(arrivalTime);
             captureTimer.RecordTimestamp(timestamp);
+            auto flipTime = lastFlipTime.load();
+
+            // The readback waits on the GPU, so it comes after everything
+            // that's timing sensitive
+            auto frameNumber = ReadFrameBarcode(d3dDevice, d3dContext, frame.Surface());
+            auto captured = sequenceTracker.Captured(frameNumber, arrivalTicks);
+            if (captured.Latency)
+            {
+                presentToCapture.Record(FrameTimeSpan(*captured.Latency));
+                flipTime = arrivalTicks - *captured.Latency;
+            }
+            // The rendered frame number, so the analyzer can see what was
+            // skipped. Without one the capture count is all we have.
+            auto sequence = frameNumber ? static_cast<uint64_t>(*frameNumber) : static_cast<uint64_t>(captureTimer.m_totalFrames - 1u);
+            FrameTraceRecord record{ sequence, timestamp.count(), arrivalTicks, flipTime };
+            if (traceWriter)
+            {
+                traceWriter->Write(record);
+            }
+            report->Frame(record, frameNumber);
+            handlerTime.Record(std::chrono::steady_clock::now() - arrivalTime);
         });
         session.StartCapture();
         if (winrt::Windows::Foundation::Metadata::ApiInformation::IsPropertyPresent(winrt::name_of<winrt::Windows::Graphics::Capture::GraphicsCaptureSession>(), L"MinUpdateInterval"))
@@ -200,6 +399,7 @@ IAsyncOperation<bool> RenderRateTest(CompositorController compositorController,
         }
 
         // Run the window
+        auto renderPhase = report->Phase("render");
         auto completed = false;
         FrameTimer<std::chrono::time_point<std::chrono::steady_clock>> renderTimer;
         while (!completed)
@@ -209,14 +409,27 @@ IAsyncOperation<bool> RenderRateTest(CompositorController compositorController,
                 completed = true;
             }
 
-            window->Flip();
-            renderTimer.RecordTimestamp(std::chrono::high_resolution_clock::now());
+            auto frameNumber = window->Flip();
+            auto flipTime = std::chrono::steady_clock::now();
+            renderTimer.RecordTimestamp(flipTime);
+            lastFlipTime = ToTraceTicks(flipTime);
+            sequenceTracker.Rendered(frameNumber, lastFlipTime);
         }
 
         // The window may already be closed, so don't check the return value
         CloseWindow(window->m_window);
         session.Close();
         framePool.Close();
+        {
+            std::lock_guard lock(delivery->Lock);
+            delivery->Stopped = true;
+        }
+        renderPhase.Stop();
+        if (traceWriter)
+        {
+            traceWriter->Close();
+            PrintTraceSummary(tracePath, *traceWriter);
+        }
 
         auto renderAverageFrameTime = renderTimer.ComputeAverageFrameTime();
         auto captureAverageFrameTime = captureTimer.ComputeAverageFrameTime();
@@ -225,19 +438,114 @@ IAsyncOperation<bool> RenderRateTest(CompositorController compositorController,
         wprintf(L"Number of rendered frames: %d\n", renderTimer.m_totalFrames);
         wprintf(L"Average capture frame time: %fms\n", captureAverageFrameTime.count());
         wprintf(L"Number of capture frames: %d\n", captureTimer.m_totalFrames);
+        auto renderStatistics = renderTimer.ComputeStatistics();
+        auto captureStatistics = captureTimer.ComputeStatistics();
+        PrintFrameTimeStatistics(L"Rendered", renderStatistics);
+        PrintFrameTimeStatistics(L"Capture", captureStatistics);
+        auto sequenceStats = sequenceTracker.GetStats();
+        PrintFrameSequenceStats(sequenceStats, presentToCapture);
+
+        report->Count("rendered_frames", renderTimer.m_totalFrames);
+        report->Count("capture_frames", captureTimer.m_totalFrames);
+        report->Value("average_rendered_frame_time_ms", renderAverageFrameTime.count());
+        report->Value("average_capture_frame_time_ms", captureAverageFrameTime.count());
+        report->Statistics("rendered", renderStatistics);
+        report->Statistics("capture", captureStatistics);
+        report->Count("dropped_frames", sequenceStats.Dropped);
+        report->Count("duplicate_frames", sequenceStats.Duplicates);
+        report->Count("out_of_order_frames", sequenceStats.OutOfOrder);
+        report->Count("unreadable_frames", sequenceStats.Unreadable);
+        auto toMilliseconds = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::milli>(value).count(); };
+        report->Value("present_to_capture_p50_ms", toMilliseconds(presentToCapture.Percentile(50.0)));
+        report->Value("present_to_capture_p99_ms", toMilliseconds(presentToCapture.Percentile(99.0)));
+        report->Value("present_to_capture_max_ms", toMilliseconds(presentToCapture.Max()));
+        ReportHandlerTime(handlerTime, report);
 
         // TODO: Compare average frame times and determine if they are close enough.
     }
     catch (hresult_error const& error)
     {
         wprintf(L"Render rate test failed! 0x%08x - %s \n", error.code().value, error.message().c_str());
+        report->Message(winrt::to_string(error.message()));
+        co_return false;
+    }
+    catch (std::runtime_error const& error)
+    {
+        wprintf(L"Render rate test failed! %S \n", error.what());
+        report->Message(error.what());
         co_return false;
     }
 
     co_return true;
 }
 
-IAsyncOperation<bool> FullscreenTransitionTest(CompositorController compositorController, IDirect3DDevice device, DispatcherQueue compositorThreadQueue, testparams::FullscreenTransitionTestMode mode)
+using CaptureFrameRing = SpscRing<Direct3D11CaptureFrame>;
+
+// Hands frames from FrameArrived to the test through the ring. The ring only
+// keeps the newest frame, and WaitForFrameAsync holds on to the last one that
+// didn't match, so give the pool a third buffer for the next one to arrive
+// into.
+void QueueArrivingFrames(Direct3D11CaptureFramePool const& framePool, CaptureFrameRing& frames)
+{
+    framePool.FrameArrived([&frames](auto& framePool, auto&)
+    {
+        if (auto frame = framePool.TryGetNextFrame())
+        {
+            frames.Push(std::move(frame));
+        }
+    });
+}
+
+// Waits for the next frame. Returns nullptr if the timeout passes first.
+IAsyncOperation<Direct3D11CaptureFrame> NextFrameAsync(CaptureFrameRing& frames, std::chrono::milliseconds timeout)
+{
+    auto item = co_await frames.PopAsync(timeout);
+    if (!item)
+    {
+        co_return nullptr;
+    }
+    co_return item->Value;
+}
+
+// Takes frames as they arrive until one passes matches, rather than sleeping
+// through a transition and taking whatever comes next. matches runs on the
+// frame pool's thread, and one that throws is a miss. If nothing matches
+// before the timeout this returns the last frame that didn't, so the
+// caller's own check can say what was wrong with it, or nullptr if no frames
+// came at all. How long the transition took goes in the report as
+// <name>_transition_ms.
+template <typename Matches>
+IAsyncOperation<Direct3D11CaptureFrame> WaitForFrameAsync(CaptureFrameRing& frames, Matches matches, std::chrono::milliseconds timeout, std::shared_ptr<TestReport> report, std::string name)
+{
+    auto match = co_await frames.PopMatchingAsync([&matches](Direct3D11CaptureFrame const& frame)
+    {
+        try
+        {
+            return matches(frame);
+        }
+        catch (hresult_error const&)
+        {
+            return false;
+        }
+    }, timeout);
+    report->Value(name + "_transition_ms", std::chrono::duration<double, std::milli>(match.Elapsed).count());
+    report->Count(name + "_skipped_frames", match.Skipped);
+    if (match.Item)
+    {
+        if (match.LastMiss)
+        {
+            match.LastMiss->Value.Close();
+        }
+        co_return match.Item->Value;
+    }
+    if (match.LastMiss)
+    {
+        co_return match.LastMiss->Value;
+    }
+    co_return nullptr;
+}
+
+IAsyncOperation<bool> FullscreenTransitionTest(CompositorController compositorController, IDirect3DDevice device, DispatcherQueue compositorThreadQueue, testparams::FullscreenTransitionTestMode mode, std::shared_ptr<TestReport> report)
 {
     auto compositor = compositorController.Compositor();
     auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
@@ -256,63 +564,78 @@ IAsyncOperation<bool> FullscreenTransitionTest(CompositorController compositorCo
         }
         else
         {
+            // The frames are waited for on the frame pool's thread, so the test
+            // hops back to its own thread after each wait
+            auto captureThread = DispatcherQueueController::CreateOnDedicatedThread();
+            auto captureThreadQueue = captureThread.DispatcherQueue();
+            co_await captureThreadQueue;
+
             // Start the capture
+            auto windowedPhase = report->Phase("windowed");
             auto item = util::CreateCaptureItemForWindow(window->m_window);
+            CaptureFrameRing frames(1, QueueFullPolicy::DropOldest);
             auto framePool = Direct3D11CaptureFramePool::CreateFreeThreaded(
                 device,
                 DirectXPixelFormat::B8G8R8A8UIntNormalized,
-                1,
+                3,
                 item.Size());
             auto session = framePool.CreateCaptureSession(item);
-            Direct3D11CaptureFrame currentFrame{ nullptr };
-            auto frameEvent = wil::shared_event(wil::EventOptions::None);
-            framePool.FrameArrived([&currentFrame, frameEvent](auto& framePool, auto&)
-                {
-                    WINRT_ASSERT(!currentFrame);
-                    currentFrame = framePool.TryGetNextFrame();
-                    WINRT_ASSERT(!frameEvent.is_signaled());
-                    frameEvent.SetEvent();
-                });
+            QueueArrivingFrames(framePool, frames);
             session.StartCapture();
-            co_await winrt::resume_on_signal(frameEvent.get());
+            auto checkFrameArrived = [](Direct3D11CaptureFrame const& frame)
+            {
+                if (!frame)
+                {
+                    throw hresult_error(E_UNEXPECTED, L"Capture timed out");
+                }
+            };
+            auto currentFrame = co_await NextFrameAsync(frames, std::chrono::seconds(5));
+            co_await captureThreadQueue;
+            checkFrameArrived(currentFrame);
 
             // Test for red
             TestCenterOfSurface(device, currentFrame.Surface(), Colors::Red());
+            currentFrame.Close();
+            windowedPhase.Stop();
 
             // Transition to fullscreen
+            auto fullscreenPhase = report->Phase("fullscreen");
             window->Fullscreen(true);
             window->Flip(Colors::Green());
-            // Wait for the transition
-            co_await std::chrono::milliseconds(500);
-
-            // Release the frame and get a new one
-            frameEvent.ResetEvent();
-            currentFrame.Close();
-            currentFrame = nullptr;
-            co_await winrt::resume_on_signal(frameEvent.get());
+            // Wait for the transition to show up
+            currentFrame = co_await WaitForFrameAsync(frames, [device](Direct3D11CaptureFrame const& frame)
+            {
+                return SurfaceRegionMatches(device, frame.Surface(), Colors::Green(), CenterOfSurface(frame.Surface()));
+            }, std::chrono::seconds(5), report, "fullscreen");
+            co_await captureThreadQueue;
+            checkFrameArrived(currentFrame);
 
             // Test for green
             TestCenterOfSurface(device, currentFrame.Surface(), Colors::Green());
+            currentFrame.Close();
+            fullscreenPhase.Stop();
 
             // Transition to windowed
+            auto restoredPhase = report->Phase("restored");
             window->Fullscreen(false);
             window->Flip(Colors::Blue());
-            // Wait for the transition
-            co_await std::chrono::milliseconds(500);
-
-            // Release the frame and get a new one
-            frameEvent.ResetEvent();
-            currentFrame.Close();
-            currentFrame = nullptr;
-            co_await winrt::resume_on_signal(frameEvent.get());
+            // Wait for the transition to show up
+            currentFrame = co_await WaitForFrameAsync(frames, [device](Direct3D11CaptureFrame const& frame)
+            {
+                return SurfaceRegionMatches(device, frame.Surface(), Colors::Blue(), CenterOfSurface(frame.Surface()));
+            }, std::chrono::seconds(5), report, "restored");
+            co_await captureThreadQueue;
+            checkFrameArrived(currentFrame);
 
             // Test for blue
             TestCenterOfSurface(device, currentFrame.Surface(), Colors::Blue());
+            currentFrame.Close();
         }
     }
     catch (hresult_error const& error)
     {
         wprintf(L"Fullscreen Transition test failed! 0x%08x - %s \n", error.code().value, error.message().c_str());
+        report->Message(winrt::to_string(error.message()));
         co_return false;
     }
 
@@ -324,7 +647,12 @@ IAsyncOperation<bool> WindowRenderRateTest(
     IDirect3DDevice device, 
     std::wstring windowName,
     std::chrono::seconds delay,
-    std::chrono::seconds duration)
+    std::chrono::seconds duration,
+    std::wstring tracePath,
+    bool hashFrames,
+    uint32_t dirtyTileSize,
+    std::wstring recordPath,
+    std::shared_ptr<TestReport> report)
 {
     auto windowNameStr = windowName;
 
@@ -357,16 +685,111 @@ IAsyncOperation<bool> WindowRenderRateTest(
         {
             session.IsBorderRequired(false);
         }
+        std::unique_ptr<FrameTraceWriter> traceWriter;
+        if (!tracePath.empty())
+        {
+            traceWriter = std::make_unique<FrameTraceWriter>(tracePath);
+        }
         FrameTimer<TimeSpan> captureTimer;
         FrameTimer<std::chrono::time_point<std::chrono::steady_clock>> captureArrivedTimer;
-        framePool.FrameArrived([&captureTimer, &captureArrivedTimer](auto& framePool, auto&)
+        // Windows often get delivered again without anything having changed,
+        // so with --hash each frame's content is hashed to tell them apart.
+        FrameChangeCounter changeCounter;
+        // With --tiles, how much of each frame changed since the one before it
+        std::optional<DirtyTileDetector> dirtyTiles;
+        // Frames with nothing to compare to (the first, and any after a size
+        // change) are all dirty and left out of the averages
+        uint64_t comparedFrames = 0;
+        double changedAreaSum = 0.0;
+        uint64_t dirtyRectSum = 0;
+        uint64_t unchangedFrames = 0;
+        if (dirtyTileSize > 0)
+        {
+            dirtyTiles.emplace(dirtyTileSize);
+        }
+        // With --record, every frame goes to a Y4M file at the window's size
+        // when the test started. The file is opened here so a bad path fails
+        // the test rather than the capture thread. Frames are copied into a
+        // small ring of staging textures and the recorder's thread maps and
+        // converts them, so FrameArrived never waits on the readback. When
+        // the ring is full the frame is dropped.
+        std::unique_ptr<StagingTextureRing> recordingTextures;
+        std::unique_ptr<VideoRecorder> recorder;
+        if (!recordPath.empty())
+        {
+            auto size = item.Size();
+            auto width = static_cast<uint32_t>(size.Width);
+            auto height = static_cast<uint32_t>(size.Height);
+            recordingTextures = std::make_unique<StagingTextureRing>(d3dDevice, d3dContext, width, height, 4);
+            recorder = std::make_unique<VideoRecorder>(recordPath, width, height);
+        }
+        LatencyHistogram handlerTime;
+        // Closing doesn't wait for a FrameArrived that's already running, and
+        // the handler uses the locals below, so stopping takes the lock to know
+        // the last one has finished
+        struct Delivery
         {
+            std::mutex Lock;
+            bool Stopped = false;
+        };
+        auto delivery = std::make_shared<Delivery>();
+        framePool.FrameArrived([delivery, &captureTimer, &captureArrivedTimer, &traceWriter, &changeCounter, &dirtyTiles, &comparedFrames, &changedAreaSum, &dirtyRectSum, &unchangedFrames, &recordingTextures, &recorder, &handlerTime, hashFrames, d3dDevice, d3dContext, report](auto& framePool, auto&)
+        {
+            std::lock_guard lock(delivery->Lock);
+            if (delivery->Stopped)
+            {
+                return;
+            }
             auto frame = framePool.TryGetNextFrame();
             auto timestamp = frame.SystemRelativeTime();
+            auto arrivalTime = std::chrono::steady_clock::now();
 
             captureTimer.RecordTimestamp(timestamp);
-            captureArrivedTimer.RecordTimestamp(std::chrono::high_resolution_clock::now());
+            captureArrivedTimer.RecordTimestamp(arrivalTime);
+            if (recorder)
+            {
+                auto texture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(frame.Surface());
+                auto content = CapturedContentRect(frame, texture);
+                if (auto lease = recordingTextures->CopyRegion(texture, content.Width, content.Height))
+                {
+                    recorder->SubmitDeferred([lease](auto const& callback) { lease->Read(callback); });
+                }
+                else
+                {
+                    recorder->CountDropped();
+                }
+            }
+            if (hashFrames || dirtyTiles)
+            {
+                ReadCapturedContent(d3dDevice, d3dContext, frame, [&](BgraImageView const& content)
+                {
+                    if (hashFrames)
+                    {
+                        changeCounter.Add(HashImageParallel(content));
+                    }
+                    if (dirtyTiles)
+                    {
+                        auto& result = dirtyTiles->Compare(content);
+                        if (result.Compared)
+                        {
+                            comparedFrames++;
+                            changedAreaSum += result.ChangedAreaPercent;
+                            dirtyRectSum += result.DirtyRects.size();
+                            unchangedFrames += result.DirtyTileCount == 0 ? 1 : 0;
+                        }
+                    }
+                });
+            }
+            // There's no render side to this test
+            FrameTraceRecord record{ captureTimer.m_totalFrames - 1u, timestamp.count(), ToTraceTicks(arrivalTime), 0 };
+            if (traceWriter)
+            {
+                traceWriter->Write(record);
+            }
+            report->Frame(record);
+            handlerTime.Record(std::chrono::steady_clock::now() - arrivalTime);
         });
+        auto capturePhase = report->Phase("capture");
         session.StartCapture();
 
         // Run for awhile
@@ -374,6 +797,31 @@ IAsyncOperation<bool> WindowRenderRateTest(
 
         session.Close();
         framePool.Close();
+        {
+            std::lock_guard lock(delivery->Lock);
+            delivery->Stopped = true;
+        }
+        capturePhase.Stop();
+        if (traceWriter)
+        {
+            traceWriter->Close();
+            PrintTraceSummary(tracePath, *traceWriter);
+        }
+        if (recorder)
+        {
+            recorder->Close();
+            auto stats = recorder->Stats();
+            wprintf(L"Recording saved: %s (%ux%u, %llu frames, %llu bytes)\n", recordPath.c_str(), recorder->Width(), recorder->Height(), stats.Written, stats.BytesWritten);
+            wprintf(L"Recording dropped %llu of %llu frames  (convert p99 %fms)\n", stats.Dropped, stats.Submitted,
+                std::chrono::duration<double, std::milli>(stats.ConvertLatency.Percentile(99.0)).count());
+            if (stats.Failed > 0)
+            {
+                wprintf(L"Recording failed to write %llu frames: %S\n", stats.Failed, stats.LastError.c_str());
+            }
+            report->Count("recorded_frames", stats.Written);
+            report->Count("recording_dropped_frames", stats.Dropped);
+            report->Count("recording_failed_frames", stats.Failed);
+        }
 
         auto captureTimerAvgTime = captureTimer.ComputeAverageFrameTime();
         auto captureArrivedTimerAvgTime = captureArrivedTimer.ComputeAverageFrameTime();
@@ -387,10 +835,54 @@ IAsyncOperation<bool> WindowRenderRateTest(
         wprintf(L"Average capture frame time: %fms  (%f fps)\n", captureTimer.ComputeAverageFrameTime().count(), captureAvgFrameRate);
         wprintf(L"Average capture arrival time: %fms  (%f fps)\n", captureArrivedTimer.ComputeAverageFrameTime().count(), captureArrivedAvgFrameRate);
         wprintf(L"Number of capture frames: %d\n", captureTimer.m_totalFrames);
+        auto captureStatistics = captureTimer.ComputeStatistics();
+        auto captureArrivedStatistics = captureArrivedTimer.ComputeStatistics();
+        PrintFrameTimeStatistics(L"Capture", captureStatistics);
+        PrintFrameTimeStatistics(L"Capture arrival", captureArrivedStatistics);
+
+        report->Count("capture_frames", captureTimer.m_totalFrames);
+        report->Value("capture_fps", captureAvgFrameRate);
+        report->Value("capture_arrival_fps", captureArrivedAvgFrameRate);
+        report->Statistics("capture", captureStatistics);
+        report->Statistics("capture_arrival", captureArrivedStatistics);
+        ReportHandlerTime(handlerTime, report);
+
+        if (hashFrames && changeCounter.Frames() > 0)
+        {
+            // Same time base as the delivered rate, so the two can be compared directly
+            auto uniqueFrameRate = captureArrivedAvgFrameRate * (static_cast<double>(changeCounter.UniqueFrames()) / changeCounter.Frames());
+            wprintf(L"Delivered frames per second: %f\n", captureArrivedAvgFrameRate);
+            wprintf(L"Unique frames per second: %f  (%llu of %llu frames changed)\n", uniqueFrameRate, changeCounter.UniqueFrames(), changeCounter.Frames());
+            wprintf(L"Longest run of identical frames: %llu\n", changeCounter.LongestIdenticalRun());
+            report->Count("unique_frames", changeCounter.UniqueFrames());
+            report->Count("longest_identical_run", changeCounter.LongestIdenticalRun());
+            report->Value("delivered_fps", captureArrivedAvgFrameRate);
+            report->Value("unique_fps", uniqueFrameRate);
+        }
+        if (dirtyTiles && comparedFrames > 0)
+        {
+            auto averageChangedArea = changedAreaSum / comparedFrames;
+            auto averageDirtyRects = static_cast<double>(dirtyRectSum) / comparedFrames;
+            wprintf(L"Average changed area: %f%%  (%u x %u tiles, %llu frames compared)\n", averageChangedArea, dirtyTileSize, dirtyTileSize, comparedFrames);
+            wprintf(L"Average dirty rects per frame: %f\n", averageDirtyRects);
+            wprintf(L"Frames with no changed tiles: %llu\n", unchangedFrames);
+            report->Count("dirty_tile_size", dirtyTileSize);
+            report->Count("frames_compared", comparedFrames);
+            report->Count("frames_without_changes", unchangedFrames);
+            report->Value("average_changed_area_percent", averageChangedArea);
+            report->Value("average_dirty_rects", averageDirtyRects);
+        }
     }
     catch (hresult_error const& error)
     {
         wprintf(L"Render rate test failed! 0x%08x - %s \n", error.code().value, error.message().c_str());
+        report->Message(winrt::to_string(error.message()));
+        co_return false;
+    }
+    catch (std::runtime_error const& error)
+    {
+        wprintf(L"Render rate test failed! %S \n", error.what());
+        report->Message(error.what());
         co_return false;
     }
 
@@ -514,8 +1006,14 @@ IAsyncOperation<bool> TestCenterOfWindowAsync(RemoteCaptureType captureType, IDi
 
     if (!success && frame != nullptr)
     {
-        auto file = co_await SaveFrameAsync(device, frame, failureFileName.c_str());
-        wprintf(L"Failure file saved: %s\n", file.Path().c_str());
+        if (auto path = SaveFrame(device, frame, failureFileName.c_str()))
+        {
+            wprintf(L"Failure file queued: %s\n", path->c_str());
+        }
+        else
+        {
+            wprintf(L"Failure file dropped, the artifact queue is full\n");
+        }
     }
 
     co_return success;
@@ -594,18 +1092,47 @@ IAsyncOperation<bool> CursorDisableTest(
     }
 }
 
-IAsyncOperation<bool> HDRContentTest(CompositorController compositorController, IDirect3DDevice device, DispatcherQueue compositorThreadQueue, com_ptr<ID2D1Device> d2dDevice)
+// Prints what the automated HDR test measured and adds it to the report
+void ReportHdrFrameStats(HdrFrameStats const& stats, std::shared_ptr<TestReport> const& report)
+{
+    wprintf(L"Max scRGB: (%f, %f, %f), max luminance %f (%f nits)\n", stats.Max.R, stats.Max.G, stats.Max.B, stats.MaxLuminance, stats.MaxLuminance * 80.0f);
+    wprintf(L"Mean scRGB: (%f, %f, %f), mean luminance %f (%f nits)\n", stats.Mean.R, stats.Mean.G, stats.Mean.B, stats.MeanLuminance, stats.MeanLuminance * 80.0);
+    wprintf(L"Matching pixels: %llu of %llu (%f%%)\n", stats.MatchingPixels, stats.PixelCount, stats.MatchingPercent);
+    wprintf(L"Luminance histogram:\n");
+    for (int bin = 0; bin < LuminanceHistogram::BinCount; bin++)
+    {
+        auto count = stats.Histogram.Counts[bin];
+        if (count > 0)
+        {
+            wprintf(L"  >= %f: %llu\n", LuminanceHistogram::BinLowerBound(bin), count);
+            report->Count("luminance_bin_" + std::to_string(bin), count);
+        }
+    }
+
+    report->Value("max_r", stats.Max.R);
+    report->Value("max_g", stats.Max.G);
+    report->Value("max_b", stats.Max.B);
+    report->Value("max_luminance", stats.MaxLuminance);
+    report->Value("mean_r", stats.Mean.R);
+    report->Value("mean_g", stats.Mean.G);
+    report->Value("mean_b", stats.Mean.B);
+    report->Value("mean_luminance", stats.MeanLuminance);
+    report->Value("matching_percent", stats.MatchingPercent);
+}
+
+IAsyncOperation<bool> HDRContentTest(CompositorController compositorController, IDirect3DDevice device, DispatcherQueue compositorThreadQueue, com_ptr<ID2D1Device> d2dDevice, testparams::HDRContentTestMode testMode, std::shared_ptr<TestReport> report)
 {
     auto compositor = compositorController.Compositor();
     auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
     com_ptr<ID3D11DeviceContext> d3dContext;
     d3dDevice->GetImmediateContext(d3dContext.put());
 
+    // Yellow is (1, 1, 0) in scRGB, so this is 3x SDR white in red and green
+    auto boostValue = 3.0f;
+    IDirect3DSurface frame{ nullptr };
+    auto success = true;
     try
     {
-        // Create the window on the compositor thread to borrow the message pump
-        auto window = co_await CreateSharedOnThreadAsync<DummyWindow>(compositorThreadQueue, L"HDR Content");
-
 		auto compositionGraphics = util::CreateCompositionGraphicsDevice(compositor, d2dDevice.get());
 		auto surface = compositionGraphics.CreateDrawingSurface(
 			{ 800, 600 }, DirectXPixelFormat::R16G16B16A16Float, DirectXAlphaMode::Premultiplied);
@@ -615,7 +1142,6 @@ IAsyncOperation<bool> HDRContentTest(CompositorController compositorController,
 			auto d2dContext = surfaceContext.GetDeviceContext();
 
 			auto color = D2D1::ColorF(D2D1::ColorF::Yellow, 1.0f);
-			auto boostValue = 3.0f;
 			color.r *= boostValue;
 			color.g *= boostValue;
 			color.b *= boostValue;
@@ -626,22 +1152,71 @@ IAsyncOperation<bool> HDRContentTest(CompositorController compositorController,
 		brush.Stretch(CompositionStretch::Fill);
 
 		auto visual = compositor.CreateSpriteVisual();
-		visual.RelativeSizeAdjustment({ 1, 1 });
 		visual.Brush(brush);
 
-		auto target = window->CreateWindowTarget(compositor);
-		target.Root(visual);
+        if (testMode == testparams::HDRContentTestMode::AdHoc)
+        {
+            // Create the window on the compositor thread to borrow the message pump
+            auto window = co_await CreateSharedOnThreadAsync<DummyWindow>(compositorThreadQueue, L"HDR Content");
 
-        compositorController.Commit();
-        co_await winrt::resume_on_signal(window->Closed().get());
+            visual.RelativeSizeAdjustment({ 1, 1 });
+            auto target = window->CreateWindowTarget(compositor);
+            target.Root(visual);
+
+            compositorController.Commit();
+            co_await winrt::resume_on_signal(window->Closed().get());
+        }
+        else
+        {
+            visual.Size({ 800, 600 });
+
+            // Capture in FP16 so nothing above 1.0 gets clamped
+            auto item = GraphicsCaptureItem::CreateFromVisual(visual);
+            auto asyncOperation = CaptureSnapshot::TakeAsync(device, item, true, true, DirectXPixelFormat::R16G16B16A16Float);
+            // We need to commit before we wait on this
+            auto capturePhase = report->Phase("capture");
+            compositorController.Commit();
+            frame = co_await asyncOperation;
+            capturePhase.Stop();
+            auto frameTexture = GetDXGIInterfaceFromObject<ID3D11Texture2D>(frame);
+
+            auto analyzePhase = report->Phase("analyze");
+            auto mapped = MappedTexture(d3dContext, frameTexture);
+            HdrAnalysisOptions options;
+            options.Expected = ScRgbColor{ boostValue, boostValue, 0.0f };
+            auto stats = AnalyzeHdrFrameParallel(mapped.HalfView(), options);
+            analyzePhase.Stop();
+
+            ReportHdrFrameStats(stats, report);
+            // Allow for a little filtering at the edges
+            if (stats.MatchingPercent < 99.0)
+            {
+                wprintf(L"HDR Content test failed! Only %f%% of pixels were (%f, %f, 0)\n", stats.MatchingPercent, boostValue, boostValue);
+                report->Message("Captured frame doesn't match the boosted color");
+                success = false;
+            }
+        }
     }
     catch (hresult_error const& error)
     {
         wprintf(L"HDR Content test failed! 0x%08x - %s \n", error.code().value, error.message().c_str());
-        co_return false;
+        report->Message(winrt::to_string(error.message()));
+        success = false;
     }
 
-    co_return true;
+    if (!success && frame != nullptr)
+    {
+        if (auto path = SaveFrame(device, frame, L"hdr_failure.exr"))
+        {
+            wprintf(L"Failure file queued: %s\n", path->c_str());
+        }
+        else
+        {
+            wprintf(L"Failure file dropped, the artifact queue is full\n");
+        }
+    }
+
+    co_return success;
 }
 
 IAsyncOperation<bool> DisplayAffinityTest(CompositorController compositorController, IDirect3DDevice device, DispatcherQueue compositorThreadQueue, testparams::DisplayAffinityMode mode)
@@ -731,6 +1306,15 @@ RECT GetClientAreaRectInCaptureSurfaceSpace(HWND window)
     };
 }
 
+PixelRect ClientAreaRegion(RECT const& clientArea)
+{
+    // Rounded window corners can eat into the client area, so stay clear of the edges
+    const LONG inset = 8;
+    auto width = std::max<LONG>(clientArea.right - clientArea.left - (2 * inset), 1);
+    auto height = std::max<LONG>(clientArea.bottom - clientArea.top - (2 * inset), 1);
+    return PixelRect{ (uint32_t)(clientArea.left + inset), (uint32_t)(clientArea.top + inset), (uint32_t)width, (uint32_t)height };
+}
+
 IAsyncOperation<GraphicsCaptureItem> CreateItemForWindowOnThreadAsync(DispatcherQueue threadQueue, HWND window)
 {
     wil::shared_event initialized(wil::EventOptions::None);
@@ -744,7 +1328,7 @@ IAsyncOperation<GraphicsCaptureItem> CreateItemForWindowOnThreadAsync(Dispatcher
     co_return item;
 }
 
-IAsyncOperation<bool> WindowStyleTest(CompositorController compositorController, IDirect3DDevice device, DispatcherQueue compositorThreadQueue, testparams::WindowStyleTestMode mode)
+IAsyncOperation<bool> WindowStyleTest(CompositorController compositorController, IDirect3DDevice device, DispatcherQueue compositorThreadQueue, testparams::WindowStyleTestMode mode, std::shared_ptr<TestReport> report)
 {
     auto compositor = compositorController.Compositor();
     auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
@@ -752,6 +1336,7 @@ IAsyncOperation<bool> WindowStyleTest(CompositorController compositorController,
     d3dDevice->GetImmediateContext(d3dContext.put());
 
     bool success = true;
+    CaptureFrameRing frames(1, QueueFullPolicy::DropOldest);
     Direct3D11CaptureFrame currentFrame{ nullptr };
     bool prematureWindowClose = false;
     try
@@ -784,82 +1369,61 @@ IAsyncOperation<bool> WindowStyleTest(CompositorController compositorController,
             auto framePool = Direct3D11CaptureFramePool::CreateFreeThreaded(
                 device,
                 DirectXPixelFormat::B8G8R8A8UIntNormalized,
-                1,
+                3,
                 item.Size());
             auto session = framePool.CreateCaptureSession(item);
-            auto frameEvent = wil::shared_event(wil::EventOptions::None);
-            framePool.FrameArrived([&currentFrame, frameEvent](auto& framePool, auto&)
+            QueueArrivingFrames(framePool, frames);
+            auto checkFrameArrived = [&prematureWindowClose](Direct3D11CaptureFrame const& frame)
             {
-                WINRT_ASSERT(!currentFrame);
-                currentFrame = framePool.TryGetNextFrame();
-                WINRT_ASSERT(!frameEvent.is_signaled());
-                frameEvent.SetEvent();
-            });
-            session.StartCapture();
-            if (!co_await winrt::resume_on_signal(frameEvent.get(), std::chrono::milliseconds(500)))
-            {
-                co_await captureThreadQueue;
-                if (prematureWindowClose)
+                if (!frame)
                 {
-                    throw hresult_error(E_UNEXPECTED, L"Window should not have closed during test!");
+                    if (prematureWindowClose)
+                    {
+                        throw hresult_error(E_UNEXPECTED, L"Window should not have closed during test!");
+                    }
+                    throw hresult_error(E_UNEXPECTED, L"Capture timed out");
                 }
-                throw hresult_error(E_UNEXPECTED, L"Capture timed out");
-            }
+            };
+            session.StartCapture();
+            currentFrame = co_await NextFrameAsync(frames, std::chrono::milliseconds(500));
             co_await captureThreadQueue;
+            checkFrameArrived(currentFrame);
 
             // Test for red
             auto clientArea = GetClientAreaRectInCaptureSurfaceSpace(window->m_window);
-            TestSurfaceAtPoint(device, currentFrame.Surface(), Colors::Red(), clientArea.left, clientArea.top);
+            TestSurfaceRegion(device, currentFrame.Surface(), Colors::Red(), ClientAreaRegion(clientArea));
 
             // Transition to pop-up
+            currentFrame.Close();
             window->Style(WindowStyle::Popup);
             window->SetBackgroundColor(Colors::Green());
-            // Wait for the transition
-            co_await std::chrono::milliseconds(500);
-
-            // Release the frame and get a new one
-            frameEvent.ResetEvent();
-            currentFrame.Close();
-            currentFrame = nullptr;
-            if (!co_await winrt::resume_on_signal(frameEvent.get(), std::chrono::milliseconds(500)))
+            // Wait for the transition to show up
+            currentFrame = co_await WaitForFrameAsync(frames, [device, hwnd = window->m_window](Direct3D11CaptureFrame const& frame)
             {
-                co_await captureThreadQueue;
-                if (prematureWindowClose)
-                {
-                    throw hresult_error(E_UNEXPECTED, L"Window should not have closed during test!");
-                }
-                throw hresult_error(E_UNEXPECTED, L"Capture timed out");
-            }
+                return SurfaceRegionMatches(device, frame.Surface(), Colors::Green(), ClientAreaRegion(GetClientAreaRectInCaptureSurfaceSpace(hwnd)));
+            }, std::chrono::seconds(5), report, "popup");
             co_await captureThreadQueue;
+            checkFrameArrived(currentFrame);
 
             // Test for green
             clientArea = GetClientAreaRectInCaptureSurfaceSpace(window->m_window);
-            TestSurfaceAtPoint(device, currentFrame.Surface(), Colors::Green(), clientArea.left, clientArea.top);
+            TestSurfaceRegion(device, currentFrame.Surface(), Colors::Green(), ClientAreaRegion(clientArea));
 
             // Transition to overlapped
+            currentFrame.Close();
             window->Style(WindowStyle::Overlapped);
             window->SetBackgroundColor(Colors::Blue());
-            // Wait for the transition
-            co_await std::chrono::milliseconds(500);
-
-            // Release the frame and get a new one
-            frameEvent.ResetEvent();
-            currentFrame.Close();
-            currentFrame = nullptr;
-            if (!co_await winrt::resume_on_signal(frameEvent.get(), std::chrono::milliseconds(500)))
+            // Wait for the transition to show up
+            currentFrame = co_await WaitForFrameAsync(frames, [device, hwnd = window->m_window](Direct3D11CaptureFrame const& frame)
             {
-                co_await captureThreadQueue;
-                if (prematureWindowClose)
-                {
-                    throw hresult_error(E_UNEXPECTED, L"Window should not have closed during test!");
-                }
-                throw hresult_error(E_UNEXPECTED, L"Capture timed out");
-            }
+                return SurfaceRegionMatches(device, frame.Surface(), Colors::Blue(), ClientAreaRegion(GetClientAreaRectInCaptureSurfaceSpace(hwnd)));
+            }, std::chrono::seconds(5), report, "overlapped");
             co_await captureThreadQueue;
+            checkFrameArrived(currentFrame);
 
             // Test for blue
             clientArea = GetClientAreaRectInCaptureSurfaceSpace(window->m_window);
-            TestSurfaceAtPoint(device, currentFrame.Surface(), Colors::Blue(), clientArea.left, clientArea.top);
+            TestSurfaceRegion(device, currentFrame.Surface(), Colors::Blue(), ClientAreaRegion(clientArea));
 
             co_await captureThreadQueue;
             item.Closed(closedToken);
@@ -873,8 +1437,14 @@ IAsyncOperation<bool> WindowStyleTest(CompositorController compositorController,
 
     if (!success && currentFrame != nullptr)
     {
-        auto file = co_await SaveFrameAsync(device, currentFrame.Surface(), L"window_style_failure.png");
-        wprintf(L"Failure file saved: %s\n", file.Path().c_str());
+        if (auto path = SaveFrame(device, currentFrame.Surface(), L"window_style_failure.png"))
+        {
+            wprintf(L"Failure file queued: %s\n", path->c_str());
+        }
+        else
+        {
+            wprintf(L"Failure file dropped, the artifact queue is full\n");
+        }
     }
 
     co_return success;
@@ -917,8 +1487,14 @@ IAsyncOperation<bool> WindowMarginsTest(CompositorController compositorControlle
 
     if (!success && currentFrame != nullptr)
     {
-        auto file = co_await SaveFrameAsync(device, currentFrame.Surface(), L"window_margin_failure.png");
-        wprintf(L"Failure file saved: %s\n", file.Path().c_str());
+        if (auto path = SaveFrame(device, currentFrame.Surface(), L"window_margin_failure.png"))
+        {
+            wprintf(L"Failure file queued: %s\n", path->c_str());
+        }
+        else
+        {
+            wprintf(L"Failure file dropped, the artifact queue is full\n");
+        }
     }
 
     co_return success;
@@ -1064,8 +1640,199 @@ bool PrintMonitorInfo()
     return true;
 }
 
-IAsyncAction MainAsync(testparams::TestParams params)
+struct StressTarget
 {
+    std::string Name;
+    GraphicsCaptureItem Item{ nullptr };
+};
+
+// Visible, titled, uncloaked top level windows that can be captured
+std::vector<StressTarget> FindStressWindows()
+{
+    std::vector<HWND> windows;
+    EnumWindows([](HWND window, LPARAM param) -> BOOL
+    {
+        DWORD cloaked = 0;
+        if (IsWindowVisible(window) &&
+            GetWindowTextLengthW(window) > 0 &&
+            SUCCEEDED(DwmGetWindowAttribute(window, DWMWA_CLOAKED, &cloaked, sizeof(cloaked))) &&
+            cloaked == 0)
+        {
+            reinterpret_cast<std::vector<HWND>*>(param)->push_back(window);
+        }
+        return TRUE;
+    }, reinterpret_cast<LPARAM>(&windows));
+
+    std::vector<StressTarget> targets;
+    for (auto&& window : windows)
+    {
+        try
+        {
+            std::wstring title(GetWindowTextLengthW(window) + 1, L'\0');
+            title.resize(GetWindowTextW(window, title.data(), static_cast<int>(title.size())));
+            targets.push_back({ "window " + winrt::to_string(title), util::CreateCaptureItemForWindow(window) });
+        }
+        catch (hresult_error const&)
+        {
+            // Some windows can't be captured, skip them
+        }
+    }
+    return targets;
+}
+
+std::vector<StressTarget> FindStressMonitors()
+{
+    std::vector<HMONITOR> monitors;
+    EnumDisplayMonitors(nullptr, nullptr, [](HMONITOR monitor, HDC, LPRECT, LPARAM param) -> BOOL
+    {
+        reinterpret_cast<std::vector<HMONITOR>*>(param)->push_back(monitor);
+        return TRUE;
+    }, reinterpret_cast<LPARAM>(&monitors));
+
+    std::vector<StressTarget> targets;
+    for (auto&& monitor : monitors)
+    {
+        auto monitorInfo = CreateWin32Struct<MONITORINFOEXW>();
+        winrt::check_bool(GetMonitorInfoW(monitor, &monitorInfo));
+        targets.push_back({ "monitor " + winrt::to_string(monitorInfo.szDevice), util::CreateCaptureItemForMonitor(monitor) });
+    }
+    return targets;
+}
+
+// Runs 1, 2, 4 ... MaxSessions capture sessions at once, cycling through
+// the windows and monitors when there are more sessions than targets, with
+// every session's FrameArrived handled on a work-stealing pool. Prints how
+// the delivery rate, latency and CPU cost change as sessions are added;
+// each session count is a subtest in the saved results. How many frames
+// windows and monitors produce depends on what's on screen, so run
+// something animated for numbers that compare.
+bool CaptureStressTest(IDirect3DDevice device, testparams::CaptureStress const& args, std::shared_ptr<TestReport> report)
+{
+    std::vector<StressTarget> targets;
+    auto windows = args.Source != testparams::CaptureStressSource::Monitors ? FindStressWindows() : std::vector<StressTarget>();
+    auto monitors = args.Source != testparams::CaptureStressSource::Windows ? FindStressMonitors() : std::vector<StressTarget>();
+    // Mixed alternates, so every session count gets some of both
+    for (size_t i = 0; i < std::max(windows.size(), monitors.size()); i++)
+    {
+        if (i < windows.size())
+        {
+            targets.push_back(windows[i]);
+        }
+        if (i < monitors.size())
+        {
+            targets.push_back(monitors[i]);
+        }
+    }
+    if (targets.empty())
+    {
+        wprintf(L"Nothing to capture!\n");
+        report->Message("Nothing to capture");
+        return false;
+    }
+    wprintf(L"Capturing %zu windows and %zu monitors\n", windows.size(), monitors.size());
+
+    WorkStealingPool pool(args.Workers > 0 ? args.Workers : std::max(1u, std::thread::hardware_concurrency()));
+    auto start = [&](StressSession& session) -> std::function<void()>
+    {
+        auto const& target = targets[session.Index() % targets.size()];
+        auto framePool = Direct3D11CaptureFramePool::CreateFreeThreaded(
+            device,
+            DirectXPixelFormat::B8G8R8A8UIntNormalized,
+            2,
+            target.Item.Size());
+        auto captureSession = framePool.CreateCaptureSession(target.Item);
+        if (winrt::Windows::Foundation::Metadata::ApiInformation::IsPropertyPresent(winrt::name_of<winrt::Windows::Graphics::Capture::GraphicsCaptureSession>(), L"MinUpdateInterval"))
+        {
+            captureSession.MinUpdateInterval(std::chrono::milliseconds(1));
+        }
+        if (winrt::Windows::Foundation::Metadata::ApiInformation::IsPropertyPresent(winrt::name_of<winrt::Windows::Graphics::Capture::GraphicsCaptureSession>(), L"IsBorderRequired"))
+        {
+            captureSession.IsBorderRequired(false);
+        }
+        session.SetHandler([framePool](StressSession& session)
+        {
+            try
+            {
+                while (auto frame = framePool.TryGetNextFrame())
+                {
+                    // SystemRelativeTime and steady_clock both count from the same QPC origin
+                    auto latency = std::chrono::steady_clock::now().time_since_epoch() - frame.SystemRelativeTime();
+                    session.RecordFrame(std::chrono::duration_cast<std::chrono::nanoseconds>(latency));
+                    frame.Close();
+                }
+            }
+            catch (hresult_error const&)
+            {
+                // The frame pool was closed while this was queued
+            }
+        });
+        // Closing doesn't wait for a FrameArrived that's already running, so
+        // stopping takes the lock to know the last one has finished
+        struct Delivery
+        {
+            std::mutex Lock;
+            bool Stopped = false;
+        };
+        auto delivery = std::make_shared<Delivery>();
+        framePool.FrameArrived([delivery, &session](auto&&, auto&&)
+        {
+            std::lock_guard lock(delivery->Lock);
+            if (!delivery->Stopped)
+            {
+                session.Signal();
+            }
+        });
+        captureSession.StartCapture();
+        return [framePool, captureSession, delivery]()
+        {
+            captureSession.Close();
+            framePool.Close();
+            std::lock_guard lock(delivery->Lock);
+            delivery->Stopped = true;
+        };
+    };
+    auto name = [&targets](uint32_t index) { return targets[index % targets.size()].Name; };
+
+    std::vector<StressLevelResult> levels;
+    for (auto sessions : StressSessionCounts(args.MaxSessions))
+    {
+        auto level = RunStressLevel(sessions, args.Duration, pool, start, name);
+        auto toMilliseconds = [](std::chrono::nanoseconds value) { return std::chrono::duration<double, std::milli>(value).count(); };
+        TestResult subtest;
+        subtest.Test = std::to_string(sessions) + " sessions";
+        subtest.Verdict = level.Delivered > 0 ? "PASSED" : "FAILED";
+        subtest.Milliseconds = std::chrono::duration<double, std::milli>(level.Window).count();
+        subtest.Counts.push_back({ "sessions", sessions });
+        subtest.Counts.push_back({ "frames", level.Frames });
+        subtest.Counts.push_back({ "delivered_frames", level.Delivered });
+        subtest.Counts.push_back({ "stolen_tasks", level.Pool.Stolen });
+        subtest.Values.push_back({ "fps", level.AggregateFramesPerSecond });
+        subtest.Values.push_back({ "min_session_fps", level.MinSessionFramesPerSecond });
+        subtest.Values.push_back({ "mean_session_fps", level.MeanSessionFramesPerSecond });
+        subtest.Values.push_back({ "latency_p50_ms", toMilliseconds(level.Latency.Percentile(50.0)) });
+        subtest.Values.push_back({ "latency_p99_ms", toMilliseconds(level.Latency.Percentile(99.0)) });
+        subtest.Values.push_back({ "latency_max_ms", toMilliseconds(level.Latency.Max()) });
+        subtest.Values.push_back({ "cpu_percent", level.CpuCores() * 100.0 });
+        subtest.Values.push_back({ "cpu_us_per_frame", level.CpuMicrosecondsPerFrame() });
+        report->Subtest(std::move(subtest));
+        levels.push_back(std::move(level));
+    }
+    PrintStressReport(levels);
+
+    // Static content only gets its first frame, which usually arrives before
+    // the measured window, so all that's asked is that frames arrived at all
+    auto success = true;
+    for (auto&& level : levels)
+    {
+        success &= level.Delivered > 0;
+    }
+    return success;
+}
+
+IAsyncOperation<bool> RunTestAsync(testparams::TestParams params, std::optional<GoldenOptions> goldens, std::shared_ptr<TestReport> report)
+{
+    auto setupPhase = report->Phase("setup");
+
     // The compositor needs a DispatcherQueue. Since we aren't going to pump messages,
     // we can't use our current thread. Create a new one that is controlled by the dispatcher.
     auto dispatcherController = DispatcherQueueController::CreateOnDedicatedThread();
@@ -1085,25 +1852,277 @@ IAsyncAction MainAsync(testparams::TestParams params)
     auto d2dDevice = util::CreateD2DDevice(d2dFactory, d3dDevice);
     winrt::com_ptr<ID2D1DeviceContext> d2dContext;
     check_hresult(d2dDevice->CreateDeviceContext(D2D1_DEVICE_CONTEXT_OPTIONS_NONE, d2dContext.put()));
+    setupPhase.Stop();
 
     // Tests
+    auto testPhase = report->Phase("test");
     auto success = std::visit(overloaded
     {
-        [=](testparams::Alpha const&) -> bool { return TransparencyTest(compositorController, device).get(); },
-        [=](testparams::FullscreenRate const& args) -> bool { return RenderRateTest(compositorController, device, compositorThread, args.FullscreenMode).get(); },
-        [=](testparams::FullscreenTransition const& args) -> bool { return FullscreenTransitionTest(compositorController, device, compositorThread, args.TransitionMode).get(); },
-        [=](testparams::HDRContent const&) -> bool { return HDRContentTest(compositorController, device, compositorThread, d2dDevice).get(); },
-        [=](testparams::WindowRate const& args) -> bool { return WindowRenderRateTest(compositorController, device, args.WindowTitle, args.Delay, args.Duration).get(); },
+        [=](testparams::Alpha const&) -> bool { return TransparencyTest(compositorController, device, goldens, report).get(); },
+        [=](testparams::FullscreenRate const& args) -> bool { return RenderRateTest(compositorController, device, compositorThread, args.FullscreenMode, args.TracePath, report).get(); },
+        [=](testparams::FullscreenTransition const& args) -> bool { return FullscreenTransitionTest(compositorController, device, compositorThread, args.TransitionMode, report).get(); },
+        [=](testparams::HDRContent const& args) -> bool { return HDRContentTest(compositorController, device, compositorThread, d2dDevice, args.TestMode, report).get(); },
+        [=](testparams::WindowRate const& args) -> bool { return WindowRenderRateTest(compositorController, device, args.WindowTitle, args.Delay, args.Duration, args.TracePath, args.HashFrames, args.DirtyTileSize, args.RecordPath, report).get(); },
         [=](testparams::CursorDisable const& args) -> bool { return CursorDisableTest(compositorController, device, compositorThread, args.Monitor, args.Window).get(); },
         [=](testparams::PCInfo const&) -> bool { auto buildString = GetBuildString(); wprintf(L"PC info: %s\n", buildString.c_str()); return true;  },
         [=](testparams::DisplayAffinity const& args) -> bool { return DisplayAffinityTest(compositorController, device, compositorThread, args.Mode).get();  },
-        [=](testparams::WindowStyle const& args) -> bool { return WindowStyleTest(compositorController, device, compositorThread, args.TransitionMode).get(); },
+        [=](testparams::WindowStyle const& args) -> bool { return WindowStyleTest(compositorController, device, compositorThread, args.TransitionMode, report).get(); },
         [=](testparams::WindowMargins const& args) -> bool { return WindowMarginsTest(compositorController, device, compositorThread, args.TestMode).get(); },
         [=](testparams::MonitorOff const&) -> bool { return MonitorOffTest(compositorController, device, compositorThread).get(); },
-        [=](testparams::MonitorInfo const&) -> bool { return PrintMonitorInfo(); }
+        [=](testparams::MonitorInfo const&) -> bool { return PrintMonitorInfo(); },
+        [=](testparams::CaptureStress const& args) -> bool { return CaptureStressTest(device, args, report); },
+        // These run from wmain, never as a test
+        [=](testparams::Suite const&) -> bool { return false; },
+        [=](testparams::SuiteWorker const&) -> bool { return false; }
     }, params);
+    testPhase.Stop();
 
-    wprintf(L"Test result: %s\n", success ? L"PASSED" : L"FAILED");
+    // Make sure every failure file is on disk before we report
+    auto flushPhase = report->Phase("artifacts");
+    ArtifactWriter::Shared().Flush();
+    flushPhase.Stop();
+    co_return success;
+}
+
+// Which global state a test takes over, so the suite runner knows what
+// it can't run in parallel.
+SuiteResource GetSuiteResources(testparams::TestParams const& params)
+{
+    return std::visit(overloaded
+    {
+        // Rate tests measure timing, so they get the machine to themselves
+        [](testparams::FullscreenRate const&) { return SuiteResource::FullscreenOutput | SuiteResource::Exclusive; },
+        [](testparams::FullscreenTransition const&) { return SuiteResource::FullscreenOutput; },
+        [](testparams::WindowRate const&) { return SuiteResource::Exclusive; },
+        [](testparams::CaptureStress const&) { return SuiteResource::Exclusive; },
+        // Monitor captures would see other tests' windows
+        [](testparams::CursorDisable const& args) { return args.Monitor ? SuiteResource::Cursor | SuiteResource::Exclusive : SuiteResource::Cursor; },
+        // Every capture on the machine is affected while the monitors are off
+        [](testparams::MonitorOff const&) { return SuiteResource::MonitorPower | SuiteResource::Exclusive; },
+        [](auto const&) { return SuiteResource::None; }
+    }, params);
+}
+
+struct ParsedCommandLine
+{
+    testparams::TestParams Params;
+    // Without the program name, the result output option or the golden options
+    std::vector<std::string> Arguments;
+    std::optional<ResultOutputOptions> Output;
+    std::optional<GoldenOptions> Goldens;
+};
+
+// Throws runtime_error if the command line isn't valid
+ParsedCommandLine ParseCommandLine(util::Application<testparams::TestParams>& app, std::vector<std::wstring> arguments)
+{
+    ParsedCommandLine result;
+    result.Output = TakeResultOutputOption(arguments);
+    result.Goldens = TakeGoldenOptions(arguments);
+    std::wstring programName = L"CaptureAdHocTest";
+    std::vector<wchar_t*> argv = { programName.data() };
+    for (auto&& argument : arguments)
+    {
+        argv.push_back(argument.data());
+        result.Arguments.push_back(winrt::to_string(argument));
+    }
+    result.Params = app.Parse(static_cast<int>(argv.size()), argv.data());
+    return result;
+}
+
+std::optional<ParsedCommandLine> TryParseTestArguments(util::Application<testparams::TestParams>& app, std::vector<std::string> const& arguments)
+{
+    std::vector<std::wstring> wideArguments;
+    for (auto&& argument : arguments)
+    {
+        wideArguments.push_back(std::wstring(winrt::to_hstring(argument)));
+    }
+    try
+    {
+        auto parsed = ParseCommandLine(app, wideArguments);
+        if (std::holds_alternative<testparams::Suite>(parsed.Params) || std::holds_alternative<testparams::SuiteWorker>(parsed.Params))
+        {
+            return std::nullopt;
+        }
+        return parsed;
+    }
+    catch (std::runtime_error const&)
+    {
+        return std::nullopt;
+    }
+}
+
+std::shared_ptr<TestResultWriter> CreateResultWriter(std::optional<ResultOutputOptions> const& output)
+{
+    if (!output)
+    {
+        return nullptr;
+    }
+    return std::make_shared<TestResultWriter>(output->Path, output->Format);
+}
+
+// Runs a test, saving its result if the command line asked for it. Throws
+// runtime_error if the result file can't be written.
+bool RunReportedTest(ParsedCommandLine const& command)
+{
+    auto arguments = command.Arguments;
+    auto test = arguments.front();
+    arguments.erase(arguments.begin());
+    auto report = std::make_shared<TestReport>(test, arguments, CreateResultWriter(command.Output));
+
+    auto success = false;
+    try
+    {
+        success = RunTestAsync(command.Params, command.Goldens, report).get();
+    }
+    catch (hresult_error const& error)
+    {
+        wprintf(L"Test failed! 0x%08x - %s\n", error.code().value, error.message().c_str());
+        report->Message(winrt::to_string(error.message()));
+    }
+    report->Finish(success);
+    if (command.Output)
+    {
+        wprintf(L"Test results saved: %s\n", command.Output->Path.c_str());
+    }
+    return success;
+}
+
+// Each suite test becomes a subtest. A test's own frames and statistics are
+// only saved if its line in the suite file asks for them.
+void WriteSuiteResult(ParsedCommandLine const& command, SuiteReport const& report)
+{
+    auto arguments = command.Arguments;
+    arguments.erase(arguments.begin());
+    TestReport result(command.Arguments.front(), arguments, CreateResultWriter(command.Output));
+    for (auto&& testResult : report.Results)
+    {
+        TestResult subtest;
+        subtest.Test = testResult.Name;
+        subtest.Verdict = SuiteVerdictName(testResult.Verdict);
+        subtest.Milliseconds = testResult.WallTime;
+        subtest.Counts.push_back({ "worker", testResult.Worker });
+        subtest.Values.push_back({ "start_ms", testResult.StartTime });
+        if (testResult.Verdict != SuiteVerdict::Passed && !testResult.Output.empty())
+        {
+            subtest.Messages.push_back(testResult.Output);
+        }
+        result.Subtest(std::move(subtest));
+    }
+    result.Count("workers", report.Workers);
+    result.Count("passed", report.Count(SuiteVerdict::Passed));
+    result.Count("failed", report.Count(SuiteVerdict::Failed));
+    result.Count("crashed", report.Count(SuiteVerdict::Crashed));
+    result.Count("timed_out", report.Count(SuiteVerdict::TimedOut));
+    result.Value("suite_wall_time_ms", report.WallTime);
+    result.Finish(report.Passed());
+}
+
+void PrintSuiteReport(SuiteReport const& report)
+{
+    for (auto&& result : report.Results)
+    {
+        wprintf(L"%-9S %10.1fms  %s\n", SuiteVerdictName(result.Verdict), result.WallTime, winrt::to_hstring(result.Name).c_str());
+        if (result.Verdict != SuiteVerdict::Passed && !result.Output.empty())
+        {
+            std::istringstream output(result.Output);
+            std::string line;
+            while (std::getline(output, line))
+            {
+                wprintf(L"    %s\n", winrt::to_hstring(line).c_str());
+            }
+        }
+    }
+    wprintf(L"Suite: %zu passed, %zu failed, %zu crashed, %zu timed out in %.1fs on %u workers\n",
+        report.Count(SuiteVerdict::Passed), report.Count(SuiteVerdict::Failed), report.Count(SuiteVerdict::Crashed),
+        report.Count(SuiteVerdict::TimedOut), report.WallTime / 1000.0, report.Workers);
+}
+
+// Runs every test in the suite file on worker processes (this program
+// started with suite-worker), serializing only tests that share a resource.
+int RunSuite(util::Application<testparams::TestParams>& app, ParsedCommandLine const& command)
+{
+    auto& args = std::get<testparams::Suite>(command.Params);
+
+    std::vector<SuiteTest> tests;
+    try
+    {
+        tests = LoadSuiteFile(args.SuitePath);
+    }
+    catch (std::runtime_error const& error)
+    {
+        wprintf(L"Failed to load suite! %S\n", error.what());
+        return 1;
+    }
+
+    // Check every line up front, rather than finding a typo halfway through the night
+    for (auto&& test : tests)
+    {
+        auto parsed = TryParseTestArguments(app, test.Arguments);
+        if (!parsed)
+        {
+            wprintf(L"Invalid test in suite: %s\n", winrt::to_hstring(test.Name).c_str());
+            return 1;
+        }
+        test.Resources = GetSuiteResources(parsed->Params);
+        test.Timeout = args.Timeout;
+    }
+
+    std::wstring programPath(MAX_PATH, L'\0');
+    programPath.resize(GetModuleFileNameW(nullptr, programPath.data(), static_cast<DWORD>(programPath.size())));
+    std::vector<std::string> workerCommandLine = { winrt::to_string(programPath), "suite-worker" };
+    wprintf(L"Running %zu tests on %u workers...\n", tests.size(), args.Workers);
+
+    SuiteWorkerRunner runner(workerCommandLine, args.Workers);
+    SuiteScheduler scheduler(args.Workers, [&](uint32_t worker, SuiteTest const& test) { return runner(worker, test); });
+    auto report = scheduler.Run(tests);
+    PrintSuiteReport(report);
+    if (command.Output)
+    {
+        try
+        {
+            WriteSuiteResult(command, report);
+            wprintf(L"Suite results saved: %s\n", command.Output->Path.c_str());
+        }
+        catch (std::runtime_error const& error)
+        {
+            wprintf(L"Failed to save suite results! %S\n", error.what());
+        }
+    }
+    wprintf(L"Test result: %s\n", report.Passed() ? L"PASSED" : L"FAILED");
+    return report.Passed() ? 0 : 1;
+}
+
+// Runs tests for a suite runner until it closes our stdin. See SuiteWorker.h.
+int RunSuiteWorker(util::Application<testparams::TestParams>& app)
+{
+    auto writeLine = [](std::string const& line)
+    {
+        fflush(stdout);
+        wprintf(L"%S\n", line.c_str());
+        fflush(stdout);
+    };
+    auto result = RunSuiteWorkerLoop(std::cin, writeLine, [&](std::vector<std::string> const& arguments)
+    {
+        auto parsed = TryParseTestArguments(app, arguments);
+        if (!parsed)
+        {
+            wprintf(L"Invalid test arguments!\n");
+            return false;
+        }
+        auto success = false;
+        try
+        {
+            success = RunReportedTest(*parsed);
+        }
+        catch (std::runtime_error const& error)
+        {
+            wprintf(L"Failed to save test results! %S\n", error.what());
+        }
+        wprintf(L"Test result: %s\n", success ? L"PASSED" : L"FAILED");
+        return success;
+    });
+    ArtifactWriter::Shared().Close();
+    return result;
 }
 
 int wmain(int argc, wchar_t* argv[])
@@ -1123,13 +2142,16 @@ int wmain(int argc, wchar_t* argv[])
     auto app = util::Application<testparams::TestParams>(L"CaptureAdHocTest")
         .Version(L"0.2.0")
         .Author(L"Robert Mikhayelyan (rob.mikh@outlook.com)")
-        .About(L"A small utility to test various parts of the Windows.Graphics.Capture API.")
+        .About(L"A small utility to test various parts of the Windows.Graphics.Capture API. Every command also takes --json <path> or --jsonl <path> to save its results, and --goldens <dir> (with --bless to replace them) to check frames against known good ones.")
         .Command(util::Command(L"alpha", testparams::TestParams(testparams::Alpha())))
         .Command(util::Command(L"fullscreen-rate", std::function(AdHocTestCliValidator::ValidateFullscreenRate))
             .Argument(util::Argument(L"--setfullscreenstate")
                 .Alias(L"-sfs"))
             .Argument(util::Argument(L"--fullscreenwindow")
-                .Alias(L"-fw")))
+                .Alias(L"-fw"))
+            .Argument(util::Argument(L"--trace")
+                .Description(L"per-frame trace output path")
+                .TakesValue(true)))
         .Command(util::Command(L"fullscreen-transition", std::function(AdHocTestCliValidator::ValidateFullscreenTransition))
             .Argument(util::Argument(L"--adhoc")
                 .Alias(L"-ah"))
@@ -1146,13 +2168,28 @@ int wmain(int argc, wchar_t* argv[])
             .Argument(util::Argument(L"--duration")
                 .Description(L"duration in seconds")
                 .TakesValue(true)
-                .DefaultValue(L"10")))
+                .DefaultValue(L"10"))
+            .Argument(util::Argument(L"--trace")
+                .Description(L"per-frame trace output path")
+                .TakesValue(true))
+            .Argument(util::Argument(L"--hash")
+                .Description(L"hash each frame to count unique frames"))
+            .Argument(util::Argument(L"--tiles")
+                .Description(L"track changed tiles of this size between frames")
+                .TakesValue(true))
+            .Argument(util::Argument(L"--record")
+                .Description(L"record every frame to a Y4M (I420) file")
+                .TakesValue(true)))
         .Command(util::Command(L"cursor-disable", std::function(AdHocTestCliValidator::ValidateCursorDisable))
             .Argument(util::Argument(L"--monitor")
                 .Alias(L"-m"))
             .Argument(util::Argument(L"--window")
                 .Alias(L"-w")))
-        .Command(util::Command(L"hdr-content", testparams::TestParams(testparams::HDRContent())))
+        .Command(util::Command(L"hdr-content", std::function(AdHocTestCliValidator::ValidateHDRContent))
+            .Argument(util::Argument(L"--adhoc")
+                .Alias(L"-ah"))
+            .Argument(util::Argument(L"--automated")
+                .Alias(L"-auto")))
         .Command(util::Command(L"display-affinity", std::function(AdHocTestCliValidator::ValidateDisplayAffinity))
             .Argument(util::Argument(L"--none")
                 .Alias(L"-n"))
@@ -1172,12 +2209,42 @@ int wmain(int argc, wchar_t* argv[])
                 .Alias(L"-auto")))
         .Command(util::Command(L"monitor-off", testparams::TestParams(testparams::MonitorOff())))
         .Command(util::Command(L"pc-info", testparams::TestParams(testparams::PCInfo())))
-        .Command(util::Command(L"monitor-info", testparams::TestParams(testparams::MonitorInfo())));
+        .Command(util::Command(L"monitor-info", testparams::TestParams(testparams::MonitorInfo())))
+        .Command(util::Command(L"suite", std::function(AdHocTestCliValidator::ValidateSuite))
+            .Argument(util::Argument(L"--file")
+                .Required(true)
+                .Description(L"suite file, one test command line per line")
+                .TakesValue(true))
+            .Argument(util::Argument(L"--workers")
+                .Description(L"number of worker processes")
+                .TakesValue(true)
+                .DefaultValue(L"4"))
+            .Argument(util::Argument(L"--timeout")
+                .Description(L"per-test timeout in seconds")
+                .TakesValue(true)
+                .DefaultValue(L"600")))
+        .Command(util::Command(L"suite-worker", testparams::TestParams(testparams::SuiteWorker())))
+        .Command(util::Command(L"capture-stress", std::function(AdHocTestCliValidator::ValidateCaptureStress))
+            .Argument(util::Argument(L"--windows")
+                .Description(L"only capture windows (default: windows and monitors)"))
+            .Argument(util::Argument(L"--monitors")
+                .Description(L"only capture monitors"))
+            .Argument(util::Argument(L"--sessions")
+                .Description(L"most sessions at once, doubling from 1")
+                .TakesValue(true)
+                .DefaultValue(L"64"))
+            .Argument(util::Argument(L"--duration")
+                .Description(L"seconds per session count")
+                .TakesValue(true)
+                .DefaultValue(L"5"))
+            .Argument(util::Argument(L"--workers")
+                .Description(L"handler threads (default: one per core)")
+                .TakesValue(true)));
 
-    testparams::TestParams params;
+    ParsedCommandLine command;
     try
     {
-        params = app.Parse(argc, argv);
+        command = ParseCommandLine(app, std::vector<std::wstring>(argv + 1, argv + argc));
     }
     catch (std::runtime_error const&)
     {
@@ -1185,6 +2252,34 @@ int wmain(int argc, wchar_t* argv[])
         return 1;
     }
 
-    MainAsync(params).get();
+    if (std::holds_alternative<testparams::Suite>(command.Params))
+    {
+        return RunSuite(app, command);
+    }
+    if (std::holds_alternative<testparams::SuiteWorker>(command.Params))
+    {
+        return RunSuiteWorker(app);
+    }
+
+    auto success = false;
+    try
+    {
+        success = RunReportedTest(command);
+    }
+    catch (std::runtime_error const& error)
+    {
+        wprintf(L"Failed to save test results! %S\n", error.what());
+    }
+
+    // Make sure every failure file is on disk before we exit
+    auto& artifacts = ArtifactWriter::Shared();
+    artifacts.Close();
+    auto artifactStats = artifacts.Stats();
+    if (artifactStats.Queued > 0)
+    {
+        PrintArtifactStats(artifactStats);
+    }
+
+    wprintf(L"Test result: %s\n", success ? L"PASSED" : L"FAILED");
     return 0;
 }
@@ -34,6 +34,8 @@
 #include <future>
 #include <variant>
 #include <functional>
+#include <mutex>
+#include <optional>
 
 // WIL
 #include <wil/resource.h>
@@ -1,4 +1,9 @@
 #pragma once
+#include "GoldenStore.h"
+#include "HalfFloat.h"
+#include "ImageDiff.h"
+#include "ReferenceRasterizer.h"
+#include "RegionVerifier.h"
 
 template<typename T>
 inline void check_color(T value, winrt::Windows::UI::Color const& expected)
@@ -16,6 +21,114 @@ inline void check_color(T value, winrt::Windows::UI::Color const& expected)
 	}
 }
 
+inline BgraColor to_bgra(winrt::Windows::UI::Color const& color)
+{
+	return BgraColor{ color.B, color.G, color.R, color.A };
+}
+
+// Describes how badly a frame differs: per-channel error and where the
+// largest differing areas are.
+inline void append_diff_summary(std::wstringstream& stringStream, ImageDiffResult const& diff, uint32_t offsetX = 0, uint32_t offsetY = 0)
+{
+	auto const& error = diff.MaxError;
+	stringStream << L"\tDiffering pixels: " << diff.DifferingPixels << L" of " << diff.PixelCount;
+	stringStream << std::endl;
+	stringStream << L"\tMax error: ( B: " << (uint32_t)error.B << L", G: " << (uint32_t)error.G << ", R: " << (uint32_t)error.R << ", A: " << (uint32_t)error.A << " )";
+	stringStream << std::endl;
+	stringStream << L"\tDiffering areas: " << diff.TotalRegionCount;
+	stringStream << std::endl;
+	for (auto&& region : diff.Regions)
+	{
+		auto const& bounds = region.Bounds;
+		stringStream << L"\t\t( X: " << bounds.X + offsetX << L", Y: " << bounds.Y + offsetY << L", Width: " << bounds.Width << L", Height: " << bounds.Height << L" ) " << region.PixelCount << L" pixels";
+		stringStream << std::endl;
+	}
+}
+
+inline void check_region(RegionVerifyResult const& result, PixelRect const& rect, winrt::Windows::UI::Color const& expected, ImageDiffResult const* diff = nullptr)
+{
+	if (!result.Passed())
+	{
+		auto const& value = result.FirstMismatchValue;
+		auto const& bounds = result.MismatchBounds;
+		std::wstringstream stringStream;
+		stringStream << L"Region color comparison failed!";
+		stringStream << std::endl;
+		stringStream << L"\tRegion: ( X: " << rect.X << L", Y: " << rect.Y << L", Width: " << rect.Width << L", Height: " << rect.Height << L" )";
+		stringStream << std::endl;
+		stringStream << L"\tMismatched pixels: " << result.MismatchCount << L" of " << result.PixelCount;
+		stringStream << std::endl;
+		stringStream << L"\tFirst mismatch: ( X: " << result.FirstMismatchX << L", Y: " << result.FirstMismatchY << L" ) ( B: " << (uint32_t)value.B << L", G: " << (uint32_t)value.G << ", R: " << (uint32_t)value.R << ", A: " << (uint32_t)value.A << " )";
+		stringStream << std::endl;
+		stringStream << L"\tMismatch bounds: ( X: " << bounds.X << L", Y: " << bounds.Y << L", Width: " << bounds.Width << L", Height: " << bounds.Height << L" )";
+		stringStream << std::endl;
+		stringStream << L"\tExpected: ( B: " << (uint32_t)expected.B << L", G: " << (uint32_t)expected.G << ", R: " << (uint32_t)expected.R << ", A: " << (uint32_t)expected.A << " )";
+		stringStream << std::endl;
+		if (diff != nullptr)
+		{
+			append_diff_summary(stringStream, *diff, rect.X, rect.Y);
+		}
+		throw winrt::hresult_error(E_FAIL, stringStream.str());
+	}
+}
+
+inline void check_reference(RegionVerifyResult const& result, ReferenceRasterizer const& reference, ImageDiffResult const* diff = nullptr)
+{
+	if (!result.Passed())
+	{
+		auto const& value = result.FirstMismatchValue;
+		auto const& bounds = result.MismatchBounds;
+		auto expected = reference.View().Row(result.FirstMismatchY) + (result.FirstMismatchX * 4);
+		std::wstringstream stringStream;
+		stringStream << L"Reference image comparison failed!";
+		stringStream << std::endl;
+		stringStream << L"\tMismatched pixels: " << result.MismatchCount << L" of " << result.PixelCount << L" (" << reference.FringePixels() << L" on edges)";
+		stringStream << std::endl;
+		stringStream << L"\tFirst mismatch: ( X: " << result.FirstMismatchX << L", Y: " << result.FirstMismatchY << L" ) ( B: " << (uint32_t)value.B << L", G: " << (uint32_t)value.G << ", R: " << (uint32_t)value.R << ", A: " << (uint32_t)value.A << " )";
+		stringStream << std::endl;
+		stringStream << L"\tMismatch bounds: ( X: " << bounds.X << L", Y: " << bounds.Y << L", Width: " << bounds.Width << L", Height: " << bounds.Height << L" )";
+		stringStream << std::endl;
+		stringStream << L"\tExpected: ( B: " << (uint32_t)expected[0] << L", G: " << (uint32_t)expected[1] << ", R: " << (uint32_t)expected[2] << ", A: " << (uint32_t)expected[3] << " )";
+		stringStream << std::endl;
+		if (diff != nullptr)
+		{
+			append_diff_summary(stringStream, *diff, 0, 0);
+		}
+		throw winrt::hresult_error(E_FAIL, stringStream.str());
+	}
+}
+
+inline void check_golden(GoldenCompareResult const& result, GoldenImage const& golden)
+{
+	if (!result.Passed())
+	{
+		std::wstringstream stringStream;
+		stringStream << L"Golden image comparison failed!";
+		stringStream << std::endl;
+		if (!result.SizeMatches)
+		{
+			stringStream << L"\tGolden size: ( Width: " << golden.Width() << L", Height: " << golden.Height() << L" )";
+			stringStream << std::endl;
+			throw winrt::hresult_error(E_FAIL, stringStream.str());
+		}
+		auto const& error = result.MaxError;
+		stringStream << L"\tChanged tiles: " << result.ChangedTiles << L" of " << result.TileCount << L" (" << result.FailedTiles.size() << L" over tolerance)";
+		stringStream << std::endl;
+		stringStream << L"\tDiffering pixels: " << result.DifferingPixels;
+		stringStream << std::endl;
+		stringStream << L"\tMax error: ( B: " << (uint32_t)error.B << L", G: " << (uint32_t)error.G << ", R: " << (uint32_t)error.R << ", A: " << (uint32_t)error.A << " )";
+		stringStream << std::endl;
+		auto shown = std::min<size_t>(result.FailedTiles.size(), 8);
+		for (size_t i = 0; i < shown; i++)
+		{
+			auto const& tile = result.FailedTiles[i];
+			stringStream << L"\t\t( X: " << tile.X << L", Y: " << tile.Y << L", Width: " << tile.Width << L", Height: " << tile.Height << L" )";
+			stringStream << std::endl;
+		}
+		throw winrt::hresult_error(E_FAIL, stringStream.str());
+	}
+}
+
 class MappedTexture
 {
 public:
@@ -44,6 +157,61 @@ public:
 		m_d3dContext->Unmap(m_texture.get(), 0);
 	}
 
+	BgraImageView View() const
+	{
+		return BgraImageView{ static_cast<uint8_t const*>(m_mappedData.pData), m_textureDesc.Width, m_textureDesc.Height, m_mappedData.RowPitch };
+	}
+
+	// For R16G16B16A16Float textures
+	HalfImageView HalfView() const
+	{
+		if (m_textureDesc.Format != DXGI_FORMAT_R16G16B16A16_FLOAT)
+		{
+			throw winrt::hresult_invalid_argument(L"Texture isn't R16G16B16A16Float!");
+		}
+		return HalfImageView{ static_cast<uint8_t const*>(m_mappedData.pData), m_textureDesc.Width, m_textureDesc.Height, m_mappedData.RowPitch };
+	}
+
+	RegionVerifyResult VerifyRegion(PixelRect const& rect, winrt::Windows::UI::Color const& expected, BgraColor const& tolerance = {}) const
+	{
+		if (!View().Contains(rect))
+		{
+			throw winrt::hresult_out_of_bounds();
+		}
+		return VerifyRegionParallel(View(), rect, to_bgra(expected), tolerance);
+	}
+
+	ImageDiffResult DiffRegion(PixelRect const& rect, winrt::Windows::UI::Color const& expected, BgraColor const& tolerance = {}) const
+	{
+		if (!View().Contains(rect))
+		{
+			throw winrt::hresult_out_of_bounds();
+		}
+		ImageDiffOptions options;
+		options.Threshold = tolerance;
+		return DiffImageAgainstColor(View().SubView(rect), to_bgra(expected), options);
+	}
+
+	// Checks the whole reference, from the top left of the texture
+	RegionVerifyResult CompareToReference(ReferenceRasterizer const& reference, BgraColor const& tolerance = {}) const
+	{
+		if (!View().Contains(PixelRect{ 0, 0, reference.Width(), reference.Height() }))
+		{
+			throw winrt::hresult_out_of_bounds();
+		}
+		return CompareToReferenceParallel(View(), reference, tolerance);
+	}
+
+	// Against the reference's expected image, for describing a failure
+	ImageDiffResult DiffReference(ReferenceRasterizer const& reference) const
+	{
+		if (!View().Contains(PixelRect{ 0, 0, reference.Width(), reference.Height() }))
+		{
+			throw winrt::hresult_out_of_bounds();
+		}
+		return DiffImages(View().SubView(PixelRect{ 0, 0, reference.Width(), reference.Height() }), reference.View());
+	}
+
 	BGRAPixel ReadBGRAPixel(uint32_t x, uint32_t y)
 	{
 		if (x < m_textureDesc.Width && y < m_textureDesc.Height)
@@ -70,6 +238,246 @@ private:
 	D3D11_TEXTURE2D_DESC m_textureDesc = {};
 };
 
+// Creating a staging texture for every readback is expensive, and the tests
+// read back frames of the same size over and over. Copy hands out a staging
+// texture that goes back to the cache when its lease is destroyed.
+class StagingTextureCache
+{
+public:
+	class Lease
+	{
+	public:
+		Lease(StagingTextureCache* cache, winrt::com_ptr<ID3D11Device> const& device, winrt::com_ptr<ID3D11Texture2D> const& texture)
+		{
+			m_cache = cache;
+			m_device = device;
+			m_texture = texture;
+		}
+		Lease(Lease&& other) noexcept
+		{
+			m_cache = std::exchange(other.m_cache, nullptr);
+			m_device = std::move(other.m_device);
+			m_texture = std::move(other.m_texture);
+		}
+		~Lease()
+		{
+			if (m_cache != nullptr && m_texture != nullptr)
+			{
+				m_cache->Return(m_device, m_texture);
+			}
+		}
+
+		Lease(Lease const&) = delete;
+		Lease& operator=(Lease const&) = delete;
+		Lease& operator=(Lease&&) = delete;
+
+		winrt::com_ptr<ID3D11Texture2D> const& Texture() const { return m_texture; }
+
+	private:
+		StagingTextureCache* m_cache = nullptr;
+		winrt::com_ptr<ID3D11Device> m_device;
+		winrt::com_ptr<ID3D11Texture2D> m_texture;
+	};
+
+	static StagingTextureCache& Shared()
+	{
+		static StagingTextureCache cache;
+		return cache;
+	}
+
+	// Copies the texture into a (possibly reused) staging texture
+	Lease Copy(winrt::com_ptr<ID3D11Device> const& d3dDevice, winrt::com_ptr<ID3D11DeviceContext> const& d3dContext, winrt::com_ptr<ID3D11Texture2D> const& texture)
+	{
+		D3D11_TEXTURE2D_DESC desc = {};
+		texture->GetDesc(&desc);
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.BindFlags = 0;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.MiscFlags = 0;
+
+		auto staging = Take(d3dDevice, desc);
+		if (staging == nullptr)
+		{
+			winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, staging.put()));
+		}
+		d3dContext->CopyResource(staging.get(), texture.get());
+		return Lease(this, d3dDevice, staging);
+	}
+
+	// Copies just part of the texture, for when only a corner is needed
+	Lease CopyRegion(winrt::com_ptr<ID3D11Device> const& d3dDevice, winrt::com_ptr<ID3D11DeviceContext> const& d3dContext, winrt::com_ptr<ID3D11Texture2D> const& texture, PixelRect const& rect)
+	{
+		D3D11_TEXTURE2D_DESC desc = {};
+		texture->GetDesc(&desc);
+		desc.Width = rect.Width;
+		desc.Height = rect.Height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.BindFlags = 0;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		desc.MiscFlags = 0;
+
+		auto staging = Take(d3dDevice, desc);
+		if (staging == nullptr)
+		{
+			winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, staging.put()));
+		}
+		D3D11_BOX box = { rect.X, rect.Y, 0, rect.Right(), rect.Bottom(), 1 };
+		d3dContext->CopySubresourceRegion(staging.get(), 0, 0, 0, 0, texture.get(), 0, &box);
+		return Lease(this, d3dDevice, staging);
+	}
+
+private:
+	static constexpr size_t MaxCachedTextures = 4;
+
+	struct Entry
+	{
+		winrt::com_ptr<ID3D11Device> Device;
+		winrt::com_ptr<ID3D11Texture2D> Texture;
+		D3D11_TEXTURE2D_DESC Desc;
+	};
+
+	winrt::com_ptr<ID3D11Texture2D> Take(winrt::com_ptr<ID3D11Device> const& d3dDevice, D3D11_TEXTURE2D_DESC const& desc)
+	{
+		std::lock_guard lock(m_lock);
+		for (auto it = m_free.begin(); it != m_free.end(); it++)
+		{
+			if (it->Device == d3dDevice && std::memcmp(&it->Desc, &desc, sizeof(desc)) == 0)
+			{
+				auto texture = it->Texture;
+				m_free.erase(it);
+				return texture;
+			}
+		}
+		return nullptr;
+	}
+
+	void Return(winrt::com_ptr<ID3D11Device> const& d3dDevice, winrt::com_ptr<ID3D11Texture2D> const& texture)
+	{
+		D3D11_TEXTURE2D_DESC desc = {};
+		texture->GetDesc(&desc);
+		std::lock_guard lock(m_lock);
+		if (m_free.size() >= MaxCachedTextures)
+		{
+			m_free.erase(m_free.begin());
+		}
+		m_free.push_back(Entry{ d3dDevice, texture, desc });
+	}
+
+private:
+	std::mutex m_lock;
+	std::vector<Entry> m_free;
+};
+
+// A fixed set of staging textures for frames that are read back later, on
+// another thread, so the thread that copies the frame doesn't wait for the
+// GPU. CopyRegion doesn't wait for a texture to come free either: with all of
+// them in use it returns nullptr, and the caller drops the frame. The ring
+// has to outlive its leases.
+class StagingTextureRing
+{
+public:
+	class Lease
+	{
+	public:
+		Lease(StagingTextureRing* ring, size_t index, uint32_t width, uint32_t height)
+		{
+			m_ring = ring;
+			m_index = index;
+			m_width = width;
+			m_height = height;
+		}
+		~Lease()
+		{
+			m_ring->Return(m_index);
+		}
+
+		Lease(Lease const&) = delete;
+		Lease& operator=(Lease const&) = delete;
+
+		// Maps the copied part of the texture, waiting for the copy to finish,
+		// for as long as the callback runs. Only one thread may call this at a time.
+		void Read(std::function<void(BgraImageView const&)> const& callback) const
+		{
+			auto mapped = MappedTexture(m_ring->m_d3dContext, m_ring->m_textures[m_index]);
+			callback(mapped.View().SubView(PixelRect{ 0, 0, m_width, m_height }));
+		}
+
+	private:
+		StagingTextureRing* m_ring = nullptr;
+		size_t m_index = 0;
+		uint32_t m_width = 0;
+		uint32_t m_height = 0;
+	};
+
+	// Copies are clipped to width x height. The leases are mapped on other
+	// threads, so this makes the immediate context multithread protected.
+	StagingTextureRing(winrt::com_ptr<ID3D11Device> const& d3dDevice, winrt::com_ptr<ID3D11DeviceContext> const& d3dContext, uint32_t width, uint32_t height, uint32_t count)
+	{
+		m_d3dContext = d3dContext;
+		m_d3dContext.as<ID3D11Multithread>()->SetMultithreadProtected(TRUE);
+		D3D11_TEXTURE2D_DESC desc = {};
+		desc.Width = width;
+		desc.Height = height;
+		desc.MipLevels = 1;
+		desc.ArraySize = 1;
+		desc.Format = DXGI_FORMAT_B8G8R8A8_UNORM;
+		desc.SampleDesc.Count = 1;
+		desc.Usage = D3D11_USAGE_STAGING;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			winrt::com_ptr<ID3D11Texture2D> texture;
+			winrt::check_hresult(d3dDevice->CreateTexture2D(&desc, nullptr, texture.put()));
+			m_textures.push_back(texture);
+			m_inUse.push_back(false);
+		}
+		m_width = width;
+		m_height = height;
+	}
+
+	StagingTextureRing(StagingTextureRing const&) = delete;
+	StagingTextureRing& operator=(StagingTextureRing const&) = delete;
+
+	// Starts copying the top left width x height of the texture, or as much
+	// of it as fits in the ring's textures
+	std::shared_ptr<Lease> CopyRegion(winrt::com_ptr<ID3D11Texture2D> const& texture, uint32_t width, uint32_t height)
+	{
+		size_t index = 0;
+		{
+			std::lock_guard lock(m_lock);
+			auto free = std::find(m_inUse.begin(), m_inUse.end(), false);
+			if (free == m_inUse.end())
+			{
+				return nullptr;
+			}
+			*free = true;
+			index = static_cast<size_t>(free - m_inUse.begin());
+		}
+		width = std::min(width, m_width);
+		height = std::min(height, m_height);
+		D3D11_BOX box = { 0, 0, 0, width, height, 1 };
+		m_d3dContext->CopySubresourceRegion(m_textures[index].get(), 0, 0, 0, 0, texture.get(), 0, &box);
+		return std::make_shared<Lease>(this, index, width, height);
+	}
+
+private:
+	void Return(size_t index)
+	{
+		std::lock_guard lock(m_lock);
+		m_inUse[index] = false;
+	}
+
+private:
+	winrt::com_ptr<ID3D11DeviceContext> m_d3dContext;
+	std::vector<winrt::com_ptr<ID3D11Texture2D>> m_textures;
+	uint32_t m_width = 0;
+	uint32_t m_height = 0;
+	std::mutex m_lock;
+	std::vector<bool> m_inUse;
+};
+
 inline void TestSurfaceAtPoint(
 	winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device, 
 	winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface const& surface, 
@@ -81,20 +489,72 @@ inline void TestSurfaceAtPoint(
 	winrt::com_ptr<ID3D11DeviceContext> d3dContext;
 	d3dDevice->GetImmediateContext(d3dContext.put());
 
-	auto frameTexture = robmikh::common::uwp::CopyD3DTexture(d3dDevice, GetDXGIInterfaceFromObject<ID3D11Texture2D>(surface), true);
-	D3D11_TEXTURE2D_DESC desc = {};
-	frameTexture->GetDesc(&desc);
-	auto mapped = MappedTexture(d3dContext, frameTexture);
+	auto staging = StagingTextureCache::Shared().Copy(d3dDevice, d3dContext, GetDXGIInterfaceFromObject<ID3D11Texture2D>(surface));
+	auto mapped = MappedTexture(d3dContext, staging.Texture());
 	check_color(mapped.ReadBGRAPixel(x, y), expectedColor);
 }
 
+inline void TestSurfaceRegion(
+	winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
+	winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface const& surface,
+	winrt::Windows::UI::Color expectedColor,
+	PixelRect const& rect,
+	BgraColor const& tolerance = {})
+{
+	auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
+	winrt::com_ptr<ID3D11DeviceContext> d3dContext;
+	d3dDevice->GetImmediateContext(d3dContext.put());
+
+	auto staging = StagingTextureCache::Shared().Copy(d3dDevice, d3dContext, GetDXGIInterfaceFromObject<ID3D11Texture2D>(surface));
+	auto mapped = MappedTexture(d3dContext, staging.Texture());
+	auto result = mapped.VerifyRegion(rect, expectedColor, tolerance);
+	if (!result.Passed())
+	{
+		// Only pay for the full diff when we're about to fail
+		auto diff = mapped.DiffRegion(rect, expectedColor, tolerance);
+		check_region(result, rect, expectedColor, &diff);
+	}
+}
+
+// Like TestSurfaceRegion, but says whether it matched instead of throwing,
+// for picking out frames as they arrive. A region the surface doesn't cover
+// (yet) doesn't match.
+inline bool SurfaceRegionMatches(
+	winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
+	winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface const& surface,
+	winrt::Windows::UI::Color expectedColor,
+	PixelRect const& rect,
+	BgraColor const& tolerance = {})
+{
+	auto d3dDevice = GetDXGIInterfaceFromObject<ID3D11Device>(device);
+	winrt::com_ptr<ID3D11DeviceContext> d3dContext;
+	d3dDevice->GetImmediateContext(d3dContext.put());
+
+	auto staging = StagingTextureCache::Shared().Copy(d3dDevice, d3dContext, GetDXGIInterfaceFromObject<ID3D11Texture2D>(surface));
+	auto mapped = MappedTexture(d3dContext, staging.Texture());
+	if (!mapped.View().Contains(rect))
+	{
+		return false;
+	}
+	return mapped.VerifyRegion(rect, expectedColor, tolerance).Passed();
+}
+
+// The middle half (in each dimension) of the surface
+inline PixelRect CenterOfSurface(winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface const& surface)
+{
+	auto desc = surface.Description();
+	auto width = static_cast<uint32_t>(desc.Width);
+	auto height = static_cast<uint32_t>(desc.Height);
+	return PixelRect{ width / 4, height / 4, std::max(1u, width / 2), std::max(1u, height / 2) };
+}
+
+// Verifies the middle half (in each dimension) of the surface
 inline void TestCenterOfSurface(
 	winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DDevice const& device,
 	winrt::Windows::Graphics::DirectX::Direct3D11::IDirect3DSurface const& surface,
 	winrt::Windows::UI::Color expectedColor)
 {
-	auto desc = surface.Description();
-	return TestSurfaceAtPoint(device, surface, expectedColor, (uint32_t)desc.Width / 2, (uint32_t)desc.Height / 2);
+	return TestSurfaceRegion(device, surface, expectedColor, CenterOfSurface(surface));
 }
 
 // https://docs.microsoft.com/en-us/windows/win32/api/winuser/nf-winuser-setsystemcursor